@@ -0,0 +1,850 @@
+/*
+ * fake nvidia driver for testing nv-video-info without a GPU
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Fake libcuda.so.1: device enumeration, contexts and host-backed memory,
+ * plus the profile, latency and error injection shared by the other fake
+ * libraries. Allocations, decoders and encoders are charged against a
+ * device memory size for cuMemGetInfo.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake.h"
+
+#define MAX_RULES   256
+#define MAX_STACK   16
+#define MAX_DEVICES 64
+
+typedef enum {
+  RULE_SETTING,
+  RULE_LATENCY,
+  RULE_FAIL,
+} rule_kind;
+
+typedef struct {
+  rule_kind kind;
+  char name[64];
+  int device;                   /* -1 for any device */
+  long value;
+} rule;
+
+static pthread_once_t load_once = PTHREAD_ONCE_INIT;
+static nvvi_snapshot profile;
+static rule rules[MAX_RULES];
+static int num_rules;
+
+static fake_context primary_ctx[MAX_DEVICES];
+static int primary_refs[MAX_DEVICES];
+static pthread_mutex_t primary_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread fake_context *ctx_stack[MAX_STACK];
+static __thread int ctx_depth;
+
+static int64_t mem_used[MAX_DEVICES];
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void add_rule(rule_kind kind, const char *spec, long value)
+{
+  if (num_rules >= MAX_RULES) {
+    return;
+  }
+
+  rule *r = &rules[num_rules++];
+  r->kind = kind;
+  r->device = -1;
+  r->value = value;
+  snprintf(r->name, sizeof(r->name), "%s", spec);
+
+  char *at = strchr(r->name, '@');
+  if (at) {
+    *at = '\0';
+    r->device = atoi(at + 1);
+  }
+}
+
+
+static void parse_profile_extras(FILE *f)
+{
+  char line[512];
+  char kind[32];
+  char spec[64];
+  long value;
+
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "fake ", 5) != 0) {
+      continue;
+    }
+
+    int n = sscanf(line + 5, "%31s %63s %ld", kind, spec, &value);
+    if (strcmp(kind, "latency") == 0 && n == 3) {
+      add_rule(RULE_LATENCY, spec, value);
+    } else if (strcmp(kind, "fail") == 0 && n >= 2) {
+      add_rule(RULE_FAIL, spec, n == 3 ? value : -1);
+    } else if (n >= 2) {
+      /* fake <setting>[@<device>] <value> */
+      add_rule(RULE_SETTING, kind, strtol(spec, NULL, 0));
+    }
+  }
+}
+
+
+static void parse_env_rules(rule_kind kind, const char *env)
+{
+  const char *spec = getenv(env);
+  if (!spec) {
+    return;
+  }
+
+  char *copy = strdup(spec);
+  char *save = NULL;
+  for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    long value = kind == RULE_FAIL ? -1 : 0;
+    char *eq = strchr(tok, '=');
+    if (eq) {
+      *eq = '\0';
+      value = strtol(eq + 1, NULL, 0);
+    }
+    add_rule(kind, tok, value);
+  }
+  free(copy);
+}
+
+
+static void load_profile(void)
+{
+  const char *path = getenv("NVVI_FAKE_PROFILE");
+
+  if (path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      fprintf(stderr, "fake driver: cannot open profile %s\n", path);
+    } else {
+      if (nvvi_snapshot_load(&profile, f) != 0) {
+        fprintf(stderr, "fake driver: cannot parse profile %s\n", path);
+      }
+      rewind(f);
+      parse_profile_extras(f);
+      fclose(f);
+    }
+  }
+
+  if (profile.num_devices > MAX_DEVICES) {
+    profile.num_devices = MAX_DEVICES;
+  }
+
+  parse_env_rules(RULE_LATENCY, "NVVI_FAKE_LATENCY");
+  parse_env_rules(RULE_FAIL, "NVVI_FAKE_FAIL");
+}
+
+
+const nvvi_snapshot *fake_profile(void)
+{
+  pthread_once(&load_once, load_profile);
+  return &profile;
+}
+
+
+static const rule *find_rule(rule_kind kind, const char *name, int device)
+{
+  fake_profile();
+
+  for (int i = num_rules - 1; i >= 0; i--) {
+    const rule *r = &rules[i];
+    if (r->kind == kind &&
+        (strcmp(r->name, name) == 0 || strcmp(r->name, "*") == 0) &&
+        (r->device < 0 || r->device == device)) {
+      return r;
+    }
+  }
+
+  return NULL;
+}
+
+
+long fake_setting(const char *name, int device, long def)
+{
+  const rule *r = find_rule(RULE_SETTING, name, device);
+  return r ? r->value : def;
+}
+
+
+int fake_enter(const char *func, int device)
+{
+  const rule *latency = find_rule(RULE_LATENCY, func, device);
+  if (latency && latency->value > 0) {
+    struct timespec ts = {
+      .tv_sec = latency->value / 1000000,
+      .tv_nsec = (latency->value % 1000000) * 1000,
+    };
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+  }
+
+  const rule *fail = find_rule(RULE_FAIL, func, device);
+  return fail ? (int)fail->value : 0;
+}
+
+
+int fake_context_device(const void *ctx)
+{
+  const fake_context *fctx = ctx;
+  if (!fctx || fctx->magic != FAKE_CONTEXT_MAGIC) {
+    return -1;
+  }
+  return fctx->device;
+}
+
+
+int fake_current_device(void)
+{
+  if (ctx_depth == 0) {
+    return -1;
+  }
+  return ctx_stack[ctx_depth - 1]->device;
+}
+
+
+static int64_t mem_total(int device)
+{
+  return (int64_t)fake_setting("memory-mb", device, 12288) << 20;
+}
+
+
+int fake_mem_charge(int device, int64_t bytes)
+{
+  int64_t pages = ((bytes < 0 ? -bytes : bytes) + (2 << 20) - 1) & ~(int64_t)((2 << 20) - 1);
+  int slot = device >= 0 && device < MAX_DEVICES ? device : MAX_DEVICES - 1;
+  int ret = 0;
+
+  pthread_mutex_lock(&mem_lock);
+  if (bytes < 0) {
+    mem_used[slot] -= pages;
+  } else if (mem_used[slot] + pages > mem_total(device)) {
+    ret = -1;
+  } else {
+    mem_used[slot] += pages;
+  }
+  pthread_mutex_unlock(&mem_lock);
+  return ret;
+}
+
+
+#define ENTER(func, device) \
+  { int err = fake_enter(func, device); if (err) { return err > 0 ? err : CUDA_ERROR_UNKNOWN; } }
+
+static int valid_device(CUdevice dev)
+{
+  return dev >= 0 && dev < fake_profile()->num_devices;
+}
+
+
+static CUresult CUDAAPI fake_cuInit(unsigned int flags)
+{
+  ENTER("cuInit", -1);
+  fake_profile();
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDriverGetVersion(int *version)
+{
+  ENTER("cuDriverGetVersion", -1);
+  *version = fake_setting("cuda-version", -1, 12000);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDeviceGetCount(int *count)
+{
+  ENTER("cuDeviceGetCount", -1);
+  *count = fake_profile()->num_devices;
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDeviceGet(CUdevice *device, int ordinal)
+{
+  ENTER("cuDeviceGet", ordinal);
+  if (!valid_device(ordinal)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  *device = ordinal;
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDeviceGetName(char *name, int len, CUdevice dev)
+{
+  ENTER("cuDeviceGetName", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  snprintf(name, len, "%s", fake_profile()->devices[dev].name);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDeviceGetUuid(CUuuid *uuid, CUdevice dev)
+{
+  ENTER("cuDeviceGetUuid", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+
+  /* "GPU-xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" */
+  const char *str = fake_profile()->devices[dev].uuid;
+  memset(uuid, 0, sizeof(*uuid));
+  if (strncmp(str, "GPU-", 4) == 0) {
+    str += 4;
+  }
+  for (int i = 0; i < 16 && *str; ) {
+    unsigned int byte;
+    if (*str == '-') {
+      str++;
+      continue;
+    }
+    if (sscanf(str, "%2x", &byte) != 1) {
+      break;
+    }
+    uuid->bytes[i++] = byte;
+    str += 2;
+  }
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDeviceGetPCIBusId(char *bus_id, int len, CUdevice dev)
+{
+  ENTER("cuDeviceGetPCIBusId", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  snprintf(bus_id, len, "%s", fake_profile()->devices[dev].pci_bus_id);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDeviceGetAttribute(int *value, CUdevice_attribute attrib, CUdevice dev)
+{
+  unsigned int domain = 0, bus = 0, device = 0, function = 0;
+
+  ENTER("cuDeviceGetAttribute", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+
+  sscanf(fake_profile()->devices[dev].pci_bus_id, "%x:%x:%x.%x",
+         &domain, &bus, &device, &function);
+
+  switch (attrib) {
+  case CU_DEVICE_ATTRIBUTE_PCI_DOMAIN_ID:
+    *value = domain;
+    break;
+  case CU_DEVICE_ATTRIBUTE_PCI_BUS_ID:
+    *value = bus;
+    break;
+  case CU_DEVICE_ATTRIBUTE_PCI_DEVICE_ID:
+    *value = device;
+    break;
+  case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR:
+    *value = fake_setting("compute-major", dev, 8);
+    break;
+  case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR:
+    *value = fake_setting("compute-minor", dev, 9);
+    break;
+  default:
+    *value = 0;
+    break;
+  }
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDeviceComputeCapability(int *major, int *minor, CUdevice dev)
+{
+  ENTER("cuDeviceComputeCapability", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  *major = fake_setting("compute-major", dev, 8);
+  *minor = fake_setting("compute-minor", dev, 9);
+  return CUDA_SUCCESS;
+}
+
+
+static int push_context(fake_context *ctx)
+{
+  if (ctx_depth >= MAX_STACK) {
+    return -1;
+  }
+  ctx_stack[ctx_depth++] = ctx;
+  return 0;
+}
+
+static CUresult CUDAAPI fake_cuCtxCreate(CUcontext *pctx, unsigned int flags, CUdevice dev)
+{
+  ENTER("cuCtxCreate", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+
+  fake_context *ctx = calloc(1, sizeof(*ctx));
+  if (!ctx) {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  ctx->magic = FAKE_CONTEXT_MAGIC;
+  ctx->device = dev;
+
+  if (push_context(ctx) != 0) {
+    free(ctx);
+    return CUDA_ERROR_UNKNOWN;
+  }
+  *pctx = (CUcontext)ctx;
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuCtxDestroy(CUcontext cuctx)
+{
+  fake_context *ctx = (fake_context *)cuctx;
+
+  ENTER("cuCtxDestroy", fake_context_device(ctx));
+  if (fake_context_device(ctx) < 0 || ctx->primary) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+
+  for (int i = 0; i < ctx_depth; i++) {
+    if (ctx_stack[i] == ctx) {
+      memmove(&ctx_stack[i], &ctx_stack[i + 1], (ctx_depth - i - 1) * sizeof(ctx));
+      ctx_depth--;
+      i--;
+    }
+  }
+  ctx->magic = 0;
+  free(ctx);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuCtxPushCurrent(CUcontext cuctx)
+{
+  ENTER("cuCtxPushCurrent", fake_context_device(cuctx));
+  if (fake_context_device(cuctx) < 0) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+  return push_context((fake_context *)cuctx) == 0 ? CUDA_SUCCESS : CUDA_ERROR_UNKNOWN;
+}
+
+static CUresult CUDAAPI fake_cuCtxPopCurrent(CUcontext *pctx)
+{
+  ENTER("cuCtxPopCurrent", fake_current_device());
+  if (ctx_depth == 0) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+  fake_context *ctx = ctx_stack[--ctx_depth];
+  if (pctx) {
+    *pctx = (CUcontext)ctx;
+  }
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuCtxGetCurrent(CUcontext *pctx)
+{
+  *pctx = ctx_depth ? (CUcontext)ctx_stack[ctx_depth - 1] : NULL;
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuCtxGetDevice(CUdevice *device)
+{
+  if (ctx_depth == 0) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+  *device = fake_current_device();
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuCtxSynchronize(void)
+{
+  return ctx_depth ? CUDA_SUCCESS : CUDA_ERROR_INVALID_CONTEXT;
+}
+
+static CUresult CUDAAPI fake_cuDevicePrimaryCtxRetain(CUcontext *pctx, CUdevice dev)
+{
+  ENTER("cuDevicePrimaryCtxRetain", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+
+  pthread_mutex_lock(&primary_lock);
+  primary_ctx[dev].magic = FAKE_CONTEXT_MAGIC;
+  primary_ctx[dev].device = dev;
+  primary_ctx[dev].primary = 1;
+  primary_refs[dev]++;
+  pthread_mutex_unlock(&primary_lock);
+
+  *pctx = (CUcontext)&primary_ctx[dev];
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDevicePrimaryCtxRelease(CUdevice dev)
+{
+  ENTER("cuDevicePrimaryCtxRelease", dev);
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+
+  CUresult ret = CUDA_SUCCESS;
+  pthread_mutex_lock(&primary_lock);
+  if (primary_refs[dev] == 0) {
+    ret = CUDA_ERROR_INVALID_CONTEXT;
+  } else {
+    primary_refs[dev]--;
+  }
+  pthread_mutex_unlock(&primary_lock);
+  return ret;
+}
+
+static CUresult CUDAAPI fake_cuDevicePrimaryCtxGetState(CUdevice dev, unsigned int *flags, int *active)
+{
+  if (!valid_device(dev)) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  pthread_mutex_lock(&primary_lock);
+  *flags = 0;
+  *active = primary_refs[dev] > 0;
+  pthread_mutex_unlock(&primary_lock);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuDevicePrimaryCtxSetFlags(CUdevice dev, unsigned int flags)
+{
+  return valid_device(dev) ? CUDA_SUCCESS : CUDA_ERROR_INVALID_DEVICE;
+}
+
+static CUresult CUDAAPI fake_cuDevicePrimaryCtxReset(CUdevice dev)
+{
+  return valid_device(dev) ? CUDA_SUCCESS : CUDA_ERROR_INVALID_DEVICE;
+}
+
+
+/*
+ * Device memory is plain host memory, so copies are all memcpy. Each
+ * allocation is preceded by its size and device, to give it back on free.
+ */
+
+typedef struct {
+  size_t size;
+  int device;
+} mem_header;
+
+#define MEM_HEADER_SIZE ((sizeof(mem_header) + 15) & ~(size_t)15)
+
+static CUresult CUDAAPI fake_cuMemAlloc(CUdeviceptr *dptr, size_t size)
+{
+  int dev = fake_current_device();
+
+  ENTER("cuMemAlloc", dev);
+  if (ctx_depth == 0) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+  if (fake_mem_charge(dev, size) != 0) {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  mem_header *header = malloc(MEM_HEADER_SIZE + size);
+  if (!header) {
+    fake_mem_charge(dev, -(int64_t)size);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  header->size = size;
+  header->device = dev;
+  *dptr = (CUdeviceptr)(uintptr_t)((uint8_t *)header + MEM_HEADER_SIZE);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuMemAllocPitch(CUdeviceptr *dptr, size_t *pitch, size_t width,
+                                             size_t height, unsigned int element_size)
+{
+  *pitch = (width + 255) & ~(size_t)255;
+  return fake_cuMemAlloc(dptr, *pitch * height);
+}
+
+static CUresult CUDAAPI fake_cuMemFree(CUdeviceptr dptr)
+{
+  ENTER("cuMemFree", fake_current_device());
+  if (dptr) {
+    mem_header *header = (mem_header *)((uint8_t *)(uintptr_t)dptr - MEM_HEADER_SIZE);
+    fake_mem_charge(header->device, -(int64_t)header->size);
+    free(header);
+  }
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuMemGetInfo(size_t *free_mem, size_t *total)
+{
+  int dev = fake_current_device();
+
+  ENTER("cuMemGetInfo", dev);
+  if (dev < 0) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+  pthread_mutex_lock(&mem_lock);
+  *total = mem_total(dev);
+  *free_mem = *total - mem_used[dev < MAX_DEVICES ? dev : MAX_DEVICES - 1];
+  pthread_mutex_unlock(&mem_lock);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuMemcpy2D(const CUDA_MEMCPY2D *copy)
+{
+  ENTER("cuMemcpy2D", fake_current_device());
+
+  const uint8_t *src = copy->srcMemoryType == CU_MEMORYTYPE_HOST ?
+                       copy->srcHost : (const void *)(uintptr_t)copy->srcDevice;
+  uint8_t *dst = copy->dstMemoryType == CU_MEMORYTYPE_HOST ?
+                 copy->dstHost : (void *)(uintptr_t)copy->dstDevice;
+  if (!src || !dst) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+
+  src += copy->srcY * copy->srcPitch + copy->srcXInBytes;
+  dst += copy->dstY * copy->dstPitch + copy->dstXInBytes;
+  for (size_t y = 0; y < copy->Height; y++) {
+    memcpy(dst + y * copy->dstPitch, src + y * copy->srcPitch, copy->WidthInBytes);
+  }
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuMemcpy2DAsync(const CUDA_MEMCPY2D *copy, CUstream stream)
+{
+  return fake_cuMemcpy2D(copy);
+}
+
+static CUresult CUDAAPI fake_cuMemcpy(CUdeviceptr dst, CUdeviceptr src, size_t size)
+{
+  memcpy((void *)(uintptr_t)dst, (const void *)(uintptr_t)src, size);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuMemcpyAsync(CUdeviceptr dst, CUdeviceptr src, size_t size, CUstream stream)
+{
+  return fake_cuMemcpy(dst, src, size);
+}
+
+static CUresult CUDAAPI fake_cuMemcpyHtoD(CUdeviceptr dst, const void *src, size_t size)
+{
+  memcpy((void *)(uintptr_t)dst, src, size);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuMemcpyHtoDAsync(CUdeviceptr dst, const void *src, size_t size, CUstream stream)
+{
+  return fake_cuMemcpyHtoD(dst, src, size);
+}
+
+static CUresult CUDAAPI fake_cuMemcpyDtoH(void *dst, CUdeviceptr src, size_t size)
+{
+  memcpy(dst, (const void *)(uintptr_t)src, size);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuMemcpyDtoHAsync(void *dst, CUdeviceptr src, size_t size, CUstream stream)
+{
+  return fake_cuMemcpyDtoH(dst, src, size);
+}
+
+static CUresult CUDAAPI fake_cuMemsetD8Async(CUdeviceptr dst, unsigned char value, size_t size, CUstream stream)
+{
+  memset((void *)(uintptr_t)dst, value, size);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuStreamSynchronize(CUstream stream)
+{
+  return CUDA_SUCCESS;
+}
+
+
+static const struct {
+  CUresult err;
+  const char *name;
+  const char *desc;
+} cuda_errors[] = {
+  { CUDA_SUCCESS,               "CUDA_SUCCESS",               "no error" },
+  { CUDA_ERROR_INVALID_VALUE,   "CUDA_ERROR_INVALID_VALUE",   "invalid argument" },
+  { CUDA_ERROR_OUT_OF_MEMORY,   "CUDA_ERROR_OUT_OF_MEMORY",   "out of memory" },
+  { CUDA_ERROR_NO_DEVICE,       "CUDA_ERROR_NO_DEVICE",       "no CUDA-capable device is detected" },
+  { CUDA_ERROR_INVALID_DEVICE,  "CUDA_ERROR_INVALID_DEVICE",  "invalid device ordinal" },
+  { CUDA_ERROR_INVALID_CONTEXT, "CUDA_ERROR_INVALID_CONTEXT", "invalid device context" },
+  { CUDA_ERROR_NOT_SUPPORTED,   "CUDA_ERROR_NOT_SUPPORTED",   "operation not supported (fake driver)" },
+};
+
+static CUresult CUDAAPI fake_cuGetErrorName(CUresult err, const char **str)
+{
+  for (int i = 0; i < sizeof(cuda_errors) / sizeof(cuda_errors[0]); i++) {
+    if (cuda_errors[i].err == err) {
+      *str = cuda_errors[i].name;
+      return CUDA_SUCCESS;
+    }
+  }
+  *str = "CUDA_ERROR_UNKNOWN";
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuGetErrorString(CUresult err, const char **str)
+{
+  for (int i = 0; i < sizeof(cuda_errors) / sizeof(cuda_errors[0]); i++) {
+    if (cuda_errors[i].err == err) {
+      *str = cuda_errors[i].desc;
+      return CUDA_SUCCESS;
+    }
+  }
+  *str = "unknown error (injected by fake driver)";
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_unsupported(void)
+{
+  return CUDA_ERROR_NOT_SUPPORTED;
+}
+
+
+FAKE_ALIAS(cuInit, fake_cuInit);
+FAKE_ALIAS(cuDriverGetVersion, fake_cuDriverGetVersion);
+FAKE_ALIAS(cuDeviceGetCount, fake_cuDeviceGetCount);
+FAKE_ALIAS(cuDeviceGet, fake_cuDeviceGet);
+FAKE_ALIAS(cuDeviceGetName, fake_cuDeviceGetName);
+FAKE_ALIAS(cuDeviceGetUuid, fake_cuDeviceGetUuid);
+FAKE_ALIAS(cuDeviceGetUuid_v2, fake_cuDeviceGetUuid);
+FAKE_ALIAS(cuDeviceGetPCIBusId, fake_cuDeviceGetPCIBusId);
+FAKE_ALIAS(cuDeviceGetAttribute, fake_cuDeviceGetAttribute);
+FAKE_ALIAS(cuDeviceComputeCapability, fake_cuDeviceComputeCapability);
+FAKE_ALIAS(cuCtxCreate, fake_cuCtxCreate);
+FAKE_ALIAS(cuCtxCreate_v2, fake_cuCtxCreate);
+FAKE_ALIAS(cuCtxDestroy, fake_cuCtxDestroy);
+FAKE_ALIAS(cuCtxDestroy_v2, fake_cuCtxDestroy);
+FAKE_ALIAS(cuCtxPushCurrent, fake_cuCtxPushCurrent);
+FAKE_ALIAS(cuCtxPushCurrent_v2, fake_cuCtxPushCurrent);
+FAKE_ALIAS(cuCtxPopCurrent, fake_cuCtxPopCurrent);
+FAKE_ALIAS(cuCtxPopCurrent_v2, fake_cuCtxPopCurrent);
+FAKE_ALIAS(cuCtxGetCurrent, fake_cuCtxGetCurrent);
+FAKE_ALIAS(cuCtxGetDevice, fake_cuCtxGetDevice);
+FAKE_ALIAS(cuCtxSynchronize, fake_cuCtxSynchronize);
+FAKE_ALIAS(cuDevicePrimaryCtxRetain, fake_cuDevicePrimaryCtxRetain);
+FAKE_ALIAS(cuDevicePrimaryCtxRelease, fake_cuDevicePrimaryCtxRelease);
+FAKE_ALIAS(cuDevicePrimaryCtxRelease_v2, fake_cuDevicePrimaryCtxRelease);
+FAKE_ALIAS(cuDevicePrimaryCtxGetState, fake_cuDevicePrimaryCtxGetState);
+FAKE_ALIAS(cuDevicePrimaryCtxSetFlags, fake_cuDevicePrimaryCtxSetFlags);
+FAKE_ALIAS(cuDevicePrimaryCtxSetFlags_v2, fake_cuDevicePrimaryCtxSetFlags);
+FAKE_ALIAS(cuDevicePrimaryCtxReset, fake_cuDevicePrimaryCtxReset);
+FAKE_ALIAS(cuDevicePrimaryCtxReset_v2, fake_cuDevicePrimaryCtxReset);
+FAKE_ALIAS(cuMemAlloc, fake_cuMemAlloc);
+FAKE_ALIAS(cuMemAlloc_v2, fake_cuMemAlloc);
+FAKE_ALIAS(cuMemAllocPitch, fake_cuMemAllocPitch);
+FAKE_ALIAS(cuMemAllocPitch_v2, fake_cuMemAllocPitch);
+FAKE_ALIAS(cuMemFree, fake_cuMemFree);
+FAKE_ALIAS(cuMemFree_v2, fake_cuMemFree);
+FAKE_ALIAS(cuMemGetInfo, fake_cuMemGetInfo);
+FAKE_ALIAS(cuMemGetInfo_v2, fake_cuMemGetInfo);
+FAKE_ALIAS(cuMemcpy, fake_cuMemcpy);
+FAKE_ALIAS(cuMemcpyAsync, fake_cuMemcpyAsync);
+FAKE_ALIAS(cuMemcpy2D, fake_cuMemcpy2D);
+FAKE_ALIAS(cuMemcpy2D_v2, fake_cuMemcpy2D);
+FAKE_ALIAS(cuMemcpy2DAsync, fake_cuMemcpy2DAsync);
+FAKE_ALIAS(cuMemcpy2DAsync_v2, fake_cuMemcpy2DAsync);
+FAKE_ALIAS(cuMemcpyHtoD, fake_cuMemcpyHtoD);
+FAKE_ALIAS(cuMemcpyHtoD_v2, fake_cuMemcpyHtoD);
+FAKE_ALIAS(cuMemcpyHtoDAsync, fake_cuMemcpyHtoDAsync);
+FAKE_ALIAS(cuMemcpyHtoDAsync_v2, fake_cuMemcpyHtoDAsync);
+FAKE_ALIAS(cuMemcpyDtoH, fake_cuMemcpyDtoH);
+FAKE_ALIAS(cuMemcpyDtoH_v2, fake_cuMemcpyDtoH);
+FAKE_ALIAS(cuMemcpyDtoHAsync, fake_cuMemcpyDtoHAsync);
+FAKE_ALIAS(cuMemcpyDtoHAsync_v2, fake_cuMemcpyDtoHAsync);
+FAKE_ALIAS(cuMemcpyDtoD, fake_cuMemcpy);
+FAKE_ALIAS(cuMemcpyDtoD_v2, fake_cuMemcpy);
+FAKE_ALIAS(cuMemcpyDtoDAsync, fake_cuMemcpyAsync);
+FAKE_ALIAS(cuMemcpyDtoDAsync_v2, fake_cuMemcpyAsync);
+FAKE_ALIAS(cuMemsetD8Async, fake_cuMemsetD8Async);
+FAKE_ALIAS(cuStreamSynchronize, fake_cuStreamSynchronize);
+FAKE_ALIAS(cuGetErrorName, fake_cuGetErrorName);
+FAKE_ALIAS(cuGetErrorString, fake_cuGetErrorString);
+
+/*
+ * Everything else the ffnvcodec loader insists on finding. None of it is
+ * needed to probe capabilities, so it all fails cleanly.
+ */
+#define UNSUPPORTED(sym) FAKE_ALIAS(sym, fake_unsupported)
+UNSUPPORTED(cuCtxSetLimit);
+UNSUPPORTED(cuMemAllocManaged);
+UNSUPPORTED(cuMemHostAlloc);
+UNSUPPORTED(cuMemFreeHost);
+UNSUPPORTED(cuDeviceGetLuid);
+UNSUPPORTED(cuDeviceGetByPCIBusId);
+UNSUPPORTED(cuStreamCreate);
+UNSUPPORTED(cuStreamQuery);
+UNSUPPORTED(cuStreamDestroy);
+UNSUPPORTED(cuStreamDestroy_v2);
+UNSUPPORTED(cuStreamAddCallback);
+UNSUPPORTED(cuStreamWaitEvent);
+UNSUPPORTED(cuEventCreate);
+UNSUPPORTED(cuEventDestroy);
+UNSUPPORTED(cuEventDestroy_v2);
+UNSUPPORTED(cuEventSynchronize);
+UNSUPPORTED(cuEventQuery);
+UNSUPPORTED(cuEventRecord);
+UNSUPPORTED(cuLaunchKernel);
+UNSUPPORTED(cuLinkCreate);
+UNSUPPORTED(cuLinkCreate_v2);
+UNSUPPORTED(cuLinkAddData);
+UNSUPPORTED(cuLinkAddData_v2);
+UNSUPPORTED(cuLinkComplete);
+UNSUPPORTED(cuLinkDestroy);
+UNSUPPORTED(cuModuleLoadData);
+UNSUPPORTED(cuModuleUnload);
+UNSUPPORTED(cuModuleGetFunction);
+UNSUPPORTED(cuModuleGetGlobal);
+UNSUPPORTED(cuModuleGetGlobal_v2);
+UNSUPPORTED(cuTexObjectCreate);
+UNSUPPORTED(cuTexObjectDestroy);
+UNSUPPORTED(cuGLGetDevices);
+UNSUPPORTED(cuGLGetDevices_v2);
+UNSUPPORTED(cuGraphicsGLRegisterImage);
+UNSUPPORTED(cuGraphicsUnregisterResource);
+UNSUPPORTED(cuGraphicsMapResources);
+UNSUPPORTED(cuGraphicsUnmapResources);
+UNSUPPORTED(cuGraphicsSubResourceGetMappedArray);
+UNSUPPORTED(cuGraphicsResourceGetMappedPointer);
+UNSUPPORTED(cuGraphicsResourceGetMappedPointer_v2);
+UNSUPPORTED(cuImportExternalMemory);
+UNSUPPORTED(cuDestroyExternalMemory);
+UNSUPPORTED(cuExternalMemoryGetMappedBuffer);
+UNSUPPORTED(cuExternalMemoryGetMappedMipmappedArray);
+UNSUPPORTED(cuMipmappedArrayGetLevel);
+UNSUPPORTED(cuMipmappedArrayDestroy);
+UNSUPPORTED(cuImportExternalSemaphore);
+UNSUPPORTED(cuDestroyExternalSemaphore);
+UNSUPPORTED(cuSignalExternalSemaphoresAsync);
+UNSUPPORTED(cuWaitExternalSemaphoresAsync);
+UNSUPPORTED(cuArrayCreate);
+UNSUPPORTED(cuArrayCreate_v2);
+UNSUPPORTED(cuArray3DCreate);
+UNSUPPORTED(cuArray3DCreate_v2);
+UNSUPPORTED(cuArrayDestroy);
+UNSUPPORTED(cuEGLStreamProducerConnect);
+UNSUPPORTED(cuEGLStreamProducerDisconnect);
+UNSUPPORTED(cuEGLStreamConsumerDisconnect);
+UNSUPPORTED(cuEGLStreamProducerPresentFrame);
+UNSUPPORTED(cuEGLStreamProducerReturnFrame);
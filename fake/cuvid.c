@@ -0,0 +1,702 @@
+/*
+ * fake nvidia driver for testing nv-video-info without a GPU
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Fake libnvcuvid.so.1: answers cuvidGetDecoderCaps from the profile.
+ *
+ * Decoders can also be created and decode, synchronously: a picture holds
+ * one of the device's "nvdecs" engines (default 1) for macroblocks /
+ * "decode-mbps" seconds (default 4000000), and "max-decoders" (default
+ * 0, no limit) caps the decoders open on a device. A decoder takes device
+ * memory for its decode and output surfaces plus 4 MiB of its own; every
+ * mapped frame is the same zeroed output surface in host memory, which is
+ * what fake device pointers are.
+ *
+ * The parser only understands what nvvi_decode_bench_run() feeds it:
+ * whole access units per packet and no reordering, as H.264 or HEVC Annex
+ * B or as AV1 temporal units. It reads the picture size and bit depth from
+ * the SPS or sequence header and decodes and displays each picture as soon
+ * as its first slice (or its frame OBU) arrives.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake.h"
+
+#define FAKE_DECODER_MAGIC 0x46784443u
+#define FAKE_PARSER_MAGIC  0x46785053u
+
+#define ENTER(func, device) \
+  { int err = fake_enter(func, device); if (err) { return err > 0 ? err : CUDA_ERROR_UNKNOWN; } }
+
+#define MAX_DEVICES 64
+
+typedef struct {
+  uint32_t magic;
+  int device;
+  unsigned int mbs;
+  unsigned int pitch;
+  unsigned int surfaces;
+  int64_t memory;
+  uint8_t *output;              /* pitch wide, what cuvidMapVideoFrame returns */
+} fake_decoder;
+
+typedef struct {
+  uint32_t magic;
+  CUVIDPARSERPARAMS params;
+  unsigned int width;           /* coded, from the last SPS, 0 before the first */
+  unsigned int height;
+  int bit_depth_minus8;
+  int sequence_sent;
+  int next_surface;
+} fake_parser;
+
+static atomic_int open_decoders[MAX_DEVICES];
+
+/* Decode engines busy per device */
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t engine_cond = PTHREAD_COND_INITIALIZER;
+static int busy_engines[MAX_DEVICES];
+
+
+/* Bytes of one surface: 4:2:0 and 4:0:0 are NV12 shaped, 16-bit formats twice as large */
+static int64_t surface_bytes(unsigned int width, unsigned int height, int chroma_format,
+                             int deep)
+{
+  int64_t luma = (int64_t)((width + 255) & ~255u) * ((height + 15) & ~15u);
+  int64_t bytes = chroma_format == cudaVideoChromaFormat_444 ? luma * 3 :
+                  chroma_format == cudaVideoChromaFormat_422 ? luma * 2 : luma * 3 / 2;
+  return deep ? bytes * 2 : bytes;
+}
+
+
+static const nvvi_decode_caps *find_caps(const nvvi_device *device, int codec,
+                                         int chroma_format, int depth)
+{
+  for (int i = 0; i < device->num_decode_caps; i++) {
+    const nvvi_decode_caps *row = &device->decode_caps[i];
+    if (row->codec == codec && row->chroma_format == chroma_format && row->bit_depth == depth) {
+      return row;
+    }
+  }
+  return NULL;
+}
+
+static CUresult CUDAAPI fake_cuvidGetDecoderCaps(CUVIDDECODECAPS *caps)
+{
+  int dev = fake_current_device();
+
+  ENTER("cuvidGetDecoderCaps", dev);
+  if (dev < 0) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+
+  const nvvi_device *device = &fake_profile()->devices[dev];
+  const nvvi_decode_caps *row = find_caps(device, caps->eCodecType, caps->eChromaFormat,
+                                          caps->nBitDepthMinus8 + 8);
+
+  caps->bIsSupported = 0;
+  caps->nNumNVDECs = 0;
+  caps->nOutputFormatMask = 0;
+  caps->nMaxWidth = caps->nMaxHeight = caps->nMaxMBCount = 0;
+  caps->nMinWidth = caps->nMinHeight = 0;
+
+  if (row) {
+    caps->bIsSupported = 1;
+    caps->nNumNVDECs = fake_setting("nvdecs", dev, 1);
+    caps->nOutputFormatMask = row->output_format_mask;
+    caps->nMaxWidth = row->max_width;
+    caps->nMaxHeight = row->max_height;
+    caps->nMaxMBCount = row->max_mb_count;
+    caps->nMinWidth = row->min_width;
+    caps->nMinHeight = row->min_height;
+  }
+
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuvidCreateDecoder(CUvideodecoder *decoder, CUVIDDECODECREATEINFO *info)
+{
+  int dev = fake_current_device();
+
+  ENTER("cuvidCreateDecoder", dev);
+  if (dev < 0) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+
+  const nvvi_device *device = &fake_profile()->devices[dev];
+  const nvvi_decode_caps *row = find_caps(device, info->CodecType, info->ChromaFormat,
+                                          info->bitDepthMinus8 + 8);
+  unsigned int mbs = ((info->ulWidth + 15) / 16) * ((info->ulHeight + 15) / 16);
+
+  if (!row || !(row->output_format_mask & (1 << info->OutputFormat))) {
+    return CUDA_ERROR_NOT_SUPPORTED;
+  }
+  if (info->ulWidth > row->max_width || info->ulHeight > row->max_height ||
+      info->ulWidth < row->min_width || info->ulHeight < row->min_height ||
+      mbs > row->max_mb_count || !info->ulNumDecodeSurfaces) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+
+  int slot = dev < MAX_DEVICES ? dev : MAX_DEVICES - 1;
+  long max = fake_setting("max-decoders", dev, 0);
+  if (max > 0 && atomic_fetch_add(&open_decoders[slot], 1) >= max) {
+    atomic_fetch_sub(&open_decoders[slot], 1);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  } else if (max <= 0) {
+    atomic_fetch_add(&open_decoders[slot], 1);
+  }
+
+  int deep_output = info->OutputFormat != cudaVideoSurfaceFormat_NV12 &&
+                    info->OutputFormat != cudaVideoSurfaceFormat_YUV444 &&
+                    info->OutputFormat != cudaVideoSurfaceFormat_NV16;
+  int64_t memory = (4 << 20) +
+    info->ulNumDecodeSurfaces * surface_bytes(info->ulWidth, info->ulHeight, info->ChromaFormat,
+                                              info->bitDepthMinus8 > 0) +
+    info->ulNumOutputSurfaces * surface_bytes(info->ulTargetWidth, info->ulTargetHeight,
+                                              info->ChromaFormat, deep_output);
+
+  /* Big enough for the coded and the target size, whichever is read */
+  unsigned long output_width = info->ulWidth > info->ulTargetWidth ? info->ulWidth :
+                               info->ulTargetWidth;
+  unsigned long output_height = info->ulHeight > info->ulTargetHeight ? info->ulHeight :
+                                info->ulTargetHeight;
+
+  fake_decoder *d = calloc(1, sizeof(*d));
+  if (d) {
+    d->output = calloc(1, surface_bytes(output_width, output_height, info->ChromaFormat,
+                                        deep_output));
+  }
+  if (!d || !d->output || fake_mem_charge(dev, memory) != 0) {
+    if (d) {
+      free(d->output);
+    }
+    free(d);
+    atomic_fetch_sub(&open_decoders[slot], 1);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  d->magic = FAKE_DECODER_MAGIC;
+  d->device = dev;
+  d->mbs = mbs;
+  d->pitch = (output_width + 255) & ~255;
+  d->surfaces = info->ulNumDecodeSurfaces;
+  d->memory = memory;
+  *decoder = d;
+  return CUDA_SUCCESS;
+}
+
+static fake_decoder *get_decoder(CUvideodecoder handle)
+{
+  fake_decoder *d = handle;
+  return d && d->magic == FAKE_DECODER_MAGIC ? d : NULL;
+}
+
+static CUresult CUDAAPI fake_cuvidDestroyDecoder(CUvideodecoder handle)
+{
+  fake_decoder *d = get_decoder(handle);
+  if (!d) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  ENTER("cuvidDestroyDecoder", d->device);
+  atomic_fetch_sub(&open_decoders[d->device < MAX_DEVICES ? d->device : MAX_DEVICES - 1], 1);
+  fake_mem_charge(d->device, -d->memory);
+  d->magic = 0;
+  free(d->output);
+  free(d);
+  return CUDA_SUCCESS;
+}
+
+/* Hold one of the device's engines for as long as the picture would take */
+static void decode_cost(const fake_decoder *d)
+{
+  int dev = d->device < MAX_DEVICES ? d->device : MAX_DEVICES - 1;
+  long engines = fake_setting("nvdecs", d->device, 1);
+  long mbps = fake_setting("decode-mbps", d->device, 4000000);
+  uint64_t ns = (uint64_t)d->mbs * 1000000000 / (mbps > 0 ? mbps : 4000000);
+
+  pthread_mutex_lock(&engine_lock);
+  while (busy_engines[dev] >= (engines > 0 ? engines : 1)) {
+    pthread_cond_wait(&engine_cond, &engine_lock);
+  }
+  busy_engines[dev]++;
+  pthread_mutex_unlock(&engine_lock);
+
+  struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+
+  pthread_mutex_lock(&engine_lock);
+  busy_engines[dev]--;
+  pthread_cond_broadcast(&engine_cond);
+  pthread_mutex_unlock(&engine_lock);
+}
+
+static CUresult CUDAAPI fake_cuvidDecodePicture(CUvideodecoder handle, CUVIDPICPARAMS *pic)
+{
+  fake_decoder *d = get_decoder(handle);
+  if (!d) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  ENTER("cuvidDecodePicture", d->device);
+  if (pic->CurrPicIdx < 0 || pic->CurrPicIdx >= d->surfaces ||
+      (unsigned int)(pic->PicWidthInMbs * pic->FrameHeightInMbs) > d->mbs ||
+      !pic->pBitstreamData || !pic->nBitstreamDataLen) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  decode_cost(d);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuvidMapVideoFrame64(CUvideodecoder handle, int index,
+                                                  unsigned long long *frame, unsigned int *pitch,
+                                                  CUVIDPROCPARAMS *params)
+{
+  fake_decoder *d = get_decoder(handle);
+  if (!d) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  ENTER("cuvidMapVideoFrame", d->device);
+  if (index < 0 || index >= d->surfaces) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  *frame = (unsigned long long)(uintptr_t)d->output;
+  *pitch = d->pitch;
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuvidUnmapVideoFrame64(CUvideodecoder handle, unsigned long long frame)
+{
+  fake_decoder *d = get_decoder(handle);
+  if (!d) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  ENTER("cuvidUnmapVideoFrame", d->device);
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuvidCreateVideoParser(CUvideoparser *parser, CUVIDPARSERPARAMS *params)
+{
+  ENTER("cuvidCreateVideoParser", fake_current_device());
+  switch (params->CodecType) {
+  case cudaVideoCodec_H264:
+  case cudaVideoCodec_HEVC:
+#if NVDECAPI_MAJOR_VERSION > 10
+  case cudaVideoCodec_AV1:
+#endif
+    break;
+  default:
+    return CUDA_ERROR_NOT_SUPPORTED;
+  }
+
+  fake_parser *p = calloc(1, sizeof(*p));
+  if (!p) {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  p->magic = FAKE_PARSER_MAGIC;
+  p->params = *params;
+  *parser = p;
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuvidDestroyVideoParser(CUvideoparser parser)
+{
+  fake_parser *p = parser;
+  if (!p || p->magic != FAKE_PARSER_MAGIC) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  p->magic = 0;
+  free(p);
+  return CUDA_SUCCESS;
+}
+
+/* Bit reader over the first bytes of a NAL unit or OBU; sizes come early */
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+} bit_reader;
+
+static unsigned int read_bits(bit_reader *r, int n)
+{
+  unsigned int v = 0;
+  for (int i = 0; i < n; i++, r->pos++) {
+    int bit = r->pos / 8 < r->size ? (r->data[r->pos / 8] >> (7 - r->pos % 8)) & 1 : 0;
+    v = (v << 1) | bit;
+  }
+  return v;
+}
+
+static unsigned int read_ue(bit_reader *r)
+{
+  int zeros = 0;
+  while (read_bits(r, 1) == 0 && zeros < 32) {
+    zeros++;
+  }
+  return (1u << zeros) - 1 + read_bits(r, zeros);
+}
+
+/* The start of a NAL unit's payload with emulation prevention bytes removed */
+static size_t unescape(const unsigned char *nal, size_t size, unsigned char *out, size_t max)
+{
+  size_t n = 0;
+  int zeros = 0;
+
+  for (size_t i = 0; i < size && n < max; i++) {
+    if (zeros >= 2 && nal[i] == 3) {
+      zeros = 0;
+      continue;
+    }
+    zeros = nal[i] ? 0 : zeros + 1;
+    out[n++] = nal[i];
+  }
+  return n;
+}
+
+/* The H.264 SPS up to the picture size, for the profiles without chroma fields */
+static int parse_h264_sps(fake_parser *p, const unsigned char *nal, size_t size)
+{
+  unsigned char buf[64];
+  bit_reader r = { buf, unescape(nal + 1, size - 1, buf, sizeof(buf)) };
+
+  int profile = read_bits(&r, 8);
+  if (profile != 66 && profile != 77 && profile != 88) {
+    return -1;
+  }
+  read_bits(&r, 16);                    /* constraint flags, level_idc */
+  read_ue(&r);                          /* seq_parameter_set_id */
+  read_ue(&r);                          /* log2_max_frame_num_minus4 */
+  unsigned int poc_type = read_ue(&r);
+  if (poc_type == 0) {
+    read_ue(&r);
+  } else if (poc_type == 1) {
+    return -1;
+  }
+  read_ue(&r);                          /* max_num_ref_frames */
+  read_bits(&r, 1);                     /* gaps_in_frame_num_value_allowed_flag */
+  p->width = (read_ue(&r) + 1) * 16;
+  p->height = (read_ue(&r) + 1) * 16;
+  p->bit_depth_minus8 = 0;
+  if (!read_bits(&r, 1)) {              /* frame_mbs_only_flag */
+    return -1;
+  }
+  return 0;
+}
+
+/* The HEVC SPS up to the bit depth, for a single sub-layer */
+static int parse_hevc_sps(fake_parser *p, const unsigned char *nal, size_t size)
+{
+  unsigned char buf[64];
+  bit_reader r = { buf, unescape(nal + 2, size - 2, buf, sizeof(buf)) };
+
+  read_bits(&r, 4);                     /* sps_video_parameter_set_id */
+  if (read_bits(&r, 3) != 0) {          /* sps_max_sub_layers_minus1 */
+    return -1;
+  }
+  read_bits(&r, 1);                     /* sps_temporal_id_nesting_flag */
+  r.pos += 96;                          /* profile_tier_level */
+  read_ue(&r);                          /* sps_seq_parameter_set_id */
+  if (read_ue(&r) != 1) {               /* chroma_format_idc: 4:2:0 only */
+    return -1;
+  }
+  p->width = read_ue(&r);
+  p->height = read_ue(&r);
+  if (read_bits(&r, 1)) {               /* conformance_window_flag */
+    for (int i = 0; i < 4; i++) {
+      read_ue(&r);
+    }
+  }
+  p->bit_depth_minus8 = read_ue(&r);
+  return p->width && p->height ? 0 : -1;
+}
+
+/* The AV1 sequence header up to the bit depth, without timing info */
+static int parse_av1_sequence_header(fake_parser *p, const unsigned char *obu, size_t size)
+{
+  bit_reader r = { obu, size };
+
+  int profile = read_bits(&r, 3);
+  read_bits(&r, 1);                     /* still_picture */
+  int reduced = read_bits(&r, 1);
+  if (reduced) {
+    read_bits(&r, 5);                   /* seq_level_idx[0] */
+  } else {
+    if (read_bits(&r, 1)) {             /* timing_info_present_flag */
+      return -1;
+    }
+    int delay = read_bits(&r, 1);
+    int points = read_bits(&r, 5) + 1;
+    for (int i = 0; i < points; i++) {
+      read_bits(&r, 12);                /* operating_point_idc */
+      if (read_bits(&r, 5) > 7) {       /* seq_level_idx */
+        read_bits(&r, 1);
+      }
+      if (delay && read_bits(&r, 1)) {
+        read_bits(&r, 4);
+      }
+    }
+  }
+  int width_bits = read_bits(&r, 4) + 1;
+  int height_bits = read_bits(&r, 4) + 1;
+  p->width = read_bits(&r, width_bits) + 1;
+  p->height = read_bits(&r, height_bits) + 1;
+
+  if (!reduced && read_bits(&r, 1)) {   /* frame_id_numbers_present_flag */
+    read_bits(&r, 7);
+  }
+  read_bits(&r, 3);                     /* 128x128, filter intra, intra edge */
+  int order_hint = 0;
+  if (!reduced) {
+    read_bits(&r, 4);                   /* interintra, masked, warped, dual filter */
+    order_hint = read_bits(&r, 1);
+    if (order_hint) {
+      read_bits(&r, 2);                 /* jnt_comp, ref_frame_mvs */
+    }
+    int screen_content = read_bits(&r, 1) ? 2 : read_bits(&r, 1);
+    if (screen_content && !read_bits(&r, 1)) {
+      read_bits(&r, 1);                 /* seq_force_integer_mv */
+    }
+    if (order_hint) {
+      read_bits(&r, 3);
+    }
+  }
+  read_bits(&r, 3);                     /* superres, cdef, restoration */
+  int high_bitdepth = read_bits(&r, 1);
+  p->bit_depth_minus8 = high_bitdepth ? (profile == 2 && read_bits(&r, 1) ? 4 : 2) : 0;
+  return 0;
+}
+
+static int send_picture(fake_parser *p, const unsigned char *data, size_t size,
+                        CUvideotimestamp timestamp, int intra)
+{
+  if (!p->sequence_sent) {
+    CUVIDEOFORMAT format = { 0 };
+
+    if (!p->width) {
+      return -1;
+    }
+    format.codec = p->params.CodecType;
+    format.frame_rate.numerator = 30;
+    format.frame_rate.denominator = 1;
+    format.progressive_sequence = 1;
+    format.bit_depth_luma_minus8 = p->bit_depth_minus8;
+    format.bit_depth_chroma_minus8 = p->bit_depth_minus8;
+    format.min_num_decode_surfaces = 2;
+    format.coded_width = p->width;
+    format.coded_height = p->height;
+    format.display_area.right = format.coded_width;
+    format.display_area.bottom = format.coded_height;
+    format.chroma_format = cudaVideoChromaFormat_420;
+    if (p->params.pfnSequenceCallback &&
+        !p->params.pfnSequenceCallback(p->params.pUserData, &format)) {
+      return -1;
+    }
+    p->sequence_sent = 1;
+  }
+
+  CUVIDPICPARAMS pic = { 0 };
+  unsigned int offset = 0;
+  unsigned int surfaces = p->params.ulMaxNumDecodeSurfaces ? p->params.ulMaxNumDecodeSurfaces : 1;
+
+  pic.PicWidthInMbs = (p->width + 15) / 16;
+  pic.FrameHeightInMbs = (p->height + 15) / 16;
+  pic.CurrPicIdx = p->next_surface;
+  pic.nBitstreamDataLen = size;
+  pic.pBitstreamData = data;
+  pic.nNumSlices = 1;
+  pic.pSliceDataOffsets = &offset;
+  pic.ref_pic_flag = 1;
+  pic.intra_pic_flag = intra;
+  p->next_surface = (p->next_surface + 1) % surfaces;
+
+  if (p->params.pfnDecodePicture &&
+      !p->params.pfnDecodePicture(p->params.pUserData, &pic)) {
+    return -1;
+  }
+
+  CUVIDPARSERDISPINFO disp = { 0 };
+  disp.picture_index = pic.CurrPicIdx;
+  disp.progressive_frame = 1;
+  disp.timestamp = timestamp;
+  if (p->params.pfnDisplayPicture &&
+      !p->params.pfnDisplayPicture(p->params.pUserData, &disp)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Annex B: split on start codes; a NAL unit runs up to the next one */
+static CUresult parse_annex_b(fake_parser *p, const unsigned char *data, size_t size,
+                              CUvideotimestamp timestamp)
+{
+  int hevc = p->params.CodecType == cudaVideoCodec_HEVC;
+  size_t pos = 0;
+
+  while (pos + 3 <= size) {
+    if (data[pos] || data[pos + 1] || data[pos + 2] != 1) {
+      pos++;
+      continue;
+    }
+    size_t start = pos + 3;
+    size_t end = start;
+    while (end + 3 <= size && (data[end] || data[end + 1] || data[end + 2] > 1)) {
+      end++;
+    }
+    if (end + 3 > size) {
+      end = size;
+    }
+    pos = end;
+    if (end <= start + hevc) {
+      continue;
+    }
+
+    const unsigned char *nal = &data[start];
+    size_t len = end - start;
+    if (hevc) {
+      int type = (nal[0] >> 1) & 0x3f;
+      if (type == 33 && parse_hevc_sps(p, nal, len) != 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+      }
+      /* VCL NAL units; first_slice_segment_in_pic_flag starts a picture */
+      if (type < 32 && len > 2 && (nal[2] & 0x80) &&
+          send_picture(p, nal, len, timestamp, type >= 16 && type <= 23) != 0) {
+        return CUDA_ERROR_UNKNOWN;
+      }
+    } else {
+      int type = nal[0] & 0x1f;
+      if (type == 7 && parse_h264_sps(p, nal, len) != 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+      }
+      if (type == 1 || type == 5) {
+        bit_reader r = { nal + 1, len - 1 };
+        if (read_ue(&r) == 0 && send_picture(p, nal, len, timestamp, type == 5) != 0) {
+          return CUDA_ERROR_UNKNOWN;
+        }
+      }
+    }
+  }
+  return CUDA_SUCCESS;
+}
+
+/* An AV1 temporal unit: OBUs with size fields, one picture per frame OBU */
+static CUresult parse_obus(fake_parser *p, const unsigned char *data, size_t size,
+                           CUvideotimestamp timestamp)
+{
+  size_t pos = 0;
+
+  while (pos < size) {
+    int type = (data[pos] >> 3) & 0xf;
+    int extension = (data[pos] >> 2) & 1;
+    if (!(data[pos] & 2)) {             /* obu_has_size_field */
+      return CUDA_ERROR_INVALID_VALUE;
+    }
+    pos += 1 + extension;
+
+    uint64_t len = 0;
+    for (int i = 0; pos < size; i++) {
+      len |= (uint64_t)(data[pos] & 0x7f) << (7 * i);
+      if (!(data[pos++] & 0x80) || i == 7) {
+        break;
+      }
+    }
+    if (len > size - pos) {
+      return CUDA_ERROR_INVALID_VALUE;
+    }
+
+    const unsigned char *obu = &data[pos];
+    if (type == 1 && parse_av1_sequence_header(p, obu, len) != 0) {
+      return CUDA_ERROR_INVALID_VALUE;
+    }
+    /* OBU_FRAME_HEADER or OBU_FRAME; show_existing_frame off, frame_type 0 is a key frame */
+    if ((type == 3 || type == 6) && len > 0 &&
+        send_picture(p, obu, len, timestamp, (obu[0] & 0xe0) == 0) != 0) {
+      return CUDA_ERROR_UNKNOWN;
+    }
+    pos += len;
+  }
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_cuvidParseVideoData(CUvideoparser parser, CUVIDSOURCEDATAPACKET *packet)
+{
+  fake_parser *p = parser;
+  if (!p || p->magic != FAKE_PARSER_MAGIC) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  ENTER("cuvidParseVideoData", fake_current_device());
+
+  const unsigned char *data = packet->payload;
+  size_t size = packet->payload ? packet->payload_size : 0;
+  CUresult err;
+
+#if NVDECAPI_MAJOR_VERSION > 10
+  if (p->params.CodecType == cudaVideoCodec_AV1) {
+    err = parse_obus(p, data, size, packet->timestamp);
+  } else
+#endif
+  {
+    err = parse_annex_b(p, data, size, packet->timestamp);
+  }
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+
+  if ((packet->flags & CUVID_PKT_ENDOFSTREAM) && p->params.pfnDisplayPicture) {
+    p->params.pfnDisplayPicture(p->params.pUserData, NULL);
+  }
+  return CUDA_SUCCESS;
+}
+
+static CUresult CUDAAPI fake_unsupported(void)
+{
+  return CUDA_ERROR_NOT_SUPPORTED;
+}
+
+
+FAKE_ALIAS(cuvidGetDecoderCaps, fake_cuvidGetDecoderCaps);
+FAKE_ALIAS(cuvidCreateDecoder, fake_cuvidCreateDecoder);
+FAKE_ALIAS(cuvidDestroyDecoder, fake_cuvidDestroyDecoder);
+FAKE_ALIAS(cuvidDecodePicture, fake_cuvidDecodePicture);
+FAKE_ALIAS(cuvidMapVideoFrame64, fake_cuvidMapVideoFrame64);
+FAKE_ALIAS(cuvidUnmapVideoFrame64, fake_cuvidUnmapVideoFrame64);
+FAKE_ALIAS(cuvidCreateVideoParser, fake_cuvidCreateVideoParser);
+FAKE_ALIAS(cuvidParseVideoData, fake_cuvidParseVideoData);
+FAKE_ALIAS(cuvidDestroyVideoParser, fake_cuvidDestroyVideoParser);
+
+#define UNSUPPORTED(sym) FAKE_ALIAS(sym, fake_unsupported)
+UNSUPPORTED(cuvidGetDecodeStatus);
+UNSUPPORTED(cuvidReconfigureDecoder);
+UNSUPPORTED(cuvidMapVideoFrame);
+UNSUPPORTED(cuvidUnmapVideoFrame);
+UNSUPPORTED(cuvidCtxLockCreate);
+UNSUPPORTED(cuvidCtxLockDestroy);
+UNSUPPORTED(cuvidCtxLock);
+UNSUPPORTED(cuvidCtxUnlock);
+UNSUPPORTED(cuvidCreateVideoSource);
+UNSUPPORTED(cuvidCreateVideoSourceW);
+UNSUPPORTED(cuvidDestroyVideoSource);
+UNSUPPORTED(cuvidSetVideoSourceState);
+UNSUPPORTED(cuvidGetVideoSourceState);
+UNSUPPORTED(cuvidGetSourceVideoFormat);
+UNSUPPORTED(cuvidGetSourceAudioFormat);
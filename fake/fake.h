@@ -0,0 +1,85 @@
+/*
+ * fake nvidia driver for testing nv-video-info without a GPU
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FAKE_H
+#define FAKE_H
+
+#include <stdint.h>
+
+#include <ffnvcodec/dynlink_cuda.h>
+#include <ffnvcodec/dynlink_nvcuvid.h>
+#include <ffnvcodec/nvEncodeAPI.h>
+
+#include "nvvideoinfo.h"
+
+#define FAKE_EXPORT __attribute__((visibility("default")))
+
+/* Export a static implementation under a driver symbol name */
+#define FAKE_ALIAS(sym, impl) \
+  extern __typeof__(impl) sym __attribute__((alias(#impl), visibility("default")))
+
+#define FAKE_CONTEXT_MAGIC 0x4678434eu
+
+typedef struct {
+  uint32_t magic;
+  int device;
+  int primary;
+} fake_context;
+
+/*
+ * The fake driver state lives in the fake libcuda; the fake libnvcuvid and
+ * libnvidia-encode link against it, just like the real libraries do.
+ *
+ * The profile is an nvvi_snapshot_save() file named by $NVVI_FAKE_PROFILE.
+ * Besides the snapshot itself it may contain lines of the form
+ *
+ *   fake <setting>[@<device>] <value>
+ *   fake latency <function>[@<device>] <microseconds>
+ *   fake fail <function>[@<device>] [<error code>]
+ *
+ * where <function> may be "*". $NVVI_FAKE_LATENCY and $NVVI_FAKE_FAIL take
+ * comma separated "<function>[@<device>][=<value>]" rules that override the
+ * profile. The last matching rule wins.
+ */
+FAKE_EXPORT const nvvi_snapshot *fake_profile(void);
+
+/* Number of a setting for a device, or def if it isn't set */
+FAKE_EXPORT long fake_setting(const char *name, int device, long def);
+
+/*
+ * Call at the top of every entry point. Sleeps for the configured latency
+ * and returns the injected error for this call: 0 for none, -1 for "use
+ * the API's generic error", or an explicit error code.
+ */
+FAKE_EXPORT int fake_enter(const char *func, int device);
+
+/* Device of a context handle, or -1 if it isn't a fake context */
+FAKE_EXPORT int fake_context_device(const void *ctx);
+
+/* Device of the calling thread's current context, or -1 */
+FAKE_EXPORT int fake_current_device(void);
+
+/*
+ * Device memory accounting behind cuMemGetInfo: take bytes, rounded up to
+ * 2 MiB pages, from a device's "memory-mb" (default 12288), or give them
+ * back with a negative size. Returns -1, taking nothing, if they don't fit.
+ */
+FAKE_EXPORT int fake_mem_charge(int device, int64_t bytes);
+
+#endif /* FAKE_H */
@@ -0,0 +1,712 @@
+/*
+ * fake nvidia driver for testing nv-video-info without a GPU
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Fake libnvidia-encode.so.1: opens sessions on fake contexts and answers
+ * the GUID, input format, capability, profile and preset queries from the
+ * profile.
+ *
+ * Sessions can also encode, synchronously and into host memory, from input
+ * buffers or from CUDA device pointers registered with nvEncRegisterResource
+ * and mapped with nvEncMapInputResource. The
+ * "max-sessions" setting (default 8, <= 0 for no limit) caps the sessions
+ * open on a device, like the consumer driver does. Encoding a frame holds
+ * one of the device's "nvencs" engines (default NV_ENC_CAPS_NUM_ENCODER_ENGINES
+ * or 1) for macroblocks / "encode-mbps" seconds (default
+ * NV_ENC_CAPS_MB_PER_SEC_MAX), so throughput scales with the session count
+ * until the engines are saturated.
+ *
+ * Device memory is taken by the session (2 MiB), by nvEncInitializeEncoder
+ * for reconstructed frames (one per B-frame plus two), quarter resolution
+ * lookahead frames, a first pass frame with multipass and motion data, and
+ * by input buffers. Bitstream buffers live in host memory.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake.h"
+
+#define FAKE_SESSION_MAGIC 0x4678454eu
+#define FAKE_INPUT_MAGIC   0x46784e49u
+#define FAKE_OUTPUT_MAGIC  0x46784e4fu
+#define FAKE_RESOURCE_MAGIC 0x46785252u
+#define FAKE_MAPPED_MAGIC  0x46784d50u
+
+typedef struct {
+  uint32_t magic;
+  int device;
+
+  /* Set by nvEncInitializeEncoder */
+  const nvvi_encode_codec *codec;
+  uint32_t width;
+  uint32_t height;
+
+  int64_t memory;               /* charged to the device, excluding input buffers */
+} fake_session;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t pitch;
+  uint8_t *data;                /* NV12, pitch * height * 3 / 2 */
+  int64_t size;
+} fake_input;
+
+/* A registered device pointer; mapping it hands out input, not charged */
+typedef struct {
+  uint32_t magic;
+  fake_input input;             /* magic FAKE_MAPPED_MAGIC while mapped */
+} fake_resource;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t size;
+  uint32_t capacity;
+  uint32_t frame;
+  NV_ENC_PIC_TYPE type;
+  uint8_t *data;
+} fake_output;
+
+#define MAX_DEVICES 64
+
+/* Open sessions per device, for the session limit and the capacity query */
+static atomic_int open_sessions[MAX_DEVICES];
+
+/* Encoder engines busy per device */
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t engine_cond = PTHREAD_COND_INITIALIZER;
+static int busy_engines[MAX_DEVICES];
+
+#define ENTER(func, device) \
+  { int err = fake_enter(func, device); if (err) { return err > 0 ? err : NV_ENC_ERR_GENERIC; } }
+
+
+static const nvvi_device *session_device(void *encoder)
+{
+  fake_session *session = encoder;
+  if (!session || session->magic != FAKE_SESSION_MAGIC) {
+    return NULL;
+  }
+  return &fake_profile()->devices[session->device];
+}
+
+
+static const nvvi_encode_codec *find_codec(const nvvi_device *device, GUID guid)
+{
+  for (int i = 0; i < device->num_encode_codecs; i++) {
+    if (memcmp(&device->encode_codecs[i].guid, &guid, sizeof(guid)) == 0) {
+      return &device->encode_codecs[i];
+    }
+  }
+  return NULL;
+}
+
+
+#define SESSION(func, encoder)                                     \
+  const nvvi_device *device = session_device(encoder);            \
+  if (!device) {                                                   \
+    return NV_ENC_ERR_INVALID_ENCODERDEVICE;                       \
+  }                                                                \
+  ENTER(func, device->index)
+
+#define CODEC(guid)                                                \
+  const nvvi_encode_codec *codec = find_codec(device, guid);       \
+  if (!codec) {                                                    \
+    return NV_ENC_ERR_INVALID_PARAM;                               \
+  }
+
+
+static NVENCSTATUS NVENCAPI fake_nvEncOpenEncodeSessionEx(NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS *params,
+                                                         void **encoder)
+{
+  int dev = fake_context_device(params->device);
+
+  ENTER("nvEncOpenEncodeSessionEx", dev);
+  if (params->deviceType != NV_ENC_DEVICE_TYPE_CUDA || dev < 0) {
+    return NV_ENC_ERR_INVALID_DEVICE;
+  }
+  if (fake_profile()->devices[dev].encode_status != 0) {
+    return NV_ENC_ERR_NO_ENCODE_DEVICE;
+  }
+
+  /* The consumer driver refuses sessions past its limit this way */
+  long max = fake_setting("max-sessions", dev, 8);
+  if (dev < MAX_DEVICES && atomic_fetch_add(&open_sessions[dev], 1) >= max && max > 0) {
+    atomic_fetch_sub(&open_sessions[dev], 1);
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+
+  fake_session *session = calloc(1, sizeof(*session));
+  if (!session || fake_mem_charge(dev, 2 << 20) != 0) {
+    free(session);
+    if (dev < MAX_DEVICES) {
+      atomic_fetch_sub(&open_sessions[dev], 1);
+    }
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+  session->magic = FAKE_SESSION_MAGIC;
+  session->device = dev;
+  session->memory = 2 << 20;
+  *encoder = session;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncDestroyEncoder(void *encoder)
+{
+  SESSION("nvEncDestroyEncoder", encoder);
+  if (device->index < MAX_DEVICES) {
+    atomic_fetch_sub(&open_sessions[device->index], 1);
+  }
+  fake_mem_charge(device->index, -((fake_session *)encoder)->memory);
+  ((fake_session *)encoder)->magic = 0;
+  free(encoder);
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodeGUIDCount(void *encoder, uint32_t *count)
+{
+  SESSION("nvEncGetEncodeGUIDCount", encoder);
+  *count = device->num_encode_codecs;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodeGUIDs(void *encoder, GUID *guids, uint32_t size,
+                                                    uint32_t *count)
+{
+  SESSION("nvEncGetEncodeGUIDs", encoder);
+  *count = 0;
+  for (int i = 0; i < device->num_encode_codecs && *count < size; i++) {
+    memcpy(&guids[(*count)++], &device->encode_codecs[i].guid, sizeof(GUID));
+  }
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetInputFormatCount(void *encoder, GUID guid, uint32_t *count)
+{
+  SESSION("nvEncGetInputFormatCount", encoder);
+  CODEC(guid);
+  *count = __builtin_popcount(codec->input_formats);
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetInputFormats(void *encoder, GUID guid, NV_ENC_BUFFER_FORMAT *fmts,
+                                                     uint32_t size, uint32_t *count)
+{
+  SESSION("nvEncGetInputFormats", encoder);
+  CODEC(guid);
+  *count = 0;
+  for (int bit = 0; bit < 32 && *count < size; bit++) {
+    if (codec->input_formats & (1u << bit)) {
+      fmts[(*count)++] = (NV_ENC_BUFFER_FORMAT)(1u << bit);
+    }
+  }
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodeCaps(void *encoder, GUID guid, NV_ENC_CAPS_PARAM *params,
+                                                   int *val)
+{
+  SESSION("nvEncGetEncodeCaps", encoder);
+  CODEC(guid);
+  if (params->capsToQuery < 0 || params->capsToQuery >= NVVI_MAX_ENCODE_CAPS) {
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  if (params->capsToQuery == NV_ENC_CAPS_DYNAMIC_QUERY_ENCODER_CAPACITY) {
+    /*
+     * Every session other than the one asking takes an equal share of
+     * "max-sessions"; the "capacity" setting pins the answer instead.
+     */
+    long max = fake_setting("max-sessions", device->index, 8);
+    long others = device->index < MAX_DEVICES ? atomic_load(&open_sessions[device->index]) - 1 : 0;
+    long left = max > 0 ? 100 * (max - others) / max : 0;
+    *val = fake_setting("capacity", device->index, left < 0 ? 0 : left);
+    return NV_ENC_SUCCESS;
+  }
+  *val = codec->caps[params->capsToQuery];
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodeProfileGUIDCount(void *encoder, GUID guid, uint32_t *count)
+{
+  SESSION("nvEncGetEncodeProfileGUIDCount", encoder);
+  CODEC(guid);
+  *count = codec->num_profiles;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodeProfileGUIDs(void *encoder, GUID guid, GUID *guids,
+                                                           uint32_t size, uint32_t *count)
+{
+  SESSION("nvEncGetEncodeProfileGUIDs", encoder);
+  CODEC(guid);
+  *count = 0;
+  for (int i = 0; i < codec->num_profiles && *count < size; i++) {
+    memcpy(&guids[(*count)++], &codec->profiles[i].guid, sizeof(GUID));
+  }
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodePresetCount(void *encoder, GUID guid, uint32_t *count)
+{
+  SESSION("nvEncGetEncodePresetCount", encoder);
+  CODEC(guid);
+  *count = codec->num_presets;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodePresetGUIDs(void *encoder, GUID guid, GUID *guids,
+                                                          uint32_t size, uint32_t *count)
+{
+  SESSION("nvEncGetEncodePresetGUIDs", encoder);
+  CODEC(guid);
+  *count = 0;
+  for (int i = 0; i < codec->num_presets && *count < size; i++) {
+    memcpy(&guids[(*count)++], &codec->presets[i].guid, sizeof(GUID));
+  }
+  return NV_ENC_SUCCESS;
+}
+
+/*
+ * A made up but plausible preset model: the position of a P preset trades
+ * B-frames and multipass for speed, and the tuning picks the rate control
+ * and reordering, roughly like the real presets do.
+ */
+static NVENCSTATUS preset_config(const nvvi_encode_codec *codec, GUID preset, int tuning,
+                                 NV_ENC_PRESET_CONFIG *config)
+{
+  const char *name = NULL;
+  for (int i = 0; i < codec->num_presets; i++) {
+    if (memcmp(&codec->presets[i].guid, &preset, sizeof(preset)) == 0) {
+      name = codec->presets[i].name;
+    }
+  }
+  if (!name) {
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  int level = name[0] == 'p' && name[1] >= '1' && name[1] <= '7' ? name[1] - '0' : 4;
+
+  uint32_t version = config->presetCfg.version;
+  memset(&config->presetCfg, 0, sizeof(config->presetCfg));
+  config->presetCfg.version = version;
+
+  NV_ENC_CONFIG *cfg = &config->presetCfg;
+  cfg->gopLength = 250;
+  cfg->frameIntervalP = 1;
+  cfg->rcParams.rateControlMode = NV_ENC_PARAMS_RC_VBR;
+  cfg->rcParams.averageBitRate = 10000000;
+
+  switch (tuning) {
+  case 1: /* high quality */
+    cfg->frameIntervalP = level >= 3 ? 4 : 1;
+    cfg->rcParams.maxBitRate = 20000000;
+#if NVENCAPI_MAJOR_VERSION > 10
+    cfg->rcParams.multiPass = level >= 6 ? NV_ENC_TWO_PASS_FULL_RESOLUTION :
+                              level >= 4 ? NV_ENC_TWO_PASS_QUARTER_RESOLUTION :
+                              NV_ENC_MULTI_PASS_DISABLED;
+#endif
+    break;
+  case 2: /* low latency */
+  case 3: /* ultra low latency */
+    cfg->gopLength = NVENC_INFINITE_GOPLENGTH;
+    cfg->rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
+    cfg->rcParams.vbvBufferSize = tuning == 3 ? 333333 : 10000000;
+    cfg->rcParams.zeroReorderDelay = 1;
+#if NVENCAPI_MAJOR_VERSION > 10
+    cfg->rcParams.multiPass = level >= (tuning == 3 ? 6 : 4) ?
+                              NV_ENC_TWO_PASS_QUARTER_RESOLUTION : NV_ENC_MULTI_PASS_DISABLED;
+#endif
+    break;
+  case 4: /* lossless */
+    cfg->rcParams.rateControlMode = NV_ENC_PARAMS_RC_CONSTQP;
+    cfg->rcParams.averageBitRate = 0;
+    break;
+  }
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodePresetConfig(void *encoder, GUID guid, GUID preset,
+                                                           NV_ENC_PRESET_CONFIG *config)
+{
+  SESSION("nvEncGetEncodePresetConfig", encoder);
+  CODEC(guid);
+  return preset_config(codec, preset, 0, config);
+}
+
+#if NVENCAPI_MAJOR_VERSION > 10
+static NVENCSTATUS NVENCAPI fake_nvEncGetEncodePresetConfigEx(void *encoder, GUID guid, GUID preset,
+                                                             NV_ENC_TUNING_INFO tuning,
+                                                             NV_ENC_PRESET_CONFIG *config)
+{
+  SESSION("nvEncGetEncodePresetConfigEx", encoder);
+  CODEC(guid);
+  if (tuning <= NV_ENC_TUNING_INFO_UNDEFINED || tuning >= NV_ENC_TUNING_INFO_COUNT) {
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  return preset_config(codec, preset, tuning, config);
+}
+#endif
+
+static NVENCSTATUS NVENCAPI fake_nvEncInitializeEncoder(void *encoder, NV_ENC_INITIALIZE_PARAMS *params)
+{
+  SESSION("nvEncInitializeEncoder", encoder);
+  CODEC(params->encodeGUID);
+  fake_session *session = encoder;
+
+  if (session->codec) {
+    return NV_ENC_ERR_INVALID_CALL;
+  }
+  if (params->encodeWidth > codec->caps[NV_ENC_CAPS_WIDTH_MAX] ||
+      params->encodeHeight > codec->caps[NV_ENC_CAPS_HEIGHT_MAX] ||
+      params->encodeWidth < codec->caps[NV_ENC_CAPS_WIDTH_MIN] ||
+      params->encodeHeight < codec->caps[NV_ENC_CAPS_HEIGHT_MIN] ||
+      !params->encodeWidth || !params->encodeHeight) {
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+
+  int64_t mbs = (int64_t)((params->encodeWidth + 15) / 16) * ((params->encodeHeight + 15) / 16);
+  int64_t frame = mbs * 256 * 3 / 2;
+  int64_t memory = mbs * 64;
+  if (params->encodeConfig) {
+    const NV_ENC_CONFIG *config = params->encodeConfig;
+    memory += frame * ((config->frameIntervalP > 1 ? config->frameIntervalP - 1 : 0) + 2);
+    if (config->rcParams.enableLookahead) {
+      memory += frame / 4 * config->rcParams.lookaheadDepth;
+    }
+#if NVENCAPI_MAJOR_VERSION > 10
+    if (config->rcParams.multiPass == NV_ENC_TWO_PASS_QUARTER_RESOLUTION) {
+      memory += frame / 4;
+    } else if (config->rcParams.multiPass == NV_ENC_TWO_PASS_FULL_RESOLUTION) {
+      memory += frame;
+    }
+#endif
+  } else {
+    memory += frame * 2;
+  }
+  if (fake_mem_charge(device->index, memory) != 0) {
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+  session->memory += memory;
+  session->codec = codec;
+  session->width = params->encodeWidth;
+  session->height = params->encodeHeight;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncCreateInputBuffer(void *encoder, NV_ENC_CREATE_INPUT_BUFFER *params)
+{
+  SESSION("nvEncCreateInputBuffer", encoder);
+  if (!((fake_session *)encoder)->codec) {
+    return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+  }
+  if (params->bufferFmt != NV_ENC_BUFFER_FORMAT_NV12 || !params->width || !params->height) {
+    return NV_ENC_ERR_UNSUPPORTED_PARAM;
+  }
+
+  fake_input *input = calloc(1, sizeof(*input));
+  if (!input) {
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+  input->magic = FAKE_INPUT_MAGIC;
+  input->pitch = (params->width + 255) & ~255u;
+  input->size = (int64_t)input->pitch * params->height * 3 / 2;
+  input->data = malloc(input->size);
+  if (!input->data || fake_mem_charge(device->index, input->size) != 0) {
+    free(input->data);
+    free(input);
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+  params->inputBuffer = input;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncDestroyInputBuffer(void *encoder, NV_ENC_INPUT_PTR buffer)
+{
+  SESSION("nvEncDestroyInputBuffer", encoder);
+  fake_input *input = buffer;
+  if (!input || input->magic != FAKE_INPUT_MAGIC) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  input->magic = 0;
+  fake_mem_charge(device->index, -input->size);
+  free(input->data);
+  free(input);
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncCreateBitstreamBuffer(void *encoder,
+                                                           NV_ENC_CREATE_BITSTREAM_BUFFER *params)
+{
+  SESSION("nvEncCreateBitstreamBuffer", encoder);
+  fake_session *session = encoder;
+  if (!session->codec) {
+    return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+  }
+
+  fake_output *output = calloc(1, sizeof(*output));
+  if (!output) {
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+  output->magic = FAKE_OUTPUT_MAGIC;
+  output->capacity = session->width * session->height;
+  output->data = calloc(1, output->capacity);
+  if (!output->data) {
+    free(output);
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+  params->bitstreamBuffer = output;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncDestroyBitstreamBuffer(void *encoder, NV_ENC_OUTPUT_PTR buffer)
+{
+  SESSION("nvEncDestroyBitstreamBuffer", encoder);
+  fake_output *output = buffer;
+  if (!output || output->magic != FAKE_OUTPUT_MAGIC) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  output->magic = 0;
+  free(output->data);
+  free(output);
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncLockInputBuffer(void *encoder, NV_ENC_LOCK_INPUT_BUFFER *params)
+{
+  SESSION("nvEncLockInputBuffer", encoder);
+  fake_input *input = params->inputBuffer;
+  if (!input || input->magic != FAKE_INPUT_MAGIC) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  params->bufferDataPtr = input->data;
+  params->pitch = input->pitch;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncUnlockInputBuffer(void *encoder, NV_ENC_INPUT_PTR buffer)
+{
+  SESSION("nvEncUnlockInputBuffer", encoder);
+  fake_input *input = buffer;
+  if (!input || input->magic != FAKE_INPUT_MAGIC) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncRegisterResource(void *encoder, NV_ENC_REGISTER_RESOURCE *params)
+{
+  SESSION("nvEncRegisterResource", encoder);
+  if (params->resourceType != NV_ENC_INPUT_RESOURCE_TYPE_CUDADEVICEPTR ||
+      params->bufferFormat != NV_ENC_BUFFER_FORMAT_NV12) {
+    return NV_ENC_ERR_UNIMPLEMENTED;
+  }
+  if (!params->resourceToRegister || !params->width || !params->height ||
+      params->pitch < params->width) {
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+
+  fake_resource *resource = calloc(1, sizeof(*resource));
+  if (!resource) {
+    return NV_ENC_ERR_OUT_OF_MEMORY;
+  }
+  resource->magic = FAKE_RESOURCE_MAGIC;
+  resource->input.pitch = params->pitch;
+  resource->input.data = params->resourceToRegister;
+  params->registeredResource = resource;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncUnregisterResource(void *encoder, NV_ENC_REGISTERED_PTR handle)
+{
+  SESSION("nvEncUnregisterResource", encoder);
+  fake_resource *resource = handle;
+  if (!resource || resource->magic != FAKE_RESOURCE_MAGIC) {
+    return NV_ENC_ERR_RESOURCE_NOT_REGISTERED;
+  }
+  resource->magic = 0;
+  free(resource);
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncMapInputResource(void *encoder, NV_ENC_MAP_INPUT_RESOURCE *params)
+{
+  SESSION("nvEncMapInputResource", encoder);
+  fake_resource *resource = params->registeredResource;
+  if (!resource || resource->magic != FAKE_RESOURCE_MAGIC) {
+    return NV_ENC_ERR_RESOURCE_NOT_REGISTERED;
+  }
+  resource->input.magic = FAKE_MAPPED_MAGIC;
+  params->mappedResource = &resource->input;
+  params->mappedBufferFmt = NV_ENC_BUFFER_FORMAT_NV12;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncUnmapInputResource(void *encoder, NV_ENC_INPUT_PTR mapped)
+{
+  SESSION("nvEncUnmapInputResource", encoder);
+  fake_input *input = mapped;
+  if (!input || input->magic != FAKE_MAPPED_MAGIC) {
+    return NV_ENC_ERR_RESOURCE_NOT_MAPPED;
+  }
+  input->magic = 0;
+  return NV_ENC_SUCCESS;
+}
+
+/* Hold one of the device's engines for as long as the frame would take */
+static void encode_cost(const fake_session *session)
+{
+  const nvvi_encode_codec *codec = session->codec;
+  int dev = session->device < MAX_DEVICES ? session->device : MAX_DEVICES - 1;
+  long engines = fake_setting("nvencs", dev, codec->caps[NV_ENC_CAPS_NUM_ENCODER_ENGINES]);
+  long mbps = fake_setting("encode-mbps", dev, codec->caps[NV_ENC_CAPS_MB_PER_SEC_MAX]);
+  uint64_t mbs = (uint64_t)((session->width + 15) / 16) * ((session->height + 15) / 16);
+  uint64_t ns = mbs * 1000000000 / (mbps > 0 ? mbps : 1000000);
+
+  pthread_mutex_lock(&engine_lock);
+  while (busy_engines[dev] >= (engines > 0 ? engines : 1)) {
+    pthread_cond_wait(&engine_cond, &engine_lock);
+  }
+  busy_engines[dev]++;
+  pthread_mutex_unlock(&engine_lock);
+
+  struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+
+  pthread_mutex_lock(&engine_lock);
+  busy_engines[dev]--;
+  pthread_cond_broadcast(&engine_cond);
+  pthread_mutex_unlock(&engine_lock);
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncEncodePicture(void *encoder, NV_ENC_PIC_PARAMS *params)
+{
+  SESSION("nvEncEncodePicture", encoder);
+  fake_session *session = encoder;
+  fake_output *output = params->outputBitstream;
+
+  if (!session->codec) {
+    return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+  }
+  fake_input *input = params->inputBuffer;
+  if (!input || (input->magic != FAKE_INPUT_MAGIC && input->magic != FAKE_MAPPED_MAGIC) ||
+      !output || output->magic != FAKE_OUTPUT_MAGIC) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  if (params->inputWidth != session->width || params->inputHeight != session->height) {
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+
+  encode_cost(session);
+
+  /* An IDR every 250 frames, and a start code so the output isn't all zero */
+  output->frame = params->frameIdx;
+  output->type = params->frameIdx % 250 ? NV_ENC_PIC_TYPE_P : NV_ENC_PIC_TYPE_IDR;
+  output->size = session->width * session->height / (output->type == NV_ENC_PIC_TYPE_IDR ? 8 : 64);
+  memcpy(output->data, "\0\0\0\1", 4);
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncLockBitstream(void *encoder, NV_ENC_LOCK_BITSTREAM *params)
+{
+  SESSION("nvEncLockBitstream", encoder);
+  fake_output *output = params->outputBitstream;
+  if (!output || output->magic != FAKE_OUTPUT_MAGIC) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  params->bitstreamBufferPtr = output->data;
+  params->bitstreamSizeInBytes = output->size;
+  params->frameIdx = output->frame;
+  params->outputTimeStamp = output->frame;
+  params->pictureType = output->type;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_nvEncUnlockBitstream(void *encoder, NV_ENC_OUTPUT_PTR buffer)
+{
+  SESSION("nvEncUnlockBitstream", encoder);
+  fake_output *output = buffer;
+  if (!output || output->magic != FAKE_OUTPUT_MAGIC) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  return NV_ENC_SUCCESS;
+}
+
+static const char *NVENCAPI fake_nvEncGetLastErrorString(void *encoder)
+{
+  return "fake driver";
+}
+
+
+static NVENCSTATUS NVENCAPI fake_NvEncodeAPIGetMaxSupportedVersion(uint32_t *version)
+{
+  ENTER("NvEncodeAPIGetMaxSupportedVersion", -1);
+  *version = fake_profile()->nvenc_max_version;
+  return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI fake_NvEncodeAPICreateInstance(NV_ENCODE_API_FUNCTION_LIST *list)
+{
+  ENTER("NvEncodeAPICreateInstance", -1);
+
+  uint32_t max = fake_profile()->nvenc_max_version;
+  if ((NVENCAPI_MAJOR_VERSION << 4 | NVENCAPI_MINOR_VERSION) > max) {
+    return NV_ENC_ERR_INVALID_VERSION;
+  }
+
+  list->nvEncOpenEncodeSessionEx = fake_nvEncOpenEncodeSessionEx;
+  list->nvEncDestroyEncoder = fake_nvEncDestroyEncoder;
+  list->nvEncGetEncodeGUIDCount = fake_nvEncGetEncodeGUIDCount;
+  list->nvEncGetEncodeGUIDs = fake_nvEncGetEncodeGUIDs;
+  list->nvEncGetInputFormatCount = fake_nvEncGetInputFormatCount;
+  list->nvEncGetInputFormats = fake_nvEncGetInputFormats;
+  list->nvEncGetEncodeCaps = fake_nvEncGetEncodeCaps;
+  list->nvEncGetEncodeProfileGUIDCount = fake_nvEncGetEncodeProfileGUIDCount;
+  list->nvEncGetEncodeProfileGUIDs = fake_nvEncGetEncodeProfileGUIDs;
+  list->nvEncGetEncodePresetCount = fake_nvEncGetEncodePresetCount;
+  list->nvEncGetEncodePresetGUIDs = fake_nvEncGetEncodePresetGUIDs;
+  list->nvEncGetEncodePresetConfig = fake_nvEncGetEncodePresetConfig;
+#if NVENCAPI_MAJOR_VERSION > 10
+  list->nvEncGetEncodePresetConfigEx = fake_nvEncGetEncodePresetConfigEx;
+#endif
+  list->nvEncInitializeEncoder = fake_nvEncInitializeEncoder;
+  list->nvEncCreateInputBuffer = fake_nvEncCreateInputBuffer;
+  list->nvEncDestroyInputBuffer = fake_nvEncDestroyInputBuffer;
+  list->nvEncCreateBitstreamBuffer = fake_nvEncCreateBitstreamBuffer;
+  list->nvEncDestroyBitstreamBuffer = fake_nvEncDestroyBitstreamBuffer;
+  list->nvEncLockInputBuffer = fake_nvEncLockInputBuffer;
+  list->nvEncUnlockInputBuffer = fake_nvEncUnlockInputBuffer;
+  list->nvEncEncodePicture = fake_nvEncEncodePicture;
+  list->nvEncLockBitstream = fake_nvEncLockBitstream;
+  list->nvEncUnlockBitstream = fake_nvEncUnlockBitstream;
+  list->nvEncRegisterResource = fake_nvEncRegisterResource;
+  list->nvEncUnregisterResource = fake_nvEncUnregisterResource;
+  list->nvEncMapInputResource = fake_nvEncMapInputResource;
+  list->nvEncUnmapInputResource = fake_nvEncUnmapInputResource;
+  list->nvEncGetLastErrorString = fake_nvEncGetLastErrorString;
+  return NV_ENC_SUCCESS;
+}
+
+
+FAKE_ALIAS(NvEncodeAPIGetMaxSupportedVersion, fake_NvEncodeAPIGetMaxSupportedVersion);
+FAKE_ALIAS(NvEncodeAPICreateInstance, fake_NvEncodeAPICreateInstance);
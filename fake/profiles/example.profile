@@ -0,0 +1,230 @@
+# Synthetic profile for the fake driver: one Ada-class GPU with made-up
+# but plausible limits. Record a real machine with `nvencinfo --record`.
+nvvideoinfo-snapshot 1
+flags 3
+driver 550.54.14
+nvenc-max-version 193
+device 0 GPU-5c1f7e2a-0b3d-4c8e-9f61-2d4a7b8c9e10 0000:01:00.0 0 0 NVIDIA GeForce RTX 4070 (fake)
+decode 1 1 8 48 16 4080 4080 65025 0x1
+decode 2 1 8 48 16 2032 2032 16129 0x1
+decode 3 1 8 48 16 2032 2032 16129 0x1
+decode 4 1 8 48 16 4096 4096 65536 0x1
+decode 5 1 8 64 64 32768 16384 2097152 0x1
+decode 8 1 8 144 144 8192 8192 262144 0x1
+decode 8 1 10 144 144 8192 8192 262144 0x3
+decode 8 1 12 144 144 8192 8192 262144 0x3
+decode 8 3 8 144 144 8192 8192 262144 0x4
+decode 8 3 10 144 144 8192 8192 262144 0x8
+decode 8 3 12 144 144 8192 8192 262144 0x8
+decode 9 1 8 48 16 4096 4096 65536 0x1
+decode 10 1 8 128 128 8192 8192 262144 0x1
+decode 10 1 10 128 128 8192 8192 262144 0x3
+decode 10 1 12 128 128 8192 8192 262144 0x3
+decode 11 1 8 128 128 8192 8192 262144 0x1
+decode 11 1 10 128 128 8192 8192 262144 0x3
+encode 6bc82762-4e63-4ca4-aa85-1e50f321f6bf 0x15001111 H264
+cap 0 4
+cap 1 63
+cap 2 0
+cap 3 0
+cap 4 0
+cap 5 1
+cap 6 1
+cap 7 1
+cap 8 1
+cap 9 1
+cap 10 4
+cap 11 1
+cap 12 1
+cap 13 62
+cap 14 10
+cap 15 1
+cap 16 4096
+cap 17 4096
+cap 18 1
+cap 19 1
+cap 20 1
+cap 21 1
+cap 22 1
+cap 23 0
+cap 24 1
+cap 25 1
+cap 26 1
+cap 27 1
+cap 28 1
+cap 29 0
+cap 30 0
+cap 31 65536
+cap 32 983040
+cap 33 1
+cap 34 1
+cap 35 0
+cap 36 1
+cap 37 1
+cap 38 1
+cap 39 0
+cap 40 8
+cap 41 1
+cap 42 1
+cap 43 1
+cap 44 1
+cap 45 145
+cap 46 49
+cap 47 1
+cap 48 0
+cap 49 2
+cap 50 1
+cap 51 1
+cap 52 1
+cap 53 1
+cap 54 1
+profile bfd6f8e7-233c-4341-8b3e-4818523803f4 Auto
+profile 0727bcaa-78c4-4c83-8c2f-ef3dff267c6a Baseline
+profile 60b5c1d4-67fe-4790-94d5-c4726d7b6e6d Main
+profile e7cbc309-4f7a-4b89-af2a-d537c92be310 High
+profile 7ac663cb-a598-4960-b844-339b261a7d52 High444
+preset fc0a8d3e-45f8-4cf8-80c7-298871590ebf p1
+preset f581cfb8-88d6-4381-93f0-df13f9c27dab p2
+preset 36850110-3a07-441f-94d5-3670631f91f6 p3
+preset 90a7b826-df06-4862-b9d2-cd6d73a08681 p4
+preset 21c6e6b4-297a-4cba-998f-b6cbde72ade3 p5
+preset 8e75c279-6299-4ab6-8302-0b215a335cf5 p6
+preset 84848c12-6f71-4c13-931b-53e283f57974 p7
+encode 790cdc88-4522-4d7b-9425-bda9975f7603 0x37111111 HEVC
+cap 0 5
+cap 1 63
+cap 2 0
+cap 3 0
+cap 4 0
+cap 5 1
+cap 6 0
+cap 7 1
+cap 8 0
+cap 9 0
+cap 10 4
+cap 11 1
+cap 12 1
+cap 13 186
+cap 14 30
+cap 15 1
+cap 16 8192
+cap 17 8192
+cap 18 1
+cap 19 1
+cap 20 1
+cap 21 1
+cap 22 1
+cap 23 0
+cap 24 1
+cap 25 1
+cap 26 1
+cap 27 1
+cap 28 1
+cap 29 0
+cap 30 0
+cap 31 262144
+cap 32 983040
+cap 33 1
+cap 34 1
+cap 35 1
+cap 36 1
+cap 37 1
+cap 38 1
+cap 39 1
+cap 40 8
+cap 41 1
+cap 42 1
+cap 43 1
+cap 44 1
+cap 45 129
+cap 46 33
+cap 47 1
+cap 48 1
+cap 49 2
+cap 50 1
+cap 51 1
+cap 52 1
+cap 53 1
+cap 54 1
+profile bfd6f8e7-233c-4341-8b3e-4818523803f4 Auto
+profile b514c39a-b55b-40fa-878f-f1253b4dfdec Main
+profile fa4d2b6c-3a5b-411a-8018-0a3f5e3c9be5 Main10
+profile 51ec32b5-1b4c-453c-9cbd-b616bd621341 Main444
+preset fc0a8d3e-45f8-4cf8-80c7-298871590ebf p1
+preset f581cfb8-88d6-4381-93f0-df13f9c27dab p2
+preset 36850110-3a07-441f-94d5-3670631f91f6 p3
+preset 90a7b826-df06-4862-b9d2-cd6d73a08681 p4
+preset 21c6e6b4-297a-4cba-998f-b6cbde72ade3 p5
+preset 8e75c279-6299-4ab6-8302-0b215a335cf5 p6
+preset 84848c12-6f71-4c13-931b-53e283f57974 p7
+encode 0a352289-0aa7-4759-862d-5d15cd16d254 0x37010111 AV1
+cap 0 7
+cap 1 63
+cap 2 0
+cap 3 0
+cap 4 0
+cap 5 0
+cap 6 0
+cap 7 0
+cap 8 0
+cap 9 0
+cap 10 4
+cap 11 1
+cap 12 1
+cap 13 19
+cap 14 0
+cap 15 1
+cap 16 8192
+cap 17 8192
+cap 18 1
+cap 19 1
+cap 20 1
+cap 21 1
+cap 22 1
+cap 23 0
+cap 24 1
+cap 25 1
+cap 26 1
+cap 27 1
+cap 28 1
+cap 29 0
+cap 30 0
+cap 31 262144
+cap 32 983040
+cap 33 0
+cap 34 0
+cap 35 0
+cap 36 1
+cap 37 1
+cap 38 1
+cap 39 1
+cap 40 8
+cap 41 1
+cap 42 1
+cap 43 1
+cap 44 1
+cap 45 129
+cap 46 33
+cap 47 1
+cap 48 0
+cap 49 2
+cap 50 1
+cap 51 1
+cap 52 1
+cap 53 1
+cap 54 1
+profile bfd6f8e7-233c-4341-8b3e-4818523803f4 Auto
+profile 5f2a39f5-f14e-4f95-9a9e-b76d568fcf97 Main
+preset fc0a8d3e-45f8-4cf8-80c7-298871590ebf p1
+preset f581cfb8-88d6-4381-93f0-df13f9c27dab p2
+preset 36850110-3a07-441f-94d5-3670631f91f6 p3
+preset 90a7b826-df06-4862-b9d2-cd6d73a08681 p4
+preset 21c6e6b4-297a-4cba-998f-b6cbde72ade3 p5
+preset 8e75c279-6299-4ab6-8302-0b215a335cf5 p6
+preset 84848c12-6f71-4c13-931b-53e283f57974 p7
+end
+
+# Fake driver settings (ignored by nvvi_snapshot_load)
+fake nvdecs 3
+fake cuda-version 12040
+fake latency cuCtxCreate 2000
@@ -0,0 +1,895 @@
+#!/usr/bin/env python3
+#
+# Run the tools against the fake driver. Called by meson test with the
+# fake libraries on LD_LIBRARY_PATH and a profile in NVVI_FAKE_PROFILE:
+#
+#   test_tools.py CASE TOOL...
+#
+# Tools are found by name, so a case can use any tool that is passed. The
+# probing ones read the PCIe/NUMA topology from an empty sysfs tree unless a case passes
+# its own, so the output doesn't depend on the machine running the tests.
+
+import json
+import os
+import re
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.error
+import urllib.request
+
+
+class Failure(Exception):
+    pass
+
+
+def check(cond, what, out=None):
+    if not cond:
+        if out is not None:
+            sys.stderr.write(out)
+        raise Failure(what)
+
+
+class Tools:
+    def __init__(self, tools, tmp):
+        tools = dict((os.path.basename(tool), tool) for tool in tools)
+        self.dec = tools['nvdecinfo']
+        self.enc = tools['nvencinfo']
+        self.video = tools['nvvideoinfo']
+        self.fleet = tools['nvvifleet']
+        self.tmp = tmp
+        self.sysfs = self.path('sysfs')
+        os.mkdir(self.sysfs)
+
+    def path(self, name):
+        return os.path.join(self.tmp, name)
+
+    def profile(self, name, *extra):
+        """Copy the test's profile with extra 'fake' lines appended and
+        return the environment that selects it."""
+        path = self.path(name)
+        with open(os.environ['NVVI_FAKE_PROFILE']) as src, open(path, 'w') as dst:
+            dst.write(src.read())
+            for line in extra:
+                dst.write('fake %s\n' % line)
+        return {'NVVI_FAKE_PROFILE': path}
+
+    def run(self, tool, *args, env=None, timeout=60, stderr=None, sysfs=None):
+        cmd = [tool] + list(args)
+        if tool != self.fleet:
+            cmd[1:1] = ['--sysfs-root', sysfs or self.sysfs]
+        full_env = dict(os.environ)
+        full_env.update(env or {})
+        print('$ ' + ' '.join(cmd))
+        p = subprocess.run(cmd, env=full_env, timeout=timeout,
+                           stdout=subprocess.PIPE, stderr=stderr,
+                           universal_newlines=True)
+        print('exit %d' % p.returncode)
+        if stderr is not None:
+            return p.returncode, p.stdout, p.stderr
+        return p.returncode, p.stdout
+
+
+def test_probe(t):
+    expect = {
+        t.dec: 'Codec | Chroma',
+        t.enc: 'Nvenc initialized successfully',
+        t.video: 'Encode',
+    }
+    for tool in (t.dec, t.enc, t.video):
+        ret, out = t.run(tool)
+        check(ret == 0, '%s failed' % tool, out)
+        check('(fake)' in out, '%s did not list the fake GPU' % tool, out)
+        check(expect[tool] in out, '%s printed no capabilities' % tool, out)
+
+
+def test_jobs(t):
+    for tool in (t.dec, t.enc, t.video):
+        ret, serial = t.run(tool)
+        check(ret == 0, '%s failed' % tool, serial)
+        ret, parallel = t.run(tool, '-j', '4')
+        check(ret == 0, '%s -j 4 failed' % tool, parallel)
+        check(parallel == serial, '%s -j 4 output differs from a serial probe' % tool,
+              serial + parallel)
+
+
+def test_cache(t):
+    cache = t.path('cache')
+    no_decode = {'NVVI_FAKE_FAIL': 'cuvidGetDecoderCaps'}
+    no_encode = {'NVVI_FAKE_FAIL': 'nvEncOpenEncodeSessionEx'}
+
+    ret, dec = t.run(t.dec, '-c', cache)
+    check(ret == 0, 'nvdecinfo -c failed', dec)
+    check(os.path.exists(cache), 'nvdecinfo -c wrote no cache')
+    ret, enc = t.run(t.enc, '-c', cache)
+    check(ret == 0, 'nvencinfo -c failed', enc)
+
+    # With the probe calls failing, only a hit reproduces the output; the
+    # encoder run must have kept the decoder records and vice versa.
+    ret, out = t.run(t.dec, '-c', cache, env=no_decode)
+    check(ret == 0 and out == dec, 'nvdecinfo missed the cache', out)
+    ret, out = t.run(t.enc, '-c', cache, env=no_encode)
+    check(ret == 0 and out == enc, 'nvencinfo missed the cache', out)
+
+    ret, out = t.run(t.dec, '-c', t.path('empty-cache'), env=no_decode)
+    check(out != dec, 'nvdecinfo hit an empty cache', out)
+
+
+def test_trace(t):
+    trace = t.path('trace.json')
+    ret, out, err = t.run(t.dec, '--timings', '--trace', trace,
+                          stderr=subprocess.PIPE)
+    check(ret == 0, 'nvdecinfo --timings failed', out + err)
+    for call in ('cuInit', 'cuvidGetDecoderCaps', 'cuDriverGetVersion',
+                 'cuDeviceGetUuid'):
+        check(call in err, '--timings did not count %s' % call, err)
+
+    with open(trace) as f:
+        events = json.load(f)
+    if isinstance(events, dict):
+        events = events['traceEvents']
+    names = set(e.get('name') for e in events)
+    check('cuvidGetDecoderCaps' in names, 'trace has no cuvidGetDecoderCaps events')
+
+
+def test_sample(t):
+    def samples(out):
+        lines = out.splitlines()
+        check(lines and lines[0] == 'time_ms,device,codec,capacity',
+              'sample output has no CSV header', out)
+        return [line.split(',') for line in lines[1:]]
+
+    ret, out = t.run(t.enc, '--sample', '10', '--count', '3')
+    check(ret == 0, 'nvencinfo --sample failed', out)
+    rows = samples(out)
+    codecs = set(row[2] for row in rows)
+    check(codecs and len(rows) == 3 * len(codecs), 'expected 3 samples per codec', out)
+    times = sorted(set(int(row[0]) for row in rows))
+    check(len(times) == 3 and times[-1] >= 20, 'samples were not spaced by the interval', out)
+    # The sampler's own session is the only one open.
+    check(all(row[3] == '100' for row in rows), 'idle capacity is not 100', out)
+
+    env = t.profile('busy.profile', 'max-sessions 4', 'capacity@0 25')
+    ret, out = t.run(t.enc, '--sample', '1', '--count', '1', env=env)
+    check(ret == 0 and all(row[3] == '25' for row in samples(out)),
+          'capacity setting was not reported', out)
+
+
+def call_counts(timings):
+    counts = {}
+    for line in timings.splitlines():
+        fields = line.split()
+        if len(fields) > 2 and fields[1].isdigit() and fields[2].isdigit():
+            counts[fields[0]] = int(fields[1])
+    return counts
+
+
+def test_shared(t):
+    ret, out, err = t.run(t.video, '--timings', stderr=subprocess.PIPE)
+    check(ret == 0, 'nvvideoinfo --timings failed', out + err)
+    check('Decode' in out and 'Encode' in out, 'nvvideoinfo printed only one table', out)
+    calls = call_counts(err)
+    check(calls.get('cuInit') == 1, 'nvvideoinfo initialised CUDA more than once', err)
+    check(calls.get('cuDevicePrimaryCtxRetain') == 2, 'expected one primary context per GPU', err)
+    check(calls.get('cuDevicePrimaryCtxRelease') == 2, 'primary contexts were not released', err)
+    check('cuCtxCreate' not in calls, 'nvvideoinfo created a context of its own', err)
+
+
+def test_query(t):
+    cases = [
+        (0, ['--decode', 'h264']),
+        (0, ['--decode', 'vp9', '--depth', '12', '--size', '7680x4320']),
+        (1, ['--decode', 'h264', '--size', '8192x8192']),
+        (0, ['--encode', 'h264', '--size', '1920x1080']),
+        (1, ['--encode', 'h264', '--size', '16000x16000']),
+        (0, ['--encode', 'hevc', '--depth', '10', '--format', 'P010']),
+        (2, ['--encode', 'h264', '-d', '5']),
+    ]
+    for want, args in cases:
+        ret, out = t.run(t.video, '-v', *args)
+        check(ret == want, '%s: exit %d, expected %d' % (' '.join(args), ret, want), out)
+        check(out.startswith(('yes: ', 'no: ', 'error: ')[want]), 'no detail line', out)
+
+    # A failed caps query is an error, never a size limit.
+    ret, out = t.run(t.video, '--encode', 'h264', '--size', '1920x1080',
+                     env={'NVVI_FAKE_FAIL': 'nvEncGetEncodeCaps'})
+    check(ret == 2, 'failed caps query answered %d, expected 2' % ret, out)
+
+
+def bench_rows(out):
+    return [line.split('|') for line in out.splitlines()
+            if line.split('|')[0].strip().isdigit()]
+
+
+def test_bench(t):
+    bench = ['--codec', 'h264', '--preset', 'p1', '--frames', '20', '--size', '320x240']
+
+    ret, out = t.run(t.enc, '--bench', '2', *bench)
+    check(ret == 0, 'nvencinfo --bench failed', out)
+    rows = bench_rows(out)
+    check([int(row[0]) for row in rows] == [1, 2], 'expected steps of 1 and 2 sessions', out)
+    check(all(float(row[1]) > 0 for row in rows), 'a step encoded nothing', out)
+    check('Session limit' not in out, 'hit a session limit below the default', out)
+
+    env = t.profile('limited.profile', 'max-sessions 3')
+    ret, out = t.run(t.enc, '--bench', '5', *bench, env=env)
+    check(ret == 0, 'nvencinfo --bench failed at the session limit', out)
+    check([int(row[0]) for row in bench_rows(out)] == [1, 2, 3],
+          'sweep did not stop at the session limit', out)
+    check('Session limit: 3 (session 4: nvEncOpenEncodeSessionEx' in out,
+          'refused session was not reported', out)
+
+
+def test_plan(t):
+    ret, out = t.run(t.video, '--plan', '1920x1080@30,3840x2160@60,16384x16384@30')
+    check(ret == 0, 'nvvideoinfo --plan failed', out)
+    rows = dict(((f[0].strip(), f[1].strip()), [x.strip() for x in f[2:]])
+                for f in (line.split('|') for line in out.splitlines())
+                if len(f) == 5 and '@' in f[0])
+    check(len(rows) == 9, 'expected a row per rendition and codec', out)
+
+    # 983040 MB/s on each of 2 engines over 8160 MBs at 30 fps
+    check(rows[('1920x1080@30', 'H264')] == ['4', '8', '17'], 'wrong 1080p30 H264 plan', out)
+    check(rows[('3840x2160@60', 'HEVC')][0] == '5.1', 'wrong 2160p60 HEVC level', out)
+    check(rows[('16384x16384@30', 'AV1')] == ['-', '-', '-'],
+          'oversized rendition was given a plan', out)
+    check('16384x16384@30 AV1 encode: exceeds 8192x8192 maximum' in out,
+          'oversized rendition was not flagged', out)
+
+
+def placements(out):
+    return dict(line.split(None, 1) for line in out.splitlines()
+                if line and not line.startswith(('Device', 'Placed')))
+
+
+def test_place(t):
+    manifest = t.path('manifest')
+    with open(manifest, 'w') as f:
+        f.write('job cam1 hevc 420 10 3840x2160@30 h264 p4 1920x1080@30,1280x720@30\n'
+                'job cam2 h264 420 8 1920x1080@60 av1 - 1280x720@60\n')
+
+    ret, out = t.run(t.video, '--place', manifest)
+    check(ret == 0, 'nvvideoinfo --place failed', out)
+    check(placements(out) == {'cam1': '0', 'cam2': '0'}, 'best fit did not pack device 0', out)
+    check('Placed 2 of 2 jobs' in out, 'no placement summary', out)
+
+    ret, out = t.run(t.video, '--place', manifest, '--spread')
+    check(ret == 0 and placements(out) == {'cam1': '0', 'cam2': '1'},
+          '--spread did not use both devices', out)
+
+    ret, out = t.run(t.video, '--place', manifest, '--max-sessions', '2')
+    check(ret == 0 and placements(out) == {'cam1': '0', 'cam2': '1'},
+          '--max-sessions did not move cam2', out)
+
+    # A rung beyond the encoder's limits is not placed, and fails the run.
+    with open(manifest, 'a') as f:
+        f.write('job big h264 420 8 1920x1080@30 h264 - 16384x16384@30\n')
+    ret, out = t.run(t.video, '--place', manifest)
+    check(ret != 0, 'an unplaceable job did not fail the run', out)
+    check(placements(out)['big'].startswith('- exceeds'), 'unplaceable job not explained', out)
+
+
+def preset_rows(out):
+    return dict(((f[0], f[1]), f[2:]) for f in (line.split() for line in out.splitlines())
+                if len(f) > 2 and f[0][:1] == 'p' and f[0][1:].isdigit())
+
+
+def test_presets(t):
+    ret, out = t.run(t.enc, '--preset-config', '--codec', 'hevc')
+    check(ret == 0, 'nvencinfo --preset-config failed', out)
+    rows = preset_rows(out)
+    check(len(rows) == 7 * 4, 'expected every preset with every tuning', out)
+    check(rows[('p1', 'hq')][0] == 'vbr' and rows[('p1', 'll')][0] == 'cbr',
+          'tuning did not change the rate control', out)
+    check(rows[('p1', 'lossless')][:2] == ['constqp', 'qp'], 'lossless is not constant QP', out)
+    check(rows[('p7', 'hq')][-4] == 'full', 'p7 hq is not full resolution multipass', out)
+
+    ret, out = t.run(t.enc, '--preset-config', '--codec', 'h264', '--preset', 'p2',
+                     env={'NVVI_FAKE_FAIL': 'nvEncGetEncodePresetConfigEx=8'})
+    check(ret == 0, 'rejected presets failed the run', out)
+    rows = preset_rows(out)
+    check(sorted(set(p for p, _ in rows)) == ['p2'], '--preset did not narrow the table', out)
+    check(all(row[:2] == ['rejected', '(NVENCSTATUS'] for row in rows.values()),
+          'rejected combinations were not listed', out)
+
+
+def test_latency(t):
+    ret, out = t.run(t.enc, '--latency', '--codec', 'h264', '--preset', 'p1,p7',
+                     '--size', '1920x1080', '--fps', '30')
+    check(ret == 0, 'nvencinfo --latency failed', out)
+    rows = preset_rows(out)
+    check(sorted(set(p for p, _ in rows)) == ['p1', 'p7'], '--preset did not narrow the table', out)
+
+    # 8160 MBs at 983040 MB/s is 8.30 ms a frame
+    check(rows[('p1', 'll')] == ['0', '0', '0', '0', '8.30', '8.30', '8.30'],
+          'wrong p1 low latency budget', out)
+    # 3 B-frames at 30 fps, plus a second full resolution pass
+    check(rows[('p7', 'hq')] == ['3', '0', '0', '3', '16.60', '116.60', '8.30'],
+          'wrong p7 high quality budget', out)
+
+
+def decode_bench_sections(out):
+    """Split nvdecinfo --bench output into {'CODEC CHROMA D-bit': text}."""
+    sections = {}
+    for block in out.split('\n\n'):
+        lines = [line for line in block.splitlines() if not line.startswith('Device')]
+        if lines:
+            name = lines[0].split(',')[0].split(':')[0]
+            sections[name] = '\n'.join(lines)
+    return sections
+
+
+def test_decode_bench(t):
+    bench = ['--frames', '20', '--size', '320x240']
+
+    ret, out = t.run(t.dec, '--bench', '2', *bench)
+    check(ret == 0, 'nvdecinfo --bench failed', out)
+    sections = decode_bench_sections(out)
+    for name in ('H264 420 8-bit', 'HEVC 420 8-bit', 'HEVC 420 10-bit',
+                 'AV1 420 8-bit', 'AV1 420 10-bit'):
+        check(name in sections, '%s was not benchmarked' % name, out)
+        rows = bench_rows(sections[name])
+        check([int(row[0]) for row in rows] == [1, 2], '%s: expected 1 and 2 decoders' % name, out)
+        check(all(float(row[1]) > 0 for row in rows), '%s decoded nothing' % name, out)
+    for name in ('MPEG2 420 8-bit', 'HEVC 444 8-bit', 'VP9 420 10-bit'):
+        check(sections.get(name, '').endswith('not benchmarked (no stream generator)'),
+              '%s was not listed as not benchmarked' % name, out)
+
+    env = t.profile('limited.profile', 'max-decoders 2')
+    ret, out = t.run(t.dec, '--bench', '4', '--codec', 'hevc', *bench, env=env)
+    check(ret == 0, 'nvdecinfo --bench failed at the decoder limit', out)
+    sections = decode_bench_sections(out)
+    check(sections and all(name.startswith('HEVC ') for name in sections),
+          '--codec did not narrow the sweep', out)
+    check([int(row[0]) for row in bench_rows(sections['HEVC 420 10-bit'])] == [1, 2] and
+          'Decoder limit: 2 (decoder 3: cuvidCreateDecoder' in sections['HEVC 420 10-bit'],
+          'sweep did not stop at the decoder limit', out)
+
+
+def footprint_rows(out):
+    return [line.split() for line in out.splitlines()
+            if line.split() and line.split()[0] in ('H264', 'HEVC', 'AV1', 'MPEG2', 'MPEG4',
+                                                     'VC1', 'MJPEG', 'VP8', 'VP9')]
+
+
+def test_footprint(t):
+    ret, out, err = t.run(t.dec, '--footprint', '--codec', 'hevc', '--sizes', '1280x720',
+                          '--repeat', '1', '--timings', stderr=subprocess.PIPE)
+    check(ret == 0, 'nvdecinfo --footprint failed', out + err)
+    rows = footprint_rows(out)
+    check(rows and all(row[0] == 'HEVC' for row in rows), '--codec did not narrow the rows', out)
+    mib = dict(((row[1], row[2], int(row[4]), int(row[5])), float(row[6])) for row in rows)
+    check(all(v > 0 for v in mib.values()), 'a decoder took no memory', out)
+    check(mib[('420', '8', 16, 1)] > mib[('420', '8', 8, 1)] and
+          mib[('420', '10', 8, 1)] > mib[('420', '8', 8, 1)],
+          'footprint does not grow with surfaces and bit depth', out)
+    check('cuMemGetInfo' in err, '--timings did not count cuMemGetInfo', err)
+
+    ret, out = t.run(t.enc, '--footprint', '--sizes', '1280x720', '--repeat', '1')
+    check(ret == 0, 'nvencinfo --footprint failed', out)
+    rows = [row for row in footprint_rows(out) if row[1] == 'default']
+    check(rows and all(float(row[6]) > 0 for row in rows), 'an encoder took no memory', out)
+    check(float(rows[1][6]) > float(rows[0][6]), 'lookahead buffers took no memory', out)
+
+
+def test_verify(t):
+    def encode_verify(out):
+        rows = {}
+        for line in out.split('Verification', 1)[1].splitlines()[2:]:
+            if line.startswith('---'):
+                break
+            cells = [c.strip() for c in line.split('|')]
+            rows[cells[0]] = cells[1:4]
+        return rows
+
+    ret, out = t.run(t.enc, '--verify')
+    check(ret == 0, 'nvencinfo --verify failed', out)
+    rows = encode_verify(out)
+    check(all(c.startswith('ok ') for c in rows['Max size']), 'an encoder failed at its maximum size', out)
+    # AV1 doesn't advertise 4:4:4, so it is not tried.
+    check(rows['4:4:4'][2] == '.' and rows['4:4:4'][0].startswith('ok '),
+          '4:4:4 was not verified as advertised', out)
+
+    ret, out = t.run(t.enc, '--verify', env={'NVVI_FAKE_FAIL': 'nvEncInitializeEncoder=20'})
+    check(ret == 0, 'nvencinfo --verify failed', out)
+    rows = encode_verify(out)
+    check(all(c == 'fail 20' for c in rows['Max size']), 'a failed encoder was not reported', out)
+    check(rows['Lossless'][2] == '.', 'an unadvertised feature was verified', out)
+
+    ret, out = t.run(t.dec, '--verify')
+    check(ret == 0, 'nvdecinfo --verify failed', out)
+    rows = [line for line in out.splitlines() if line.count('|') == 9 and 'Codec' not in line]
+    check(rows and all(row.split('|')[9].strip().startswith('ok ') for row in rows),
+          'a decoder failed at its limits', out)
+
+    ret, out = t.run(t.dec, '--verify', env={'NVVI_FAKE_FAIL': 'cuvidCreateDecoder@0=2'})
+    check(ret == 0, 'nvdecinfo --verify failed', out)
+    rows = [line for line in out.splitlines() if line.count('|') == 9 and 'Codec' not in line]
+    check(rows and all(row.split('|')[9].strip() == 'fail 2' for row in rows),
+          'a failed decoder was not reported', out)
+
+
+def test_timeout(t):
+    ret, out = t.run(t.dec, '--timeout', '5000')
+    check(ret == 0, 'nvdecinfo --timeout failed on healthy devices', out)
+    check(out.count('Device ') == 2, 'not every device was probed', out)
+
+    # Device 1 wedges in context creation; device 0 must still be reported.
+    hang = {'NVVI_FAKE_LATENCY': 'cuCtxCreate@1=30000000,cuDevicePrimaryCtxRetain@1=30000000'}
+    start = time.monotonic()
+    ret, out = t.run(t.enc, '--timeout', '500', env=hang)
+    elapsed = time.monotonic() - start
+    check(ret != 0, 'a timed out device did not fail the probe', out)
+    check(elapsed < 5, 'the probe was not cut off at the deadline', out)
+    devices = out.split('Device ')
+    check(len(devices) == 3 and 'Max No. of B-Frames' in devices[1],
+          'the healthy device was not reported', out)
+    check('Probe timed out after 500 ms' in devices[2], 'the wedged device was not reported', out)
+
+    ret, out, err = t.run(t.dec, '--timeout', '300', env={'NVVI_FAKE_LATENCY': 'cuInit=30000000'},
+                          stderr=subprocess.PIPE)
+    check(ret != 0 and 'Device enumeration did not finish within 300 ms' in out + err,
+          'a wedged enumeration was not reported', out + err)
+
+
+def test_affinity(t):
+    sysfs = t.path('host')
+    for bus_id, attrs in (('0000:01:00.0', {'numa_node': '0', 'local_cpulist': '0-7,16-23',
+                                            'current_link_speed': '2.5 GT/s PCIe',
+                                            'max_link_speed': '16.0 GT/s PCIe',
+                                            'current_link_width': '16',
+                                            'max_link_width': '16'}),
+                          ('0000:02:00.0', {'numa_node': '1', 'local_cpulist': '40-47',
+                                            'current_link_speed': '32.0 GT/s PCIe',
+                                            'max_link_speed': '32.0 GT/s PCIe',
+                                            'current_link_width': '8',
+                                            'max_link_width': '8'})):
+        path = os.path.join(sysfs, 'bus', 'pci', 'devices', bus_id)
+        os.makedirs(path)
+        for name, value in attrs.items():
+            with open(os.path.join(path, name), 'w') as f:
+                f.write(value + '\n')
+
+    ret, out = t.run(t.video, '--affinity', sysfs=sysfs)
+    check(ret == 0, 'nvvideoinfo --affinity failed', out)
+    check(out.splitlines()[1:] == ['0 0000:01:00.0 0 0-7,16-23 ff00ff',
+                                   '1 0000:02:00.0 1 40-47 ff00,00000000'],
+          'wrong affinity lines', out)
+
+    ret, out = t.run(t.dec, sysfs=sysfs)
+    check(ret == 0, 'nvdecinfo failed', out)
+    check(', NUMA node 0, CPUs 0-7,16-23, PCIe Gen1 x16 (max Gen4 x16)' in out and
+          ', NUMA node 1, CPUs 40-47, PCIe Gen5 x8\n' in out,
+          'device headers lack the topology', out)
+
+    ret, out = t.run(t.video, '--affinity')
+    check(ret == 0, 'nvvideoinfo --affinity failed without topology', out)
+    check(out.splitlines()[1:] == ['0 0000:01:00.0 - - -', '1 0000:02:00.0 - - -'],
+          'missing topology was not shown as -', out)
+
+
+def parse_metrics(out):
+    """Samples of an OpenMetrics text by metric name, checking every one
+    was declared with a TYPE line and the text ends with # EOF."""
+    check(out.endswith('# EOF\n'), 'metrics do not end with # EOF', out)
+    types = set()
+    samples = {}
+    for line in out.splitlines()[:-1]:
+        if line.startswith('# TYPE '):
+            types.add(line.split()[2])
+        elif not line.startswith('#'):
+            name, value = line.rsplit(' ', 1)
+            family = name.split('{')[0]
+            check(family in types or family.rsplit('_', 1)[0] in types,
+                  '%s has no TYPE' % family, out)
+            samples.setdefault(family, {})[name[len(family):]] = float(value)
+    return samples
+
+
+def test_metrics(t):
+    metrics = t.path('nvvi.prom')
+    ret, out = t.run(t.video, '--metrics', metrics)
+    check(ret == 0, 'nvvideoinfo --metrics failed', out)
+    with open(metrics) as f:
+        text = f.read()
+    samples = parse_metrics(text)
+    check(samples['nvvi_device_probed'] == {'{device="0"}': 1}, 'device 0 was not probed', text)
+    check(samples['nvvi_encode_limit']['{device="0",codec="H264",limit="mb_per_sec_max"}'] == 983040,
+          'wrong H264 mb_per_sec_max', text)
+    check(samples['nvvi_decode_max_width']['{device="0",codec="AV1",chroma="420",bit_depth="10"}'] == 8192,
+          'wrong AV1 10-bit max width', text)
+    check('nvvi_encode_capacity_percent' not in samples, 'capacity exported without --capacity', text)
+
+    with socket.socket() as s:
+        s.bind(('127.0.0.1', 0))
+        port = s.getsockname()[1]
+    cmd = [t.video, '--sysfs-root', t.sysfs, '--listen', '127.0.0.1:%d' % port, '--capacity']
+    print('$ ' + ' '.join(cmd))
+    server = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                              universal_newlines=True)
+    try:
+        check('Serving metrics' in server.stderr.readline(), 'exporter did not start')
+        url = 'http://127.0.0.1:%d' % port
+        with urllib.request.urlopen(url + '/metrics', timeout=10) as r:
+            check(r.headers['Content-Type'].startswith('application/openmetrics-text'),
+                  'wrong content type')
+            text = r.read().decode()
+        samples = parse_metrics(text)
+        capacity = samples.get('nvvi_encode_capacity_percent', {})
+        check(capacity and all(v == 100 for v in capacity.values()),
+              'idle capacity was not exported as 100', text)
+        try:
+            urllib.request.urlopen(url + '/other', timeout=10)
+            check(False, 'an unknown path was served')
+        except urllib.error.HTTPError as e:
+            check(e.code == 404, 'an unknown path did not get 404')
+    finally:
+        server.kill()
+        server.communicate()
+
+
+def test_shm(t):
+    name = 'nvvi-test-%d' % os.getpid()
+    segment = os.path.join('/dev/shm', name)
+    ret, probed = t.run(t.video)
+    check(ret == 0, 'nvvideoinfo failed', probed)
+
+    ret, out = t.run(t.video, '--publish', name)
+    check(ret == 0 and os.path.exists(segment), 'nvvideoinfo --publish left no segment', out)
+    try:
+        # The reader must not touch the driver at all.
+        no_driver = {'NVVI_FAKE_FAIL': 'cuInit'}
+        ret, out = t.run(t.video, '--shm', name, env=no_driver)
+        check(ret == 0 and out == probed, '--shm does not show the published snapshot', out)
+        ret, out = t.run(t.video, '--shm', name, '--metrics', '-', env=no_driver)
+        check(ret == 0, 'nvvideoinfo --shm --metrics failed', out)
+        check(parse_metrics(out)['nvvi_device_probed'] == {'{device="0"}': 1},
+              'metrics from --shm lack the device', out)
+    finally:
+        os.unlink(segment)
+
+    ret, out = t.run(t.video, '--shm', name)
+    check(ret != 0, '--shm succeeded without a segment', out)
+
+    cmd = [t.video, '--sysfs-root', t.sysfs, '--publish', name, '--capacity', '--interval', '50']
+    print('$ ' + ' '.join(cmd))
+    publisher = subprocess.Popen(cmd)
+    try:
+        for _ in range(100):
+            if os.path.exists(segment):
+                break
+            time.sleep(0.05)
+        check(os.path.exists(segment), 'the capacity publisher did not create the segment')
+        time.sleep(0.2)
+        ret, out = t.run(t.video, '--shm', name, '--metrics', '-')
+        capacity = parse_metrics(out).get('nvvi_encode_capacity_percent', {})
+        check(capacity and all(v == 100 for v in capacity.values()),
+              'the publisher did not refresh the capacity', out)
+    finally:
+        publisher.send_signal(signal.SIGINT)
+        publisher.wait(timeout=10)
+    check(not os.path.exists(segment), 'the publisher did not remove its segment')
+
+
+class Client:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.settimeout(10)
+        try:
+            self.sock.connect(path)
+        except OSError:
+            self.sock.close()
+            raise
+        self.reader = self.sock.makefile('r')
+
+    def request(self, line):
+        self.sock.sendall((line + '\n').encode())
+        reply = self.reader.readline().rstrip('\n')
+        print('> %s\n< %s' % (line, reply))
+        return reply
+
+    def jobs(self):
+        """Jobs on each device, from status"""
+        self.sock.sendall(b'status\n')
+        jobs = {}
+        for line in self.reader:
+            line = line.rstrip('\n')
+            if line == '.':
+                break
+            m = re.match(r'device (\d+) jobs (\d+)', line)
+            check(m, 'bad status line: %s' % line)
+            jobs[int(m.group(1))] = int(m.group(2))
+        return jobs
+
+    def close(self):
+        self.reader.close()
+        self.sock.close()
+
+
+def start_admit(t, path, *args, env=None):
+    """Start an admission daemon and return it with a connected client"""
+    full_env = dict(os.environ)
+    full_env.update(env or {})
+    cmd = [t.video, '--sysfs-root', t.sysfs, '--admit', path] + list(args)
+    print('$ ' + ' '.join(cmd))
+    daemon = subprocess.Popen(cmd, env=full_env)
+
+    # It measures session memory on every device before it listens
+    deadline = time.monotonic() + 30
+    while True:
+        check(daemon.poll() is None, 'the admission daemon exited')
+        check(time.monotonic() < deadline, 'the admission daemon never listened')
+        try:
+            return daemon, Client(path)
+        except (FileNotFoundError, ConnectionRefusedError):
+            time.sleep(0.1)
+
+
+def stop_admit(daemon, path):
+    daemon.send_signal(signal.SIGTERM)
+    ret = daemon.wait(timeout=10)
+    check(ret == 0, 'the admission daemon exited with %d' % ret)
+    check(not os.path.exists(path), 'the admission daemon left its socket behind')
+
+
+def test_admit(t):
+    job = 'job t1 h264 420 8 1920x1080@30 h264 - 1920x1080@30'
+    uhd = 'job t2 h264 420 8 3840x2160@60 h264 - 3840x2160@60'
+    path = t.path('admit.sock')
+
+    daemon, a = start_admit(t, path)
+    try:
+        reply = a.request(job).split()
+        check(len(reply) == 3 and reply[0] == 'ok' and reply[2] == '0', 'reservation failed')
+        check(a.jobs() == {0: 1}, 'the reservation is not in the status')
+        check(a.request('release %s' % reply[1]) == 'ok', 'release failed')
+        check(a.jobs() == {0: 0}, 'the release is not in the status')
+        check(a.request('release %s' % reply[1]).startswith('error'),
+              'a reservation was released twice')
+
+        # One 2160p60 encode takes most of the H264 MB/s budget
+        first = a.request(uhd).split()
+        check(first[0] == 'ok', '2160p60 reservation failed')
+        check(a.request(uhd) == 'denied encode budget full', 'the MB/s budget was overbooked')
+        a.request('release %s' % first[1])
+        check(a.request(uhd).startswith('ok '), 'released MB/s were not given back')
+        a.close()
+
+        # The disconnect is handled before the next client is accepted
+        b = Client(path)
+        check(b.jobs() == {0: 0}, 'a disconnect did not release its reservation')
+        b.close()
+    finally:
+        stop_admit(daemon, path)
+
+    # 100 MiB fit two 1080p decoder and encoder pairs (48 MiB each)
+    small = t.profile('small.profile', 'memory-mb 100')
+    daemon, a = start_admit(t, path, env=small)
+    try:
+        check(a.request(job).startswith('ok ') and a.request(job).startswith('ok '),
+              'reservations within the memory failed')
+        check(a.request(job) == 'denied device memory full', 'device memory was overbooked')
+        a.close()
+    finally:
+        stop_admit(daemon, path)
+
+    daemon, a = start_admit(t, path, '--no-memory', env=small)
+    try:
+        check(all(a.request(job).startswith('ok ') for _ in range(3)),
+              '--no-memory still accounts device memory')
+        a.close()
+    finally:
+        stop_admit(daemon, path)
+
+
+def test_fleet(t):
+    snapshots = t.path('snapshots')
+    os.mkdir(snapshots)
+    for host, profile in (('a', 'example.profile'), ('b', 'dual.profile'), ('c', 'example.profile')):
+        env = {'NVVI_FAKE_PROFILE': os.path.join(os.path.dirname(os.environ['NVVI_FAKE_PROFILE']),
+                                                 profile)}
+        ret, out = t.run(t.video, '--record', os.path.join(snapshots, host + '.snapshot'), env=env)
+        check(ret == 0, 'nvvideoinfo --record failed', out)
+
+    def hosts(out, query):
+        section = out.split('# %s\n' % query, 1)[1].split('# ', 1)[0]
+        return dict(line.split() for line in section.splitlines())
+
+    index = t.path('index')
+    ret, out = t.run(t.fleet, '-i', index, '-s', snapshots)
+    check(ret == 0, 'nvvifleet failed to index the snapshots', out)
+    # The same GPU under the same driver is one capability set for every host
+    check('3 hosts, 4 devices, 1 capability sets' in out, 'wrong index stats', out)
+
+    ret, out = t.run(t.fleet, '-i', index, '-q', 'devices>=2', '-q', 'encode=av1 support_10bit_encode=1',
+                     '-q', 'decode=vp8:444')
+    check(ret == 0, 'nvvifleet -q failed on a saved index', out)
+    check(hosts(out, 'devices>=2') == {'b': '2'}, 'wrong hosts for devices>=2', out)
+    check(hosts(out, 'encode=av1 support_10bit_encode=1') == {'a': '1', 'b': '2', 'c': '1'},
+          'wrong hosts for 10-bit AV1 encode', out)
+    check(hosts(out, 'decode=vp8:444') == {}, 'a host decodes 4:4:4 VP8', out)
+
+    ret, out = t.run(t.fleet, '-i', index, '-q', 'no_such_cap=1')
+    check(ret != 0, 'an invalid query was accepted', out)
+
+
+def test_diff(t):
+    old = t.path('old.snapshot')
+
+    ret, out = t.run(t.video, '--record', old)
+    check(ret == 0, 'nvvideoinfo --record failed', out)
+    ret, out = t.run(t.video, '--diff', old)
+    check(ret == 0, 'diff against the same driver found regressions', out)
+
+    def edit(name, change):
+        with open(old) as f:
+            lines = f.readlines()
+        path = t.path(name)
+        with open(path, 'w') as f:
+            f.writelines(change(lines))
+        return path
+
+    def drop_first_decoder(lines):
+        first = next(i for i, line in enumerate(lines) if line.startswith('decode '))
+        return lines[:first] + lines[first + 1:]
+    new = edit('new.snapshot', drop_first_decoder)
+    ret, out = t.run(t.video, '--diff', old, new)
+    check(ret == 1 and 'REGRESSION' in out, 'a removed decoder row is not a regression', out)
+    ret, out = t.run(t.video, '--diff', new, old)
+    check(ret == 0 and 'REGRESSION' not in out, 'an added decoder row is a regression', out)
+
+    # Lose P016 output for 10-bit HEVC and half the H264 MB/s
+    def downgrade(lines):
+        lines = list(lines)
+        lines[lines.index('decode 8 1 10 144 144 8192 8192 262144 0x3\n')] = \
+            'decode 8 1 10 144 144 8192 8192 262144 0x1\n'
+        lines[lines.index('cap 32 983040\n')] = 'cap 32 491520\n'
+        return lines
+    new = edit('downgraded.snapshot', downgrade)
+    ret, out = t.run(t.video, '--diff', old, new)
+    check(ret == 1, 'a downgrade is not a regression', out)
+    check('decode HEVC 420 10-bit output format P016 removed' in out and
+          'H264: mb_per_sec_max 983040 -> 491520' in out and
+          '2 differences, 2 regressions' in out, 'wrong downgrade report', out)
+    ret, out = t.run(t.video, '--diff', new, old)
+    check(ret == 0 and '2 differences, 0 regressions' in out, 'an upgrade is a regression', out)
+
+    ret, out = t.run(t.video, '--diff', t.path('missing.snapshot'))
+    check(ret == 2, 'a missing snapshot is not an error', out)
+
+
+def test_transcode(t):
+    run = ['--transcode', '--sizes', '320x240', '--frames', '20']
+
+    def rows(out):
+        """Stage rows of the zero-copy and copy runs: path -> stage -> fields"""
+        paths = {}
+        path = None
+        for line in out.splitlines():
+            fields = line.split()
+            if line.startswith('320x240'):
+                fields = fields[1:]
+            if fields and fields[0] in ('zero-copy', 'copy'):
+                path = fields.pop(0)
+            if path and fields and fields[0] in ('decode', 'map', 'encode', 'total'):
+                paths.setdefault(path, {})[fields[0]] = fields[1:]
+        return paths
+
+    for source in ('h264', 'hevc', 'av1'):
+        ret, out, err = t.run(t.enc, *run, '--source', source, '--codec', 'h264', '--timings',
+                              stderr=subprocess.PIPE)
+        check(ret == 0, 'nvencinfo --transcode --source %s failed' % source, out + err)
+        check('%s -> H264 default preset, 20 frames' % source.upper() in out,
+              'wrong transcode heading', out)
+        paths = rows(out)
+        check(sorted(paths) == ['copy', 'zero-copy'] and
+              all(len(p) == 4 for p in paths.values()), 'missing transcode stages', out)
+        check(', 1 registered' in out, 'the zero-copy run registered no surface', out)
+        for call in ('cuMemcpy2D', 'nvEncRegisterResource', 'nvEncUnregisterResource',
+                     'nvEncMapInputResource', 'nvEncUnmapInputResource'):
+            check(call in err, '--timings did not count %s' % call, err)
+
+    ret, out, err = t.run(t.enc, '--transcode', '--source', 'vp9', stderr=subprocess.PIPE)
+    check(ret != 0 and 'No vp9 stream to transcode from' in err,
+          'an unsupported source was not refused', out + err)
+
+    # A device that doesn't decode the source says so for every run
+    with open(os.environ['NVVI_FAKE_PROFILE']) as f:
+        lines = [line for line in f if not line.startswith('decode 11 ')]
+    no_av1 = t.path('no-av1.profile')
+    with open(no_av1, 'w') as f:
+        f.writelines(lines)
+    ret, out = t.run(t.enc, *run, '--source', 'av1', '--codec', 'hevc',
+                     env={'NVVI_FAKE_PROFILE': no_av1})
+    check(ret == 0, 'nvencinfo --transcode failed on a device without AV1 decode', out)
+    check(out.count('AV1 420 8-bit decode not supported') == 2, 'missing AV1 decode was not reported', out)
+
+    ret, out = t.run(t.enc, *run, '--codec', 'h264',
+                     env={'NVVI_FAKE_FAIL': 'nvEncRegisterResource=8'})
+    check(ret == 0, 'nvencinfo --transcode failed when registering failed', out)
+    check('zero-copy nvEncRegisterResource: invalid param' in out and 'copy' in rows(out),
+          'a refused registration was not reported next to the copy run', out)
+
+
+def test_paths(t):
+    def paths(out):
+        result = {}
+        for line in out.splitlines():
+            if ' -> ' in line and not line.startswith('Device'):
+                row, rest = line.split(' -> ', 1)
+                codec, path = rest.split(None, 1)
+                result[(row.strip(), codec)] = path
+        return result
+
+    ret, out = t.run(t.video, '--paths')
+    check(ret == 0, 'nvvideoinfo --paths failed', out)
+    found = paths(out)
+    check(len(found) == 17 * 3, 'expected every decoder row with every encoder', out)
+    for key, path in ((('H264 420 8-bit', 'AV1'), 'NV12 -> NV12 (420 8-bit)'),
+                      (('HEVC 420 10-bit', 'HEVC'), 'P016 -> P010 (420 10-bit)'),
+                      (('HEVC 420 10-bit', 'H264'), 'NV12 -> NV12 (420 8-bit)'),
+                      (('HEVC 444 12-bit', 'HEVC'), 'YUV444P16 -> YUV444P10 (444 10-bit)'),
+                      (('HEVC 444 8-bit', 'AV1'), 'none: YUV444P surface, no 4:4:4 input'),
+                      (('HEVC 444 10-bit', 'H264'), 'none: YUV444P16 surface, no 10-bit input')):
+        check(found.get(key) == path, '%s -> %s is not %s' % (key + (path,)), out)
+
+    # Without P016 output 10-bit HEVC can only reach the encoder as 8 bits
+    with open(os.environ['NVVI_FAKE_PROFILE']) as f:
+        profile = f.read().replace('decode 8 1 10 144 144 8192 8192 262144 0x3',
+                                   'decode 8 1 10 144 144 8192 8192 262144 0x1')
+    no_p016 = t.path('no-p016.profile')
+    with open(no_p016, 'w') as f:
+        f.write(profile)
+    ret, out = t.run(t.video, '--paths', env={'NVVI_FAKE_PROFILE': no_p016})
+    check(ret == 0, 'nvvideoinfo --paths failed', out)
+    check(paths(out).get(('HEVC 420 10-bit', 'HEVC')) == 'NV12 -> NV12 (420 8-bit)',
+          'the path did not fall back to 8 bits', out)
+
+
+CASES = {
+    'probe': test_probe,
+    'jobs': test_jobs,
+    'cache': test_cache,
+    'trace': test_trace,
+    'sample': test_sample,
+    'shared': test_shared,
+    'query': test_query,
+    'bench': test_bench,
+    'plan': test_plan,
+    'place': test_place,
+    'presets': test_presets,
+    'latency': test_latency,
+    'decode_bench': test_decode_bench,
+    'footprint': test_footprint,
+    'verify': test_verify,
+    'timeout': test_timeout,
+    'affinity': test_affinity,
+    'metrics': test_metrics,
+    'shm': test_shm,
+    'admit': test_admit,
+    'fleet': test_fleet,
+    'diff': test_diff,
+    'transcode': test_transcode,
+    'paths': test_paths,
+}
+
+
+def main():
+    if len(sys.argv) < 3 or sys.argv[1] not in CASES:
+        sys.stderr.write('Usage: %s CASE TOOL...\n' % sys.argv[0])
+        return 2
+
+    with tempfile.TemporaryDirectory(prefix='nvvi-test-') as tmp:
+        try:
+            CASES[sys.argv[1]](Tools(sys.argv[2:], tmp))
+        except Failure as e:
+            sys.stderr.write('FAIL: %s\n' % e)
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -17,207 +17,438 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-#include <ffnvcodec/dynlink_loader.h>
+#include "nvvideoinfo.h"
+#include "nvvi_tool.h"
 
-static CudaFunctions *cu;
-static CuvidFunctions *cv;
+enum {
+  OPT_FRAMES = TOOL_OPT_FIRST_LOCAL,
+  OPT_SIZE,
+  OPT_CODEC,
+  OPT_FOOTPRINT,
+  OPT_SIZES,
+  OPT_SURFACES,
+  OPT_OUTPUTS,
+  OPT_REPEAT,
+};
 
-static int check_cu(CUresult err, const char *func)
+typedef struct {
+  int max_sessions;
+  int device;                   /* -1 for every device */
+  int codec;                    /* cudaVideoCodec, -1 for every codec */
+  nvvi_decode_bench_options opts;
+} bench_config;
+
+typedef struct {
+  int enabled;
+  int codec;                    /* cudaVideoCodec, -1 for every codec */
+  int repeat;
+  int num_sizes;
+  unsigned int widths[TOOL_MAX_LIST];
+  unsigned int heights[TOOL_MAX_LIST];
+  int num_surfaces;
+  int surfaces[TOOL_MAX_LIST];
+  int num_outputs;
+  int outputs[TOOL_MAX_LIST];
+} footprint_config;
+
+/*
+ * Sweep one decoder caps row from 1 decoder up, stopping at max_sessions
+ * or at the first decoder the driver refuses. A row that can't be run at
+ * all gets a single "not benchmarked" line.
+ */
+static int bench_sweep(const bench_config *config, const nvvi_decode_caps *caps,
+                       nvvi_decode_bench_options *opts)
 {
-  const char *err_name;
-  const char *err_string;
+  unsigned int width = opts->width ? opts->width : 1920;
+  unsigned int height = opts->height ? opts->height : 1080;
 
-  if (err == CUDA_SUCCESS) {
+  printf("%s %s %d-bit", nvvi_decode_codec_name(caps->codec),
+         nvvi_chroma_format_name(caps->chroma_format), caps->bit_depth);
+  if (!nvvi_decode_bench_supported(caps->codec, caps->chroma_format, caps->bit_depth)) {
+    printf(": not benchmarked (no stream generator)\n");
     return 0;
   }
+  printf(", %ux%u (%u MBs), %d frames per decoder\n", width, height,
+         ((width + 15) / 16) * ((height + 15) / 16), opts->frames ? opts->frames : 300);
 
-  cu->cuGetErrorName(err, &err_name);
-  cu->cuGetErrorString(err, &err_string);
+  opts->codec = caps->codec;
+  opts->bit_depth = caps->bit_depth;
+  for (int n = 1; n <= config->max_sessions; n++) {
+    nvvi_decode_bench_step step;
 
-  fprintf(stderr, "%s failed", func);
-  if (err_name && err_string) {
-    fprintf(stderr, " -> %s: %s", err_name, err_string);
+    if (nvvi_decode_bench_run(opts, n, &step) != 0) {
+      fprintf(stderr, "Benchmark failed with %d decoders\n", n);
+      return -1;
+    }
+    if (step.opened == 0) {
+      printf("Not benchmarked (%s)\n", step.error);
+      return 0;
+    }
+    if (n == 1) {
+      if (step.nvdecs) {
+        printf("NVDEC engines: %d, ", step.nvdecs);
+      } else {
+        printf("NVDEC engines: not reported, ");
+      }
+      printf("max %u MBs per picture\n", step.max_mb_count);
+      printf("Decoders |   Total fps |        MB/s | Decoder fps min/max |  p50 ms |  p95 ms |  p99 ms |  max ms\n");
+      printf("-----------------------------------------------------------------------------------------------\n");
+    }
+    if (step.opened < n) {
+      printf("Decoder limit: %d (decoder %d: %s)\n", step.opened, step.opened + 1, step.error);
+      return 0;
+    }
+    printf("%8d | %11.1f | %11.0f | %9.1f %9.1f | %7.2f | %7.2f | %7.2f | %7.2f\n",
+           n, step.fps, step.mb_per_sec, step.session_fps_min, step.session_fps_max,
+           step.latency_p50_ms, step.latency_p95_ms, step.latency_p99_ms, step.latency_max_ms);
+    fflush(stdout);
   }
-  fprintf(stderr, "\n");
-
-  return -1;
+  printf("No decoder limit up to %d decoders\n", config->max_sessions);
+  return 0;
 }
 
-#define CHECK_CU(x) { int ret = check_cu((x), #x); if (ret != 0) { return ret; } }
-
-static int get_caps(cudaVideoCodec codec_type,
-                    cudaVideoChromaFormat chroma_format,
-                    unsigned int bit_depth)
+static int bench(const nvvi_snapshot *snap, const bench_config *config)
 {
-  CUVIDDECODECAPS caps;
-  caps.eCodecType = codec_type;
-  caps.eChromaFormat = chroma_format;
-  caps.nBitDepthMinus8 = bit_depth - 8;
+  int ret = 0;
 
-  CHECK_CU(cv->cuvidGetDecoderCaps(&caps));
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    nvvi_decode_bench_options opts = config->opts;
 
-  if (!caps.bIsSupported) {
-    return 0;
+    if (device->decode_status != 0 || (config->device >= 0 && device->index != config->device)) {
+      continue;
+    }
+    printf("Device %d: %s\n", device->index, device->name);
+    opts.device = device->index;
+    for (int j = 0; j < device->num_decode_caps; j++) {
+      const nvvi_decode_caps *caps = &device->decode_caps[j];
+      if (config->codec < 0 || caps->codec == config->codec) {
+        ret |= bench_sweep(config, caps, &opts);
+        printf("\n");
+      }
+    }
   }
 
-  const char *codec;
-  switch (codec_type) {
-  case cudaVideoCodec_MPEG1:
-    codec = "MPEG1";
-    break;
-  case cudaVideoCodec_MPEG2:
-    codec = "MPEG2";
-    break;
-  case cudaVideoCodec_MPEG4:
-    codec = "MPEG4";
-    break;
-  case cudaVideoCodec_VC1:
-    codec = "VC1";
-    break;
-  case cudaVideoCodec_H264:
-    codec = "H264";
-    break;
-  case cudaVideoCodec_JPEG:
-    codec = "MJPEG";
-    break;
-  case cudaVideoCodec_H264_SVC:
-    codec = "H264 SVC";
-    break;
-  case cudaVideoCodec_H264_MVC:
-    codec = "H264 MVC";
-    break;
-  case cudaVideoCodec_HEVC:
-    codec = "HEVC";
-    break;
-  case cudaVideoCodec_VP8:
-    codec = "VP8";
-    break;
-  case cudaVideoCodec_VP9:
-    codec = "VP9";
-    break;
-#if NVDECAPI_MAJOR_VERSION > 10
-  case cudaVideoCodec_AV1:
-    codec = "AV1";
-    break;
-#endif
-  default:
-    codec = "Unknown";
-    break;
+  return ret;
+}
+
+/*
+ * One row per decode format, size, decode and output surface count, for
+ * every size the format's caps admit.
+ */
+static int footprint_device(const footprint_config *config, const nvvi_device *device)
+{
+  int header = 0;
+
+  for (int i = 0; i < device->num_decode_caps; i++) {
+    const nvvi_decode_caps *caps = &device->decode_caps[i];
+
+    if (config->codec >= 0 && caps->codec != config->codec) {
+      continue;
+    }
+    for (int j = 0; j < config->num_sizes; j++) {
+      unsigned int width = config->widths[j], height = config->heights[j];
+
+      if (width > caps->max_width || height > caps->max_height ||
+          width < caps->min_width || height < caps->min_height ||
+          ((width + 15) / 16) * ((height + 15) / 16) > caps->max_mb_count) {
+        continue;
+      }
+      for (int k = 0; k < config->num_surfaces; k++) {
+        for (int l = 0; l < config->num_outputs; l++) {
+          nvvi_footprint_options opts = {
+            .device = device->index,
+            .codec = caps->codec,
+            .width = width,
+            .height = height,
+            .chroma_format = caps->chroma_format,
+            .bit_depth = caps->bit_depth,
+            .decode_surfaces = config->surfaces[k],
+            .output_surfaces = config->outputs[l],
+            .repeat = config->repeat,
+          };
+          nvvi_footprint fp;
+          char size[32];
+
+          if (nvvi_decode_footprint(&opts, &fp) != 0) {
+            fprintf(stderr, "Could not measure device %d\n", device->index);
+            return -1;
+          }
+          if (!header) {
+            tool_print_memory(&fp);
+            printf("Codec  Chroma Depth      Size Surfaces Outputs      MiB      Min      Max\n");
+            header = 1;
+          }
+          snprintf(size, sizeof(size), "%ux%u", width, height);
+          printf("%-6s %-6s %5d %9s %8d %7d ", nvvi_decode_codec_name(caps->codec),
+                 nvvi_chroma_format_name(caps->chroma_format), caps->bit_depth, size,
+                 config->surfaces[k], config->outputs[l]);
+          tool_print_footprint(&fp);
+        }
+      }
+    }
+  }
+  if (!header) {
+    printf("No decode format takes the given sizes\n");
   }
 
-  const char *format;
-  switch (chroma_format) {
-  case cudaVideoChromaFormat_Monochrome:
-    format = "400";
-    break;
-  case cudaVideoChromaFormat_420:
-    format = "420";
-    break;
-  case cudaVideoChromaFormat_422:
-    format = "422";
-    break;
-  case cudaVideoChromaFormat_444:
-    format = "444";
-    break;
+  return 0;
+}
+
+static int footprint(const nvvi_snapshot *snap, const footprint_config *config, int device)
+{
+  int ret = 0;
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    if (snap->devices[i].decode_status != 0 ||
+        (device >= 0 && snap->devices[i].index != device)) {
+      continue;
+    }
+    printf("Device %d: %s\n", snap->devices[i].index, snap->devices[i].name);
+    ret |= footprint_device(config, &snap->devices[i]);
+    printf("\n");
   }
 
-  const char *surface;
-  switch (caps.nOutputFormatMask) {
-  case 1 << cudaVideoSurfaceFormat_NV12:
-      surface = "NV12";
+  return ret;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          TOOL_COMMON_USAGE
+          "  -h, --help      show this help\n"
+          "\n"
+          "Benchmark mode: for every codec, chroma format and bit depth the device\n"
+          "decodes, decode a synthetic stream with 1, 2, ... N concurrent decoders and\n"
+          "report throughput, latency and the decoder limit.\n"
+          "  -b, --bench N       sweep up to N decoders\n"
+          "  -d, --device N      only benchmark device N\n"
+          "      --codec CODEC   only benchmark CODEC (h264, hevc, av1, ...)\n"
+          "      --frames N      frames per decoder (default 300)\n"
+          "      --size WxH      frame size (default 1920x1080)\n"
+          "\n"
+          "Footprint mode: device memory one decoder takes, per decode format,\n"
+          "size and surface count, from cuMemGetInfo around cuvidCreateDecoder.\n"
+          "      --footprint     measure instead of printing capabilities\n"
+          "      --sizes LIST    frame sizes (default 1280x720,1920x1080,3840x2160)\n"
+          "      --surfaces LIST decode surface counts (default 8,16)\n"
+          "      --outputs LIST  output surface counts (default 1,4)\n"
+          "      --repeat N      measurements per row, the median is shown (default 3)\n"
+          "                      (-d and --codec select as above)\n",
+          prog);
+}
+
+int main(int argc, char *argv[])
+{
+  nvvi_probe_options opts = {
+    .flags = NVVI_PROBE_DECODE,
+    .threads = 1,
+  };
+  static const struct option long_opts[] = {
+    { "jobs", required_argument, NULL, 'j' },
+    { "cache", required_argument, NULL, 'c' },
+    { "record", required_argument, NULL, 'r' },
+    { "bench", required_argument,  NULL, 'b' },
+    { "device", required_argument, NULL, 'd' },
+    { "codec", required_argument,  NULL, OPT_CODEC },
+    { "frames", required_argument, NULL, OPT_FRAMES },
+    { "size", required_argument,   NULL, OPT_SIZE },
+    { "footprint", no_argument,    NULL, OPT_FOOTPRINT },
+    { "sizes", required_argument,  NULL, OPT_SIZES },
+    { "surfaces", required_argument, NULL, OPT_SURFACES },
+    { "outputs", required_argument, NULL, OPT_OUTPUTS },
+    { "repeat", required_argument, NULL, OPT_REPEAT },
+    { "timings", no_argument,     NULL, TOOL_OPT_TIMINGS },
+    { "trace", required_argument, NULL, TOOL_OPT_TRACE },
+    { "verify", no_argument,      NULL, TOOL_OPT_VERIFY },
+    { "timeout", required_argument, NULL, TOOL_OPT_TIMEOUT },
+    { "sysfs-root", required_argument, NULL, TOOL_OPT_SYSFS_ROOT },
+    { "diff", required_argument, NULL, TOOL_OPT_DIFF },
+    { "help", no_argument,       NULL, 'h' },
+    { NULL },
+  };
+  bench_config bench_cfg = {
+    .device = -1,
+    .codec = -1,
+  };
+  footprint_config footprint_cfg = {
+    .codec = -1,
+    .num_sizes = 3,
+    .widths = { 1280, 1920, 3840 },
+    .heights = { 720, 1080, 2160 },
+    .num_surfaces = 2,
+    .surfaces = { 8, 16 },
+    .num_outputs = 2,
+    .outputs = { 1, 4 },
+  };
+  const char *record_path = NULL;
+  const char *diff_path = NULL;
+  tool_trace trace = { 0 };
+  nvvi_snapshot snap;
+  int ret;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "j:c:r:b:d:h", long_opts, NULL)) != -1) {
+    switch (c) {
+    case 'j':
+      opts.threads = atoi(optarg);
+      break;
+    case 'c':
+      opts.cache_path = optarg;
+      break;
+    case 'r':
+      record_path = optarg;
+      opts.flags |= NVVI_PROBE_ALL;
+      break;
+    case 'b':
+      bench_cfg.max_sessions = atoi(optarg);
+      if (bench_cfg.max_sessions <= 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'd':
+      bench_cfg.device = atoi(optarg);
+      break;
+    case OPT_CODEC:
+      bench_cfg.codec = nvvi_decode_codec_from_name(optarg);
+      if (bench_cfg.codec < 0) {
+        fprintf(stderr, "Unknown codec '%s'\n", optarg);
+        return -1;
+      }
+      footprint_cfg.codec = bench_cfg.codec;
+      break;
+    case OPT_FRAMES:
+      bench_cfg.opts.frames = atoi(optarg);
       break;
-  case 1 << cudaVideoSurfaceFormat_P016:
-      surface = "P016";
+    case OPT_SIZE:
+      if (sscanf(optarg, "%ux%u", &bench_cfg.opts.width, &bench_cfg.opts.height) != 2) {
+        usage(argv[0]);
+        return -1;
+      }
       break;
-  case 1 << cudaVideoSurfaceFormat_YUV444:
-      surface = "YUV444P";
+    case OPT_FOOTPRINT:
+      footprint_cfg.enabled = 1;
       break;
-  case 1 << cudaVideoSurfaceFormat_YUV444_16Bit:
-      surface = "YUV444P16";
+    case OPT_SIZES:
+      footprint_cfg.num_sizes = tool_parse_sizes(optarg, footprint_cfg.widths,
+                                                 footprint_cfg.heights, TOOL_MAX_LIST);
+      if (footprint_cfg.num_sizes <= 0) {
+        fprintf(stderr, "Invalid size list '%s'\n", optarg);
+        return -1;
+      }
       break;
-  case (1 << cudaVideoSurfaceFormat_NV12) + (1 << cudaVideoSurfaceFormat_P016):
-      surface = "P016, NV12";
+    case OPT_SURFACES:
+    case OPT_OUTPUTS: {
+      int *values = c == OPT_SURFACES ? footprint_cfg.surfaces : footprint_cfg.outputs;
+      int count = tool_parse_ints(optarg, values, TOOL_MAX_LIST);
+      if (count <= 0) {
+        fprintf(stderr, "Invalid surface count list '%s'\n", optarg);
+        return -1;
+      }
+      if (c == OPT_SURFACES) {
+        footprint_cfg.num_surfaces = count;
+      } else {
+        footprint_cfg.num_outputs = count;
+      }
       break;
-#if NVDECAPI_MAJOR_VERSION > 12
-  case 1 << cudaVideoSurfaceFormat_NV16:
-      surface = "NV16";
+    }
+    case OPT_REPEAT:
+      footprint_cfg.repeat = atoi(optarg);
       break;
-  case 1 << cudaVideoSurfaceFormat_P216:
-      surface = "P216";
+    case TOOL_OPT_TIMINGS:
+      trace.timings = 1;
       break;
-  case (1 << cudaVideoSurfaceFormat_NV16) + (1 << cudaVideoSurfaceFormat_P216):
-      surface = "P216, NV16";
+    case TOOL_OPT_TRACE:
+      trace.trace_path = optarg;
       break;
-#endif
-  default:
-      surface = "Unknown";
+    case TOOL_OPT_VERIFY:
+      opts.flags |= NVVI_PROBE_VERIFY;
       break;
+    case TOOL_OPT_TIMEOUT:
+      opts.timeout_ms = atoi(optarg);
+      if (opts.timeout_ms <= 0) {
+        fprintf(stderr, "Invalid timeout '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case TOOL_OPT_SYSFS_ROOT:
+      opts.sysfs_root = optarg;
+      break;
+    case TOOL_OPT_DIFF:
+      diff_path = optarg;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
   }
 
-  printf("%5s | %6s | %5d | %9d | %10d | %9d | %10d | %8d | %15s\n",
-         codec, format, bit_depth, caps.nMinWidth, caps.nMinHeight,
-         caps.nMaxWidth, caps.nMaxHeight, caps.nMaxMBCount, surface);
-
-  return 0;
-}
-
-int main(int argc, char *argv[])
-{
-  CUcontext cuda_ctx;
-  CUcontext dummy;
-  int ret;
+  if (diff_path && optind < argc) {
+    return tool_diff_files(diff_path, argv[optind]);
+  }
 
-  ret = cuda_load_functions(&cu, NULL);
-  if (ret != 0) {
-    fprintf(stderr, "Failed to load CUDA functions.\n");
+  if (tool_trace_start(&trace) != 0) {
     return -1;
   }
-  ret = cuvid_load_functions(&cv, NULL);
+
+  ret = nvvi_probe_ex(&snap, &opts);
   if (ret != 0) {
-    fprintf(stderr, "Failed to load NVDEC functions.\n");
+    tool_trace_finish(&trace);
     return -1;
   }
 
-  if (!cv->cuvidGetDecoderCaps) {
-    fprintf(stderr,
-            "The current nvidia driver is too old to perform a capability check.\n"
-            "The minimum required driver version is %s\n",
-#if defined(_WIN32) || defined(__CYGWIN__)
-            "378.66");
-#else
-            "378.13");
-#endif
-    return -1;
+  /* Traced together with the probe, as the sweep is all driver calls */
+  if (bench_cfg.max_sessions || footprint_cfg.enabled) {
+    if (footprint_cfg.enabled) {
+      ret = footprint(&snap, &footprint_cfg, bench_cfg.device);
+    } else {
+      ret = bench(&snap, &bench_cfg);
+    }
+    tool_trace_finish(&trace);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
   }
+  tool_trace_finish(&trace);
 
-  CHECK_CU(cu->cuInit(0));
-  int count;
-  CHECK_CU(cu->cuDeviceGetCount(&count));
-
-  for (int i = 0; i < count; i++) {
-    CUdevice dev;
-    CHECK_CU(cu->cuDeviceGet(&dev, i));
-
-    char name[255];
-    CHECK_CU(cu->cuDeviceGetName(name, 255, dev));
-    printf("Device %d: %s\n", i, name);
-    printf("-----------------------------------------------------------------------------------------------------\n");
-
-    CHECK_CU(cu->cuCtxCreate(&cuda_ctx, CU_CTX_SCHED_BLOCKING_SYNC, dev));
-    printf("Codec | Chroma | Depth | Min Width | Min Height | Max Width | Max Height |  Max MBs | Surface Formats\n");
-    printf("-----------------------------------------------------------------------------------------------------\n");
-    for (int c = 0; c < cudaVideoCodec_NumCodecs; c++) {
-      for (int f = 0; f < 4; f++) {
-        for (int b = 8; b < 14; b += 2) {
-          get_caps(c, f, b);
-        }
-      }
+  if (diff_path) {
+    ret = tool_diff(diff_path, &snap);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (record_path) {
+    ret = tool_record_snapshot(&snap, record_path);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  for (int i = 0; i < snap.num_devices; i++) {
+    const nvvi_device *device = &snap.devices[i];
+
+    tool_print_device(device);
+    if (tool_print_probe_status(device) != 0) {
+      ret = -1;
+      continue;
+    }
+    if (tool_print_decode(device) != 0) {
+      ret = -1;
     }
-    printf("-----------------------------------------------------------------------------------------------------\n\n");
-    cu->cuCtxPopCurrent(&dummy);
   }
 
-  return 0;
+  nvvi_snapshot_free(&snap);
+  nvvi_unload();
+
+  return ret;
 }
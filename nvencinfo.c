@@ -17,681 +17,870 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/param.h>
-
-#include <ffnvcodec/dynlink_loader.h>
-
-static CudaFunctions *cu;
-static NvencFunctions *nv;
-static NV_ENCODE_API_FUNCTION_LIST nv_funcs;
-
-static int check_cu(CUresult err, const char *func)
-{
-  const char *err_name;
-  const char *err_string;
-
-  if (err == CUDA_SUCCESS) {
-    return 0;
-  }
-
-  cu->cuGetErrorName(err, &err_name);
-  cu->cuGetErrorString(err, &err_string);
-
-  fprintf(stderr, "%s failed", func);
-  if (err_name && err_string) {
-    fprintf(stderr, " -> %s: %s", err_name, err_string);
-  }
-  fprintf(stderr, "\n");
-
-  return -1;
-}
-
-#define CHECK_CU(x) { int ret = check_cu((x), #x); if (ret != 0) { return ret; } }
-
-static const struct {
-    NVENCSTATUS nverr;
-    int         averr;
-    const char *desc;
-} nvenc_errors[] = {
-    { NV_ENC_SUCCESS,                       0, "success"                  },
-    { NV_ENC_ERR_NO_ENCODE_DEVICE,         -1, "no encode device"         },
-    { NV_ENC_ERR_UNSUPPORTED_DEVICE,       -1, "unsupported device"       },
-    { NV_ENC_ERR_INVALID_ENCODERDEVICE,    -1, "invalid encoder device"   },
-    { NV_ENC_ERR_INVALID_DEVICE,           -1, "invalid device"           },
-    { NV_ENC_ERR_DEVICE_NOT_EXIST,         -1, "device does not exist"    },
-    { NV_ENC_ERR_INVALID_PTR,              -1, "invalid ptr"              },
-    { NV_ENC_ERR_INVALID_EVENT,            -1, "invalid event"            },
-    { NV_ENC_ERR_INVALID_PARAM,            -1, "invalid param"            },
-    { NV_ENC_ERR_INVALID_CALL,             -1, "invalid call"             },
-    { NV_ENC_ERR_OUT_OF_MEMORY,            -1, "out of memory"            },
-    { NV_ENC_ERR_ENCODER_NOT_INITIALIZED,  -1, "encoder not initialized"  },
-    { NV_ENC_ERR_UNSUPPORTED_PARAM,        -1, "unsupported param"        },
-    { NV_ENC_ERR_LOCK_BUSY,                -1, "lock busy"                },
-    { NV_ENC_ERR_NOT_ENOUGH_BUFFER,        -1, "not enough buffer"        },
-    { NV_ENC_ERR_INVALID_VERSION,          -1, "invalid version"          },
-    { NV_ENC_ERR_MAP_FAILED,               -1, "map failed"               },
-    { NV_ENC_ERR_NEED_MORE_INPUT,          -1, "need more input"          },
-    { NV_ENC_ERR_ENCODER_BUSY,             -1, "encoder busy"             },
-    { NV_ENC_ERR_EVENT_NOT_REGISTERD,      -1, "event not registered"     },
-    { NV_ENC_ERR_GENERIC,                  -1, "generic error"            },
-    { NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY,  -1, "incompatible client key"  },
-    { NV_ENC_ERR_UNIMPLEMENTED,            -1, "unimplemented"            },
-    { NV_ENC_ERR_RESOURCE_REGISTER_FAILED, -1, "resource register failed" },
-    { NV_ENC_ERR_RESOURCE_NOT_REGISTERED,  -1, "resource not registered"  },
-    { NV_ENC_ERR_RESOURCE_NOT_MAPPED,      -1, "resource not mapped"      },
-#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 0)
-    { NV_ENC_ERR_NEED_MORE_OUTPUT,         -1, "need more output"         },
-#endif
+#include <strings.h>
+#include <time.h>
+
+#include "nvvideoinfo.h"
+#include "nvvi_tool.h"
+
+enum {
+  OPT_CODEC = TOOL_OPT_FIRST_LOCAL,
+  OPT_PRESET,
+  OPT_FRAMES,
+  OPT_SIZE,
+  OPT_PRESET_CONFIG,
+  OPT_LATENCY,
+  OPT_FPS,
+  OPT_FOOTPRINT,
+  OPT_SIZES,
+  OPT_BFRAMES,
+  OPT_LOOKAHEAD,
+  OPT_REPEAT,
+  OPT_TRANSCODE,
+  OPT_SOURCE,
 };
 
-#define FF_ARRAY_ELEMS(a) (sizeof(a) / sizeof((a)[0]))
-static int nvenc_map_error(NVENCSTATUS err, const char **desc)
-{
-    int i;
-    for (i = 0; i < FF_ARRAY_ELEMS(nvenc_errors); i++) {
-        if (nvenc_errors[i].nverr == err) {
-            if (desc)
-                *desc = nvenc_errors[i].desc;
-            return nvenc_errors[i].averr;
-        }
-    }
-    if (desc)
-        *desc = "unknown error";
-    return -1;
-}
-
-static int check_nv(NVENCSTATUS err, const char *func)
-{
-  const char *err_string;
-
-  if (err == NV_ENC_SUCCESS) {
-    return 0;
-  }
-
-  nvenc_map_error(err, &err_string);
-
-  fprintf(stderr, "%s failed", func);
-  if (err_string) {
-    fprintf(stderr, " -> %s", err_string);
-  }
-  fprintf(stderr, "\n");
-
-  return -1;
-}
-
-#define CHECK_NV(x) { int ret = check_nv((x), #x); if (ret != 0) { return ret; } }
-
 typedef struct {
-  NV_ENC_CAPS cap;
-  const char *desc;
-} cap_t;
-
-
-static const cap_t nvenc_limits[] = {
-  { NV_ENC_CAPS_WIDTH_MAX,                      "Maximum Width" },
-  { NV_ENC_CAPS_HEIGHT_MAX,                     "Maximum Hight" },
-  { NV_ENC_CAPS_MB_NUM_MAX,                     "Maximum Macroblocks/frame" },
-  { NV_ENC_CAPS_MB_PER_SEC_MAX,                 "Maximum Macroblocks/second" },
-  { NV_ENC_CAPS_LEVEL_MAX,                      "Max Encoding Level" },
-  { NV_ENC_CAPS_LEVEL_MIN,                      "Min Encoding Level" },
-  { NV_ENC_CAPS_NUM_MAX_BFRAMES,                "Max No. of B-Frames" },
-  { NV_ENC_CAPS_NUM_MAX_LTR_FRAMES,             "Maxmimum LT Reference Frames" },
-  { NV_ENC_CAPS_WIDTH_MIN,                      "Minimum Width" },
-  { NV_ENC_CAPS_HEIGHT_MIN,                     "Minimum Hight" },
-#if NVENCAPI_MAJOR_VERSION > 10
-  { NV_ENC_CAPS_NUM_ENCODER_ENGINES,            "Number of Encoder Engines" },
-#endif
-#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
-  { NV_ENC_CAPS_SUPPORT_LOOKAHEAD_LEVEL,        "Maximum Lookahead Level"}
-#endif
-};
-
-static const cap_t nvenc_caps[] = {
-  { NV_ENC_CAPS_SUPPORTED_RATECONTROL_MODES,    "Supported Rate-Control Modes" },
-  { NV_ENC_CAPS_SUPPORT_FIELD_ENCODING,         "Supports Field-Encoding" },
-  { NV_ENC_CAPS_SUPPORT_MONOCHROME,             "Supports Monochrome" },
-  { NV_ENC_CAPS_SUPPORT_FMO,                    "Supports FMO" },
-  { NV_ENC_CAPS_SUPPORT_QPELMV,                 "Supports QPEL Motion Estimation" },
-  { NV_ENC_CAPS_SUPPORT_BDIRECT_MODE,           "Supports BDirect Mode" },
-  { NV_ENC_CAPS_SUPPORT_CABAC,                  "Supports CABAC" },
-  { NV_ENC_CAPS_SUPPORT_ADAPTIVE_TRANSFORM,     "Supports Adaptive Transform" },
-  { NV_ENC_CAPS_SUPPORT_STEREO_MVC,             "Supports Stereo Multi-View Coding" },
-  { NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS,        "Supports Temporal Layers" },
-  { NV_ENC_CAPS_SUPPORT_HIERARCHICAL_PFRAMES,   "Supports Hierarchical P-Frames" },
-  { NV_ENC_CAPS_SUPPORT_HIERARCHICAL_BFRAMES,   "Supports Hierarchical B-Frames" },
-  { NV_ENC_CAPS_SEPARATE_COLOUR_PLANE,          "Supports Separate Colour Planes" },
-  { NV_ENC_CAPS_SUPPORT_TEMPORAL_SVC,           "Supports Temporal SVC" },
-  { NV_ENC_CAPS_SUPPORT_DYN_RES_CHANGE,         "Supports Dynamic Resolution Change" },
-  { NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE,     "Supports Dynamic Bitrate Change" },
-  { NV_ENC_CAPS_SUPPORT_DYN_FORCE_CONSTQP,      "Supports Dynamic Force Const-QP" },
-  { NV_ENC_CAPS_SUPPORT_DYN_RCMODE_CHANGE,      "Supports Dynamic RC-Mode Change" },
-  { NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK,      "Supports Sub-Frame Read-back" },
-  { NV_ENC_CAPS_SUPPORT_CONSTRAINED_ENCODING,   "Supports Constrained Encoding" },
-  { NV_ENC_CAPS_SUPPORT_INTRA_REFRESH,          "Supports Intra Refresh" },
-  { NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE,    "Supports Custom VBV Buffer Size" },
-  { NV_ENC_CAPS_SUPPORT_DYNAMIC_SLICE_MODE,     "Supports Dynamic Slice Mode" },
-  { NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION,   "Supports Ref Pic Invalidation" },
-  { NV_ENC_CAPS_PREPROC_SUPPORT,                "Supports PreProcessing" },
-  { NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT,           "Supports Async Encoding" },
-  { NV_ENC_CAPS_SUPPORT_YUV444_ENCODE,          "Supports YUV444 Encoding" },
-  { NV_ENC_CAPS_SUPPORT_LOSSLESS_ENCODE,        "Supports Lossless Encoding" },
-  { NV_ENC_CAPS_SUPPORT_SAO,                    "Supports SAO" },
-  { NV_ENC_CAPS_SUPPORT_MEONLY_MODE,            "Supports ME-Only Mode" },
-  { NV_ENC_CAPS_SUPPORT_LOOKAHEAD,              "Supports Lookahead Encoding" },
-  { NV_ENC_CAPS_SUPPORT_TEMPORAL_AQ,            "Supports Temporal AQ" },
-  { NV_ENC_CAPS_SUPPORT_10BIT_ENCODE,           "Supports 10-bit Encoding" },
-  { NV_ENC_CAPS_SUPPORT_WEIGHTED_PREDICTION,    "Supports Weighted Prediction" },
-#if 0
-  /* This isn't really a capability. It's a runtime measurement. */
-  { NV_ENC_CAPS_DYNAMIC_QUERY_ENCODER_CAPACITY, "Remaining Encoder Capacity" },
-#endif
-  { NV_ENC_CAPS_SUPPORT_BFRAME_REF_MODE,        "Supports B-Frames as References" },
-  { NV_ENC_CAPS_SUPPORT_EMPHASIS_LEVEL_MAP,     "Supports Emphasis Level Map" },
-  { NV_ENC_CAPS_SUPPORT_MULTIPLE_REF_FRAMES,    "Supports Multiple Reference Frames" },
-#if NVENCAPI_MAJOR_VERSION > 11 || (NVENCAPI_MAJOR_VERSION == 11 && NVENCAPI_MINOR_VERSION > 0)
-  { NV_ENC_CAPS_SUPPORT_ALPHA_LAYER_ENCODING,   "Supports Alpha Layer Encoding" },
-  { NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH,     "Supports Single Slice Intra Refresh" },
-#endif
-#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 0)
-  { NV_ENC_CAPS_DISABLE_ENC_STATE_ADVANCE,      "Supports encoding without advancing" },
-  { NV_ENC_CAPS_OUTPUT_RECON_SURFACE,           "Supports reconstructed output" },
-  { NV_ENC_CAPS_OUTPUT_BLOCK_STATS,             "Supports per-block output stats" },
-  { NV_ENC_CAPS_OUTPUT_ROW_STATS,               "Supports per-row output stats" },
-#endif
-#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
-  { NV_ENC_CAPS_SUPPORT_TEMPORAL_FILTER,        "Supports Temporal Filtering" },
-  { NV_ENC_CAPS_SUPPORT_UNIDIRECTIONAL_B,       "Supports Unidirectional B Frames "},
-#endif
-#if NVENCAPI_MAJOR_VERSION > 12
-  { NV_ENC_CAPS_SUPPORT_MVHEVC_ENCODE,          "Supports Multi-View HEVC Encoding" },
-  { NV_ENC_CAPS_SUPPORT_YUV422_ENCODE,          "Supports YUV422 Encoding" },
-#endif
-};
-
-static const struct {
-  NV_ENC_BUFFER_FORMAT fmt;
-  const char *desc;
-} nvenc_formats[] = {
-  { NV_ENC_BUFFER_FORMAT_NV12,         "NV12" },
-  { NV_ENC_BUFFER_FORMAT_YV12,         "YV12" },
-  { NV_ENC_BUFFER_FORMAT_IYUV,         "IYUV" },
-  { NV_ENC_BUFFER_FORMAT_YUV444,       "YUV444" },
-  { NV_ENC_BUFFER_FORMAT_YUV420_10BIT, "P010" },
-  { NV_ENC_BUFFER_FORMAT_YUV444_10BIT, "YUV444P10" },
-  { NV_ENC_BUFFER_FORMAT_ARGB,         "ARGB" },
-  { NV_ENC_BUFFER_FORMAT_ARGB10,       "ARGB10" },
-  { NV_ENC_BUFFER_FORMAT_AYUV,         "AYUV" },
-  { NV_ENC_BUFFER_FORMAT_ABGR,         "ABGR" },
-  { NV_ENC_BUFFER_FORMAT_ABGR10,       "ABGR10" },
-  { NV_ENC_BUFFER_FORMAT_U8,           "U8" },
-#if NVENCAPI_MAJOR_VERSION > 12
-  { NV_ENC_BUFFER_FORMAT_NV16,         "NV16" },
-  { NV_ENC_BUFFER_FORMAT_P210,         "P210" },
-#endif
-};
-
-static const struct {
-  const GUID *guid;
-  const char *desc;
-} nvenc_profiles[] = {
-  { &NV_ENC_CODEC_PROFILE_AUTOSELECT_GUID,        "Auto" },
-  { &NV_ENC_H264_PROFILE_BASELINE_GUID,           "Baseline" },
-  { &NV_ENC_H264_PROFILE_MAIN_GUID,               "Main" },
-  { &NV_ENC_H264_PROFILE_HIGH_GUID,               "High" },
-#if NVENCAPI_MAJOR_VERSION > 12
-  { &NV_ENC_H264_PROFILE_HIGH_10_GUID,            "High10" },
-  { &NV_ENC_H264_PROFILE_HIGH_422_GUID,           "High422" },
-#endif
-  { &NV_ENC_H264_PROFILE_HIGH_444_GUID,           "High444" },
-  { &NV_ENC_H264_PROFILE_STEREO_GUID,             "MVC" },
-  { &NV_ENC_H264_PROFILE_PROGRESSIVE_HIGH_GUID,   "Progressive High" },
-  { &NV_ENC_H264_PROFILE_CONSTRAINED_HIGH_GUID,   "Constrained High" },
-  { &NV_ENC_HEVC_PROFILE_MAIN_GUID,               "Main" },
-  { &NV_ENC_HEVC_PROFILE_MAIN10_GUID,             "Main10" },
-  { &NV_ENC_HEVC_PROFILE_FREXT_GUID,              "Main444" },
-#if NVENCAPI_MAJOR_VERSION > 11
-  { &NV_ENC_AV1_PROFILE_MAIN_GUID,                "Main" },
-#endif
-};
-
-
-#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION >= 1)
-// =========================================================================================
-// *   Preset GUIDS supported by the NvEncodeAPI interface.
-// =========================================================================================
-// {B2DFB705-4EBD-4C49-9B5F-24A777D3E587}
-static const GUID NV_ENC_PRESET_DEFAULT_GUID =
-{ 0xb2dfb705, 0x4ebd, 0x4c49, { 0x9b, 0x5f, 0x24, 0xa7, 0x77, 0xd3, 0xe5, 0x87 } };
-
-// {60E4C59F-E846-4484-A56D-CD45BE9FDDF6}
-static const GUID NV_ENC_PRESET_HP_GUID =
-{ 0x60e4c59f, 0xe846, 0x4484, { 0xa5, 0x6d, 0xcd, 0x45, 0xbe, 0x9f, 0xdd, 0xf6 } };
-
-// {34DBA71D-A77B-4B8F-9C3E-B6D5DA24C012}
-static const GUID NV_ENC_PRESET_HQ_GUID =
-{ 0x34dba71d, 0xa77b, 0x4b8f, { 0x9c, 0x3e, 0xb6, 0xd5, 0xda, 0x24, 0xc0, 0x12 } };
-
-// {82E3E450-BDBB-4e40-989C-82A90DF9EF32}
-static const GUID NV_ENC_PRESET_BD_GUID  =
-{ 0x82e3e450, 0xbdbb, 0x4e40, { 0x98, 0x9c, 0x82, 0xa9, 0xd, 0xf9, 0xef, 0x32 } };
-
-// {49DF21C5-6DFA-4feb-9787-6ACC9EFFB726}
-static const GUID NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID  =
-{ 0x49df21c5, 0x6dfa, 0x4feb, { 0x97, 0x87, 0x6a, 0xcc, 0x9e, 0xff, 0xb7, 0x26 } };
-
-// {C5F733B9-EA97-4cf9-BEC2-BF78A74FD105}
-static const GUID NV_ENC_PRESET_LOW_LATENCY_HQ_GUID  =
-{ 0xc5f733b9, 0xea97, 0x4cf9, { 0xbe, 0xc2, 0xbf, 0x78, 0xa7, 0x4f, 0xd1, 0x5 } };
-
-// {67082A44-4BAD-48FA-98EA-93056D150A58}
-static const GUID NV_ENC_PRESET_LOW_LATENCY_HP_GUID =
-{ 0x67082a44, 0x4bad, 0x48fa, { 0x98, 0xea, 0x93, 0x5, 0x6d, 0x15, 0xa, 0x58 } };
-
-// {D5BFB716-C604-44e7-9BB8-DEA5510FC3AC}
-static const GUID NV_ENC_PRESET_LOSSLESS_DEFAULT_GUID =
-{ 0xd5bfb716, 0xc604, 0x44e7, { 0x9b, 0xb8, 0xde, 0xa5, 0x51, 0xf, 0xc3, 0xac } };
-
-// {149998E7-2364-411d-82EF-179888093409}
-static const GUID NV_ENC_PRESET_LOSSLESS_HP_GUID =
-{ 0x149998e7, 0x2364, 0x411d, { 0x82, 0xef, 0x17, 0x98, 0x88, 0x9, 0x34, 0x9 } };
-#endif
-
-static const struct {
-  const GUID *guid;
-  const char *desc;
-} nvenc_presets[] = {
-  { &NV_ENC_PRESET_DEFAULT_GUID,             "default" },
-  { &NV_ENC_PRESET_HP_GUID,                  "hp"},
-  { &NV_ENC_PRESET_HQ_GUID,                  "hq"},
-  { &NV_ENC_PRESET_BD_GUID,                  "bluray"},
-  { &NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID, "ll" },
-  { &NV_ENC_PRESET_LOW_LATENCY_HQ_GUID,      "llhq" },
-  { &NV_ENC_PRESET_LOW_LATENCY_HP_GUID,      "llhp" },
-  { &NV_ENC_PRESET_LOSSLESS_DEFAULT_GUID,    "lossless" },
-  { &NV_ENC_PRESET_LOSSLESS_HP_GUID,         "losslesshp" },
-#if NVENCAPI_MAJOR_VERSION > 10
-  { &NV_ENC_PRESET_P1_GUID,                  "p1" },
-  { &NV_ENC_PRESET_P2_GUID,                  "p2" },
-  { &NV_ENC_PRESET_P3_GUID,                  "p3" },
-  { &NV_ENC_PRESET_P4_GUID,                  "p4" },
-  { &NV_ENC_PRESET_P5_GUID,                  "p5" },
-  { &NV_ENC_PRESET_P6_GUID,                  "p6" },
-  { &NV_ENC_PRESET_P7_GUID,                  "p7" },
-#endif
-};
+  int max_sessions;
+  int device;                   /* -1 for every device */
+  int codec;                    /* cudaVideoCodec, -1 for every codec */
+  const char *presets;          /* comma separated names, "all", or NULL */
+  nvvi_bench_options opts;
 
+  /* --preset-config and --latency */
+  int show_presets;
+  int latency;
+  double fps;
 
-#define NVENCAPI_CHECK_VERSION(major, minor) \
-    ((major) < NVENCAPI_MAJOR_VERSION || ((major) == NVENCAPI_MAJOR_VERSION && (minor) <= NVENCAPI_MINOR_VERSION))
+  int transcode;
+  int source;                   /* cudaVideoCodec decoded by --transcode */
+} bench_config;
 
-static void nvenc_print_driver_requirement()
+typedef struct {
+  int enabled;
+  int repeat;
+  int num_sizes;
+  unsigned int widths[TOOL_MAX_LIST];
+  unsigned int heights[TOOL_MAX_LIST];
+  int num_b_frames;
+  int b_frames[TOOL_MAX_LIST];
+  int num_lookaheads;
+  int lookaheads[TOOL_MAX_LIST];
+} footprint_config;
+
+static uint64_t now_ms(void)
 {
-#if NVENCAPI_CHECK_VERSION(9, 1)
-# if defined(_WIN32) || defined(__CYGWIN__)
-    const char *minver = "436.15";
-# else
-    const char *minver = "435.21";
-# endif
-#elif NVENCAPI_CHECK_VERSION(8, 1)
-# if defined(_WIN32) || defined(__CYGWIN__)
-    const char *minver = "390.77";
-# else
-    const char *minver = "390.25";
-# endif
-#else
-# if defined(_WIN32) || defined(__CYGWIN__)
-    const char *minver = "378.66";
-# else
-    const char *minver = "378.13";
-# endif
-#endif
-    printf("The minimum required Nvidia driver for nvenc is %s or newer\n", minver);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static int nvenc_load_libraries()
+/*
+ * Print remaining encoder capacity as CSV, one row per device and codec
+ * every interval milliseconds. Samples are scheduled on absolute deadlines
+ * so a slow poll doesn't make the series drift.
+ */
+static int sample_capacity(const nvvi_snapshot *snap, int interval, int count)
 {
-  uint32_t nvenc_max_ver;
-  int ret;
-
-  ret = cuda_load_functions(&cu, NULL);
-  if (ret < 0)
-    return ret;
-
-  ret = nvenc_load_functions(&nv, NULL);
-  if (ret < 0) {
-    nvenc_print_driver_requirement();
-    return ret;
+  int *capacity = calloc(snap->num_devices * NVVI_MAX_ENCODE_CODECS + 1, sizeof(int));
+  if (!capacity) {
+    return -1;
   }
 
-  CHECK_NV(nv->NvEncodeAPIGetMaxSupportedVersion(&nvenc_max_ver));
-
-  printf("Loaded Nvenc version %d.%d\n", nvenc_max_ver >> 4, nvenc_max_ver & 0xf);
-
-  if ((NVENCAPI_MAJOR_VERSION << 4 | NVENCAPI_MINOR_VERSION) > nvenc_max_ver) {
-    printf("Driver does not support the required nvenc API version. "
-           "Required: %d.%d Found: %d.%d\n",
-           NVENCAPI_MAJOR_VERSION, NVENCAPI_MINOR_VERSION,
-           nvenc_max_ver >> 4, nvenc_max_ver & 0xf);
-    nvenc_print_driver_requirement();
+  nvvi_sampler *sampler = nvvi_sampler_open(snap);
+  if (!sampler) {
+    free(capacity);
     return -1;
   }
 
-  nv_funcs.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  uint64_t start = (uint64_t)deadline.tv_sec * 1000 + deadline.tv_nsec / 1000000;
 
-  CHECK_NV(nv->NvEncodeAPICreateInstance(&nv_funcs));
+  printf("time_ms,device,codec,capacity\n");
+  for (int n = 0; count <= 0 || n < count; n++) {
+    uint64_t t = now_ms() - start;
+    nvvi_sampler_poll(sampler, capacity);
 
-  printf("Nvenc initialized successfully\n");
+    for (int i = 0; i < snap->num_devices; i++) {
+      const nvvi_device *device = &snap->devices[i];
+      for (int j = 0; j < device->num_encode_codecs; j++) {
+        printf("%llu,%d,%s,%d\n", (unsigned long long)t, device->index,
+               device->encode_codecs[j].name, capacity[i * NVVI_MAX_ENCODE_CODECS + j]);
+      }
+    }
+    fflush(stdout);
 
+    if (count > 0 && n == count - 1) {
+      break;
+    }
+    deadline.tv_sec += interval / 1000;
+    deadline.tv_nsec += (long)(interval % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+    }
+  }
+
+  nvvi_sampler_close(sampler);
+  free(capacity);
   return 0;
 }
 
-static int print_divider(int count) {
-  printf("-------------------------------------");
-  for (int i = 0; i < count; i++) {
-    printf("------------");
+/*
+ * Sweep one codec and preset from 1 session up, stopping at max_sessions
+ * or at the first session the driver refuses.
+ */
+static int bench_sweep(const bench_config *config, nvvi_bench_options *opts, const char *preset)
+{
+  printf("%s %s, %ux%u, %d frames per session\n",
+         nvvi_decode_codec_name(opts->codec), preset,
+         opts->width ? opts->width : 1920, opts->height ? opts->height : 1080,
+         opts->frames ? opts->frames : 300);
+  printf("Sessions |   Total fps | Session fps min/max |  p50 ms |  p95 ms |  p99 ms |  max ms\n");
+  printf("----------------------------------------------------------------------------------\n");
+
+  for (int n = 1; n <= config->max_sessions; n++) {
+    nvvi_bench_step step;
+
+    if (nvvi_bench_run(opts, n, &step) != 0) {
+      fprintf(stderr, "Benchmark failed with %d sessions\n", n);
+      return -1;
+    }
+    if (step.opened == 0) {
+      fprintf(stderr, "Could not set up an encoder: %s\n", step.error);
+      return -1;
+    }
+    if (step.opened < n) {
+      printf("Session limit: %d (session %d: %s)\n", step.opened, step.opened + 1, step.error);
+      return 0;
+    }
+    printf("%8d | %11.1f | %9.1f %9.1f | %7.2f | %7.2f | %7.2f | %7.2f\n",
+           n, step.fps, step.session_fps_min, step.session_fps_max,
+           step.latency_p50_ms, step.latency_p95_ms, step.latency_p99_ms, step.latency_max_ms);
+    fflush(stdout);
   }
-  printf("\n");
+  printf("No session limit up to %d sessions\n", config->max_sessions);
+  return 0;
 }
 
-static int print_thick_divider(int count) {
-  printf("=====================================");
-  for (int i = 0; i < count; i++) {
-    printf("============");
-  }
-  printf("\n");
-}
+static int preset_selected(const char *list, const char *name)
+{
+  size_t len = strlen(name);
 
-static int print_header(const char *text, int count) {
-  printf("%s", text);
-  for (int i = 0; i < count; i++) {
-    printf("           |");
+  if (strcasecmp(list, "all") == 0) {
+    return 1;
   }
-  printf("\n");
+  for (const char *p = list; *p; p += strcspn(p, ",")) {
+    p += *p == ',';
+    if (strncasecmp(p, name, len) == 0 && (p[len] == ',' || !p[len])) {
+      return 1;
+    }
+  }
+  return 0;
 }
 
-static int print_formats(void *encoder, GUID *guids, int guid_count)
+static int bench_device(const bench_config *config, const nvvi_device *device)
 {
-  NV_ENC_BUFFER_FORMAT *formats_for_guid = calloc(guid_count, sizeof(NV_ENC_BUFFER_FORMAT));
-  if (!formats_for_guid) {
-    return -1;
-  }
+  int ret = 0;
 
-  for (int i = 0; i < guid_count; i++) {
-    uint32_t count = 0;
-    CHECK_NV(nv_funcs.nvEncGetInputFormatCount(encoder, guids[i], &count));
+  for (int i = 0; i < device->num_encode_codecs; i++) {
+    const nvvi_encode_codec *codec = &device->encode_codecs[i];
+    nvvi_bench_options opts = config->opts;
 
-    NV_ENC_BUFFER_FORMAT *formats = malloc(count * sizeof(NV_ENC_BUFFER_FORMAT));
-    if (!formats) {
-      return -1;
+    opts.device = device->index;
+    opts.codec = nvvi_decode_codec_from_name(codec->name);
+    if (opts.codec < 0 || (config->codec >= 0 && opts.codec != config->codec)) {
+      continue;
     }
 
-    CHECK_NV(nv_funcs.nvEncGetInputFormats(encoder, guids[i], formats, count, &count));
-    for (int j = 0; j < count; j++) {
-      formats_for_guid[i] |= formats[j];
+    if (!config->presets) {
+      ret |= bench_sweep(config, &opts, "default preset");
+      printf("\n");
+      continue;
+    }
+    for (int j = 0; j < codec->num_presets; j++) {
+      if (preset_selected(config->presets, codec->presets[j].name)) {
+        opts.preset = codec->presets[j].guid;
+        ret |= bench_sweep(config, &opts, codec->presets[j].name);
+        printf("\n");
+      }
     }
-
-    free(formats);
   }
 
-  print_header("        Input Buffer Formats        |", guid_count);
-  print_divider(guid_count);
-  for (int i = 0; i < FF_ARRAY_ELEMS(nvenc_formats); i++) {
-    printf("%35s |", nvenc_formats[i].desc);
-    for (int j = 0; j < guid_count; j++) {
-      printf("%10s |", (formats_for_guid[j] & nvenc_formats[i].fmt) ? "x" : ".");
+  return ret;
+}
+
+static int bench(const nvvi_snapshot *snap, const bench_config *config)
+{
+  int ret = 0;
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+
+    if (device->encode_status != 0 || (config->device >= 0 && device->index != config->device)) {
+      continue;
     }
-    printf("\n");
+    printf("Device %d: %s\n", device->index, device->name);
+    ret |= bench_device(config, device);
   }
-  print_divider(guid_count);
 
-  free(formats_for_guid);
-
-  return 0;
+  return ret;
 }
 
-
-static int get_profiles(void *encoder, GUID encodeGUID, const char **profiles, uint32_t *count)
+/*
+ * One row per size, B-frame count and lookahead depth, with as many input
+ * buffers as that takes to keep the encoder fed. Combinations the codec's
+ * caps rule out are left out.
+ */
+static int footprint_preset(const footprint_config *config, const nvvi_encode_codec *codec,
+                            nvvi_footprint_options *opts, const char *preset, int *header)
 {
-  GUID guids[FF_ARRAY_ELEMS(nvenc_profiles)];
-  CHECK_NV(nv_funcs.nvEncGetEncodeProfileGUIDs(encoder, encodeGUID, guids,
-                                               FF_ARRAY_ELEMS(nvenc_profiles), count));
-
-  for (int i = 0; i < *count; i++) {
-    int matched = 0;
-    for (int j = 0; j < FF_ARRAY_ELEMS(nvenc_profiles); j++) {
-      if (memcmp(&guids[i], nvenc_profiles[j].guid, sizeof (GUID)) == 0) {
-        profiles[i] = nvenc_profiles[j].desc;
-        matched = 1;
+  for (int i = 0; i < config->num_sizes; i++) {
+    for (int j = 0; j < config->num_b_frames; j++) {
+      for (int k = 0; k < config->num_lookaheads; k++) {
+        nvvi_footprint fp;
+        char size[32];
+
+        opts->width = config->widths[i];
+        opts->height = config->heights[i];
+        opts->b_frames = config->b_frames[j];
+        opts->lookahead = config->lookaheads[k];
+        if (nvvi_encode_footprint(opts, &fp) != 0) {
+          fprintf(stderr, "Could not measure device %d\n", opts->device);
+          return -1;
+        }
+        if (fp.status == -1) {
+          continue;
+        }
+        if (!*header) {
+          tool_print_memory(&fp);
+          printf("Codec  Preset          Size  B Lookahead Buffers      MiB      Min      Max\n");
+          *header = 1;
+        }
+        snprintf(size, sizeof(size), "%ux%u", opts->width, opts->height);
+        printf("%-6s %-8s %9s %2d %9d %7d ", codec->name, preset, size, opts->b_frames,
+               opts->lookahead, opts->b_frames + opts->lookahead + 1);
+        tool_print_footprint(&fp);
       }
     }
-    if (!matched) {
-      profiles[i] = "Unknown";
-    }
   }
   return 0;
 }
 
-
-static int print_profiles(void *encoder, GUID *guids, int count)
+static int footprint(const nvvi_snapshot *snap, const bench_config *bench,
+                     const footprint_config *config)
 {
-  print_divider(count);
-  print_header("              Profiles              |", count);
-  print_divider(count);
-
-  const char *profileGuids[count][FF_ARRAY_ELEMS(nvenc_profiles)];
-  uint32_t profileCount[count];
-  uint32_t max = 0;
+  int ret = 0;
 
-  for (int i = 0; i < count; i++) {
-    get_profiles(encoder, guids[i], profileGuids[i], &profileCount[i]);
-    max = MAX(max, profileCount[i]);
-  }
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    int header = 0;
 
-  for (int i = 0; i < max; i++) {
-    printf("%35s |", "");
-    for (int j = 0; j < count; j++) {
-      if (i < profileCount[j]) {
-        printf("%10s |", profileGuids[j][i]);
-      } else {
-        printf("%10s |", "");
+    if (device->encode_status != 0 || (bench->device >= 0 && device->index != bench->device)) {
+      continue;
+    }
+    printf("Device %d: %s\n", device->index, device->name);
+    for (int j = 0; j < device->num_encode_codecs && ret == 0; j++) {
+      const nvvi_encode_codec *codec = &device->encode_codecs[j];
+      nvvi_footprint_options opts = {
+        .device = device->index,
+        .codec = nvvi_decode_codec_from_name(codec->name),
+        .repeat = config->repeat,
+      };
+
+      if (opts.codec < 0 || (bench->codec >= 0 && opts.codec != bench->codec)) {
+        continue;
+      }
+      if (!bench->presets) {
+        ret = footprint_preset(config, codec, &opts, "default", &header);
+        continue;
+      }
+      for (int k = 0; k < codec->num_presets && ret == 0; k++) {
+        if (preset_selected(bench->presets, codec->presets[k].name)) {
+          opts.preset = codec->presets[k].guid;
+          ret = footprint_preset(config, codec, &opts, codec->presets[k].name, &header);
+        }
       }
     }
     printf("\n");
   }
 
-  return 0;
+  return ret;
 }
 
+static void print_stage(const char *stage, const nvvi_percentiles *p)
+{
+  printf("%-8s %8.2f %8.2f %8.2f %8.2f", stage, p->p50_ms, p->p95_ms, p->p99_ms, p->max_ms);
+}
 
-static int get_presets(void *encoder, GUID encodeGUID, const char **presets, uint32_t *count)
+/*
+ * One block per size with both ways of handing decoded frames to the
+ * encoder, zero copy first, each with a row per stage.
+ */
+static int transcode_preset(const footprint_config *sizes, nvvi_transcode_options *opts,
+                            const char *preset)
 {
-  GUID guids[FF_ARRAY_ELEMS(nvenc_presets)];
-  CHECK_NV(nv_funcs.nvEncGetEncodePresetGUIDs(encoder, encodeGUID, guids,
-                                               FF_ARRAY_ELEMS(nvenc_presets), count));
-
-  for (int i = 0; i < *count; i++) {
-    int matched = 0;
-    for (int j = 0; j < FF_ARRAY_ELEMS(nvenc_presets); j++) {
-      if (memcmp(&guids[i], nvenc_presets[j].guid, sizeof (GUID)) == 0) {
-        presets[i] = nvenc_presets[j].desc;
-        matched = 1;
+  static const char *paths[] = { "copy", "zero-copy" };
+
+  printf("%s -> %s %s, %d frames\n", nvvi_decode_codec_name(opts->decode_codec),
+         nvvi_decode_codec_name(opts->encode_codec), preset, opts->frames ? opts->frames : 300);
+  printf("Size       Path      Stage      p50 ms   p95 ms   p99 ms   max ms\n");
+  printf("-----------------------------------------------------------------\n");
+
+  for (int i = 0; i < sizes->num_sizes; i++) {
+    char size[32];
+
+    snprintf(size, sizeof(size), "%ux%u", sizes->widths[i], sizes->heights[i]);
+    opts->width = sizes->widths[i];
+    opts->height = sizes->heights[i];
+    for (int zero_copy = 1; zero_copy >= 0; zero_copy--) {
+      nvvi_transcode_step step;
+
+      opts->zero_copy = zero_copy;
+      if (nvvi_transcode_run(opts, &step) != 0) {
+        fprintf(stderr, "Transcode failed at %s\n", size);
+        return -1;
       }
-    }
-    if (!matched) {
-      presets[i] = "Unknown";
+      printf("%-10s %-9s ", zero_copy ? size : "", paths[zero_copy]);
+      if (step.error[0]) {
+        printf("%s\n", step.error);
+        continue;
+      }
+      print_stage("decode", &step.decode);
+      printf("\n%21s", "");
+      print_stage("map", &step.map);
+      printf("\n%21s", "");
+      print_stage("encode", &step.encode);
+      printf("\n%21s", "");
+      print_stage("total", &step.total);
+      printf("  %.1f fps", step.fps);
+      if (zero_copy) {
+        printf(", %d registered", step.registered);
+      }
+      printf("\n");
+      fflush(stdout);
     }
   }
+  printf("\n");
   return 0;
 }
 
-
-static int print_presets(void *encoder, GUID *guids, int count)
+static int transcode(const nvvi_snapshot *snap, const bench_config *bench,
+                     const footprint_config *sizes)
 {
-  print_divider(count);
-  print_header("               Presets              |", count);
-  print_divider(count);
+  int ret = 0;
 
-  const char *presetGuids[count][FF_ARRAY_ELEMS(nvenc_presets)];
-  uint32_t presetCount[count];
-  uint32_t max = 0;
-
-  for (int i = 0; i < count; i++) {
-    get_presets(encoder, guids[i], presetGuids[i], &presetCount[i]);
-    max = MAX(max, presetCount[i]);
-  }
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
 
-  for (int i = 0; i < max; i++) {
-    printf("%35s |", "");
-    for (int j = 0; j < count; j++) {
-      if (i < presetCount[j]) {
-        printf("%10s |", presetGuids[j][i]);
-      } else {
-        printf("%10s |", "");
+    if (device->encode_status != 0 || (bench->device >= 0 && device->index != bench->device)) {
+      continue;
+    }
+    printf("Device %d: %s\n", device->index, device->name);
+    for (int j = 0; j < device->num_encode_codecs && ret == 0; j++) {
+      const nvvi_encode_codec *codec = &device->encode_codecs[j];
+      nvvi_transcode_options opts = {
+        .device = device->index,
+        .decode_codec = bench->source,
+        .encode_codec = nvvi_decode_codec_from_name(codec->name),
+        .frames = bench->opts.frames,
+      };
+
+      if (opts.encode_codec < 0 || (bench->codec >= 0 && opts.encode_codec != bench->codec)) {
+        continue;
+      }
+      if (!bench->presets) {
+        ret = transcode_preset(sizes, &opts, "default preset");
+        continue;
+      }
+      for (int k = 0; k < codec->num_presets && ret == 0; k++) {
+        if (preset_selected(bench->presets, codec->presets[k].name)) {
+          opts.preset = codec->presets[k].guid;
+          ret = transcode_preset(sizes, &opts, codec->presets[k].name);
+        }
       }
     }
-    printf("\n");
   }
 
-  return 0;
+  return ret;
 }
 
-
-static int get_cap(void *encoder, GUID *guid, NV_ENC_CAPS cap)
+static const char *tuning_name(int tuning)
 {
-  NV_ENC_CAPS_PARAM params = { 0 };
-
-  int val = 0;
-  params.version = NV_ENC_CAPS_PARAM_VER;
-  params.capsToQuery = cap;
-  CHECK_NV(nv_funcs.nvEncGetEncodeCaps(encoder, *guid, &params, &val));
-
-  return val;
+  static const char *names[] = { "-", "hq", "ll", "ull", "lossless", "uhq" };
+  return tuning >= 0 && tuning < (int)(sizeof(names) / sizeof(names[0])) ? names[tuning] : "?";
 }
 
-
-static int print_caps(void *encoder, GUID *guids, int count)
+static const char *rc_mode_name(int mode)
 {
-  print_header("              Limits                |", count);
-  print_divider(count);
-  for (int i = 0; i < FF_ARRAY_ELEMS(nvenc_limits); i++) {
-    printf("%35s |", nvenc_limits[i].desc);
-    for (int j = 0; j < count; j++) {
-      int ret = get_cap(encoder, &guids[j], nvenc_limits[i].cap);
-      printf("%10d |", ret);
-    }
-    printf("\n");
+  switch (mode) {
+  case 0x0:
+    return "constqp";
+  case 0x1:
+    return "vbr";
+  case 0x2:
+    return "cbr";
+  /* Only in the headers before SDK 10 */
+  case 0x8:
+    return "cbr_ll_hq";
+  case 0x10:
+    return "cbr_hq";
+  case 0x20:
+    return "vbr_hq";
+  default:
+    return "?";
   }
+}
 
-  print_divider(count);
-  print_header("            Capabilities            |", count);
-  print_divider(count);
-  for (int i = 0; i < FF_ARRAY_ELEMS(nvenc_caps); i++) {
-    printf("%35s |", nvenc_caps[i].desc);
-    for (int j = 0; j < count; j++) {
-      int ret = get_cap(encoder, &guids[j], nvenc_caps[i].cap);
-      printf("%10d |", ret);
-    }
-    printf("\n");
+static void format_bitrate(char *buf, size_t len, uint32_t rate)
+{
+  if (rate) {
+    snprintf(buf, len, "%.1fM", rate / 1e6);
+  } else {
+    snprintf(buf, len, "-");
   }
-
-  return 0;
 }
 
-
-static int print_codecs(void *encoder)
+static void print_preset_config(const nvvi_preset_config *c)
 {
-  uint32_t count = 0;
-  CHECK_NV(nv_funcs.nvEncGetEncodeGUIDCount(encoder, &count));
-
-  GUID *guids = malloc(count * sizeof(GUID));
-  if (!guids) {
-    return -1;
+  static const char *multipass[] = { "off", "quarter", "full" };
+  static const char *b_ref[] = { "off", "each", "middle" };
+  char rate[24], max_rate[16], vbv[16], gop[16], refs[16], lookahead[16], aq[16];
+
+  printf("%-10s %-8s ", c->preset_name, tuning_name(c->tuning));
+  if (c->status != 0) {
+    printf("rejected (NVENCSTATUS %d)\n", c->status);
+    return;
   }
 
-  CHECK_NV(nv_funcs.nvEncGetEncodeGUIDs(encoder, guids, count, &count));
-
-  print_thick_divider(count);
-  printf("                              Codec |");
-  for (int i = 0; i < count; i++) {
-    if (memcmp(&guids[i], &NV_ENC_CODEC_H264_GUID, 16) == 0) {
-      printf("    H264   |");
-    } else if (memcmp(&guids[i], &NV_ENC_CODEC_HEVC_GUID, 16) == 0) {
-      printf("    HEVC   |");
-#if NVENCAPI_MAJOR_VERSION > 11
-    } else if (memcmp(&guids[i], &NV_ENC_CODEC_AV1_GUID, 16) == 0) {
-      printf("    AV1    |");
-#endif
-    } else {
-      printf("  Unknown  |");
-    }
+  if (c->rc_mode == 0) {
+    snprintf(rate, sizeof(rate), "qp %d/%d/%d", c->qp_intra, c->qp_inter_p, c->qp_inter_b);
+  } else {
+    format_bitrate(rate, sizeof(rate), c->average_bitrate);
+  }
+  format_bitrate(max_rate, sizeof(max_rate), c->max_bitrate);
+  format_bitrate(vbv, sizeof(vbv), c->vbv_buffer_size);
+  if (c->gop_length == 0xffffffff) {
+    snprintf(gop, sizeof(gop), "inf");
+  } else {
+    snprintf(gop, sizeof(gop), "%u", c->gop_length);
+  }
+  snprintf(refs, sizeof(refs), c->ref_frames ? "%d" : "auto", c->ref_frames);
+  snprintf(lookahead, sizeof(lookahead), c->lookahead ? "%d" : "off", c->lookahead);
+  if (!c->spatial_aq) {
+    snprintf(aq, sizeof(aq), "off");
+  } else {
+    snprintf(aq, sizeof(aq), c->aq_strength ? "%d" : "auto", c->aq_strength);
   }
-  printf("\n");
-  print_thick_divider(count);
-  CHECK_NV(print_formats(encoder, guids, count));
-  CHECK_NV(print_caps(encoder, guids, count));
-  CHECK_NV(print_profiles(encoder, guids, count));
-  CHECK_NV(print_presets(encoder, guids, count));
-  print_thick_divider(count);
-
-  free(guids);
 
-  return 0;
+  printf("%-9s %-11s %-8s %-8s %-4s %2d %-6s %-4s %-3s %-9s %-4s %-3s %s\n",
+         rc_mode_name(c->rc_mode), rate, max_rate, vbv, gop, c->b_frames,
+         c->b_ref_mode >= 0 && c->b_ref_mode < 3 ? b_ref[c->b_ref_mode] : "?", refs, lookahead,
+         c->multipass >= 0 && c->multipass < 3 ? multipass[c->multipass] : "?", aq,
+         c->temporal_aq ? "on" : "off", c->zero_reorder_delay ? "on" : "off");
 }
 
+static void print_latency(const nvvi_encode_codec *enc, const nvvi_preset_config *c,
+                          const bench_config *config)
+{
+  nvvi_rendition r = {
+    .width = config->opts.width ? config->opts.width : 1920,
+    .height = config->opts.height ? config->opts.height : 1080,
+    .fps = config->fps,
+  };
+  nvvi_latency latency;
+
+  printf("%-10s %-8s ", c->preset_name, tuning_name(c->tuning));
+  if (c->status != 0) {
+    printf("rejected (NVENCSTATUS %d)\n", c->status);
+    return;
+  }
+
+  nvvi_plan_latency(enc, c, &r, &latency);
+  printf("%7d %9d %8d %6d %9.2f %9.2f %9.2f\n", latency.reorder, latency.lookahead,
+         latency.temporal_filter, latency.frames, latency.encode_ms, latency.ms, latency.min_ms);
+}
 
-static int print_nvenc_capabilities(CUcontext cuda_ctx)
+/*
+ * Print what every preset and tuning of the selected codecs configures,
+ * or the latency that results, one table per codec so rows compare column
+ * by column.
+ */
+static int preset_configs(const nvvi_snapshot *snap, const bench_config *config)
 {
-  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
-  void *nvencoder;
+  nvvi_preset_config configs[NVVI_MAX_PRESETS * NVVI_MAX_TUNINGS];
+  int ret = 0;
 
-  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
-  params.apiVersion = NVENCAPI_VERSION;
-  params.device     = cuda_ctx;
-  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
 
-  CHECK_NV(nv_funcs.nvEncOpenEncodeSessionEx(&params, &nvencoder));
+    if (device->encode_status != 0 || (config->device >= 0 && device->index != config->device)) {
+      continue;
+    }
+    printf("Device %d: %s\n", device->index, device->name);
 
-  CHECK_NV(print_codecs(nvencoder));
+    for (int j = 0; j < device->num_encode_codecs; j++) {
+      int codec = nvvi_decode_codec_from_name(device->encode_codecs[j].name);
+      if (codec < 0 || (config->codec >= 0 && codec != config->codec)) {
+        continue;
+      }
 
-  CHECK_NV(nv_funcs.nvEncDestroyEncoder(nvencoder));
+      int count = nvvi_preset_configs(device->index, codec, configs,
+                                      NVVI_MAX_PRESETS * NVVI_MAX_TUNINGS);
+      if (count < 0) {
+        fprintf(stderr, "Could not query %s presets\n", device->encode_codecs[j].name);
+        ret = -1;
+        continue;
+      }
 
-  return 0;
+      printf("%s\n", device->encode_codecs[j].name);
+      if (config->latency) {
+        printf("Preset     Tuning   Reorder Lookahead Temporal Frames Encode ms  Total ms    Min ms\n");
+        printf("------------------------------------------------------------------------------------\n");
+      } else {
+        printf("Preset     Tuning   RC        Rate        Max rate VBV      GOP   B B ref  Refs LA  "
+               "Multipass AQ   TAQ ZRD\n");
+        printf("----------------------------------------------------------------------------------"
+               "----------------------\n");
+      }
+      for (int k = 0; k < count; k++) {
+        if (config->presets && !preset_selected(config->presets, configs[k].preset_name)) {
+          continue;
+        }
+        if (config->latency) {
+          print_latency(&device->encode_codecs[j], &configs[k], config);
+        } else {
+          print_preset_config(&configs[k]);
+        }
+      }
+      printf("\n");
+    }
+  }
+
+  return ret;
 }
 
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          TOOL_COMMON_USAGE
+          "  -s, --sample MS sample remaining encoder capacity every MS milliseconds\n"
+          "  -n, --count N   stop sampling after N samples (default: run forever)\n"
+          "  -h, --help      show this help\n"
+          "\n"
+          "Benchmark mode: encode a synthetic clip with 1, 2, ... N concurrent\n"
+          "sessions and report throughput, latency and the session limit.\n"
+          "  -b, --bench N       sweep up to N sessions\n"
+          "  -d, --device N      only benchmark device N\n"
+          "      --codec CODEC   only benchmark CODEC (h264, hevc, av1)\n"
+          "      --preset LIST   comma separated presets, e.g. p1,p4,p7, or all\n"
+          "      --frames N      frames per session (default 300)\n"
+          "      --size WxH      frame size (default 1920x1080)\n"
+          "\n"
+          "      --preset-config print what every preset and tuning configures\n"
+          "      --latency       print the latency every preset and tuning adds\n"
+          "                      at --size and --fps\n"
+          "      --fps N         frame rate for --latency (default 30)\n"
+          "                      (-d, --codec and --preset select as above)\n"
+          "\n"
+          "      --footprint     measure the device memory one session takes, from\n"
+          "                      cuMemGetInfo around session setup and its buffers\n"
+          "      --sizes LIST    frame sizes (default 1280x720,1920x1080,3840x2160)\n"
+          "      --bframes LIST  B-frame counts (default 0,3)\n"
+          "      --lookahead LIST lookahead depths (default 0,16)\n"
+          "      --repeat N      measurements per row, the median is shown (default 3)\n"
+          "                      (-d, --codec and --preset select as above)\n"
+          "\n"
+          "      --transcode     decode a synthetic stream and re-encode every frame\n"
+          "                      on the same device, handing the decoded surface to\n"
+          "                      the encoder directly and by copying it, and print\n"
+          "                      decode, map, encode and total latency per frame\n"
+          "      --source CODEC  codec of the stream: h264 (default), hevc or av1\n"
+          "                      (--sizes, --frames, -d, --codec and --preset as above)\n",
+          prog);
+}
 
 int main(int argc, char *argv[])
 {
-  CUcontext cuda_ctx;
-  CUcontext dummy;
+  nvvi_probe_options opts = {
+    .flags = NVVI_PROBE_ENCODE,
+    .threads = 1,
+  };
+  static const struct option long_opts[] = {
+    { "jobs", required_argument, NULL, 'j' },
+    { "cache", required_argument, NULL, 'c' },
+    { "record", required_argument, NULL, 'r' },
+    { "sample", required_argument, NULL, 's' },
+    { "count", required_argument,  NULL, 'n' },
+    { "bench", required_argument,  NULL, 'b' },
+    { "device", required_argument, NULL, 'd' },
+    { "codec", required_argument,  NULL, OPT_CODEC },
+    { "preset", required_argument, NULL, OPT_PRESET },
+    { "frames", required_argument, NULL, OPT_FRAMES },
+    { "size", required_argument,   NULL, OPT_SIZE },
+    { "preset-config", no_argument, NULL, OPT_PRESET_CONFIG },
+    { "latency", no_argument,      NULL, OPT_LATENCY },
+    { "fps", required_argument,    NULL, OPT_FPS },
+    { "footprint", no_argument,    NULL, OPT_FOOTPRINT },
+    { "sizes", required_argument,  NULL, OPT_SIZES },
+    { "bframes", required_argument, NULL, OPT_BFRAMES },
+    { "lookahead", required_argument, NULL, OPT_LOOKAHEAD },
+    { "repeat", required_argument, NULL, OPT_REPEAT },
+    { "transcode", no_argument,    NULL, OPT_TRANSCODE },
+    { "source", required_argument, NULL, OPT_SOURCE },
+    { "timings", no_argument,     NULL, TOOL_OPT_TIMINGS },
+    { "trace", required_argument, NULL, TOOL_OPT_TRACE },
+    { "verify", no_argument,      NULL, TOOL_OPT_VERIFY },
+    { "timeout", required_argument, NULL, TOOL_OPT_TIMEOUT },
+    { "sysfs-root", required_argument, NULL, TOOL_OPT_SYSFS_ROOT },
+    { "diff", required_argument, NULL, TOOL_OPT_DIFF },
+    { "help", no_argument,       NULL, 'h' },
+    { NULL },
+  };
+  bench_config bench_cfg = {
+    .device = -1,
+    .codec = -1,
+    .fps = 30,
+    .source = nvvi_decode_codec_from_name("h264"),
+  };
+  footprint_config footprint_cfg = {
+    .num_sizes = 3,
+    .widths = { 1280, 1920, 3840 },
+    .heights = { 720, 1080, 2160 },
+    .num_b_frames = 2,
+    .b_frames = { 0, 3 },
+    .num_lookaheads = 2,
+    .lookaheads = { 0, 16 },
+  };
+  const char *record_path = NULL;
+  const char *diff_path = NULL;
+  tool_trace trace = { 0 };
+  int sample_interval = 0;
+  int sample_count = 0;
+  nvvi_snapshot snap;
   int ret;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "j:c:r:s:n:b:d:h", long_opts, NULL)) != -1) {
+    switch (c) {
+    case 'j':
+      opts.threads = atoi(optarg);
+      break;
+    case 'c':
+      opts.cache_path = optarg;
+      break;
+    case 'r':
+      record_path = optarg;
+      opts.flags |= NVVI_PROBE_ALL;
+      break;
+    case 's':
+      sample_interval = atoi(optarg);
+      if (sample_interval <= 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'n':
+      sample_count = atoi(optarg);
+      break;
+    case 'b':
+      bench_cfg.max_sessions = atoi(optarg);
+      if (bench_cfg.max_sessions <= 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'd':
+      bench_cfg.device = atoi(optarg);
+      break;
+    case OPT_CODEC:
+      bench_cfg.codec = nvvi_decode_codec_from_name(optarg);
+      if (bench_cfg.codec < 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case OPT_PRESET:
+      bench_cfg.presets = optarg;
+      break;
+    case OPT_FRAMES:
+      bench_cfg.opts.frames = atoi(optarg);
+      break;
+    case OPT_SIZE:
+      if (sscanf(optarg, "%ux%u", &bench_cfg.opts.width, &bench_cfg.opts.height) != 2) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case OPT_PRESET_CONFIG:
+      bench_cfg.show_presets = 1;
+      break;
+    case OPT_LATENCY:
+      bench_cfg.latency = 1;
+      break;
+    case OPT_FPS:
+      bench_cfg.fps = atof(optarg);
+      if (bench_cfg.fps <= 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case OPT_FOOTPRINT:
+      footprint_cfg.enabled = 1;
+      break;
+    case OPT_SIZES:
+      footprint_cfg.num_sizes = tool_parse_sizes(optarg, footprint_cfg.widths,
+                                                 footprint_cfg.heights, TOOL_MAX_LIST);
+      if (footprint_cfg.num_sizes <= 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case OPT_BFRAMES:
+      footprint_cfg.num_b_frames = tool_parse_ints(optarg, footprint_cfg.b_frames, TOOL_MAX_LIST);
+      if (footprint_cfg.num_b_frames <= 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case OPT_LOOKAHEAD:
+      footprint_cfg.num_lookaheads = tool_parse_ints(optarg, footprint_cfg.lookaheads,
+                                                     TOOL_MAX_LIST);
+      if (footprint_cfg.num_lookaheads <= 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case OPT_REPEAT:
+      footprint_cfg.repeat = atoi(optarg);
+      break;
+    case OPT_TRANSCODE:
+      bench_cfg.transcode = 1;
+      break;
+    case OPT_SOURCE:
+      bench_cfg.source = nvvi_decode_codec_from_name(optarg);
+      if (!nvvi_decode_bench_supported(bench_cfg.source, nvvi_chroma_format_from_name("420"), 8)) {
+        fprintf(stderr, "No %s stream to transcode from, --source takes h264, hevc or av1\n",
+                optarg);
+        return -1;
+      }
+      break;
+    case TOOL_OPT_TIMINGS:
+      trace.timings = 1;
+      break;
+    case TOOL_OPT_TRACE:
+      trace.trace_path = optarg;
+      break;
+    case TOOL_OPT_VERIFY:
+      opts.flags |= NVVI_PROBE_VERIFY;
+      break;
+    case TOOL_OPT_TIMEOUT:
+      opts.timeout_ms = atoi(optarg);
+      if (opts.timeout_ms <= 0) {
+        fprintf(stderr, "Invalid timeout '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case TOOL_OPT_SYSFS_ROOT:
+      opts.sysfs_root = optarg;
+      break;
+    case TOOL_OPT_DIFF:
+      diff_path = optarg;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
 
-  ret = nvenc_load_libraries();
+  if (diff_path && optind < argc) {
+    return tool_diff_files(diff_path, argv[optind]);
+  }
+
+  if (tool_trace_start(&trace) != 0) {
+    return -1;
+  }
+
+  ret = nvvi_probe_ex(&snap, &opts);
   if (ret < 0) {
+    tool_trace_finish(&trace);
     return ret;
   }
 
-  CHECK_CU(cu->cuInit(0));
-  int count;
-  CHECK_CU(cu->cuDeviceGetCount(&count));
+  /* Traced together with the probe, as these modes are all driver calls */
+  if (bench_cfg.max_sessions || bench_cfg.show_presets || bench_cfg.latency ||
+      bench_cfg.transcode || footprint_cfg.enabled) {
+    if (bench_cfg.transcode) {
+      ret = transcode(&snap, &bench_cfg, &footprint_cfg);
+    } else if (footprint_cfg.enabled) {
+      ret = footprint(&snap, &bench_cfg, &footprint_cfg);
+    } else if (bench_cfg.max_sessions) {
+      ret = bench(&snap, &bench_cfg);
+    } else {
+      ret = preset_configs(&snap, &bench_cfg);
+    }
+    tool_trace_finish(&trace);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+  tool_trace_finish(&trace);
 
-  for (int i = 0; i < count; i++) {
-    CUdevice dev;
-    CHECK_CU(cu->cuDeviceGet(&dev, i));
+  if (diff_path) {
+    ret = tool_diff(diff_path, &snap);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (record_path) {
+    ret = tool_record_snapshot(&snap, record_path);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (sample_interval) {
+    ret = sample_capacity(&snap, sample_interval, sample_count);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  printf("Loaded Nvenc version %d.%d\n",
+         snap.nvenc_max_version >> 4, snap.nvenc_max_version & 0xf);
+  printf("Nvenc initialized successfully\n");
 
-    char name[255];
-    CHECK_CU(cu->cuDeviceGetName(name, 255, dev));
-    printf("Device %d: %s\n", i, name);
+  for (int i = 0; i < snap.num_devices; i++) {
+    const nvvi_device *device = &snap.devices[i];
 
-    CHECK_CU(cu->cuCtxCreate(&cuda_ctx, CU_CTX_SCHED_BLOCKING_SYNC, dev));
-    print_nvenc_capabilities(cuda_ctx);
+    tool_print_device(device);
+    if (tool_print_probe_status(device) != 0) {
+      ret = -1;
+    } else if (device->encode_status == 0) {
+      tool_print_encode(device);
+    } else {
+      printf("Encoder capabilities unavailable\n");
+      ret = -1;
+    }
     printf("\n");
-    cu->cuCtxPopCurrent(&dummy);
   }
 
-  nvenc_free_functions(&nv);
-  cuda_free_functions(&cu);
+  nvvi_snapshot_free(&snap);
+  nvvi_unload();
 
-  return 0;
+  return ret;
 }
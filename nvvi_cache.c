@@ -0,0 +1,392 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Persistent capability cache.
+ *
+ * The cache file is a fixed header followed by an array of records, one per
+ * device, written with the in-memory layout of this build. Readers mmap the
+ * file and use the records in place; the header carries everything needed
+ * to reject a file written by an incompatible build.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+#include "nvvi_internal.h"
+#include "nvvi_trace.h"
+
+#define NVVI_CACHE_MAGIC   "NVVICACH"
+#define NVVI_CACHE_VERSION 1
+
+#ifndef NVDECAPI_MINOR_VERSION
+#define NVDECAPI_MINOR_VERSION 0
+#endif
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  uint32_t nvenc_api_version;
+  uint32_t nvdec_api_version;
+  uint32_t num_records;
+  char driver_version[32];
+} cache_header;
+
+typedef struct {
+  uint32_t flags;               /* NVVI_PROBE_* the device was probed with */
+  uint32_t nvenc_max_version;
+  nvvi_device device;
+} cache_record;
+
+typedef struct {
+  void *map;
+  size_t size;
+  const cache_header *header;
+  const cache_record *records;
+} cache_file;
+
+
+static uint32_t nvdec_api_version(void)
+{
+  return NVDECAPI_MAJOR_VERSION << 16 | NVDECAPI_MINOR_VERSION;
+}
+
+
+static int cache_open(cache_file *cache, const char *path)
+{
+  struct stat st;
+
+  memset(cache, 0, sizeof(*cache));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(cache_header)) {
+    close(fd);
+    return -1;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  const cache_header *header = map;
+  if (memcmp(header->magic, NVVI_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != NVVI_CACHE_VERSION ||
+      header->header_size != sizeof(cache_header) ||
+      header->record_size != sizeof(cache_record) ||
+      header->nvenc_api_version != NVENCAPI_VERSION ||
+      header->nvdec_api_version != nvdec_api_version() ||
+      st.st_size != sizeof(cache_header) + (size_t)header->num_records * sizeof(cache_record)) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+
+  cache->map = map;
+  cache->size = st.st_size;
+  cache->header = header;
+  cache->records = (const cache_record *)(header + 1);
+
+  return 0;
+}
+
+
+static void cache_close(cache_file *cache)
+{
+  if (cache->map) {
+    munmap(cache->map, cache->size);
+  }
+  memset(cache, 0, sizeof(*cache));
+}
+
+
+static const cache_record *cache_find(const cache_file *cache, const char *driver_version,
+                                      const char *uuid, const char *pci_bus_id,
+                                      unsigned int flags)
+{
+  if (!cache->header || !uuid[0] || !pci_bus_id[0] ||
+      strcmp(cache->header->driver_version, driver_version) != 0) {
+    return NULL;
+  }
+
+  for (int i = 0; i < cache->header->num_records; i++) {
+    const cache_record *record = &cache->records[i];
+    if ((record->flags & flags) == flags &&
+        strcasecmp(record->device.uuid, uuid) == 0 &&
+        strcasecmp(record->device.pci_bus_id, pci_bus_id) == 0) {
+      return record;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Answer the whole snapshot from the cache if every GPU the kernel driver
+ * knows about has a matching record. This path never touches CUDA.
+ */
+static int cache_lookup_all(const cache_file *cache, nvvi_snapshot *snap, unsigned int flags)
+{
+  nvvi_host_gpu gpus[NVVI_MAX_HOST_GPUS];
+  char driver_version[32];
+
+  if (!cache->header ||
+      nvvi_read_driver_version(driver_version, sizeof(driver_version)) != 0) {
+    return -1;
+  }
+
+  /*
+   * procfs lists every GPU, but these change which devices CUDA exposes and
+   * in what order, so only CUDA itself can map ordinals to GPUs.
+   */
+  if (getenv("CUDA_VISIBLE_DEVICES") || getenv("CUDA_DEVICE_ORDER")) {
+    return -1;
+  }
+
+  int count = nvvi_read_host_gpus(gpus, NVVI_MAX_HOST_GPUS);
+  if (count <= 0) {
+    return -1;
+  }
+
+  const cache_record *found[NVVI_MAX_HOST_GPUS];
+  for (int i = 0; i < count; i++) {
+    found[i] = cache_find(cache, driver_version, gpus[i].uuid, gpus[i].pci_bus_id, flags);
+    if (!found[i] || found[i]->device.index < 0 || found[i]->device.index >= count) {
+      return -1;
+    }
+  }
+
+  nvvi_device *devices = calloc(count, sizeof(nvvi_device));
+  if (!devices) {
+    return -1;
+  }
+
+  /* Records keep the CUDA ordinal they were probed at. */
+  for (int i = 0; i < count; i++) {
+    nvvi_device *device = &devices[found[i]->device.index];
+    if (device->name[0]) {
+      free(devices);
+      return -1;
+    }
+    *device = found[i]->device;
+  }
+
+  memset(snap, 0, sizeof(*snap));
+  snap->flags = flags;
+  snap->nvenc_max_version = found[0]->nvenc_max_version;
+  snprintf(snap->driver_version, sizeof(snap->driver_version), "%s", driver_version);
+  snap->num_devices = count;
+  snap->devices = devices;
+
+  return 0;
+}
+
+
+static int reuse_record(nvvi_device *device, const nvvi_snapshot *snap, void *opaque)
+{
+  const cache_file *cache = opaque;
+
+  const cache_record *record = cache_find(cache, snap->driver_version, device->uuid,
+                                          device->pci_bus_id, snap->flags);
+  if (!record) {
+    return 0;
+  }
+
+  int index = device->index;
+  *device = record->device;
+  device->index = index;
+
+  return 1;
+}
+
+
+/* Copy the halves of a device named by flags, NVVI_PROBE_*, from src */
+static void merge_device(nvvi_device *dst, const nvvi_device *src, unsigned int flags)
+{
+  if (flags & NVVI_PROBE_DECODE) {
+    dst->decode_status = src->decode_status;
+    dst->num_decode_caps = src->num_decode_caps;
+    memcpy(dst->decode_caps, src->decode_caps, sizeof(dst->decode_caps));
+  }
+  if (flags & NVVI_PROBE_ENCODE) {
+    dst->encode_status = src->encode_status;
+    dst->num_encode_codecs = src->num_encode_codecs;
+    memcpy(dst->encode_codecs, src->encode_codecs, sizeof(dst->encode_codecs));
+  }
+}
+
+
+static int snapshot_has(const nvvi_snapshot *snap, const nvvi_device *device)
+{
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *d = &snap->devices[i];
+    if (d->uuid[0] && d->pci_bus_id[0] &&
+        strcasecmp(d->uuid, device->uuid) == 0 &&
+        strcasecmp(d->pci_bus_id, device->pci_bus_id) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+ * Rewrite the cache with the snapshot merged into what old already holds
+ * for the same driver: GPUs not probed this time keep their records, and
+ * a GPU probed for only one half keeps the other half from its record, so
+ * nvdecinfo and nvencinfo can share one file.
+ */
+static int cache_store(const char *path, const nvvi_snapshot *snap, const cache_file *old)
+{
+  cache_header header = { 0 };
+  char tmp[4096];
+  int keep_old = old->header &&
+                 strcmp(old->header->driver_version, snap->driver_version) == 0;
+
+  memcpy(header.magic, NVVI_CACHE_MAGIC, sizeof(header.magic));
+  header.version = NVVI_CACHE_VERSION;
+  header.header_size = sizeof(cache_header);
+  header.record_size = sizeof(cache_record);
+  header.nvenc_api_version = NVENCAPI_VERSION;
+  header.nvdec_api_version = nvdec_api_version();
+  snprintf(header.driver_version, sizeof(header.driver_version), "%s", snap->driver_version);
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    if (device->uuid[0] && device->pci_bus_id[0]) {
+      header.num_records++;
+    }
+  }
+  for (int i = 0; keep_old && i < old->header->num_records; i++) {
+    if (!snapshot_has(snap, &old->records[i].device)) {
+      header.num_records++;
+    }
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    return -1;
+  }
+
+  int ret = fwrite(&header, sizeof(header), 1, f) == 1 ? 0 : -1;
+  for (int i = 0; i < snap->num_devices && ret == 0; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    cache_record record;
+
+    /* Devices that failed to probe are not worth remembering. */
+    if (!device->uuid[0] || !device->pci_bus_id[0]) {
+      continue;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.flags = 0;
+    if ((snap->flags & NVVI_PROBE_DECODE) && device->decode_status == 0) {
+      record.flags |= NVVI_PROBE_DECODE;
+    }
+    if ((snap->flags & NVVI_PROBE_ENCODE) && device->encode_status == 0) {
+      record.flags |= NVVI_PROBE_ENCODE;
+    }
+    record.nvenc_max_version = snap->nvenc_max_version;
+    record.device = *device;
+
+    const cache_record *prev = cache_find(old, snap->driver_version, device->uuid,
+                                          device->pci_bus_id, 0);
+    if (prev) {
+      unsigned int missing = prev->flags & ~record.flags;
+      merge_device(&record.device, &prev->device, missing);
+      if (missing & NVVI_PROBE_ENCODE) {
+        record.nvenc_max_version = prev->nvenc_max_version;
+      }
+      record.flags |= prev->flags;
+    }
+
+    if (fwrite(&record, sizeof(record), 1, f) != 1) {
+      ret = -1;
+    }
+  }
+
+  for (int i = 0; keep_old && i < old->header->num_records && ret == 0; i++) {
+    const cache_record *record = &old->records[i];
+    if (!snapshot_has(snap, &record->device) &&
+        fwrite(record, sizeof(*record), 1, f) != 1) {
+      ret = -1;
+    }
+  }
+
+  if (fclose(f) != 0) {
+    ret = -1;
+  }
+  if (ret == 0 && rename(tmp, path) != 0) {
+    ret = -1;
+  }
+  if (ret != 0) {
+    unlink(tmp);
+  }
+
+  return ret;
+}
+
+
+int nvvi_cache_probe(nvvi_snapshot *snap, const nvvi_probe_options *opts)
+{
+  cache_file cache;
+  int ret;
+
+  uint64_t start = nvvi_trace_begin();
+  cache_open(&cache, opts->cache_path);
+  ret = cache_lookup_all(&cache, snap, opts->flags);
+  nvvi_trace_end("cache lookup", -1, start);
+  if (ret == 0) {
+    cache_close(&cache);
+    return 0;
+  }
+
+  ret = nvvi_probe_devices(snap, opts, reuse_record, &cache);
+  if (ret != 0) {
+    cache_close(&cache);
+    return ret;
+  }
+
+  start = nvvi_trace_begin();
+  if (snap->driver_version[0] && cache_store(opts->cache_path, snap, &cache) != 0) {
+    fprintf(stderr, "Failed to write capability cache %s\n", opts->cache_path);
+  }
+  nvvi_trace_end("cache store", -1, start);
+  cache_close(&cache);
+
+  return 0;
+}
@@ -0,0 +1,397 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Snapshot comparison. Devices are paired by UUID where both snapshots
+ * have one and by index otherwise, decoder rows by codec, chroma format
+ * and depth, encoders by codec name and presets and profiles by GUID.
+ * Anything that takes away from what a device could do before counts as a
+ * regression: lower maximums, higher minimums, bits gone from a mask, and
+ * rows, codecs, presets and profiles that are no longer there.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+#include "nvvideoinfo.h"
+
+typedef struct {
+  nvvi_diff_fn fn;
+  void *opaque;
+  int regressions;
+  nvvi_diff_entry entry;        /* device and codec filled in as the walk goes */
+} diff_state;
+
+
+static void report(diff_state *s, int kind, int regression, const char *item,
+                   const char *from, const char *to)
+{
+  nvvi_diff_entry *e = &s->entry;
+
+  e->kind = kind;
+  e->regression = regression;
+  snprintf(e->item, sizeof(e->item), "%s", item);
+  snprintf(e->from, sizeof(e->from), "%s", from ? from : "");
+  snprintf(e->to, sizeof(e->to), "%s", to ? to : "");
+  s->regressions += regression;
+  s->fn(e, s->opaque);
+}
+
+
+/* Lower is a regression unless lower_is_better */
+static void diff_value(diff_state *s, const char *item, long long a, long long b,
+                       int lower_is_better)
+{
+  char from[32], to[32];
+
+  if (a == b) {
+    return;
+  }
+  snprintf(from, sizeof(from), "%lld", a);
+  snprintf(to, sizeof(to), "%lld", b);
+  report(s, NVVI_DIFF_CHANGED, lower_is_better ? b > a : b < a, item, from, to);
+}
+
+
+/*
+ * Bits gone from a mask are a regression, new bits an addition. Named
+ * bits are reported one entry each, as REMOVED or ADDED "item name", so
+ * a change to one format of a long list isn't lost to truncation.
+ */
+static void diff_mask(diff_state *s, const char *item, uint32_t a, uint32_t b,
+                      const char *(*name)(uint32_t))
+{
+  char from[64], to[64], bit_item[96];
+  uint32_t lost = a & ~b;
+
+  if (a == b) {
+    return;
+  }
+  if (!name) {
+    snprintf(from, sizeof(from), "0x%x", a);
+    snprintf(to, sizeof(to), "0x%x", b);
+    report(s, NVVI_DIFF_CHANGED, lost != 0, item, from, to);
+    return;
+  }
+
+  for (int i = 0; i < 32; i++) {
+    uint32_t bit = 1u << i;
+    if ((a ^ b) & bit) {
+      snprintf(bit_item, sizeof(bit_item), "%s %s", item, name(bit));
+      if (lost & bit) {
+        report(s, NVVI_DIFF_REMOVED, 1, bit_item, NULL, NULL);
+      } else {
+        report(s, NVVI_DIFF_ADDED, 0, bit_item, NULL, NULL);
+      }
+    }
+  }
+}
+
+
+static const char *surface_name(uint32_t bit)
+{
+  return nvvi_surface_formats_name(bit);
+}
+
+
+static void decode_row_name(char *buf, size_t len, const nvvi_decode_caps *caps)
+{
+  snprintf(buf, len, "decode %s %s %d-bit", nvvi_decode_codec_name(caps->codec),
+           nvvi_chroma_format_name(caps->chroma_format), caps->bit_depth);
+}
+
+
+static const nvvi_decode_caps *find_decode(const nvvi_device *device, const nvvi_decode_caps *row)
+{
+  for (int i = 0; i < device->num_decode_caps; i++) {
+    const nvvi_decode_caps *caps = &device->decode_caps[i];
+    if (caps->codec == row->codec && caps->chroma_format == row->chroma_format &&
+        caps->bit_depth == row->bit_depth) {
+      return caps;
+    }
+  }
+  return NULL;
+}
+
+
+static void diff_verify(diff_state *s, const char *item, const nvvi_verify_result *a,
+                        const nvvi_verify_result *b)
+{
+  static const char *results[] = { "untested", "pass", "fail" };
+
+  /* Only a result both sides tested says anything */
+  if (a->result == NVVI_VERIFY_UNTESTED || b->result == NVVI_VERIFY_UNTESTED ||
+      a->result == b->result) {
+    return;
+  }
+  report(s, NVVI_DIFF_CHANGED, b->result == NVVI_VERIFY_FAIL, item,
+         results[a->result], results[b->result]);
+}
+
+
+static void diff_decode(diff_state *s, const nvvi_device *a, const nvvi_device *b)
+{
+  char row[64], item[96];
+
+  s->entry.codec[0] = '\0';
+  for (int i = 0; i < a->num_decode_caps; i++) {
+    const nvvi_decode_caps *x = &a->decode_caps[i];
+    const nvvi_decode_caps *y = find_decode(b, x);
+
+    decode_row_name(row, sizeof(row), x);
+    if (!y) {
+      report(s, NVVI_DIFF_REMOVED, 1, row, NULL, NULL);
+      continue;
+    }
+
+#define DIFF_FIELD(field, lower_is_better) \
+    snprintf(item, sizeof(item), "%s " #field, row); \
+    diff_value(s, item, x->field, y->field, lower_is_better)
+
+    DIFF_FIELD(max_width, 0);
+    DIFF_FIELD(max_height, 0);
+    DIFF_FIELD(max_mb_count, 0);
+    DIFF_FIELD(min_width, 1);
+    DIFF_FIELD(min_height, 1);
+#undef DIFF_FIELD
+
+    snprintf(item, sizeof(item), "%s output format", row);
+    diff_mask(s, item, x->output_format_mask, y->output_format_mask, surface_name);
+    snprintf(item, sizeof(item), "%s verify", row);
+    diff_verify(s, item, &x->verify, &y->verify);
+  }
+
+  for (int i = 0; i < b->num_decode_caps; i++) {
+    if (!find_decode(a, &b->decode_caps[i])) {
+      decode_row_name(row, sizeof(row), &b->decode_caps[i]);
+      report(s, NVVI_DIFF_ADDED, 0, row, NULL, NULL);
+    }
+  }
+}
+
+
+static const nvvi_encode_codec *find_encode(const nvvi_device *device, const char *name)
+{
+  for (int i = 0; i < device->num_encode_codecs; i++) {
+    if (strcmp(device->encode_codecs[i].name, name) == 0) {
+      return &device->encode_codecs[i];
+    }
+  }
+  return NULL;
+}
+
+
+static int has_guid(const nvvi_named_guid *list, int count, const nvvi_guid *guid)
+{
+  for (int i = 0; i < count; i++) {
+    if (memcmp(&list[i].guid, guid, sizeof(*guid)) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static void diff_guids(diff_state *s, const char *what, const nvvi_named_guid *a, int num_a,
+                       const nvvi_named_guid *b, int num_b)
+{
+  char item[96];
+
+  for (int i = 0; i < num_a; i++) {
+    if (!has_guid(b, num_b, &a[i].guid)) {
+      snprintf(item, sizeof(item), "%s %s", what, a[i].name);
+      report(s, NVVI_DIFF_REMOVED, 1, item, NULL, NULL);
+    }
+  }
+  for (int i = 0; i < num_b; i++) {
+    if (!has_guid(a, num_a, &b[i].guid)) {
+      snprintf(item, sizeof(item), "%s %s", what, b[i].name);
+      report(s, NVVI_DIFF_ADDED, 0, item, NULL, NULL);
+    }
+  }
+}
+
+
+/* Formats this build has no name for by value, to keep them apart */
+static const char *format_name(uint32_t fmt)
+{
+  static _Thread_local char buf[16];
+  const char *name = nvvi_encode_format_name(fmt);
+
+  if (strcmp(name, "Unknown") != 0) {
+    return name;
+  }
+  snprintf(buf, sizeof(buf), "0x%x", fmt);
+  return buf;
+}
+
+
+static void diff_codec(diff_state *s, const nvvi_encode_codec *x, const nvvi_encode_codec *y)
+{
+  static const char *kinds[NVVI_VERIFY_KINDS] = { "max size", "4:4:4", "10-bit", "lossless" };
+  char item[96];
+
+  for (int i = 0; i < nvvi_num_encode_limits; i++) {
+    const nvvi_cap_desc *desc = &nvvi_encode_limits[i];
+    const char *name = desc->name;
+    int lower_is_better = strcmp(name + strlen(name) - 4, "_min") == 0;
+    diff_value(s, name, x->caps[desc->cap], y->caps[desc->cap], lower_is_better);
+  }
+  for (int i = 0; i < nvvi_num_encode_caps; i++) {
+    const nvvi_cap_desc *desc = &nvvi_encode_caps[i];
+    if (desc->cap == NV_ENC_CAPS_SUPPORTED_RATECONTROL_MODES) {
+      diff_mask(s, desc->name, x->caps[desc->cap], y->caps[desc->cap], NULL);
+    } else {
+      diff_value(s, desc->name, x->caps[desc->cap], y->caps[desc->cap], 0);
+    }
+  }
+
+  diff_mask(s, "input format", x->input_formats, y->input_formats, format_name);
+  diff_guids(s, "preset", x->presets, x->num_presets, y->presets, y->num_presets);
+  diff_guids(s, "profile", x->profiles, x->num_profiles, y->profiles, y->num_profiles);
+  for (int i = 0; i < NVVI_VERIFY_KINDS; i++) {
+    snprintf(item, sizeof(item), "verify %s", kinds[i]);
+    diff_verify(s, item, &x->verify[i], &y->verify[i]);
+  }
+}
+
+
+static void diff_encode(diff_state *s, const nvvi_device *a, const nvvi_device *b)
+{
+  for (int i = 0; i < a->num_encode_codecs; i++) {
+    const nvvi_encode_codec *x = &a->encode_codecs[i];
+    const nvvi_encode_codec *y = find_encode(b, x->name);
+
+    snprintf(s->entry.codec, sizeof(s->entry.codec), "%s", x->name);
+    if (!y) {
+      report(s, NVVI_DIFF_REMOVED, 1, "encoder", NULL, NULL);
+      continue;
+    }
+    diff_codec(s, x, y);
+  }
+
+  for (int i = 0; i < b->num_encode_codecs; i++) {
+    if (!find_encode(a, b->encode_codecs[i].name)) {
+      snprintf(s->entry.codec, sizeof(s->entry.codec), "%s", b->encode_codecs[i].name);
+      report(s, NVVI_DIFF_ADDED, 0, "encoder", NULL, NULL);
+    }
+  }
+}
+
+
+/*
+ * pair[i] is the device of b that a->devices[i] became, or -1: the one
+ * with its UUID, else the one at its index that no UUID claimed.
+ */
+static void pair_devices(const nvvi_snapshot *a, const nvvi_snapshot *b, int *pair, char *taken)
+{
+  for (int i = 0; i < a->num_devices; i++) {
+    pair[i] = -1;
+    for (int j = 0; j < b->num_devices && a->devices[i].uuid[0]; j++) {
+      if (!taken[j] && strcmp(a->devices[i].uuid, b->devices[j].uuid) == 0) {
+        pair[i] = j;
+        taken[j] = 1;
+        break;
+      }
+    }
+  }
+  for (int i = 0; i < a->num_devices; i++) {
+    for (int j = 0; j < b->num_devices && pair[i] < 0; j++) {
+      if (!taken[j] && b->devices[j].index == a->devices[i].index) {
+        pair[i] = j;
+        taken[j] = 1;
+      }
+    }
+  }
+}
+
+
+int nvvi_snapshot_diff(const nvvi_snapshot *a, const nvvi_snapshot *b,
+                       nvvi_diff_fn fn, void *opaque)
+{
+  diff_state s = { .fn = fn, .opaque = opaque };
+  unsigned int both = a->flags & b->flags;
+  char from[32], to[32];
+  int *pair = calloc(a->num_devices + 1, sizeof(*pair));
+  char *taken = calloc(b->num_devices + 1, 1);
+
+  if (!pair || !taken) {
+    free(pair);
+    free(taken);
+    return -1;
+  }
+  pair_devices(a, b, pair, taken);
+
+  s.entry.device = -1;
+  if (strcmp(a->driver_version, b->driver_version) != 0) {
+    report(&s, NVVI_DIFF_CHANGED, 0, "driver", a->driver_version, b->driver_version);
+  }
+  if (a->nvenc_max_version != b->nvenc_max_version && (both & NVVI_PROBE_ENCODE)) {
+    snprintf(from, sizeof(from), "%u.%u", a->nvenc_max_version >> 4, a->nvenc_max_version & 0xf);
+    snprintf(to, sizeof(to), "%u.%u", b->nvenc_max_version >> 4, b->nvenc_max_version & 0xf);
+    report(&s, NVVI_DIFF_CHANGED, b->nvenc_max_version < a->nvenc_max_version,
+           "nvenc version", from, to);
+  }
+
+  for (int i = 0; i < a->num_devices; i++) {
+    const nvvi_device *x = &a->devices[i];
+    const nvvi_device *y = pair[i] >= 0 ? &b->devices[pair[i]] : NULL;
+
+    s.entry.device = x->index;
+    snprintf(s.entry.name, sizeof(s.entry.name), "%s", x->name);
+    s.entry.codec[0] = '\0';
+    if (!y) {
+      report(&s, NVVI_DIFF_REMOVED, 1, "device", NULL, NULL);
+      continue;
+    }
+    if (strcmp(x->name, y->name) != 0) {
+      report(&s, NVVI_DIFF_CHANGED, 0, "name", x->name, y->name);
+    }
+    /* A half that failed to probe on one side can't be compared */
+    if ((both & NVVI_PROBE_DECODE) && x->decode_status == 0 && y->decode_status == 0) {
+      diff_decode(&s, x, y);
+    } else if ((both & NVVI_PROBE_DECODE) && x->decode_status == 0) {
+      report(&s, NVVI_DIFF_REMOVED, 1, "decode probe", NULL, NULL);
+    }
+    if ((both & NVVI_PROBE_ENCODE) && x->encode_status == 0 && y->encode_status == 0) {
+      diff_encode(&s, x, y);
+    } else if ((both & NVVI_PROBE_ENCODE) && x->encode_status == 0) {
+      s.entry.codec[0] = '\0';
+      report(&s, NVVI_DIFF_REMOVED, 1, "encode probe", NULL, NULL);
+    }
+  }
+
+  for (int i = 0; i < b->num_devices; i++) {
+    const nvvi_device *y = &b->devices[i];
+    if (!taken[i]) {
+      s.entry.device = y->index;
+      snprintf(s.entry.name, sizeof(s.entry.name), "%s", y->name);
+      s.entry.codec[0] = '\0';
+      report(&s, NVVI_DIFF_ADDED, 0, "device", NULL, NULL);
+    }
+  }
+
+  free(pair);
+  free(taken);
+  return s.regressions;
+}
@@ -0,0 +1,997 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Fleet capability index.
+ *
+ * A capability set is one device with everything that differs between
+ * otherwise identical machines cleared (index, ids, topology, probe and
+ * creation timings), together with the driver it was probed under. Sets
+ * are kept once, keyed by a hash of their contents, and every host is a
+ * list of set numbers. A query is evaluated once per set and then only
+ * counted per host.
+ *
+ * On disk, an index is a directory holding each set as a one device
+ * snapshot, sets/<hash>, and the host lists in hosts.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nvvideoinfo.h"
+
+#define FLEET_MAGIC   "nvvi-fleet"
+#define FLEET_VERSION 1
+
+#define FLEET_MAX_TERMS 32
+
+typedef struct {
+  uint64_t hash;
+  int hosts;
+  int devices;
+  nvvi_snapshot snap;           /* the one device and the driver it was probed under */
+} fleet_set;
+
+typedef struct {
+  char *name;
+  int first;                    /* into the set number pool */
+  int count;
+} fleet_host;
+
+struct nvvi_fleet {
+  fleet_set *sets;
+  int num_sets;
+  int size_sets;
+  int *set_table;               /* open addressing over sets, -1 for empty */
+  int table_size;
+
+  fleet_host *hosts;
+  int num_hosts;
+  int size_hosts;
+  int *host_table;
+  int host_table_size;
+
+  int *pool;
+  int pool_len;
+  int pool_size;
+};
+
+enum {
+  TERM_DECODE,
+  TERM_ENCODE,
+  TERM_FORMAT,
+  TERM_CAP,
+  TERM_DRIVER,
+  TERM_GPU,
+};
+
+enum {
+  OP_EQ,
+  OP_NE,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+};
+
+typedef struct {
+  int kind;
+  int group;                    /* encode terms: the encode= term they qualify, -1 for any codec */
+  int codec;                    /* cudaVideoCodec */
+  int chroma_format;            /* -1 for any */
+  int bit_depth;                /* 0 for any */
+  int cap;
+  int op;
+  int value;
+  uint32_t format;
+  char text[64];
+} fleet_term;
+
+struct nvvi_fleet_query {
+  int num_terms;
+  fleet_term terms[FLEET_MAX_TERMS];
+  int devices_op;               /* how many devices of a host must match */
+  int devices;
+};
+
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ p[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+
+/* Only what the driver reports about the device's capabilities */
+static void canonical_device(nvvi_device *dst, const nvvi_device *src)
+{
+  memset(dst, 0, sizeof(*dst));
+  memcpy(dst->name, src->name, sizeof(dst->name));
+  dst->decode_status = src->decode_status;
+  dst->encode_status = src->encode_status;
+
+  dst->num_decode_caps = src->num_decode_caps;
+  for (int i = 0; i < src->num_decode_caps; i++) {
+    dst->decode_caps[i] = src->decode_caps[i];
+    dst->decode_caps[i].verify.create_ms = 0;
+  }
+  dst->num_encode_codecs = src->num_encode_codecs;
+  for (int i = 0; i < src->num_encode_codecs; i++) {
+    dst->encode_codecs[i] = src->encode_codecs[i];
+    for (int j = 0; j < NVVI_VERIFY_KINDS; j++) {
+      dst->encode_codecs[i].verify[j].create_ms = 0;
+    }
+  }
+}
+
+
+/* The used part of a canonical set; the rest is zero */
+static uint64_t hash_set(const nvvi_snapshot *snap)
+{
+  const nvvi_device *device = &snap->devices[0];
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  hash = fnv1a(hash, snap->driver_version, sizeof(snap->driver_version));
+  hash = fnv1a(hash, &snap->nvenc_max_version, sizeof(snap->nvenc_max_version));
+  hash = fnv1a(hash, &snap->flags, sizeof(snap->flags));
+  hash = fnv1a(hash, device->name, sizeof(device->name));
+  hash = fnv1a(hash, &device->decode_status, sizeof(device->decode_status));
+  hash = fnv1a(hash, &device->encode_status, sizeof(device->encode_status));
+  hash = fnv1a(hash, device->decode_caps, device->num_decode_caps * sizeof(nvvi_decode_caps));
+  hash = fnv1a(hash, device->encode_codecs,
+               device->num_encode_codecs * sizeof(nvvi_encode_codec));
+  return hash;
+}
+
+
+static int equal_sets(const nvvi_snapshot *a, const nvvi_snapshot *b)
+{
+  const nvvi_device *x = &a->devices[0];
+  const nvvi_device *y = &b->devices[0];
+
+  return strcmp(a->driver_version, b->driver_version) == 0 &&
+         a->nvenc_max_version == b->nvenc_max_version && a->flags == b->flags &&
+         strcmp(x->name, y->name) == 0 && x->decode_status == y->decode_status &&
+         x->encode_status == y->encode_status &&
+         x->num_decode_caps == y->num_decode_caps &&
+         x->num_encode_codecs == y->num_encode_codecs &&
+         memcmp(x->decode_caps, y->decode_caps,
+                x->num_decode_caps * sizeof(nvvi_decode_caps)) == 0 &&
+         memcmp(x->encode_codecs, y->encode_codecs,
+                x->num_encode_codecs * sizeof(nvvi_encode_codec)) == 0;
+}
+
+
+static uint64_t hash_string(const char *str)
+{
+  return fnv1a(0xcbf29ce484222325ull, str, strlen(str));
+}
+
+
+/* A power of two at least twice count, filled with -1 */
+static int *new_table(int count, int *size)
+{
+  *size = 64;
+  while (*size < 2 * count) {
+    *size *= 2;
+  }
+  int *table = malloc(*size * sizeof(int));
+  if (table) {
+    memset(table, 0xff, *size * sizeof(int));
+  }
+  return table;
+}
+
+
+static int rehash_sets(nvvi_fleet *fleet)
+{
+  int size;
+  int *table = new_table(fleet->num_sets + 1, &size);
+  if (!table) {
+    return -1;
+  }
+  for (int i = 0; i < fleet->num_sets; i++) {
+    int slot = fleet->sets[i].hash & (size - 1);
+    while (table[slot] >= 0) {
+      slot = (slot + 1) & (size - 1);
+    }
+    table[slot] = i;
+  }
+  free(fleet->set_table);
+  fleet->set_table = table;
+  fleet->table_size = size;
+  return 0;
+}
+
+
+static int rehash_hosts(nvvi_fleet *fleet)
+{
+  int size;
+  int *table = new_table(fleet->num_hosts + 1, &size);
+  if (!table) {
+    return -1;
+  }
+  for (int i = 0; i < fleet->num_hosts; i++) {
+    int slot = hash_string(fleet->hosts[i].name) & (size - 1);
+    while (table[slot] >= 0) {
+      slot = (slot + 1) & (size - 1);
+    }
+    table[slot] = i;
+  }
+  free(fleet->host_table);
+  fleet->host_table = table;
+  fleet->host_table_size = size;
+  return 0;
+}
+
+
+/* The number of the set holding device under snap's driver, adding it if new */
+static int intern_set(nvvi_fleet *fleet, const nvvi_snapshot *snap, const nvvi_device *device)
+{
+  nvvi_device *canonical = malloc(sizeof(*canonical));
+  if (!canonical) {
+    return -1;
+  }
+  canonical_device(canonical, device);
+
+  nvvi_snapshot key = {
+    .flags = snap->flags,
+    .nvenc_max_version = snap->nvenc_max_version,
+    .num_devices = 1,
+    .devices = canonical,
+  };
+  memcpy(key.driver_version, snap->driver_version, sizeof(key.driver_version));
+  uint64_t hash = hash_set(&key);
+
+  int slot = hash & (fleet->table_size - 1);
+  for (; fleet->set_table[slot] >= 0; slot = (slot + 1) & (fleet->table_size - 1)) {
+    fleet_set *set = &fleet->sets[fleet->set_table[slot]];
+    if (set->hash == hash && equal_sets(&set->snap, &key)) {
+      free(canonical);
+      return fleet->set_table[slot];
+    }
+  }
+
+  if (fleet->num_sets == fleet->size_sets) {
+    int size = fleet->size_sets ? fleet->size_sets * 2 : 16;
+    fleet_set *grown = realloc(fleet->sets, size * sizeof(*grown));
+    if (!grown) {
+      free(canonical);
+      return -1;
+    }
+    fleet->sets = grown;
+    fleet->size_sets = size;
+  }
+  fleet_set *set = &fleet->sets[fleet->num_sets];
+  memset(set, 0, sizeof(*set));
+  set->hash = hash;
+  set->snap = key;
+  fleet->set_table[slot] = fleet->num_sets++;
+
+  if (2 * fleet->num_sets > fleet->table_size && rehash_sets(fleet) != 0) {
+    return -1;
+  }
+  return fleet->num_sets - 1;
+}
+
+
+static int find_host(const nvvi_fleet *fleet, const char *name, int *slot)
+{
+  *slot = hash_string(name) & (fleet->host_table_size - 1);
+  for (; fleet->host_table[*slot] >= 0; *slot = (*slot + 1) & (fleet->host_table_size - 1)) {
+    if (strcmp(fleet->hosts[fleet->host_table[*slot]].name, name) == 0) {
+      return fleet->host_table[*slot];
+    }
+  }
+  return -1;
+}
+
+
+/* A host counts once per set, however many of its devices share it */
+static void count_host(nvvi_fleet *fleet, const int *sets, int count, int delta)
+{
+  for (int i = 0; i < count; i++) {
+    fleet_set *set = &fleet->sets[sets[i]];
+    int first = 1;
+    for (int j = 0; j < i; j++) {
+      first &= sets[j] != sets[i];
+    }
+    set->devices += delta;
+    set->hosts += first ? delta : 0;
+  }
+}
+
+
+/* Add or replace host with the given set numbers */
+static int set_host(nvvi_fleet *fleet, const char *name, const int *sets, int count)
+{
+  int slot;
+  int index = find_host(fleet, name, &slot);
+  fleet_host *host;
+
+  if (fleet->pool_len + count > fleet->pool_size) {
+    int size = fleet->pool_size ? fleet->pool_size : 256;
+    while (size < fleet->pool_len + count) {
+      size *= 2;
+    }
+    int *grown = realloc(fleet->pool, size * sizeof(*grown));
+    if (!grown) {
+      return -1;
+    }
+    fleet->pool = grown;
+    fleet->pool_size = size;
+  }
+
+  if (index >= 0) {
+    /* The old list stays in the pool until the index is saved and loaded */
+    host = &fleet->hosts[index];
+    count_host(fleet, &fleet->pool[host->first], host->count, -1);
+  } else {
+    if (fleet->num_hosts == fleet->size_hosts) {
+      int size = fleet->size_hosts ? fleet->size_hosts * 2 : 64;
+      fleet_host *grown = realloc(fleet->hosts, size * sizeof(*grown));
+      if (!grown) {
+        return -1;
+      }
+      fleet->hosts = grown;
+      fleet->size_hosts = size;
+    }
+    host = &fleet->hosts[fleet->num_hosts];
+    host->name = strdup(name);
+    if (!host->name) {
+      return -1;
+    }
+    fleet->host_table[slot] = fleet->num_hosts++;
+    if (2 * fleet->num_hosts > fleet->host_table_size && rehash_hosts(fleet) != 0) {
+      return -1;
+    }
+  }
+
+  host->first = fleet->pool_len;
+  host->count = count;
+  memcpy(&fleet->pool[fleet->pool_len], sets, count * sizeof(int));
+  fleet->pool_len += count;
+  count_host(fleet, sets, count, 1);
+  return 0;
+}
+
+
+nvvi_fleet *nvvi_fleet_new(void)
+{
+  nvvi_fleet *fleet = calloc(1, sizeof(*fleet));
+  if (!fleet) {
+    return NULL;
+  }
+  fleet->set_table = new_table(0, &fleet->table_size);
+  fleet->host_table = new_table(0, &fleet->host_table_size);
+  if (!fleet->set_table || !fleet->host_table) {
+    nvvi_fleet_free(fleet);
+    return NULL;
+  }
+  return fleet;
+}
+
+
+void nvvi_fleet_free(nvvi_fleet *fleet)
+{
+  if (!fleet) {
+    return;
+  }
+  for (int i = 0; i < fleet->num_sets; i++) {
+    nvvi_snapshot_free(&fleet->sets[i].snap);
+  }
+  for (int i = 0; i < fleet->num_hosts; i++) {
+    free(fleet->hosts[i].name);
+  }
+  free(fleet->sets);
+  free(fleet->set_table);
+  free(fleet->hosts);
+  free(fleet->host_table);
+  free(fleet->pool);
+  free(fleet);
+}
+
+
+int nvvi_fleet_add(nvvi_fleet *fleet, const char *host, const nvvi_snapshot *snap)
+{
+  int ret = 0;
+
+  if (!host[0] || host[strcspn(host, " \t\r\n")] || strlen(host) > 255) {
+    fprintf(stderr, "Invalid host name '%s'\n", host);
+    return -1;
+  }
+  int *sets = calloc(snap->num_devices + 1, sizeof(int));
+  if (!sets) {
+    return -1;
+  }
+  for (int i = 0; i < snap->num_devices && ret == 0; i++) {
+    sets[i] = intern_set(fleet, snap, &snap->devices[i]);
+    ret = sets[i] < 0 ? -1 : 0;
+  }
+  if (ret == 0) {
+    ret = set_host(fleet, host, sets, snap->num_devices);
+  }
+  free(sets);
+  return ret;
+}
+
+
+void nvvi_fleet_stats(const nvvi_fleet *fleet, int *hosts, int *devices, int *sets)
+{
+  *hosts = fleet->num_hosts;
+  *sets = 0;
+  *devices = 0;
+  for (int i = 0; i < fleet->num_sets; i++) {
+    *sets += fleet->sets[i].devices > 0;
+    *devices += fleet->sets[i].devices;
+  }
+}
+
+
+int nvvi_fleet_num_sets(const nvvi_fleet *fleet)
+{
+  return fleet->num_sets;
+}
+
+
+const nvvi_snapshot *nvvi_fleet_set(const nvvi_fleet *fleet, int index, uint64_t *id,
+                                    int *hosts, int *devices)
+{
+  const fleet_set *set = &fleet->sets[index];
+
+  *id = set->hash;
+  *hosts = set->hosts;
+  *devices = set->devices;
+  return &set->snap;
+}
+
+
+static int write_set(const char *dir, const fleet_set *set)
+{
+  char path[4096];
+  char tmp[4096 + 8];
+  struct stat st;
+
+  snprintf(path, sizeof(path), "%s/sets/%016llx", dir, (unsigned long long)set->hash);
+  if (stat(path, &st) == 0) {
+    return 0;
+  }
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *f = fopen(tmp, "w");
+  if (!f) {
+    perror(tmp);
+    return -1;
+  }
+  int ret = nvvi_snapshot_save(&set->snap, f);
+  if (fclose(f) != 0 || ret != 0 || rename(tmp, path) != 0) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+
+int nvvi_fleet_save(const nvvi_fleet *fleet, const char *dir)
+{
+  char path[4096];
+  char tmp[4096 + 8];
+
+  snprintf(path, sizeof(path), "%s/sets", dir);
+  if ((mkdir(dir, 0755) != 0 && errno != EEXIST) ||
+      (mkdir(path, 0755) != 0 && errno != EEXIST)) {
+    perror(path);
+    return -1;
+  }
+  for (int i = 0; i < fleet->num_sets; i++) {
+    if (fleet->sets[i].devices > 0 && write_set(dir, &fleet->sets[i]) != 0) {
+      return -1;
+    }
+  }
+
+  /* Host lists last, so they never name a set that isn't on disk yet */
+  snprintf(path, sizeof(path), "%s/hosts", dir);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *f = fopen(tmp, "w");
+  if (!f) {
+    perror(tmp);
+    return -1;
+  }
+  fprintf(f, "%s %d\n", FLEET_MAGIC, FLEET_VERSION);
+  for (int i = 0; i < fleet->num_hosts; i++) {
+    const fleet_host *host = &fleet->hosts[i];
+    fprintf(f, "host %s", host->name);
+    for (int j = 0; j < host->count; j++) {
+      fprintf(f, " %016llx", (unsigned long long)fleet->sets[fleet->pool[host->first + j]].hash);
+    }
+    fprintf(f, "\n");
+  }
+  if (fclose(f) != 0 || rename(tmp, path) != 0) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+
+typedef struct {
+  uint64_t id;                  /* as named on disk */
+  int set;
+} set_file;
+
+
+static int compare_set_files(const void *a, const void *b)
+{
+  const set_file *x = a;
+  const set_file *y = b;
+
+  return x->id < y->id ? -1 : x->id > y->id;
+}
+
+
+/* Every set file, interned, sorted by the id it is stored under */
+static int load_sets(nvvi_fleet *fleet, const char *dir, set_file **files, int *count)
+{
+  char path[4096];
+  int size = 0;
+
+  *files = NULL;
+  *count = 0;
+  snprintf(path, sizeof(path), "%s/sets", dir);
+  DIR *d = opendir(path);
+  if (!d) {
+    perror(path);
+    return -1;
+  }
+
+  int ret = 0;
+  for (struct dirent *e; ret == 0 && (e = readdir(d));) {
+    unsigned long long id;
+    nvvi_snapshot snap;
+    int n = 0;
+
+    if (sscanf(e->d_name, "%16llx%n", &id, &n) != 1 || n != 16 || e->d_name[n]) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/sets/%s", dir, e->d_name);
+    FILE *f = fopen(path, "r");
+    if (!f || nvvi_snapshot_load(&snap, f) != 0 || snap.num_devices != 1) {
+      fprintf(stderr, "Cannot read capability set %s\n", path);
+      if (f) {
+        fclose(f);
+      }
+      ret = -1;
+      break;
+    }
+    fclose(f);
+
+    if (*count == size) {
+      size = size ? size * 2 : 64;
+      set_file *grown = realloc(*files, size * sizeof(*grown));
+      if (!grown) {
+        nvvi_snapshot_free(&snap);
+        ret = -1;
+        break;
+      }
+      *files = grown;
+    }
+    (*files)[*count].id = id;
+    (*files)[*count].set = intern_set(fleet, &snap, &snap.devices[0]);
+    ret = (*files)[(*count)++].set < 0 ? -1 : 0;
+    nvvi_snapshot_free(&snap);
+  }
+  closedir(d);
+
+  qsort(*files, *count, sizeof(**files), compare_set_files);
+  return ret;
+}
+
+
+int nvvi_fleet_load(nvvi_fleet *fleet, const char *dir)
+{
+  char path[4096];
+  char line[65536];
+  set_file *files;
+  int num_files;
+  int version;
+  int ret = 0;
+
+  if (load_sets(fleet, dir, &files, &num_files) != 0) {
+    free(files);
+    return -1;
+  }
+
+  snprintf(path, sizeof(path), "%s/hosts", dir);
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    free(files);
+    return -1;
+  }
+  if (!fgets(line, sizeof(line), f) ||
+      sscanf(line, FLEET_MAGIC " %d", &version) != 1 || version != FLEET_VERSION) {
+    fprintf(stderr, "%s is not a fleet index\n", path);
+    fclose(f);
+    free(files);
+    return -1;
+  }
+
+  int *sets = NULL;
+  int size = 0;
+  while (ret == 0 && fgets(line, sizeof(line), f)) {
+    char name[256];
+    int count = 0;
+    int n;
+
+    if (sscanf(line, "host %255s%n", name, &n) != 1) {
+      continue;
+    }
+    for (const char *p = line + n; ret == 0; ) {
+      set_file key;
+      int used;
+      unsigned long long id;
+
+      if (sscanf(p, " %llx%n", &id, &used) != 1) {
+        break;
+      }
+      p += used;
+      key.id = id;
+      const set_file *found = bsearch(&key, files, num_files, sizeof(*files), compare_set_files);
+      if (!found) {
+        fprintf(stderr, "Host %s uses missing capability set %016llx\n", name, id);
+        ret = -1;
+        break;
+      }
+      if (count == size) {
+        size = size ? size * 2 : 16;
+        int *grown = realloc(sets, size * sizeof(*grown));
+        if (!grown) {
+          ret = -1;
+          break;
+        }
+        sets = grown;
+      }
+      sets[count++] = found->set;
+    }
+    if (ret == 0) {
+      ret = set_host(fleet, name, sets, count);
+    }
+  }
+
+  free(sets);
+  free(files);
+  fclose(f);
+  return ret;
+}
+
+
+static int parse_op(const char **p)
+{
+  static const struct {
+    const char *str;
+    int op;
+  } ops[] = {
+    { ">=", OP_GE }, { "<=", OP_LE }, { "!=", OP_NE }, { "==", OP_EQ },
+    { ">", OP_GT }, { "<", OP_LT }, { "=", OP_EQ },
+  };
+
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    size_t len = strlen(ops[i].str);
+    if (strncmp(*p, ops[i].str, len) == 0) {
+      *p += len;
+      return ops[i].op;
+    }
+  }
+  return -1;
+}
+
+
+static int compare(int value, int op, int ref)
+{
+  switch (op) {
+  case OP_EQ: return value == ref;
+  case OP_NE: return value != ref;
+  case OP_LT: return value < ref;
+  case OP_LE: return value <= ref;
+  case OP_GT: return value > ref;
+  default:    return value >= ref;
+  }
+}
+
+
+static int find_cap(const char *name)
+{
+  for (int i = 0; i < nvvi_num_encode_limits; i++) {
+    if (strcasecmp(nvvi_encode_limits[i].name, name) == 0) {
+      return nvvi_encode_limits[i].cap;
+    }
+  }
+  for (int i = 0; i < nvvi_num_encode_caps; i++) {
+    if (strcasecmp(nvvi_encode_caps[i].name, name) == 0) {
+      return nvvi_encode_caps[i].cap;
+    }
+  }
+  return -1;
+}
+
+
+/* "CODEC[:CHROMA[:DEPTH]]" */
+static int parse_decode(fleet_term *term, const char *value)
+{
+  char codec[16], chroma[16];
+  int fields = sscanf(value, "%15[^:]:%15[^:]:%d", codec, chroma, &term->bit_depth);
+
+  term->chroma_format = -1;
+  if (fields < 3) {
+    term->bit_depth = 0;
+  }
+  term->codec = fields >= 1 ? nvvi_decode_codec_from_name(codec) : -1;
+  if (fields >= 2) {
+    term->chroma_format = nvvi_chroma_format_from_name(chroma);
+    if (term->chroma_format < 0) {
+      return -1;
+    }
+  }
+  return term->codec < 0 ? -1 : 0;
+}
+
+
+static int parse_term(nvvi_fleet_query *q, const char *word, int *group,
+                      char *error, size_t len)
+{
+  char key[64];
+  const char *p = word + strcspn(word, "=!<>");
+  fleet_term *term = &q->terms[q->num_terms];
+
+  snprintf(key, sizeof(key), "%.*s", (int)(p - word), word);
+  int op = parse_op(&p);
+  if (!key[0] || op < 0 || !*p) {
+    snprintf(error, len, "expected KEY=VALUE or KEY OP NUMBER: %s", word);
+    return -1;
+  }
+
+  memset(term, 0, sizeof(*term));
+  term->group = *group;
+  term->op = op;
+  if (strcmp(key, "devices") == 0) {
+    q->devices_op = op;
+    if (sscanf(p, "%d", &q->devices) != 1) {
+      snprintf(error, len, "invalid device count: %s", word);
+      return -1;
+    }
+    return 0;
+  }
+  if (q->num_terms == FLEET_MAX_TERMS) {
+    snprintf(error, len, "too many terms");
+    return -1;
+  }
+
+  if (strcmp(key, "decode") == 0) {
+    term->kind = TERM_DECODE;
+    if (op != OP_EQ || parse_decode(term, p) != 0) {
+      snprintf(error, len, "expected decode=CODEC[:CHROMA[:DEPTH]]: %s", word);
+      return -1;
+    }
+  } else if (strcmp(key, "encode") == 0) {
+    term->kind = TERM_ENCODE;
+    term->codec = nvvi_decode_codec_from_name(p);
+    if (op != OP_EQ || term->codec < 0) {
+      snprintf(error, len, "expected encode=CODEC: %s", word);
+      return -1;
+    }
+    /* Caps and formats after this qualify this codec */
+    *group = term->group = q->num_terms;
+  } else if (strcmp(key, "format") == 0) {
+    term->kind = TERM_FORMAT;
+    term->format = nvvi_encode_format_from_name(p);
+    if (op != OP_EQ || !term->format) {
+      snprintf(error, len, "unknown input format: %s", word);
+      return -1;
+    }
+  } else if (strcmp(key, "driver") == 0 || strcmp(key, "gpu") == 0) {
+    term->kind = key[0] == 'd' ? TERM_DRIVER : TERM_GPU;
+    if (op != OP_EQ && op != OP_NE) {
+      snprintf(error, len, "expected %s=TEXT or %s!=TEXT: %s", key, key, word);
+      return -1;
+    }
+    snprintf(term->text, sizeof(term->text), "%s", p);
+  } else {
+    term->kind = TERM_CAP;
+    term->cap = find_cap(key);
+    if (term->cap < 0 || sscanf(p, "%d", &term->value) != 1) {
+      snprintf(error, len, "unknown encoder cap or invalid value: %s", word);
+      return -1;
+    }
+  }
+  q->num_terms++;
+  return 0;
+}
+
+
+nvvi_fleet_query *nvvi_fleet_query_parse(const char *expr, char *error, size_t len)
+{
+  nvvi_fleet_query *q = calloc(1, sizeof(*q));
+  char *copy = strdup(expr);
+  char *save;
+  int group = -1;
+
+  if (!q || !copy) {
+    snprintf(error, len, "out of memory");
+    free(q);
+    free(copy);
+    return NULL;
+  }
+  q->devices_op = OP_GE;
+  q->devices = 1;
+
+  for (char *word = strtok_r(copy, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+    if (parse_term(q, word, &group, error, len) != 0) {
+      free(q);
+      free(copy);
+      return NULL;
+    }
+  }
+  free(copy);
+  return q;
+}
+
+
+void nvvi_fleet_query_free(nvvi_fleet_query *q)
+{
+  free(q);
+}
+
+
+/* Does codec satisfy every cap and format term of group */
+static int match_codec(const nvvi_fleet_query *q, int group, const nvvi_encode_codec *codec)
+{
+  if (group >= 0 && nvvi_decode_codec_from_name(codec->name) != q->terms[group].codec) {
+    return 0;
+  }
+  for (int i = 0; i < q->num_terms; i++) {
+    const fleet_term *t = &q->terms[i];
+    if (t->group != group) {
+      continue;
+    }
+    if ((t->kind == TERM_FORMAT && !(codec->input_formats & t->format)) ||
+        (t->kind == TERM_CAP && !compare(codec->caps[t->cap], t->op, t->value))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+static int match_group(const nvvi_fleet_query *q, int group, const nvvi_device *device)
+{
+  for (int i = 0; i < device->num_encode_codecs; i++) {
+    if (match_codec(q, group, &device->encode_codecs[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static int match_decode(const fleet_term *t, const nvvi_device *device)
+{
+  for (int i = 0; i < device->num_decode_caps; i++) {
+    const nvvi_decode_caps *caps = &device->decode_caps[i];
+    if (caps->codec == t->codec &&
+        (t->chroma_format < 0 || caps->chroma_format == t->chroma_format) &&
+        (!t->bit_depth || caps->bit_depth == t->bit_depth)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static int contains(const char *haystack, const char *needle)
+{
+  size_t len = strlen(needle);
+
+  for (; *haystack; haystack++) {
+    if (strncasecmp(haystack, needle, len) == 0) {
+      return 1;
+    }
+  }
+  return !len;
+}
+
+
+static int match_set(const nvvi_fleet_query *q, const nvvi_snapshot *snap)
+{
+  const nvvi_device *device = &snap->devices[0];
+  int any_codec = 0;
+
+  for (int i = 0; i < q->num_terms; i++) {
+    const fleet_term *t = &q->terms[i];
+    int ok = 1;
+
+    switch (t->kind) {
+    case TERM_DECODE:
+      ok = match_decode(t, device);
+      break;
+    case TERM_ENCODE:
+      ok = match_group(q, i, device);
+      break;
+    case TERM_FORMAT:
+    case TERM_CAP:
+      any_codec |= t->group < 0;
+      break;
+    case TERM_DRIVER:
+      ok = (strcmp(snap->driver_version, t->text) == 0) == (t->op == OP_EQ);
+      break;
+    case TERM_GPU:
+      ok = contains(device->name, t->text) == (t->op == OP_EQ);
+      break;
+    }
+    if (!ok) {
+      return 0;
+    }
+  }
+  return !any_codec || match_group(q, -1, device);
+}
+
+
+int nvvi_fleet_query_run(const nvvi_fleet *fleet, const nvvi_fleet_query *q,
+                         nvvi_fleet_match_fn fn, void *opaque)
+{
+  char *match = calloc(fleet->num_sets + 1, 1);
+  int matched = 0;
+
+  if (!match) {
+    return -1;
+  }
+  for (int i = 0; i < fleet->num_sets; i++) {
+    match[i] = fleet->sets[i].devices > 0 && match_set(q, &fleet->sets[i].snap);
+  }
+
+  for (int i = 0; i < fleet->num_hosts; i++) {
+    const fleet_host *host = &fleet->hosts[i];
+    int devices = 0;
+    for (int j = 0; j < host->count; j++) {
+      devices += match[fleet->pool[host->first + j]];
+    }
+    if (compare(devices, q->devices_op, q->devices)) {
+      matched++;
+      if (fn) {
+        fn(host->name, devices, opaque);
+      }
+    }
+  }
+
+  free(match);
+  return matched;
+}
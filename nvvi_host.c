@@ -0,0 +1,230 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Host-side information about the nvidia driver and GPUs that can be read
+ * from procfs and sysfs without initialising CUDA.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvvi_internal.h"
+
+#define NVIDIA_PROCFS "/proc/driver/nvidia"
+
+
+static void strip(char *str)
+{
+  size_t len = strlen(str);
+  while (len > 0 && isspace((unsigned char)str[len - 1])) {
+    str[--len] = '\0';
+  }
+}
+
+
+int nvvi_read_driver_version(char *buf, size_t len)
+{
+  char line[256];
+  FILE *f;
+
+  f = fopen("/sys/module/nvidia/version", "r");
+  if (f) {
+    char *ok = fgets(line, sizeof(line), f);
+    fclose(f);
+    if (ok) {
+      strip(line);
+      snprintf(buf, len, "%s", line);
+      return 0;
+    }
+  }
+
+  /* NVRM version: NVIDIA UNIX x86_64 Kernel Module  550.54.14  Thu Feb 22 ... */
+  f = fopen(NVIDIA_PROCFS "/version", "r");
+  if (!f) {
+    return -1;
+  }
+  char *ok = fgets(line, sizeof(line), f);
+  fclose(f);
+  if (!ok) {
+    return -1;
+  }
+
+  char *module = strstr(line, "Kernel Module");
+  char version[64];
+  if (!module || sscanf(module + strlen("Kernel Module"), "%63s", version) != 1) {
+    return -1;
+  }
+  snprintf(buf, len, "%s", version);
+
+  return 0;
+}
+
+
+void nvvi_normalize_bus_id(char *dst, const char *src)
+{
+  unsigned int domain, bus, device, function;
+
+  if (sscanf(src, "%x:%x:%x.%x", &domain, &bus, &device, &function) == 4) {
+    snprintf(dst, NVVI_BUS_ID_LEN, "%04x:%02x:%02x.%x",
+             domain & 0xffff, bus, device, function);
+  } else {
+    snprintf(dst, NVVI_BUS_ID_LEN, "%s", src);
+  }
+}
+
+
+static int read_gpu_information(const char *dir, nvvi_host_gpu *gpu)
+{
+  char path[512];
+  char line[256];
+
+  snprintf(path, sizeof(path), NVIDIA_PROCFS "/gpus/%s/information", dir);
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return -1;
+  }
+
+  gpu->uuid[0] = '\0';
+  gpu->pci_bus_id[0] = '\0';
+
+  while (fgets(line, sizeof(line), f)) {
+    char *value = strchr(line, ':');
+    if (!value) {
+      continue;
+    }
+    *value++ = '\0';
+    while (isspace((unsigned char)*value)) {
+      value++;
+    }
+    strip(value);
+
+    if (strcmp(line, "GPU UUID") == 0) {
+      snprintf(gpu->uuid, sizeof(gpu->uuid), "%s", value);
+    } else if (strcmp(line, "Bus Location") == 0) {
+      nvvi_normalize_bus_id(gpu->pci_bus_id, value);
+    }
+  }
+  fclose(f);
+
+  return (gpu->uuid[0] && gpu->pci_bus_id[0]) ? 0 : -1;
+}
+
+
+int nvvi_read_host_gpus(nvvi_host_gpu *gpus, int max)
+{
+  DIR *dir = opendir(NVIDIA_PROCFS "/gpus");
+  if (!dir) {
+    return -1;
+  }
+
+  int count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) && count < max) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    if (read_gpu_information(entry->d_name, &gpus[count]) == 0) {
+      count++;
+    }
+  }
+  closedir(dir);
+
+  return count > 0 ? count : -1;
+}
+
+
+/* First line of a sysfs attribute of a PCI device, stripped; -1 if it can't be read */
+static int read_pci_attr(const char *root, const char *bus_id, const char *attr,
+                         char *buf, size_t len)
+{
+  char path[512];
+
+  snprintf(path, sizeof(path), "%s/bus/pci/devices/%s/%s", root ? root : "/sys", bus_id, attr);
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return -1;
+  }
+  char *ok = fgets(buf, len, f);
+  fclose(f);
+  if (!ok) {
+    return -1;
+  }
+  strip(buf);
+
+  return 0;
+}
+
+
+/* "16.0 GT/s PCIe" (or "8 GT/s" on older kernels) to a PCIe generation */
+static int link_gen(const char *speed)
+{
+  static const struct {
+    double gts;
+    int gen;
+  } gens[] = {
+    { 2.5, 1 }, { 5, 2 }, { 8, 3 }, { 16, 4 }, { 32, 5 }, { 64, 6 },
+  };
+  double gts;
+
+  if (sscanf(speed, "%lf GT/s", &gts) != 1) {
+    return 0;
+  }
+  for (int i = 0; i < sizeof(gens) / sizeof(gens[0]); i++) {
+    if (gts > gens[i].gts - 0.1 && gts < gens[i].gts + 0.1) {
+      return gens[i].gen;
+    }
+  }
+  return 0;
+}
+
+
+void nvvi_read_topology(const char *sysfs_root, nvvi_device *device)
+{
+  nvvi_topology *topo = &device->topology;
+  char buf[NVVI_CPULIST_LEN];
+
+  memset(topo, 0, sizeof(*topo));
+  topo->numa_node = -1;
+  if (!device->pci_bus_id[0]) {
+    return;
+  }
+
+  if (read_pci_attr(sysfs_root, device->pci_bus_id, "numa_node", buf, sizeof(buf)) == 0) {
+    topo->numa_node = atoi(buf);
+  }
+  if (read_pci_attr(sysfs_root, device->pci_bus_id, "local_cpulist", buf, sizeof(buf)) == 0) {
+    snprintf(topo->local_cpus, sizeof(topo->local_cpus), "%s", buf);
+  }
+  if (read_pci_attr(sysfs_root, device->pci_bus_id, "current_link_speed", buf, sizeof(buf)) == 0) {
+    topo->link_gen = link_gen(buf);
+  }
+  if (read_pci_attr(sysfs_root, device->pci_bus_id, "max_link_speed", buf, sizeof(buf)) == 0) {
+    topo->max_link_gen = link_gen(buf);
+  }
+  if (read_pci_attr(sysfs_root, device->pci_bus_id, "current_link_width", buf, sizeof(buf)) == 0) {
+    topo->link_width = atoi(buf);
+  }
+  if (read_pci_attr(sysfs_root, device->pci_bus_id, "max_link_width", buf, sizeof(buf)) == 0) {
+    topo->max_link_width = atoi(buf);
+  }
+}
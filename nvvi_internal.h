@@ -0,0 +1,124 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Declarations shared between the library's translation units. Nothing in
+ * here is installed or part of the public API.
+ */
+
+#ifndef NVVI_INTERNAL_H
+#define NVVI_INTERNAL_H
+
+#include <stddef.h>
+
+#include "nvvideoinfo.h"
+
+#define NVVI_MAX_HOST_GPUS 64
+
+/*
+ * Called for every device once its name and ids are known, before any
+ * context is created for it. Returning non-zero means the callback has
+ * filled in the device itself and it must not be probed.
+ */
+typedef int (*nvvi_reuse_fn)(nvvi_device *device, const nvvi_snapshot *snap, void *opaque);
+
+/* The uncached probe; nvvi_probe_ex() minus the cache lookup */
+int nvvi_probe_devices(nvvi_snapshot *snap, const nvvi_probe_options *opts,
+                       nvvi_reuse_fn reuse, void *opaque);
+
+/*
+ * nvvi_verify() for the device at index alone, leaving every other device
+ * and the snapshot's flags untouched. Used by isolated probe children.
+ */
+int nvvi_verify_device(nvvi_snapshot *snap, int index);
+
+/* nvvi_cache.c */
+int nvvi_cache_probe(nvvi_snapshot *snap, const nvvi_probe_options *opts);
+
+/* nvvi_isolate.c: nvvi_probe_ex() with a timeout */
+int nvvi_isolated_probe(nvvi_snapshot *snap, const nvvi_probe_options *opts);
+
+/* nvvi_host.c */
+typedef struct {
+  char uuid[NVVI_UUID_LEN];
+  char pci_bus_id[NVVI_BUS_ID_LEN];
+} nvvi_host_gpu;
+
+/*
+ * Read the kernel driver version and the list of GPUs it manages without
+ * going through CUDA. Both return -1 if the information is unavailable,
+ * e.g. on a system without the nvidia kernel module.
+ */
+int nvvi_read_driver_version(char *buf, size_t len);
+int nvvi_read_host_gpus(nvvi_host_gpu *gpus, int max);
+
+/*
+ * Fill a device's topology from /sys/bus/pci/devices/<pci_bus_id> under
+ * sysfs_root (NULL for /sys). Whatever can't be read is left unknown.
+ */
+void nvvi_read_topology(const char *sysfs_root, nvvi_device *device);
+
+/* Canonicalise a PCI bus id to the dddd:bb:dd.f form used in sysfs */
+void nvvi_normalize_bus_id(char *dst, const char *src);
+
+/*
+ * nvvi_plan.c: the rate model behind nvvi_plan_rendition(), shared with
+ * the placement solver. Rates are luma samples per second for decode (MB
+ * aligned for H264) and macroblocks per second for encode, 0 if unknown.
+ * The limit checks return -1 and say why in detail if r doesn't fit.
+ */
+double nvvi_plan_sample_rate(int codec, const nvvi_rendition *r);
+int nvvi_plan_encode_limits(const nvvi_encode_codec *enc, const nvvi_rendition *r,
+                            char *detail, size_t len);
+int nvvi_plan_encode_engines(const nvvi_encode_codec *enc);
+double nvvi_plan_encode_rate(const nvvi_encode_codec *enc);
+int nvvi_plan_decode_limits(const nvvi_decode_caps *dec, const nvvi_rendition *r,
+                            char *detail, size_t len);
+double nvvi_plan_decode_rate(const nvvi_decode_caps *dec);
+
+/*
+ * nvvi_synth.c: synthetic H.264, HEVC and AV1 streams, one access unit
+ * (Annex B for H.264 and HEVC, a temporal unit of OBUs for AV1) per
+ * picture. Units 0 and 1 are random access points carrying the parameter
+ * sets or sequence header, the rest are the pictures of the GOP;
+ * nvvi_synth_frame() returns the unit for any frame of an endless stream.
+ * Only 4:2:0 is generated, see nvvi_synth_supported(). Width and height
+ * must be even; coded_width/height is the size the decoder is created at.
+ */
+#define NVVI_SYNTH_GOP 30
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+} nvvi_synth_unit;
+
+typedef struct {
+  int codec;
+  unsigned int coded_width;
+  unsigned int coded_height;
+  nvvi_synth_unit units[NVVI_SYNTH_GOP + 1];
+} nvvi_synth_stream;
+
+int nvvi_synth_supported(int codec, int chroma_format, int bit_depth);
+int nvvi_synth_stream_init(nvvi_synth_stream *s, int codec, int bit_depth,
+                           unsigned int width, unsigned int height);
+const nvvi_synth_unit *nvvi_synth_frame(const nvvi_synth_stream *s, int index);
+void nvvi_synth_stream_free(nvvi_synth_stream *s);
+
+#endif /* NVVI_INTERNAL_H */
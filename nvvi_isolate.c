@@ -0,0 +1,422 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Isolated probing.
+ *
+ * A wedged GPU can block cuInit, context creation or opening an encode
+ * session forever, and nothing can interrupt a thread stuck in the driver.
+ * Here one child process lists the devices and then one child per device
+ * probes it, each sending its part of the snapshot back over a pipe in the
+ * in-memory layout of this build. Children that miss the deadline are
+ * killed and their devices reported as timed out; the parent never loads
+ * CUDA itself.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvvi_internal.h"
+#include "nvvi_trace.h"
+
+typedef struct {
+  unsigned int flags;
+  uint32_t nvenc_max_version;
+  char driver_version[32];
+  int num_devices;
+} isolate_header;
+
+typedef struct {
+  pid_t pid;
+  int fd;
+  char *buf;
+  size_t size;
+  size_t cap;
+  int done;                     /* the child closed its end */
+  uint64_t end;                 /* when it did */
+} isolate_child;
+
+typedef int (*isolate_fn)(int fd, const nvvi_probe_options *opts, int device);
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int write_all(int fd, const void *data, size_t len)
+{
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+/* Only probe the device the child was started for; others are left unprobed */
+static int skip_device(nvvi_device *device, const nvvi_snapshot *snap, void *opaque)
+{
+  const int *only = opaque;
+  return !only || device->index != *only;
+}
+
+
+static int enumerate_child(int fd, const nvvi_probe_options *opts, int device)
+{
+  nvvi_snapshot snap;
+
+  if (nvvi_probe_devices(&snap, opts, skip_device, NULL) != 0) {
+    return -1;
+  }
+
+  isolate_header header = {
+    .flags = snap.flags,
+    .nvenc_max_version = snap.nvenc_max_version,
+    .num_devices = snap.num_devices,
+  };
+  memcpy(header.driver_version, snap.driver_version, sizeof(header.driver_version));
+  int ret = write_all(fd, &header, sizeof(header));
+  if (ret == 0 && snap.num_devices) {
+    ret = write_all(fd, snap.devices, snap.num_devices * sizeof(nvvi_device));
+  }
+  nvvi_snapshot_free(&snap);
+
+  return ret;
+}
+
+
+static int device_child(int fd, const nvvi_probe_options *opts, int device)
+{
+  nvvi_snapshot snap;
+
+  if (nvvi_probe_devices(&snap, opts, skip_device, &device) != 0) {
+    return -1;
+  }
+  if (device >= snap.num_devices) {
+    nvvi_snapshot_free(&snap);
+    return -1;
+  }
+  if ((opts->flags & NVVI_PROBE_VERIFY) && nvvi_verify_device(&snap, device) != 0) {
+    nvvi_snapshot_free(&snap);
+    return -1;
+  }
+  int ret = write_all(fd, &snap.devices[device], sizeof(nvvi_device));
+  nvvi_snapshot_free(&snap);
+
+  return ret;
+}
+
+
+/*
+ * Start fn in a worker process whose output is read from child->fd. The
+ * worker is forked from a short-lived intermediate so that init, not the
+ * caller, reaps it: one killed while stuck in the driver may not exit for
+ * a long time. The intermediate sends the worker's pid first; the worker
+ * holds the pipe open until it exits, so while the pipe is open the pid
+ * is still its own and safe to kill.
+ */
+static int isolate_spawn(isolate_child *child, isolate_fn fn, const nvvi_probe_options *opts,
+                         int device)
+{
+  int fds[2];
+  int status;
+
+  memset(child, 0, sizeof(*child));
+  child->pid = -1;
+  child->fd = -1;
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    /* The parent's trace file and stdio buffers are not ours to flush */
+    nvvi_trace_detach();
+    close(fds[0]);
+    pid_t worker = fork();
+    if (worker == 0) {
+      _exit(fn(fds[1], opts, device) == 0 ? 0 : 1);
+    }
+    _exit(worker > 0 && write_all(fds[1], &worker, sizeof(worker)) == 0 ? 0 : 1);
+  }
+
+  close(fds[1]);
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+
+  /* Written in one go before the intermediate exited, so read in one go too */
+  ssize_t n;
+  do {
+    n = read(fds[0], &child->pid, sizeof(child->pid));
+  } while (n < 0 && errno == EINTR);
+  if (n != sizeof(child->pid)) {
+    fprintf(stderr, "Failed to start a probe process\n");
+    child->pid = -1;
+    close(fds[0]);
+    return -1;
+  }
+
+  child->fd = fds[0];
+  return 0;
+}
+
+
+static void isolate_read(isolate_child *child)
+{
+  if (child->size == child->cap) {
+    size_t cap = child->cap ? child->cap * 2 : 65536;
+    char *buf = realloc(child->buf, cap);
+    if (!buf) {
+      /* Its output is lost either way, so don't leave it running */
+      kill(child->pid, SIGKILL);
+      child->done = 1;
+      child->end = now_ns();
+      return;
+    }
+    child->buf = buf;
+    child->cap = cap;
+  }
+
+  ssize_t n = read(child->fd, child->buf + child->size, child->cap - child->size);
+  if (n < 0 && errno == EINTR) {
+    return;
+  }
+  if (n <= 0) {
+    child->done = 1;
+    child->end = now_ns();
+    return;
+  }
+  child->size += n;
+}
+
+
+/*
+ * Read every child's output until it exits or the deadline passes, then
+ * kill whatever is left. A child stuck inside the driver may not die at
+ * once; it is left to exit on its own, and to be reaped by init, rather
+ * than blocking on it again.
+ */
+static void isolate_collect(isolate_child *children, int count, uint64_t deadline)
+{
+  struct pollfd *fds = calloc(count + 1, sizeof(*fds));
+  int *which = calloc(count + 1, sizeof(*which));
+
+  while (fds && which) {
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+      if (children[i].fd >= 0 && !children[i].done) {
+        fds[n].fd = children[i].fd;
+        fds[n].events = POLLIN;
+        which[n++] = i;
+      }
+    }
+    uint64_t now = now_ns();
+    if (n == 0 || now >= deadline) {
+      break;
+    }
+
+    int timeout = (int)((deadline - now + 999999) / 1000000);
+    int ready = poll(fds, n, timeout);
+    if (ready < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+    for (int j = 0; j < n && ready > 0; j++) {
+      if (fds[j].revents) {
+        isolate_read(&children[which[j]]);
+      }
+    }
+  }
+  free(fds);
+  free(which);
+
+  for (int i = 0; i < count; i++) {
+    isolate_child *child = &children[i];
+    if (child->pid > 0 && !child->done) {
+      kill(child->pid, SIGKILL);
+    }
+    if (child->fd >= 0) {
+      close(child->fd);
+    }
+  }
+}
+
+
+/* Enumeration itself hung: list the GPUs procfs knows about, all timed out */
+static int enumerate_timed_out(nvvi_snapshot *snap, double ms)
+{
+  nvvi_host_gpu gpus[NVVI_MAX_HOST_GPUS];
+  int count = nvvi_read_host_gpus(gpus, NVVI_MAX_HOST_GPUS);
+
+  fprintf(stderr, "Device enumeration did not finish within %.0f ms\n", ms);
+  if (count <= 0) {
+    return -1;
+  }
+
+  snap->devices = calloc(count, sizeof(nvvi_device));
+  if (!snap->devices) {
+    return -1;
+  }
+  snap->num_devices = count;
+  nvvi_read_driver_version(snap->driver_version, sizeof(snap->driver_version));
+
+  for (int i = 0; i < count; i++) {
+    nvvi_device *device = &snap->devices[i];
+
+    device->index = i;
+    device->decode_status = -1;
+    device->encode_status = -1;
+    device->probe_status = NVVI_DEVICE_TIMED_OUT;
+    device->probe_ms = ms;
+    snprintf(device->name, sizeof(device->name), "unknown");
+    memcpy(device->uuid, gpus[i].uuid, sizeof(device->uuid));
+    memcpy(device->pci_bus_id, gpus[i].pci_bus_id, sizeof(device->pci_bus_id));
+  }
+
+  return 0;
+}
+
+
+static int enumerate(nvvi_snapshot *snap, const nvvi_probe_options *opts)
+{
+  isolate_child child;
+  isolate_header header;
+  int ret = -1;
+
+  uint64_t start = now_ns();
+  if (isolate_spawn(&child, enumerate_child, opts, -1) != 0) {
+    return -1;
+  }
+  isolate_collect(&child, 1, start + (uint64_t)opts->timeout_ms * 1000000);
+
+  if (!child.done) {
+    ret = enumerate_timed_out(snap, opts->timeout_ms);
+  } else if (child.size >= sizeof(header)) {
+    memcpy(&header, child.buf, sizeof(header));
+    if (header.num_devices >= 0 &&
+        child.size == sizeof(header) + header.num_devices * sizeof(nvvi_device)) {
+      snap->nvenc_max_version = header.nvenc_max_version;
+      memcpy(snap->driver_version, header.driver_version, sizeof(snap->driver_version));
+      snap->devices = calloc(header.num_devices + 1, sizeof(nvvi_device));
+      if (snap->devices) {
+        memcpy(snap->devices, child.buf + sizeof(header),
+               header.num_devices * sizeof(nvvi_device));
+        snap->num_devices = header.num_devices;
+        ret = 0;
+      }
+    }
+  }
+  free(child.buf);
+
+  return ret;
+}
+
+
+int nvvi_isolated_probe(nvvi_snapshot *snap, const nvvi_probe_options *opts)
+{
+  nvvi_probe_options probe = *opts;
+  isolate_child *children;
+
+  memset(snap, 0, sizeof(*snap));
+  probe.cache_path = NULL;
+
+  uint64_t start = nvvi_trace_begin();
+  if (enumerate(snap, &probe) != 0) {
+    nvvi_snapshot_free(snap);
+    return -1;
+  }
+  nvvi_trace_end("isolated enumerate", -1, start);
+  snap->flags = opts->flags & ~NVVI_PROBE_VERIFY;
+  if (snap->num_devices == 0 || snap->devices[0].probe_status == NVVI_DEVICE_TIMED_OUT) {
+    return 0;
+  }
+
+  children = calloc(snap->num_devices, sizeof(*children));
+  if (!children) {
+    nvvi_snapshot_free(snap);
+    return -1;
+  }
+
+  start = nvvi_trace_begin();
+  uint64_t spawned = now_ns();
+  for (int i = 0; i < snap->num_devices; i++) {
+    if (isolate_spawn(&children[i], device_child, &probe, i) != 0) {
+      children[i].done = 1;
+      children[i].end = spawned;
+    }
+  }
+  isolate_collect(children, snap->num_devices, spawned + (uint64_t)opts->timeout_ms * 1000000);
+  nvvi_trace_end("isolated probe", -1, start);
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    nvvi_device *device = &snap->devices[i];
+    isolate_child *child = &children[i];
+
+    if (child->done && child->size == sizeof(nvvi_device)) {
+      int index = device->index;
+      memcpy(device, child->buf, sizeof(nvvi_device));
+      device->index = index;
+      device->probe_status = NVVI_DEVICE_PROBED;
+    } else {
+      device->probe_status = child->done ? NVVI_DEVICE_ABORTED : NVVI_DEVICE_TIMED_OUT;
+    }
+    device->probe_ms = child->done ? (child->end - spawned) / 1e6 : opts->timeout_ms;
+    free(child->buf);
+  }
+  free(children);
+
+  if (opts->flags & NVVI_PROBE_VERIFY) {
+    snap->flags |= NVVI_PROBE_VERIFY;
+  }
+  return 0;
+}
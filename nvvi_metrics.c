@@ -0,0 +1,189 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * OpenMetrics text exposition of a snapshot. Everything but the device info
+ * is a gauge labelled by device index, plus codec and whatever else tells the series of a
+ * family apart; encoder caps keep the NV_ENC_CAPS_ names so the labels
+ * don't change when the display text does.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "nvvideoinfo.h"
+
+
+/* A label value with \, " and newlines escaped */
+static void write_label(FILE *f, const char *name, const char *value)
+{
+  fprintf(f, "%s=\"", name);
+  for (const char *p = value; *p; p++) {
+    if (*p == '\\' || *p == '"') {
+      fprintf(f, "\\%c", *p);
+    } else if (*p == '\n') {
+      fprintf(f, "\\n");
+    } else {
+      fputc(*p, f);
+    }
+  }
+  fputc('"', f);
+}
+
+
+static void write_family(FILE *f, const char *name, const char *type, const char *help)
+{
+  fprintf(f, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+
+static void write_device_info(FILE *f, const nvvi_snapshot *snap)
+{
+  write_family(f, "nvvi_device", "info", "A probed GPU, with its ids and NUMA node as labels.");
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    char numa[16];
+
+    snprintf(numa, sizeof(numa), "%d", device->topology.numa_node);
+    fprintf(f, "nvvi_device_info{device=\"%d\",", device->index);
+    write_label(f, "name", device->name);
+    fputc(',', f);
+    write_label(f, "uuid", device->uuid);
+    fputc(',', f);
+    write_label(f, "pci_bus_id", device->pci_bus_id);
+    fputc(',', f);
+    write_label(f, "numa_node", numa);
+    fputc(',', f);
+    write_label(f, "driver", snap->driver_version);
+    fprintf(f, "} 1\n");
+  }
+
+  write_family(f, "nvvi_device_probed", "gauge",
+               "1 if the device answered the probe, 0 if it failed or timed out.");
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    fprintf(f, "nvvi_device_probed{device=\"%d\"} %d\n", device->index,
+            device->probe_status == NVVI_DEVICE_PROBED);
+  }
+}
+
+
+static void write_decode(FILE *f, const nvvi_snapshot *snap)
+{
+  static const struct {
+    const char *name;
+    const char *help;
+    size_t offset;
+  } families[] = {
+    { "nvvi_decode_min_width", "Minimum coded width of a decoder.",
+      offsetof(nvvi_decode_caps, min_width) },
+    { "nvvi_decode_min_height", "Minimum coded height of a decoder.",
+      offsetof(nvvi_decode_caps, min_height) },
+    { "nvvi_decode_max_width", "Maximum coded width of a decoder.",
+      offsetof(nvvi_decode_caps, max_width) },
+    { "nvvi_decode_max_height", "Maximum coded height of a decoder.",
+      offsetof(nvvi_decode_caps, max_height) },
+    { "nvvi_decode_max_macroblocks", "Maximum macroblocks per picture of a decoder.",
+      offsetof(nvvi_decode_caps, max_mb_count) },
+  };
+
+  for (int k = 0; k < sizeof(families) / sizeof(families[0]); k++) {
+    write_family(f, families[k].name, "gauge", families[k].help);
+    for (int i = 0; i < snap->num_devices; i++) {
+      const nvvi_device *device = &snap->devices[i];
+      for (int j = 0; j < device->num_decode_caps; j++) {
+        const nvvi_decode_caps *caps = &device->decode_caps[j];
+        unsigned int value = *(const unsigned int *)((const char *)caps + families[k].offset);
+
+        fprintf(f, "%s{device=\"%d\",codec=\"%s\",chroma=\"%s\",bit_depth=\"%d\"} %u\n",
+                families[k].name, device->index, nvvi_decode_codec_name(caps->codec),
+                nvvi_chroma_format_name(caps->chroma_format), caps->bit_depth, value);
+      }
+    }
+  }
+}
+
+
+static void write_encode_caps(FILE *f, const nvvi_snapshot *snap, const char *family,
+                              const char *label, const nvvi_cap_desc *descs, int count)
+{
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    for (int j = 0; j < device->num_encode_codecs; j++) {
+      const nvvi_encode_codec *codec = &device->encode_codecs[j];
+      for (int k = 0; k < count; k++) {
+        fprintf(f, "%s{device=\"%d\",codec=\"%s\",%s=\"%s\"} %d\n", family, device->index,
+                codec->name, label, descs[k].name, codec->caps[descs[k].cap]);
+      }
+    }
+  }
+}
+
+
+static void write_encode(FILE *f, const nvvi_snapshot *snap, const int *capacity)
+{
+  write_family(f, "nvvi_encode_limit", "gauge", "Numeric NV_ENC_CAPS limit of an encoder.");
+  write_encode_caps(f, snap, "nvvi_encode_limit", "limit",
+                    nvvi_encode_limits, nvvi_num_encode_limits);
+
+  write_family(f, "nvvi_encode_capability", "gauge",
+               "NV_ENC_CAPS feature of an encoder; 0 if unsupported, otherwise as reported.");
+  write_encode_caps(f, snap, "nvvi_encode_capability", "capability",
+                    nvvi_encode_caps, nvvi_num_encode_caps);
+
+  write_family(f, "nvvi_encode_input_format", "gauge", "1 if an encoder accepts an input format.");
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    for (int j = 0; j < device->num_encode_codecs; j++) {
+      const nvvi_encode_codec *codec = &device->encode_codecs[j];
+      for (int k = 0; k < nvvi_num_encode_formats; k++) {
+        fprintf(f, "nvvi_encode_input_format{device=\"%d\",codec=\"%s\",format=\"%s\"} %d\n",
+                device->index, codec->name, nvvi_encode_formats[k].desc,
+                !!(codec->input_formats & nvvi_encode_formats[k].fmt));
+      }
+    }
+  }
+
+  if (!capacity) {
+    return;
+  }
+  write_family(f, "nvvi_encode_capacity_percent", "gauge",
+               "Encoder capacity still free when scraped, in percent.");
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    for (int j = 0; j < device->num_encode_codecs; j++) {
+      int value = capacity[i * NVVI_MAX_ENCODE_CODECS + j];
+      if (value >= 0) {
+        fprintf(f, "nvvi_encode_capacity_percent{device=\"%d\",codec=\"%s\"} %d\n",
+                device->index, device->encode_codecs[j].name, value);
+      }
+    }
+  }
+}
+
+
+int nvvi_metrics_write(const nvvi_snapshot *snap, const int *capacity, FILE *f)
+{
+  write_device_info(f, snap);
+  write_decode(f, snap);
+  write_encode(f, snap, capacity);
+  fprintf(f, "# EOF\n");
+
+  return ferror(f) ? -1 : 0;
+}
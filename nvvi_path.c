@@ -0,0 +1,160 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Zero-conversion paths from decoder surfaces to encoder input formats,
+ * worked out from a snapshot alone. No driver calls are made.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+#include "nvvideoinfo.h"
+
+#define NO_CAP -1
+
+/* Surface and input format pairs with the same memory layout */
+static const struct {
+  int surface;                  /* cudaVideoSurfaceFormat */
+  uint32_t input;               /* NV_ENC_BUFFER_FORMAT */
+  int chroma_format;
+  int max_depth;                /* significant bits the encoder reads */
+  int chroma_cap;               /* NV_ENC_CAPS the encoder needs, or NO_CAP */
+  const char *chroma_name;
+} layouts[] = {
+  { cudaVideoSurfaceFormat_NV12, NV_ENC_BUFFER_FORMAT_NV12, cudaVideoChromaFormat_420, 8,
+    NO_CAP, NULL },
+  { cudaVideoSurfaceFormat_P016, NV_ENC_BUFFER_FORMAT_YUV420_10BIT, cudaVideoChromaFormat_420, 10,
+    NO_CAP, NULL },
+  { cudaVideoSurfaceFormat_YUV444, NV_ENC_BUFFER_FORMAT_YUV444, cudaVideoChromaFormat_444, 8,
+    NV_ENC_CAPS_SUPPORT_YUV444_ENCODE, "4:4:4" },
+  { cudaVideoSurfaceFormat_YUV444_16Bit, NV_ENC_BUFFER_FORMAT_YUV444_10BIT,
+    cudaVideoChromaFormat_444, 10, NV_ENC_CAPS_SUPPORT_YUV444_ENCODE, "4:4:4" },
+#if NVDECAPI_MAJOR_VERSION > 12 && NVENCAPI_MAJOR_VERSION > 12
+  { cudaVideoSurfaceFormat_NV16, NV_ENC_BUFFER_FORMAT_NV16, cudaVideoChromaFormat_422, 8,
+    NV_ENC_CAPS_SUPPORT_YUV422_ENCODE, "4:2:2" },
+  { cudaVideoSurfaceFormat_P216, NV_ENC_BUFFER_FORMAT_P210, cudaVideoChromaFormat_422, 10,
+    NV_ENC_CAPS_SUPPORT_YUV422_ENCODE, "4:2:2" },
+#endif
+};
+
+#define NUM_LAYOUTS (int)(sizeof(layouts) / sizeof(layouts[0]))
+
+
+/* Why the encoder can't read layout i as is, or NULL if it can */
+static const char *layout_refused(const nvvi_encode_codec *enc, int i)
+{
+  if (layouts[i].chroma_cap != NO_CAP && enc->caps[layouts[i].chroma_cap] <= 0) {
+    return layouts[i].chroma_name;
+  }
+  if (layouts[i].max_depth > 8 && enc->caps[NV_ENC_CAPS_SUPPORT_10BIT_ENCODE] <= 0) {
+    return "10-bit";
+  }
+  if (!(enc->input_formats & layouts[i].input)) {
+    return nvvi_encode_format_name(layouts[i].input);
+  }
+  return NULL;
+}
+
+
+int nvvi_format_path_find(const nvvi_decode_caps *dec, const nvvi_encode_codec *enc,
+                          nvvi_format_path *path)
+{
+  int best_score = -1;
+  int refused_score = -1;
+
+  memset(path, 0, sizeof(*path));
+  path->codec = dec->codec;
+  path->chroma_format = dec->chroma_format;
+  path->bit_depth = dec->bit_depth;
+  path->encode_codec = nvvi_decode_codec_from_name(enc->name);
+  path->surface_format = -1;
+
+  if (!dec->output_format_mask) {
+    snprintf(path->detail, sizeof(path->detail), "decoder reports no output formats");
+    return -1;
+  }
+
+  for (int surface = 0; surface < 32; surface++) {
+    if (!(dec->output_format_mask & (1u << surface))) {
+      continue;
+    }
+
+    int i = 0;
+    while (i < NUM_LAYOUTS && layouts[i].surface != surface) {
+      i++;
+    }
+    if (i == NUM_LAYOUTS) {
+      if (refused_score < 0) {
+        snprintf(path->detail, sizeof(path->detail), "no encoder input reads %s",
+                 nvvi_surface_format_name(surface));
+        refused_score = 0;
+      }
+      continue;
+    }
+
+    /* Most chroma first, then most depth, then the smaller surface */
+    int chroma = MIN(dec->chroma_format, layouts[i].chroma_format);
+    int depth = MIN(dec->bit_depth, layouts[i].max_depth);
+    int score = (chroma == dec->chroma_format) * 1000 + depth * 10 - (layouts[i].max_depth > 8);
+
+    const char *refused = layout_refused(enc, i);
+    if (refused) {
+      if (score > refused_score) {
+        snprintf(path->detail, sizeof(path->detail), "%s surface, no %s input",
+                 nvvi_surface_format_name(surface), refused);
+        refused_score = score;
+      }
+      continue;
+    }
+    if (score > best_score) {
+      path->surface_format = surface;
+      path->input_format = layouts[i].input;
+      path->out_chroma_format = chroma;
+      path->out_bit_depth = depth;
+      best_score = score;
+    }
+  }
+
+  if (best_score < 0) {
+    return -1;
+  }
+  path->detail[0] = '\0';
+  return 0;
+}
+
+
+int nvvi_format_paths(const nvvi_device *device, nvvi_format_path *paths, int max)
+{
+  int count = 0;
+
+  if (device->decode_status != 0 || device->encode_status != 0) {
+    return 0;
+  }
+  for (int i = 0; i < device->num_decode_caps; i++) {
+    for (int j = 0; j < device->num_encode_codecs && count < max; j++) {
+      nvvi_format_path_find(&device->decode_caps[i], &device->encode_codecs[j], &paths[count++]);
+    }
+  }
+  return count;
+}
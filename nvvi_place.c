@@ -0,0 +1,597 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Greedy placement of transcode jobs onto the devices of a snapshot, and
+ * the job manifest reader.
+ *
+ * Every job is costed against every device once, up front, as a fraction
+ * of the device's decode and encode budgets (or rejected with a reason).
+ * Placement then only adds fractions, so thousands of jobs across a node
+ * take a few milliseconds.
+ *
+ * Admission is the same placement one job at a time, against loads that
+ * also go down again as reservations are released. Devices are indexed
+ * once when it is opened, so a reservation costs the job on each device
+ * and nothing else.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+#include "nvvideoinfo.h"
+#include "nvvi_internal.h"
+
+#define PLACE_CODECS 32         /* covers every cudaVideoCodec a decoder reports */
+
+typedef struct {
+  const nvvi_decode_caps *dec[PLACE_CODECS][4][3];     /* codec, chroma, (depth - 8) / 2 */
+  const nvvi_encode_codec *enc[PLACE_CODECS];
+} device_index;
+
+typedef struct {
+  double decode;                /* fractions of the device's budgets */
+  double encode;
+  uint64_t memory;              /* bytes, if memory is accounted */
+  int ok;
+} job_cost;
+
+struct nvvi_admission {
+  const nvvi_snapshot *snap;
+  nvvi_place_options opts;
+  nvvi_memory_model *memory;    /* per device, NULL if not accounted */
+  device_index *index;
+  nvvi_device_load *loads;
+};
+
+
+static void index_device(const nvvi_device *device, device_index *index)
+{
+  memset(index, 0, sizeof(*index));
+
+  for (int i = 0; i < device->num_decode_caps; i++) {
+    const nvvi_decode_caps *caps = &device->decode_caps[i];
+    int depth = (caps->bit_depth - 8) / 2;
+    if (caps->codec >= 0 && caps->codec < PLACE_CODECS && caps->chroma_format >= 0 &&
+        caps->chroma_format < 4 && depth >= 0 && depth < 3) {
+      index->dec[caps->codec][caps->chroma_format][depth] = caps;
+    }
+  }
+  for (int i = 0; i < device->num_encode_codecs; i++) {
+    int codec = nvvi_decode_codec_from_name(device->encode_codecs[i].name);
+    if (codec >= 0 && codec < PLACE_CODECS) {
+      index->enc[codec] = &device->encode_codecs[i];
+    }
+  }
+}
+
+
+/* The surface a decoder has to produce for the input to reach the encoder */
+static unsigned int decode_surfaces(int chroma_format, int bit_depth)
+{
+  switch (chroma_format) {
+  case cudaVideoChromaFormat_444:
+    return 1u << (bit_depth > 8 ? cudaVideoSurfaceFormat_YUV444_16Bit : cudaVideoSurfaceFormat_YUV444);
+  case cudaVideoChromaFormat_420:
+  case cudaVideoChromaFormat_Monochrome:
+    return 1u << (bit_depth > 8 ? cudaVideoSurfaceFormat_P016 : cudaVideoSurfaceFormat_NV12);
+  default:
+    /* 4:2:2 surfaces depend on the SDK; take whatever is offered */
+    return ~0u;
+  }
+}
+
+
+/* With verified_only, anything nvvi_verify() didn't pass is as good as missing */
+static int check_verified(const nvvi_verify_result *verify, const char *what,
+                          char *reason, size_t len)
+{
+  if (verify->result == NVVI_VERIFY_PASS) {
+    return 0;
+  }
+  snprintf(reason, len, "%s %s", what,
+           verify->result == NVVI_VERIFY_FAIL ? "failed verification" : "not verified");
+  return -1;
+}
+
+
+static int cost_decode(const nvvi_job *job, const device_index *index,
+                       const nvvi_place_options *opts, job_cost *cost, char *reason, size_t len)
+{
+  const nvvi_rendition *in = &job->input;
+  int depth = (in->bit_depth - 8) / 2;
+  const nvvi_decode_caps *dec = NULL;
+
+  if (job->codec >= 0 && job->codec < PLACE_CODECS && job->chroma_format >= 0 &&
+      job->chroma_format < 4 && depth >= 0 && depth < 3) {
+    dec = index->dec[job->codec][job->chroma_format][depth];
+  }
+  if (!dec) {
+    snprintf(reason, len, "no %s %s %d-bit decoder", nvvi_decode_codec_name(job->codec),
+             nvvi_chroma_format_name(job->chroma_format), in->bit_depth);
+    return -1;
+  }
+  if (opts->verified_only && check_verified(&dec->verify, "decoder", reason, len) != 0) {
+    return -1;
+  }
+  if (nvvi_plan_decode_limits(dec, in, reason, len) != 0) {
+    return -1;
+  }
+  if (dec->output_format_mask && !(dec->output_format_mask &
+                                   decode_surfaces(job->chroma_format, in->bit_depth))) {
+    snprintf(reason, len, "decoder only outputs %s",
+             nvvi_surface_formats_name(dec->output_format_mask));
+    return -1;
+  }
+
+  double rate = nvvi_plan_decode_rate(dec);
+  if (rate <= 0) {
+    snprintf(reason, len, "no rate model for %s decode", nvvi_decode_codec_name(job->codec));
+    return -1;
+  }
+  cost->decode = nvvi_plan_sample_rate(job->codec, in) / rate;
+  return 0;
+}
+
+
+static int cost_encode(const nvvi_job *job, const device_index *index,
+                       const nvvi_place_options *opts, job_cost *cost, char *reason, size_t len)
+{
+  const nvvi_encode_codec *enc = NULL;
+  const char *name = nvvi_decode_codec_name(job->out_codec);
+
+  if (job->out_codec >= 0 && job->out_codec < PLACE_CODECS) {
+    enc = index->enc[job->out_codec];
+  }
+  if (!enc) {
+    snprintf(reason, len, "no %s encoder", name);
+    return -1;
+  }
+  if (opts->verified_only) {
+    int deep = 0;
+    for (int i = 0; i < job->num_outputs; i++) {
+      deep |= job->outputs[i].bit_depth > 8;
+    }
+    if (check_verified(&enc->verify[NVVI_VERIFY_MAX_SIZE], "encoder", reason, len) != 0 ||
+        (deep && check_verified(&enc->verify[NVVI_VERIFY_10BIT], "10-bit encode",
+                                reason, len) != 0)) {
+      return -1;
+    }
+  }
+
+  if (job->preset[0]) {
+    int found = 0;
+    for (int i = 0; i < enc->num_presets; i++) {
+      found |= strcasecmp(enc->presets[i].name, job->preset) == 0;
+    }
+    if (!found) {
+      snprintf(reason, len, "no %s preset %s", name, job->preset);
+      return -1;
+    }
+  }
+
+  double rate = nvvi_plan_encode_rate(enc);
+  if (rate <= 0) {
+    snprintf(reason, len, "no MB/s limit reported for %s", name);
+    return -1;
+  }
+
+  cost->encode = 0;
+  for (int i = 0; i < job->num_outputs; i++) {
+    const nvvi_rendition *out = &job->outputs[i];
+    uint32_t format = out->bit_depth > 8 ? NV_ENC_BUFFER_FORMAT_YUV420_10BIT
+                                         : NV_ENC_BUFFER_FORMAT_NV12;
+
+    if (nvvi_plan_encode_limits(enc, out, reason, len) != 0) {
+      return -1;
+    }
+    if (!(enc->input_formats & format)) {
+      snprintf(reason, len, "%s encoder doesn't take %s", name, nvvi_encode_format_name(format));
+      return -1;
+    }
+    cost->encode += ((out->width + 15) / 16) * ((out->height + 15) / 16) * out->fps / rate;
+  }
+  return 0;
+}
+
+
+static uint64_t cost_memory(const nvvi_job *job, const nvvi_memory_model *memory)
+{
+  const nvvi_rendition *in = &job->input;
+  double bytes = memory->decode_bytes_per_mb * ((in->width + 15) / 16) * ((in->height + 15) / 16);
+
+  for (int i = 0; i < job->num_outputs; i++) {
+    const nvvi_rendition *out = &job->outputs[i];
+    bytes += memory->encode_bytes_per_mb * ((out->width + 15) / 16) * ((out->height + 15) / 16);
+  }
+  return bytes;
+}
+
+
+/* The larger of the device's two loads with the job on it, or -1 and why it doesn't fit */
+static int fit_job(const nvvi_device_load *load, const job_cost *c, int sessions,
+                   const nvvi_place_options *opts, const nvvi_memory_model *memory,
+                   double *score, char *reason, size_t len)
+{
+  double limit = 1 - opts->headroom;
+  double dec = load->decode_load + c->decode;
+  double enc = load->encode_load + c->encode;
+
+  if (dec > limit + 1e-9) {
+    snprintf(reason, len, "decode budget full");
+    return -1;
+  }
+  if (enc > limit + 1e-9) {
+    snprintf(reason, len, "encode budget full");
+    return -1;
+  }
+  if (opts->max_sessions && load->sessions + sessions > opts->max_sessions) {
+    snprintf(reason, len, "no encode sessions left");
+    return -1;
+  }
+  if (memory && memory->budget_bytes &&
+      load->memory_bytes + c->memory > memory->budget_bytes * limit) {
+    snprintf(reason, len, "device memory full");
+    return -1;
+  }
+  *score = dec > enc ? dec : enc;
+  return 0;
+}
+
+
+typedef struct {
+  double size;                  /* cost on the device the job fits best */
+  int job;
+} job_order;
+
+
+static int compare_jobs(const void *a, const void *b)
+{
+  const job_order *x = a;
+  const job_order *y = b;
+
+  /* Largest first; the job index keeps the order stable */
+  if (x->size != y->size) {
+    return x->size < y->size ? 1 : -1;
+  }
+  return x->job - y->job;
+}
+
+
+int nvvi_place(const nvvi_snapshot *snap, const nvvi_job *jobs, int num_jobs,
+               const nvvi_place_options *opts, nvvi_placement *placements,
+               nvvi_device_load *loads)
+{
+  int devices = snap->num_devices;
+  device_index *index = calloc(devices + 1, sizeof(*index));
+  job_cost *costs = calloc((size_t)num_jobs * devices + 1, sizeof(*costs));
+  job_order *order = calloc(num_jobs + 1, sizeof(*order));
+  char full[64];
+  int unplaced = 0;
+
+  if (!index || !costs || !order) {
+    free(index);
+    free(costs);
+    free(order);
+    return -1;
+  }
+
+  memset(loads, 0, devices * sizeof(*loads));
+  for (int d = 0; d < devices; d++) {
+    index_device(&snap->devices[d], &index[d]);
+  }
+
+  for (int j = 0; j < num_jobs; j++) {
+    nvvi_placement *p = &placements[j];
+
+    p->device = -1;
+    snprintf(p->reason, sizeof(p->reason), "no devices");
+    for (int d = 0; d < devices; d++) {
+      job_cost *c = &costs[(size_t)j * devices + d];
+      if (cost_decode(&jobs[j], &index[d], opts, c, p->reason, sizeof(p->reason)) == 0 &&
+          cost_encode(&jobs[j], &index[d], opts, c, p->reason, sizeof(p->reason)) == 0) {
+        c->ok = 1;
+      }
+    }
+  }
+
+  for (int j = 0; j < num_jobs; j++) {
+    order[j].job = j;
+    order[j].size = 2;
+    for (int d = 0; d < devices; d++) {
+      const job_cost *c = &costs[(size_t)j * devices + d];
+      double size = c->decode > c->encode ? c->decode : c->encode;
+      if (c->ok && size < order[j].size) {
+        order[j].size = size;
+      }
+    }
+  }
+  qsort(order, num_jobs, sizeof(*order), compare_jobs);
+
+  for (int k = 0; k < num_jobs; k++) {
+    int j = order[k].job;
+    const nvvi_job *job = &jobs[j];
+    nvvi_placement *p = &placements[j];
+    double best = 0;
+    int eligible = 0;
+
+    for (int d = 0; d < devices; d++) {
+      const job_cost *c = &costs[(size_t)j * devices + d];
+      nvvi_device_load *load = &loads[d];
+      if (!c->ok) {
+        continue;
+      }
+      eligible = 1;
+
+      double score;
+      if (fit_job(load, c, job->num_outputs, opts, NULL, &score, full, sizeof(full)) != 0) {
+        continue;
+      }
+      if (p->device < 0 ||
+          (opts->policy == NVVI_PLACE_PACK ? score > best : score < best)) {
+        p->device = d;
+        best = score;
+      }
+    }
+
+    if (p->device < 0) {
+      if (eligible) {
+        snprintf(p->reason, sizeof(p->reason), "no device has room left");
+      }
+      unplaced++;
+      continue;
+    }
+    p->reason[0] = '\0';
+
+    const job_cost *c = &costs[(size_t)j * devices + p->device];
+    loads[p->device].jobs++;
+    loads[p->device].sessions += job->num_outputs;
+    loads[p->device].decode_load += c->decode;
+    loads[p->device].encode_load += c->encode;
+  }
+
+  free(index);
+  free(costs);
+  free(order);
+  return unplaced;
+}
+
+
+nvvi_admission *nvvi_admission_open(const nvvi_snapshot *snap, const nvvi_place_options *opts,
+                                    const nvvi_memory_model *memory)
+{
+  int devices = snap->num_devices;
+  nvvi_admission *adm = calloc(1, sizeof(*adm));
+  if (!adm) {
+    return NULL;
+  }
+  adm->snap = snap;
+  adm->opts = *opts;
+  adm->index = calloc(devices + 1, sizeof(*adm->index));
+  adm->loads = calloc(devices + 1, sizeof(*adm->loads));
+  if (memory) {
+    adm->memory = calloc(devices + 1, sizeof(*adm->memory));
+  }
+  if (!adm->index || !adm->loads || (memory && !adm->memory)) {
+    nvvi_admission_close(adm);
+    return NULL;
+  }
+  if (memory) {
+    memcpy(adm->memory, memory, devices * sizeof(*adm->memory));
+  }
+  for (int d = 0; d < devices; d++) {
+    index_device(&snap->devices[d], &adm->index[d]);
+  }
+  return adm;
+}
+
+
+int nvvi_admission_reserve(nvvi_admission *adm, const nvvi_job *job, nvvi_reservation *res,
+                           char *reason, size_t len)
+{
+  double best = 0;
+  char unable[64];
+  int eligible = 0;
+
+  memset(res, 0, sizeof(*res));
+  res->device = -1;
+  snprintf(reason, len, "no devices");
+
+  job_cost chosen = { 0 };
+  for (int d = 0; d < adm->snap->num_devices; d++) {
+    const nvvi_memory_model *memory = adm->memory ? &adm->memory[d] : NULL;
+    job_cost c = { 0 };
+    double score;
+
+    /* Once a device could take the job, the reason is why none has room */
+    char *why = eligible ? unable : reason;
+    size_t why_len = eligible ? sizeof(unable) : len;
+    if (cost_decode(job, &adm->index[d], &adm->opts, &c, why, why_len) != 0 ||
+        cost_encode(job, &adm->index[d], &adm->opts, &c, why, why_len) != 0) {
+      continue;
+    }
+    eligible = 1;
+    if (memory) {
+      c.memory = cost_memory(job, memory);
+    }
+    if (fit_job(&adm->loads[d], &c, job->num_outputs, &adm->opts, memory,
+                &score, reason, len) != 0) {
+      continue;
+    }
+    if (res->device < 0 ||
+        (adm->opts.policy == NVVI_PLACE_PACK ? score > best : score < best)) {
+      res->device = d;
+      best = score;
+      chosen = c;
+    }
+  }
+
+  if (res->device < 0) {
+    return -1;
+  }
+  reason[0] = '\0';
+
+  nvvi_device_load *load = &adm->loads[res->device];
+  res->sessions = job->num_outputs;
+  res->decode = chosen.decode;
+  res->encode = chosen.encode;
+  res->memory_bytes = chosen.memory;
+  load->jobs++;
+  load->sessions += res->sessions;
+  load->decode_load += res->decode;
+  load->encode_load += res->encode;
+  load->memory_bytes += res->memory_bytes;
+  return 0;
+}
+
+
+void nvvi_admission_release(nvvi_admission *adm, const nvvi_reservation *res)
+{
+  if (res->device < 0 || res->device >= adm->snap->num_devices) {
+    return;
+  }
+
+  nvvi_device_load *load = &adm->loads[res->device];
+  load->jobs--;
+  load->sessions -= res->sessions;
+  load->decode_load -= res->decode;
+  load->encode_load -= res->encode;
+  load->memory_bytes -= res->memory_bytes;
+  if (load->jobs == 0) {
+    /* Don't let rounding accumulate over a long-running daemon */
+    memset(load, 0, sizeof(*load));
+  }
+}
+
+
+const nvvi_device_load *nvvi_admission_loads(const nvvi_admission *adm)
+{
+  return adm->loads;
+}
+
+
+void nvvi_admission_close(nvvi_admission *adm)
+{
+  if (!adm) {
+    return;
+  }
+  free(adm->index);
+  free(adm->loads);
+  free(adm->memory);
+  free(adm);
+}
+
+
+static int parse_rendition(nvvi_rendition *r, const char *str)
+{
+  int n = 0;
+
+  memset(r, 0, sizeof(*r));
+  r->bit_depth = 8;
+  if (sscanf(str, "%ux%u@%lf%n", &r->width, &r->height, &r->fps, &n) != 3 ||
+      !r->width || !r->height || r->fps <= 0) {
+    return -1;
+  }
+  if (str[n] == ':' && sscanf(str + n + 1, "%d", &r->bit_depth) != 1) {
+    return -1;
+  }
+  return 0;
+}
+
+
+int nvvi_job_parse(nvvi_job *job, const char *line)
+{
+  char name[NVVI_NAME_LEN], codec[16], chroma[16], input[64];
+  char out_codec[16], preset[NVVI_NAME_LEN], ladder[512];
+  int depth;
+
+  memset(job, 0, sizeof(*job));
+  if (sscanf(line, "job %31s %15s %15s %d %63s %15s %31s %511s", name, codec, chroma,
+             &depth, input, out_codec, preset, ladder) != 8) {
+    return -1;
+  }
+
+  snprintf(job->name, sizeof(job->name), "%s", name);
+  job->codec = nvvi_decode_codec_from_name(codec);
+  job->chroma_format = nvvi_chroma_format_from_name(chroma);
+  job->out_codec = nvvi_decode_codec_from_name(out_codec);
+  if (job->codec < 0 || job->chroma_format < 0 || job->out_codec < 0 ||
+      parse_rendition(&job->input, input) != 0) {
+    return -1;
+  }
+  job->input.bit_depth = depth;
+  if (strcmp(preset, "-") != 0) {
+    snprintf(job->preset, sizeof(job->preset), "%s", preset);
+  }
+
+  for (char *rung = strtok(ladder, ","); rung; rung = strtok(NULL, ",")) {
+    if (job->num_outputs == NVVI_MAX_LADDER ||
+        parse_rendition(&job->outputs[job->num_outputs++], rung) != 0) {
+      return -1;
+    }
+  }
+  return job->num_outputs > 0 ? 0 : -1;
+}
+
+
+int nvvi_jobs_load(FILE *f, nvvi_job **jobs, int *num_jobs)
+{
+  char line[1024];
+  int lineno = 0;
+  int size = 0;
+  int ret = 0;
+
+  *jobs = NULL;
+  *num_jobs = 0;
+  while (fgets(line, sizeof(line), f)) {
+    char *p = line + strspn(line, " \t");
+    lineno++;
+
+    if (*p == '#' || *p == '\n' || !*p) {
+      continue;
+    }
+    if (*num_jobs == size) {
+      size = size ? size * 2 : 256;
+      nvvi_job *grown = realloc(*jobs, size * sizeof(nvvi_job));
+      if (!grown) {
+        ret = -1;
+        break;
+      }
+      *jobs = grown;
+    }
+    if (nvvi_job_parse(&(*jobs)[*num_jobs], p) != 0) {
+      fprintf(stderr, "Invalid job on line %d: %s", lineno, p);
+      ret = -1;
+      break;
+    }
+    (*num_jobs)++;
+  }
+
+  if (ret != 0) {
+    free(*jobs);
+    *jobs = NULL;
+    *num_jobs = 0;
+  }
+  return ret;
+}
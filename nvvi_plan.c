@@ -0,0 +1,435 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Stream capacity planning from the limits in a snapshot and the level
+ * tables of the H.264 (Table A-1), HEVC (Table A.8) and AV1 (Annex A.3)
+ * specifications. No driver calls are made.
+ *
+ * Levels are kept in luma samples throughout, so H.264's macroblock limits
+ * are multiplied out by 256 and the three codecs share one code path.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+#include "nvvideoinfo.h"
+#include "nvvi_internal.h"
+
+typedef struct {
+  const char *name;
+  int nv_level;                 /* NV_ENC_LEVEL value, as NV_ENC_CAPS_LEVEL_MAX reports it */
+  uint64_t max_samples;         /* luma samples per picture */
+  uint64_t max_rate;            /* luma samples per second */
+  unsigned int max_width;       /* 0: sqrt(8 * max_samples) */
+  unsigned int max_height;
+} plan_level;
+
+#define H264_LEVEL(name, idc, fs, mbps) { name, idc, (fs) * 256ull, (mbps) * 256ull, 0, 0 }
+
+static const plan_level h264_levels[] = {
+  H264_LEVEL("1",   10,     99,     1485),
+  H264_LEVEL("1b",   9,     99,     1485),
+  H264_LEVEL("1.1", 11,    396,     3000),
+  H264_LEVEL("1.2", 12,    396,     6000),
+  H264_LEVEL("1.3", 13,    396,    11880),
+  H264_LEVEL("2",   20,    396,    11880),
+  H264_LEVEL("2.1", 21,    792,    19800),
+  H264_LEVEL("2.2", 22,   1620,    20250),
+  H264_LEVEL("3",   30,   1620,    40500),
+  H264_LEVEL("3.1", 31,   3600,   108000),
+  H264_LEVEL("3.2", 32,   5120,   216000),
+  H264_LEVEL("4",   40,   8192,   245760),
+  H264_LEVEL("4.1", 41,   8192,   245760),
+  H264_LEVEL("4.2", 42,   8704,   522240),
+  H264_LEVEL("5",   50,  22080,   589824),
+  H264_LEVEL("5.1", 51,  36864,   983040),
+  H264_LEVEL("5.2", 52,  36864,  2073600),
+  H264_LEVEL("6",   60, 139264,  4177920),
+  H264_LEVEL("6.1", 61, 139264,  8355840),
+  H264_LEVEL("6.2", 62, 139264, 16711680),
+};
+
+static const plan_level hevc_levels[] = {
+  { "1",   30,    36864,     552960, 0, 0 },
+  { "2",   60,   122880,    3686400, 0, 0 },
+  { "2.1", 63,   245760,    7372800, 0, 0 },
+  { "3",   90,   552960,   16588800, 0, 0 },
+  { "3.1", 93,   983040,   33177600, 0, 0 },
+  { "4",  120,  2228224,   66846720, 0, 0 },
+  { "4.1", 123, 2228224,  133693440, 0, 0 },
+  { "5",  150,  8912896,  267386880, 0, 0 },
+  { "5.1", 153, 8912896,  534773760, 0, 0 },
+  { "5.2", 156, 8912896, 1069547520, 0, 0 },
+  { "6",  180, 35651584, 1069547520, 0, 0 },
+  { "6.1", 183, 35651584, 2139095040, 0, 0 },
+  { "6.2", 186, 35651584, 4278190080ull, 0, 0 },
+};
+
+/* AV1 limits picture width and height separately; the rate is MaxDisplayRate */
+static const plan_level av1_levels[] = {
+  { "2.0",  0,   147456,    4423680,  2048, 1152 },
+  { "2.1",  1,   278784,    8363520,  2816, 1584 },
+  { "3.0",  4,   665856,   19975680,  4352, 2448 },
+  { "3.1",  5,  1065024,   31950720,  5504, 3096 },
+  { "4.0",  8,  2359296,   70778880,  6144, 3456 },
+  { "4.1",  9,  2359296,  141557760,  6144, 3456 },
+  { "5.0", 12,  8912896,  267386880,  8192, 4352 },
+  { "5.1", 13,  8912896,  534773760,  8192, 4352 },
+  { "5.2", 14,  8912896, 1069547520,  8192, 4352 },
+  { "5.3", 15,  8912896, 1069547520,  8192, 4352 },
+  { "6.0", 16, 35651584, 1069547520, 16384, 8704 },
+  { "6.1", 17, 35651584, 2139095040, 16384, 8704 },
+  { "6.2", 18, 35651584, 4278190080ull, 16384, 8704 },
+  { "6.3", 19, 35651584, 4278190080ull, 16384, 8704 },
+};
+
+#define FF_ARRAY_ELEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+
+static const plan_level *codec_levels(int codec, int *count)
+{
+  switch (codec) {
+  case cudaVideoCodec_H264:
+    *count = FF_ARRAY_ELEMS(h264_levels);
+    return h264_levels;
+  case cudaVideoCodec_HEVC:
+    *count = FF_ARRAY_ELEMS(hevc_levels);
+    return hevc_levels;
+#if NVDECAPI_MAJOR_VERSION > 10
+  case cudaVideoCodec_AV1:
+    *count = FF_ARRAY_ELEMS(av1_levels);
+    return av1_levels;
+#endif
+  default:
+    *count = 0;
+    return NULL;
+  }
+}
+
+
+static unsigned int isqrt(uint64_t n)
+{
+  uint64_t r = 0;
+  while ((r + 1) * (r + 1) <= n) {
+    r++;
+  }
+  return r;
+}
+
+
+static int level_fits(const plan_level *level, int codec, unsigned int width,
+                      unsigned int height, uint64_t samples, double rate)
+{
+  unsigned int max_w = level->max_width;
+  unsigned int max_h = level->max_height;
+
+  if (!max_w) {
+    /* H.264 bounds each dimension in macroblocks, HEVC in samples */
+    if (codec == cudaVideoCodec_H264) {
+      max_w = max_h = isqrt(level->max_samples / 256 * 8) * 16;
+    } else {
+      max_w = max_h = isqrt(level->max_samples * 8);
+    }
+  }
+  return samples <= level->max_samples && rate <= level->max_rate &&
+         width <= max_w && height <= max_h;
+}
+
+
+/* Index of the lowest level that fits, or -1 if none does */
+static int find_level(const plan_level *levels, int count, int codec, unsigned int width,
+                      unsigned int height, double fps)
+{
+  uint64_t samples = (uint64_t)width * height;
+
+  if (codec == cudaVideoCodec_H264) {
+    samples = (uint64_t)((width + 15) / 16) * ((height + 15) / 16) * 256;
+  }
+  for (int i = 0; i < count; i++) {
+    if (level_fits(&levels[i], codec, width, height, samples, samples * fps)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+double nvvi_plan_sample_rate(int codec, const nvvi_rendition *r)
+{
+  if (codec == cudaVideoCodec_H264) {
+    return ((r->width + 15) / 16) * ((r->height + 15) / 16) * 256.0 * r->fps;
+  }
+  return (double)r->width * r->height * r->fps;
+}
+
+
+int nvvi_plan_encode_limits(const nvvi_encode_codec *enc, const nvvi_rendition *r,
+                            char *detail, size_t len)
+{
+  const int *caps = enc->caps;
+  unsigned int mbs = ((r->width + 15) / 16) * ((r->height + 15) / 16);
+
+  if (r->bit_depth > 8 && !caps[NV_ENC_CAPS_SUPPORT_10BIT_ENCODE]) {
+    snprintf(detail, len, "no %d-bit encode", r->bit_depth);
+    return -1;
+  }
+  if (r->width > caps[NV_ENC_CAPS_WIDTH_MAX] || r->height > caps[NV_ENC_CAPS_HEIGHT_MAX]) {
+    snprintf(detail, len, "exceeds %dx%d maximum",
+             caps[NV_ENC_CAPS_WIDTH_MAX], caps[NV_ENC_CAPS_HEIGHT_MAX]);
+    return -1;
+  }
+  if (r->width < caps[NV_ENC_CAPS_WIDTH_MIN] || r->height < caps[NV_ENC_CAPS_HEIGHT_MIN]) {
+    snprintf(detail, len, "below %dx%d minimum",
+             caps[NV_ENC_CAPS_WIDTH_MIN], caps[NV_ENC_CAPS_HEIGHT_MIN]);
+    return -1;
+  }
+  if (caps[NV_ENC_CAPS_MB_NUM_MAX] && mbs > caps[NV_ENC_CAPS_MB_NUM_MAX]) {
+    snprintf(detail, len, "%u MBs exceeds %d maximum", mbs, caps[NV_ENC_CAPS_MB_NUM_MAX]);
+    return -1;
+  }
+  return 0;
+}
+
+
+int nvvi_plan_encode_engines(const nvvi_encode_codec *enc)
+{
+#if NVENCAPI_MAJOR_VERSION > 10
+  if (enc->caps[NV_ENC_CAPS_NUM_ENCODER_ENGINES] > 0) {
+    return enc->caps[NV_ENC_CAPS_NUM_ENCODER_ENGINES];
+  }
+#endif
+  return 1;
+}
+
+
+double nvvi_plan_encode_rate(const nvvi_encode_codec *enc)
+{
+  return (double)enc->caps[NV_ENC_CAPS_MB_PER_SEC_MAX] * nvvi_plan_encode_engines(enc);
+}
+
+
+int nvvi_plan_decode_limits(const nvvi_decode_caps *dec, const nvvi_rendition *r,
+                            char *detail, size_t len)
+{
+  unsigned int mbs = ((r->width + 15) / 16) * ((r->height + 15) / 16);
+
+  if (r->width > dec->max_width || r->height > dec->max_height) {
+    snprintf(detail, len, "exceeds %ux%u maximum", dec->max_width, dec->max_height);
+    return -1;
+  }
+  if (r->width < dec->min_width || r->height < dec->min_height) {
+    snprintf(detail, len, "below %ux%u minimum", dec->min_width, dec->min_height);
+    return -1;
+  }
+  if (dec->max_mb_count && mbs > dec->max_mb_count) {
+    snprintf(detail, len, "%u MBs exceeds %u maximum", mbs, dec->max_mb_count);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*
+ * NVDEC reports no throughput. Assume it runs the level its largest
+ * picture needs at that level's full rate, which is what it would have to
+ * do to decode a conforming stream of that size.
+ */
+static int decode_level(const nvvi_decode_caps *dec)
+{
+  int count;
+  const plan_level *levels = codec_levels(dec->codec, &count);
+  uint64_t max_samples = (uint64_t)dec->max_width * dec->max_height;
+
+  if (!levels) {
+    return -1;
+  }
+  if (dec->max_mb_count && (uint64_t)dec->max_mb_count * 256 < max_samples) {
+    max_samples = (uint64_t)dec->max_mb_count * 256;
+  }
+  int max_level = count - 1;
+  for (int i = count - 1; i >= 0 && levels[i].max_samples >= max_samples; i--) {
+    max_level = i;
+  }
+  return max_level;
+}
+
+
+double nvvi_plan_decode_rate(const nvvi_decode_caps *dec)
+{
+  int count;
+  const plan_level *levels = codec_levels(dec->codec, &count);
+  int level = decode_level(dec);
+
+  return level < 0 ? 0 : levels[level].max_rate;
+}
+
+
+/*
+ * plan_encode() and plan_decode() fill in plan and return the index of the
+ * highest level the device handles for the codec, or -1 if unknown.
+ */
+static int plan_encode(const nvvi_device *device, int codec, const nvvi_rendition *r,
+                       nvvi_plan *plan)
+{
+  const nvvi_encode_codec *enc = NULL;
+
+  for (int i = 0; i < device->num_encode_codecs; i++) {
+    if (nvvi_decode_codec_from_name(device->encode_codecs[i].name) == codec) {
+      enc = &device->encode_codecs[i];
+    }
+  }
+  if (!enc) {
+    snprintf(plan->detail, sizeof(plan->detail), "no encoder");
+    return -1;
+  }
+  if (nvvi_plan_encode_limits(enc, r, plan->detail, sizeof(plan->detail)) != 0) {
+    return -1;
+  }
+  plan->supported = 1;
+
+  int engines = nvvi_plan_encode_engines(enc);
+  double rate = nvvi_plan_encode_rate(enc);
+  if (rate > 0 && r->fps > 0) {
+    plan->streams = rate / (((r->width + 15) / 16) * ((r->height + 15) / 16) * r->fps);
+    snprintf(plan->detail, sizeof(plan->detail), "%d MB/s x %d engine%s",
+             enc->caps[NV_ENC_CAPS_MB_PER_SEC_MAX], engines, engines > 1 ? "s" : "");
+  } else {
+    snprintf(plan->detail, sizeof(plan->detail), "no MB/s limit reported");
+  }
+
+  /* The highest level this encoder will signal */
+  int count;
+  const plan_level *levels = codec_levels(codec, &count);
+  for (int i = 0; i < count; i++) {
+    if (levels[i].nv_level == enc->caps[NV_ENC_CAPS_LEVEL_MAX]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+static int plan_decode(const nvvi_device *device, int codec, const nvvi_rendition *r,
+                       nvvi_plan *plan)
+{
+  const nvvi_decode_caps *dec = NULL;
+
+  for (int i = 0; i < device->num_decode_caps; i++) {
+    const nvvi_decode_caps *caps = &device->decode_caps[i];
+    if (caps->codec == codec && caps->chroma_format == cudaVideoChromaFormat_420 &&
+        caps->bit_depth == r->bit_depth) {
+      dec = caps;
+    }
+  }
+  if (!dec) {
+    snprintf(plan->detail, sizeof(plan->detail), "no %d-bit 4:2:0 decoder", r->bit_depth);
+    return -1;
+  }
+  if (nvvi_plan_decode_limits(dec, r, plan->detail, sizeof(plan->detail)) != 0) {
+    return -1;
+  }
+  plan->supported = 1;
+
+  int count;
+  const plan_level *levels = codec_levels(codec, &count);
+  int max_level = decode_level(dec);
+  if (r->fps > 0) {
+    plan->streams = levels[max_level].max_rate / nvvi_plan_sample_rate(codec, r);
+  }
+  snprintf(plan->detail, sizeof(plan->detail), "level %s rate", levels[max_level].name);
+  return max_level;
+}
+
+
+void nvvi_plan_latency(const nvvi_encode_codec *enc, const nvvi_preset_config *config,
+                       const nvvi_rendition *r, nvvi_latency *latency)
+{
+  const int *caps = enc->caps;
+  unsigned int mbs = ((r->width + 15) / 16) * ((r->height + 15) / 16);
+
+  memset(latency, 0, sizeof(*latency));
+  latency->reorder = MIN(config->b_frames, caps[NV_ENC_CAPS_NUM_MAX_BFRAMES]);
+  if (caps[NV_ENC_CAPS_SUPPORT_LOOKAHEAD]) {
+    latency->lookahead = config->lookahead;
+  }
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
+  if (caps[NV_ENC_CAPS_SUPPORT_TEMPORAL_FILTER]) {
+    /* The level is the window size, centred on the current frame */
+    latency->temporal_filter = config->temporal_filter / 2;
+  }
+#endif
+  latency->frames = latency->lookahead + MAX(latency->reorder, latency->temporal_filter);
+
+  if (r->fps > 0) {
+    latency->frame_ms = 1000 / r->fps;
+  }
+  if (caps[NV_ENC_CAPS_MB_PER_SEC_MAX] > 0) {
+    latency->min_ms = 1000.0 * mbs / caps[NV_ENC_CAPS_MB_PER_SEC_MAX];
+  }
+  latency->encode_ms = latency->min_ms;
+#if NVENCAPI_MAJOR_VERSION > 10
+  if (config->multipass == NV_ENC_TWO_PASS_QUARTER_RESOLUTION) {
+    latency->encode_ms *= 1.25;
+  } else if (config->multipass == NV_ENC_TWO_PASS_FULL_RESOLUTION) {
+    latency->encode_ms *= 2;
+  }
+#endif
+  latency->ms = latency->frames * latency->frame_ms + latency->encode_ms;
+}
+
+
+int nvvi_plan_rendition(const nvvi_device *device, int encode, int codec,
+                        const nvvi_rendition *rendition, nvvi_plan *plan)
+{
+  nvvi_rendition r = *rendition;
+  int count;
+  const plan_level *levels = codec_levels(codec, &count);
+
+  memset(plan, 0, sizeof(*plan));
+  plan->streams = -1;
+  if (!levels) {
+    return -1;
+  }
+  if (!r.bit_depth) {
+    r.bit_depth = 8;
+  }
+
+  int level = find_level(levels, count, codec, r.width, r.height, r.fps);
+  if (level >= 0) {
+    snprintf(plan->level, sizeof(plan->level), "%s", levels[level].name);
+  }
+
+  int max_level;
+  if (encode) {
+    max_level = plan_encode(device, codec, &r, plan);
+  } else {
+    max_level = plan_decode(device, codec, &r, plan);
+  }
+
+  plan->level_exceeded = level < 0 || (max_level >= 0 && level > max_level);
+  if (max_level >= 0) {
+    snprintf(plan->max_level, sizeof(plan->max_level), "%s", levels[max_level].name);
+  }
+  return 0;
+}
@@ -0,0 +1,359 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Shared-memory snapshot.
+ *
+ * The segment is a header, the devices and the live encoder capacity, in
+ * the in-memory layout of this build. Every write is bracketed by the
+ * sequence counter going odd and back to even; readers copy what they need
+ * and retry if the counter moved or was odd, so they never block the
+ * publisher and never take a lock or make a syscall.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvvideoinfo.h"
+
+#define NVVI_SHM_MAGIC   "NVVISHM"
+#define NVVI_SHM_VERSION 1
+
+/* A write copies a few hundred KiB; a writer odd for this long has died mid-write */
+#define SHM_MAX_SPINS    (1 << 26)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t device_size;
+  uint32_t num_devices;
+
+  _Atomic uint64_t seq;         /* odd while the publisher is writing */
+  uint64_t generation;          /* bumped for every new snapshot, not for capacity */
+  uint64_t updated_ns;          /* CLOCK_REALTIME of the last write */
+
+  uint32_t flags;
+  uint32_t nvenc_max_version;
+  char driver_version[32];
+} shm_header;
+
+struct nvvi_shm {
+  char name[256];
+  void *map;
+  size_t size;
+  int writable;
+};
+
+
+static size_t shm_size(int num_devices)
+{
+  return sizeof(shm_header) + num_devices * sizeof(nvvi_device) +
+         num_devices * NVVI_MAX_ENCODE_CODECS * sizeof(int);
+}
+
+
+static shm_header *shm_hdr(const nvvi_shm *shm)
+{
+  return shm->map;
+}
+
+
+static nvvi_device *shm_devices(const nvvi_shm *shm)
+{
+  return (nvvi_device *)(shm_hdr(shm) + 1);
+}
+
+
+static int *shm_capacity(const nvvi_shm *shm)
+{
+  return (int *)(shm_devices(shm) + shm_hdr(shm)->num_devices);
+}
+
+
+/* Names are "/name"; accept them without the slash too */
+static void shm_name(char *dst, size_t len, const char *name)
+{
+  snprintf(dst, len, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+
+static void write_begin(shm_header *header)
+{
+  atomic_fetch_add_explicit(&header->seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+
+static void write_end(shm_header *header)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header->updated_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  atomic_fetch_add_explicit(&header->seq, 1, memory_order_release);
+}
+
+
+/* The even sequence number to check the copy against; -1 if the writer never finishes */
+static int read_begin(const shm_header *header, uint64_t *seq)
+{
+  for (long spins = 0; spins < SHM_MAX_SPINS; spins++) {
+    *seq = atomic_load_explicit(&((shm_header *)header)->seq, memory_order_acquire);
+    if (!(*seq & 1)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+static int read_retry(const shm_header *header, uint64_t seq)
+{
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&((shm_header *)header)->seq, memory_order_relaxed) != seq;
+}
+
+
+/* The body of a write; either part may be NULL */
+static void shm_fill(nvvi_shm *shm, const nvvi_snapshot *snap, const int *capacity)
+{
+  shm_header *header = shm_hdr(shm);
+
+  if (snap) {
+    header->generation++;
+    header->flags = snap->flags;
+    header->nvenc_max_version = snap->nvenc_max_version;
+    memcpy(header->driver_version, snap->driver_version, sizeof(header->driver_version));
+    memcpy(shm_devices(shm), snap->devices, header->num_devices * sizeof(nvvi_device));
+  }
+  if (capacity) {
+    memcpy(shm_capacity(shm), capacity,
+           header->num_devices * NVVI_MAX_ENCODE_CODECS * sizeof(int));
+  }
+}
+
+
+nvvi_shm *nvvi_shm_create(const char *name, const nvvi_snapshot *snap)
+{
+  nvvi_shm *shm = calloc(1, sizeof(*shm));
+  if (!shm) {
+    return NULL;
+  }
+  shm_name(shm->name, sizeof(shm->name), name);
+  shm->size = shm_size(snap->num_devices);
+  shm->writable = 1;
+
+  /* A fresh segment, so readers of an old one keep their consistent copy */
+  shm_unlink(shm->name);
+  int fd = shm_open(shm->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    perror(shm->name);
+    free(shm);
+    return NULL;
+  }
+  if (ftruncate(fd, shm->size) != 0) {
+    perror(shm->name);
+    close(fd);
+    shm_unlink(shm->name);
+    free(shm);
+    return NULL;
+  }
+  shm->map = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm->map == MAP_FAILED) {
+    perror(shm->name);
+    shm_unlink(shm->name);
+    free(shm);
+    return NULL;
+  }
+
+  /* Odd until the first snapshot is in, so early readers wait for it */
+  shm_header *header = shm_hdr(shm);
+  atomic_store(&header->seq, 1);
+  header->version = NVVI_SHM_VERSION;
+  header->header_size = sizeof(shm_header);
+  header->device_size = sizeof(nvvi_device);
+  header->num_devices = snap->num_devices;
+  for (int i = 0; i < snap->num_devices * NVVI_MAX_ENCODE_CODECS; i++) {
+    shm_capacity(shm)[i] = -1;
+  }
+  shm_fill(shm, snap, NULL);
+  memcpy(header->magic, NVVI_SHM_MAGIC, sizeof(header->magic));
+  write_end(header);
+
+  return shm;
+}
+
+
+int nvvi_shm_update(nvvi_shm *shm, const nvvi_snapshot *snap, const int *capacity)
+{
+  shm_header *header = shm_hdr(shm);
+
+  if (!shm->writable || (snap && snap->num_devices != (int)header->num_devices)) {
+    return -1;
+  }
+
+  write_begin(header);
+  shm_fill(shm, snap, capacity);
+  write_end(header);
+
+  return 0;
+}
+
+
+nvvi_shm *nvvi_shm_open(const char *name)
+{
+  struct stat st;
+  nvvi_shm *shm = calloc(1, sizeof(*shm));
+  if (!shm) {
+    return NULL;
+  }
+  shm_name(shm->name, sizeof(shm->name), name);
+
+  int fd = shm_open(shm->name, O_RDONLY, 0);
+  if (fd < 0) {
+    free(shm);
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(shm_header)) {
+    close(fd);
+    free(shm);
+    return NULL;
+  }
+  shm->size = st.st_size;
+  shm->map = mmap(NULL, shm->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm->map == MAP_FAILED) {
+    free(shm);
+    return NULL;
+  }
+
+  const shm_header *header = shm_hdr(shm);
+  if (memcmp(header->magic, NVVI_SHM_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != NVVI_SHM_VERSION ||
+      header->header_size != sizeof(shm_header) ||
+      header->device_size != sizeof(nvvi_device) ||
+      shm->size != shm_size(header->num_devices)) {
+    munmap(shm->map, shm->size);
+    free(shm);
+    return NULL;
+  }
+
+  return shm;
+}
+
+
+int nvvi_shm_num_devices(const nvvi_shm *shm)
+{
+  return shm_hdr(shm)->num_devices;
+}
+
+
+uint64_t nvvi_shm_generation(const nvvi_shm *shm)
+{
+  const shm_header *header = shm_hdr(shm);
+  uint64_t seq, generation;
+
+  do {
+    if (read_begin(header, &seq) != 0) {
+      return 0;
+    }
+    generation = header->generation;
+  } while (read_retry(header, seq));
+
+  return generation;
+}
+
+
+int nvvi_shm_read_device(const nvvi_shm *shm, int index, nvvi_device *device, int *capacity)
+{
+  const shm_header *header = shm_hdr(shm);
+  uint64_t seq;
+
+  if (index < 0 || index >= (int)header->num_devices) {
+    return -1;
+  }
+  do {
+    if (read_begin(header, &seq) != 0) {
+      return -1;
+    }
+    memcpy(device, &shm_devices(shm)[index], sizeof(*device));
+    if (capacity) {
+      memcpy(capacity, &shm_capacity(shm)[index * NVVI_MAX_ENCODE_CODECS],
+             NVVI_MAX_ENCODE_CODECS * sizeof(int));
+    }
+  } while (read_retry(header, seq));
+
+  return 0;
+}
+
+
+int nvvi_shm_read(const nvvi_shm *shm, nvvi_snapshot *snap, int *capacity)
+{
+  const shm_header *header = shm_hdr(shm);
+  int count = header->num_devices;
+  uint64_t seq;
+
+  memset(snap, 0, sizeof(*snap));
+  snap->devices = calloc(count + 1, sizeof(nvvi_device));
+  if (!snap->devices) {
+    return -1;
+  }
+  snap->num_devices = count;
+
+  do {
+    if (read_begin(header, &seq) != 0) {
+      nvvi_snapshot_free(snap);
+      return -1;
+    }
+    snap->flags = header->flags;
+    snap->nvenc_max_version = header->nvenc_max_version;
+    memcpy(snap->driver_version, header->driver_version, sizeof(snap->driver_version));
+    memcpy(snap->devices, shm_devices(shm), count * sizeof(nvvi_device));
+    if (capacity) {
+      memcpy(capacity, shm_capacity(shm), count * NVVI_MAX_ENCODE_CODECS * sizeof(int));
+    }
+  } while (read_retry(header, seq));
+
+  return 0;
+}
+
+
+void nvvi_shm_close(nvvi_shm *shm, int unlink)
+{
+  if (!shm) {
+    return;
+  }
+  munmap(shm->map, shm->size);
+  if (shm->writable && unlink) {
+    shm_unlink(shm->name);
+  }
+  free(shm);
+}
@@ -0,0 +1,330 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Line oriented text serialisation of snapshots.
+ *
+ * Each line is a keyword followed by space separated fields; free-form names
+ * always come last so they may contain spaces. Readers skip keywords they do
+ * not know, which lets other consumers (such as the fake driver) keep their
+ * own settings in the same file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvvideoinfo.h"
+
+#define NVVI_SNAPSHOT_MAGIC   "nvvideoinfo-snapshot"
+#define NVVI_SNAPSHOT_VERSION 1
+
+
+void nvvi_guid_to_string(const nvvi_guid *guid, char *buf)
+{
+  snprintf(buf, NVVI_GUID_STRING_LEN,
+           "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+           guid->data1, guid->data2, guid->data3,
+           guid->data4[0], guid->data4[1], guid->data4[2], guid->data4[3],
+           guid->data4[4], guid->data4[5], guid->data4[6], guid->data4[7]);
+}
+
+
+int nvvi_guid_from_string(nvvi_guid *guid, const char *str)
+{
+  unsigned int d1, d2, d3, d4[8];
+
+  if (sscanf(str, "%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x",
+             &d1, &d2, &d3, &d4[0], &d4[1], &d4[2], &d4[3],
+             &d4[4], &d4[5], &d4[6], &d4[7]) != 11) {
+    return -1;
+  }
+
+  guid->data1 = d1;
+  guid->data2 = d2;
+  guid->data3 = d3;
+  for (int i = 0; i < 8; i++) {
+    guid->data4[i] = d4[i];
+  }
+
+  return 0;
+}
+
+
+static const char *or_dash(const char *str)
+{
+  return str[0] ? str : "-";
+}
+
+
+static void write_named_guid(FILE *f, const char *keyword, const nvvi_named_guid *named)
+{
+  char guid[NVVI_GUID_STRING_LEN];
+
+  nvvi_guid_to_string(&named->guid, guid);
+  fprintf(f, "%s %s %s\n", keyword, guid, named->name);
+}
+
+
+int nvvi_snapshot_save(const nvvi_snapshot *snap, FILE *f)
+{
+  char guid[NVVI_GUID_STRING_LEN];
+
+  fprintf(f, "%s %d\n", NVVI_SNAPSHOT_MAGIC, NVVI_SNAPSHOT_VERSION);
+  fprintf(f, "flags %u\n", snap->flags);
+  fprintf(f, "driver %s\n", or_dash(snap->driver_version));
+  fprintf(f, "nvenc-max-version %u\n", snap->nvenc_max_version);
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+
+    fprintf(f, "device %d %s %s %d %d %s\n", device->index,
+            or_dash(device->uuid), or_dash(device->pci_bus_id),
+            device->decode_status, device->encode_status, device->name);
+    if (device->probe_status != NVVI_DEVICE_PROBED || device->probe_ms > 0) {
+      fprintf(f, "probe %d %.3f\n", device->probe_status, device->probe_ms);
+    }
+    const nvvi_topology *topo = &device->topology;
+    if (topo->numa_node >= 0 || topo->local_cpus[0] || topo->max_link_gen) {
+      fprintf(f, "topology %d %d %d %d %d %s\n", topo->numa_node,
+              topo->link_gen, topo->link_width, topo->max_link_gen, topo->max_link_width,
+              or_dash(topo->local_cpus));
+    }
+
+    for (int j = 0; j < device->num_decode_caps; j++) {
+      const nvvi_decode_caps *caps = &device->decode_caps[j];
+      fprintf(f, "decode %d %d %d %u %u %u %u %u 0x%x\n",
+              caps->codec, caps->chroma_format, caps->bit_depth,
+              caps->min_width, caps->min_height, caps->max_width, caps->max_height,
+              caps->max_mb_count, caps->output_format_mask);
+      if (caps->verify.result != NVVI_VERIFY_UNTESTED) {
+        fprintf(f, "verify %d %d %.3f\n", caps->verify.result, caps->verify.status,
+                caps->verify.create_ms);
+      }
+    }
+
+    for (int j = 0; j < device->num_encode_codecs; j++) {
+      const nvvi_encode_codec *codec = &device->encode_codecs[j];
+
+      nvvi_guid_to_string(&codec->guid, guid);
+      fprintf(f, "encode %s 0x%x %s\n", guid, codec->input_formats, codec->name);
+
+      for (int k = 0; k < nvvi_num_encode_limits; k++) {
+        int cap = nvvi_encode_limits[k].cap;
+        fprintf(f, "cap %d %d\n", cap, codec->caps[cap]);
+      }
+      for (int k = 0; k < nvvi_num_encode_caps; k++) {
+        int cap = nvvi_encode_caps[k].cap;
+        fprintf(f, "cap %d %d\n", cap, codec->caps[cap]);
+      }
+      for (int k = 0; k < codec->num_profiles; k++) {
+        write_named_guid(f, "profile", &codec->profiles[k]);
+      }
+      for (int k = 0; k < codec->num_presets; k++) {
+        write_named_guid(f, "preset", &codec->presets[k]);
+      }
+      for (int k = 0; k < NVVI_VERIFY_KINDS; k++) {
+        const nvvi_verify_result *verify = &codec->verify[k];
+        if (verify->result != NVVI_VERIFY_UNTESTED) {
+          fprintf(f, "verify-encode %d %d %d %.3f\n", k, verify->result, verify->status,
+                  verify->create_ms);
+        }
+      }
+    }
+  }
+
+  fprintf(f, "end\n");
+
+  return ferror(f) ? -1 : 0;
+}
+
+
+static void read_rest(char *dst, size_t len, const char *src)
+{
+  while (*src == ' ') {
+    src++;
+  }
+  snprintf(dst, len, "%s", src);
+  dst[strcspn(dst, "\r\n")] = '\0';
+  if (strcmp(dst, "-") == 0) {
+    dst[0] = '\0';
+  }
+}
+
+
+static int read_named_guid(nvvi_named_guid *named, const char *args)
+{
+  char guid[64];
+  int n = 0;
+
+  if (sscanf(args, "%63s%n", guid, &n) != 1 ||
+      nvvi_guid_from_string(&named->guid, guid) != 0) {
+    return -1;
+  }
+  read_rest(named->name, sizeof(named->name), args + n);
+
+  return 0;
+}
+
+
+static int parse_line(nvvi_snapshot *snap, char *line, int *done)
+{
+  nvvi_device *device = snap->num_devices ? &snap->devices[snap->num_devices - 1] : NULL;
+  nvvi_encode_codec *codec = (device && device->num_encode_codecs) ?
+                             &device->encode_codecs[device->num_encode_codecs - 1] : NULL;
+  char keyword[32];
+  char buf[64];
+  int n = 0;
+
+  if (sscanf(line, "%31s%n", keyword, &n) != 1) {
+    return 0;
+  }
+  const char *args = line + n;
+
+  if (strcmp(keyword, "flags") == 0) {
+    return sscanf(args, "%u", &snap->flags) == 1 ? 0 : -1;
+  } else if (strcmp(keyword, "driver") == 0) {
+    read_rest(snap->driver_version, sizeof(snap->driver_version), args);
+  } else if (strcmp(keyword, "nvenc-max-version") == 0) {
+    return sscanf(args, "%u", &snap->nvenc_max_version) == 1 ? 0 : -1;
+  } else if (strcmp(keyword, "device") == 0) {
+    nvvi_device *devices = realloc(snap->devices, (snap->num_devices + 1) * sizeof(nvvi_device));
+    if (!devices) {
+      return -1;
+    }
+    snap->devices = devices;
+    device = &devices[snap->num_devices++];
+    memset(device, 0, sizeof(*device));
+    device->topology.numa_node = -1;
+
+    char uuid[NVVI_UUID_LEN];
+    char bus_id[NVVI_BUS_ID_LEN];
+    if (sscanf(args, "%d %47s %15s %d %d%n", &device->index, uuid, bus_id,
+               &device->decode_status, &device->encode_status, &n) != 5) {
+      return -1;
+    }
+    read_rest(device->uuid, sizeof(device->uuid), uuid);
+    read_rest(device->pci_bus_id, sizeof(device->pci_bus_id), bus_id);
+    read_rest(device->name, sizeof(device->name), args + n);
+  } else if (strcmp(keyword, "probe") == 0) {
+    if (!device) {
+      return -1;
+    }
+    return sscanf(args, "%d %lf", &device->probe_status, &device->probe_ms) == 2 ? 0 : -1;
+  } else if (strcmp(keyword, "topology") == 0) {
+    nvvi_topology *topo = device ? &device->topology : NULL;
+    if (!topo || sscanf(args, "%d %d %d %d %d%n", &topo->numa_node, &topo->link_gen,
+                        &topo->link_width, &topo->max_link_gen, &topo->max_link_width,
+                        &n) != 5) {
+      return -1;
+    }
+    read_rest(topo->local_cpus, sizeof(topo->local_cpus), args + n);
+  } else if (strcmp(keyword, "decode") == 0) {
+    if (!device || device->num_decode_caps >= NVVI_MAX_DECODE_CAPS) {
+      return -1;
+    }
+    nvvi_decode_caps *caps = &device->decode_caps[device->num_decode_caps++];
+    if (sscanf(args, "%d %d %d %u %u %u %u %u %x",
+               &caps->codec, &caps->chroma_format, &caps->bit_depth,
+               &caps->min_width, &caps->min_height, &caps->max_width, &caps->max_height,
+               &caps->max_mb_count, &caps->output_format_mask) != 9) {
+      return -1;
+    }
+  } else if (strcmp(keyword, "encode") == 0) {
+    if (!device || device->num_encode_codecs >= NVVI_MAX_ENCODE_CODECS) {
+      return -1;
+    }
+    codec = &device->encode_codecs[device->num_encode_codecs++];
+    if (sscanf(args, "%63s %x%n", buf, &codec->input_formats, &n) != 2 ||
+        nvvi_guid_from_string(&codec->guid, buf) != 0) {
+      return -1;
+    }
+    read_rest(codec->name, sizeof(codec->name), args + n);
+  } else if (strcmp(keyword, "cap") == 0) {
+    int cap, value;
+    if (!codec || sscanf(args, "%d %d", &cap, &value) != 2) {
+      return -1;
+    }
+    if (cap >= 0 && cap < NVVI_MAX_ENCODE_CAPS) {
+      codec->caps[cap] = value;
+    }
+  } else if (strcmp(keyword, "profile") == 0) {
+    if (!codec || codec->num_profiles >= NVVI_MAX_PROFILES) {
+      return -1;
+    }
+    return read_named_guid(&codec->profiles[codec->num_profiles++], args);
+  } else if (strcmp(keyword, "preset") == 0) {
+    if (!codec || codec->num_presets >= NVVI_MAX_PRESETS) {
+      return -1;
+    }
+    return read_named_guid(&codec->presets[codec->num_presets++], args);
+  } else if (strcmp(keyword, "verify") == 0) {
+    if (!device || device->num_decode_caps == 0) {
+      return -1;
+    }
+    nvvi_verify_result *verify = &device->decode_caps[device->num_decode_caps - 1].verify;
+    return sscanf(args, "%d %d %lf", &verify->result, &verify->status,
+                  &verify->create_ms) == 3 ? 0 : -1;
+  } else if (strcmp(keyword, "verify-encode") == 0) {
+    nvvi_verify_result verify;
+    int kind;
+    if (!codec || sscanf(args, "%d %d %d %lf", &kind, &verify.result, &verify.status,
+                         &verify.create_ms) != 4) {
+      return -1;
+    }
+    if (kind >= 0 && kind < NVVI_VERIFY_KINDS) {
+      codec->verify[kind] = verify;
+    }
+  } else if (strcmp(keyword, "end") == 0) {
+    *done = 1;
+  }
+
+  return 0;
+}
+
+
+int nvvi_snapshot_load(nvvi_snapshot *snap, FILE *f)
+{
+  char line[1024];
+  int version;
+  int done = 0;
+
+  memset(snap, 0, sizeof(*snap));
+
+  /* Leading comment lines are allowed, e.g. to describe a fake profile */
+  do {
+    if (!fgets(line, sizeof(line), f)) {
+      return -1;
+    }
+  } while (line[0] == '#');
+
+  if (sscanf(line, NVVI_SNAPSHOT_MAGIC " %d", &version) != 1 ||
+      version != NVVI_SNAPSHOT_VERSION) {
+    return -1;
+  }
+
+  while (!done && fgets(line, sizeof(line), f)) {
+    if (parse_line(snap, line, &done) != 0) {
+      nvvi_snapshot_free(snap);
+      return -1;
+    }
+  }
+
+  return 0;
+}
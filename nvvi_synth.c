@@ -0,0 +1,1270 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Synthetic streams for the decode benchmark, generated at run time so
+ * any size can be had without shipping sample files.
+ *
+ * Each codec gets the simplest stream that still has the decoder
+ * reconstruct every block of every picture: intra pictures of flat
+ * predicted blocks with no residual and, where inter prediction is cheap
+ * to signal, P pictures that copy the previous one. Pictures decode to
+ * flat grey, so this measures the decoder's per-block reconstruction rate
+ * rather than its entropy decoding, and is an upper bound for real content
+ * of the same size.
+ *
+ * H.264: Main profile CAVLC, one IDR of I_16x16 DC macroblocks followed by
+ * P frames that are a single skip run.
+ *
+ * HEVC: Main or Main 10, 32x32 CTBs, the same GOP shape: the IDR has one
+ * intra CU per CTB with no coded blocks and the P frames skip every CU.
+ *
+ * AV1: Main profile at 8 or 10 bits. Every picture is a key frame of
+ * skipped DC predicted 64x64 blocks, as inter frames need many more of
+ * the default CDFs than the handful used here.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+#include "nvvi_internal.h"
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t alloc;
+  uint32_t bits;                /* pending bits, msb first */
+  int num_bits;
+  int ret;
+} bit_writer;
+
+static void put_byte(bit_writer *w, uint8_t byte)
+{
+  if (w->size == w->alloc) {
+    size_t alloc = w->alloc ? w->alloc * 2 : 256;
+    uint8_t *data = realloc(w->data, alloc);
+    if (!data) {
+      w->ret = -1;
+      return;
+    }
+    w->data = data;
+    w->alloc = alloc;
+  }
+  w->data[w->size++] = byte;
+}
+
+static void put_bits(bit_writer *w, int n, uint32_t value)
+{
+  for (int i = n - 1; i >= 0; i--) {
+    w->bits = (w->bits << 1) | ((value >> i) & 1);
+    if (++w->num_bits == 8) {
+      put_byte(w, w->bits);
+      w->bits = 0;
+      w->num_bits = 0;
+    }
+  }
+}
+
+static void put_ue(bit_writer *w, uint32_t value)
+{
+  uint64_t v = (uint64_t)value + 1;
+  int len = 0;
+
+  while ((v >> len) > 1) {
+    len++;
+  }
+  put_bits(w, len, 0);
+  put_bits(w, len + 1, v);
+}
+
+static void put_se(bit_writer *w, int32_t value)
+{
+  put_ue(w, value > 0 ? 2 * value - 1 : -2 * value);
+}
+
+/* Zero bits up to the next byte boundary */
+static void put_align(bit_writer *w)
+{
+  while (w->num_bits) {
+    put_bits(w, 1, 0);
+  }
+}
+
+static void put_trailing_bits(bit_writer *w)
+{
+  put_bits(w, 1, 1);
+  put_align(w);
+}
+
+/*
+ * Append rbsp to unit as a NAL unit with start code and emulation
+ * prevention. header is the 1 byte H.264 or 2 byte HEVC NAL unit header.
+ */
+static void put_nal(bit_writer *unit, int header_bytes, uint32_t header, const bit_writer *rbsp)
+{
+  int zeros = 0;
+
+  put_bits(unit, 32, 1);
+  put_bits(unit, 8 * header_bytes, header);
+  for (size_t i = 0; i < rbsp->size; i++) {
+    if (zeros == 2 && rbsp->data[i] <= 3) {
+      put_byte(unit, 3);
+      zeros = 0;
+    }
+    put_byte(unit, rbsp->data[i]);
+    zeros = rbsp->data[i] ? 0 : zeros + 1;
+  }
+  if (rbsp->ret) {
+    unit->ret = -1;
+  }
+}
+
+
+/* H.264 */
+
+static void h264_sps(bit_writer *w, unsigned int width, unsigned int height)
+{
+  unsigned int mb_width = (width + 15) / 16;
+  unsigned int mb_height = (height + 15) / 16;
+
+  put_bits(w, 8, 77);                   /* profile_idc: Main */
+  put_bits(w, 8, 0);                    /* constraint flags */
+  put_bits(w, 8, mb_width * mb_height <= 36864 ? 51 : 62);  /* level_idc by MaxFS */
+  put_ue(w, 0);                         /* seq_parameter_set_id */
+  put_ue(w, 4);                         /* log2_max_frame_num_minus4 */
+  put_ue(w, 2);                         /* pic_order_cnt_type: output order is decode order */
+  put_ue(w, 1);                         /* max_num_ref_frames */
+  put_bits(w, 1, 0);                    /* gaps_in_frame_num_value_allowed_flag */
+  put_ue(w, mb_width - 1);
+  put_ue(w, mb_height - 1);
+  put_bits(w, 1, 1);                    /* frame_mbs_only_flag */
+  put_bits(w, 1, 1);                    /* direct_8x8_inference_flag */
+
+  int crop = mb_width * 16 != width || mb_height * 16 != height;
+  put_bits(w, 1, crop);
+  if (crop) {
+    put_ue(w, 0);
+    put_ue(w, (mb_width * 16 - width) / 2);
+    put_ue(w, 0);
+    put_ue(w, (mb_height * 16 - height) / 2);
+  }
+
+  /* VUI, only to say that no picture is ever held back for reordering */
+  put_bits(w, 1, 1);                    /* vui_parameters_present_flag */
+  put_bits(w, 5, 0);                    /* aspect ratio, overscan, signal type, chroma loc, timing */
+  put_bits(w, 3, 0);                    /* nal/vcl hrd, pic_struct_present_flag */
+  put_bits(w, 1, 1);                    /* bitstream_restriction_flag */
+  put_bits(w, 1, 1);                    /* motion_vectors_over_pic_boundaries_flag */
+  put_ue(w, 2);                         /* max_bytes_per_pic_denom */
+  put_ue(w, 1);                         /* max_bits_per_mb_denom */
+  put_ue(w, 16);                        /* log2_max_mv_length_horizontal */
+  put_ue(w, 16);                        /* log2_max_mv_length_vertical */
+  put_ue(w, 0);                         /* max_num_reorder_frames */
+  put_ue(w, 1);                         /* max_dec_frame_buffering */
+  put_trailing_bits(w);
+}
+
+static void h264_pps(bit_writer *w)
+{
+  put_ue(w, 0);                         /* pic_parameter_set_id */
+  put_ue(w, 0);                         /* seq_parameter_set_id */
+  put_bits(w, 1, 0);                    /* entropy_coding_mode_flag: CAVLC */
+  put_bits(w, 1, 0);                    /* bottom_field_pic_order_in_frame_present_flag */
+  put_ue(w, 0);                         /* num_slice_groups_minus1 */
+  put_ue(w, 0);                         /* num_ref_idx_l0_default_active_minus1 */
+  put_ue(w, 0);                         /* num_ref_idx_l1_default_active_minus1 */
+  put_bits(w, 1, 0);                    /* weighted_pred_flag */
+  put_bits(w, 2, 0);                    /* weighted_bipred_idc */
+  put_se(w, 0);                         /* pic_init_qp_minus26 */
+  put_se(w, 0);                         /* pic_init_qs_minus26 */
+  put_se(w, 0);                         /* chroma_qp_index_offset */
+  put_bits(w, 1, 0);                    /* deblocking_filter_control_present_flag */
+  put_bits(w, 1, 0);                    /* constrained_intra_pred_flag */
+  put_bits(w, 1, 0);                    /* redundant_pic_cnt_present_flag */
+  put_trailing_bits(w);
+}
+
+static void h264_idr(bit_writer *w, unsigned int mbs, int idr_pic_id)
+{
+  put_ue(w, 0);                         /* first_mb_in_slice */
+  put_ue(w, 7);                         /* slice_type: I, all slices */
+  put_ue(w, 0);                         /* pic_parameter_set_id */
+  put_bits(w, 8, 0);                    /* frame_num */
+  put_ue(w, idr_pic_id);
+  put_bits(w, 1, 0);                    /* no_output_of_prior_pics_flag */
+  put_bits(w, 1, 0);                    /* long_term_reference_flag */
+  put_se(w, 0);                         /* slice_qp_delta */
+
+  for (unsigned int i = 0; i < mbs; i++) {
+    put_ue(w, 3);                       /* mb_type: I_16x16_2_0_0, DC, no coded blocks */
+    put_ue(w, 0);                       /* intra_chroma_pred_mode: DC */
+    put_se(w, 0);                       /* mb_qp_delta */
+    put_bits(w, 1, 1);                  /* Intra16x16DCLevel coeff_token: no coefficients */
+  }
+  put_trailing_bits(w);
+}
+
+static void h264_p(bit_writer *w, unsigned int mbs, int frame_num)
+{
+  put_ue(w, 0);                         /* first_mb_in_slice */
+  put_ue(w, 5);                         /* slice_type: P, all slices */
+  put_ue(w, 0);                         /* pic_parameter_set_id */
+  put_bits(w, 8, frame_num);
+  put_bits(w, 1, 0);                    /* num_ref_idx_active_override_flag */
+  put_bits(w, 1, 0);                    /* ref_pic_list_modification_flag_l0 */
+  put_bits(w, 1, 0);                    /* adaptive_ref_pic_marking_mode_flag */
+  put_se(w, 0);                         /* slice_qp_delta */
+  put_ue(w, mbs);                       /* mb_skip_run */
+  put_trailing_bits(w);
+}
+
+static void h264_unit(bit_writer *unit, int index, unsigned int width, unsigned int height)
+{
+  unsigned int mbs = ((width + 15) / 16) * ((height + 15) / 16);
+  bit_writer rbsp = { 0 };
+
+  if (index < 2) {
+    h264_sps(&rbsp, width, height);
+    put_nal(unit, 1, 3 << 5 | 7, &rbsp);
+    rbsp.size = 0;
+    h264_pps(&rbsp);
+    put_nal(unit, 1, 3 << 5 | 8, &rbsp);
+    rbsp.size = 0;
+    h264_idr(&rbsp, mbs, index);
+    put_nal(unit, 1, 3 << 5 | 5, &rbsp);
+  } else {
+    h264_p(&rbsp, mbs, index - 1);
+    put_nal(unit, 1, 2 << 5 | 1, &rbsp);
+  }
+  free(rbsp.data);
+}
+
+
+/* HEVC: the CABAC encoder of H.265 9.3.4.3 and a fixed coding tree */
+
+#define HEVC_MIN_CB_LOG2 3
+#define HEVC_CTB_LOG2    5
+
+static const uint8_t cabac_range_lps[64][4] = {
+  { 128, 176, 208, 240 }, { 128, 167, 197, 227 }, { 128, 158, 187, 216 }, { 123, 150, 178, 205 },
+  { 116, 142, 169, 195 }, { 111, 135, 160, 185 }, { 105, 128, 152, 175 }, { 100, 122, 144, 166 },
+  {  95, 116, 137, 158 }, {  90, 110, 130, 150 }, {  85, 104, 123, 142 }, {  81,  99, 117, 135 },
+  {  77,  94, 111, 128 }, {  73,  89, 105, 122 }, {  69,  85, 100, 116 }, {  66,  80,  95, 110 },
+  {  62,  76,  90, 104 }, {  59,  72,  86,  99 }, {  56,  69,  81,  94 }, {  53,  65,  77,  89 },
+  {  51,  62,  73,  85 }, {  48,  59,  69,  80 }, {  46,  56,  66,  76 }, {  43,  53,  63,  72 },
+  {  41,  50,  59,  69 }, {  39,  48,  56,  65 }, {  37,  45,  54,  62 }, {  35,  43,  51,  59 },
+  {  33,  41,  48,  56 }, {  32,  39,  46,  53 }, {  30,  37,  43,  50 }, {  29,  35,  41,  48 },
+  {  27,  33,  39,  45 }, {  26,  31,  37,  43 }, {  24,  30,  35,  41 }, {  23,  28,  33,  39 },
+  {  22,  27,  32,  37 }, {  21,  26,  30,  35 }, {  20,  24,  29,  33 }, {  19,  23,  27,  31 },
+  {  18,  22,  26,  30 }, {  17,  21,  25,  28 }, {  16,  20,  23,  27 }, {  15,  19,  22,  25 },
+  {  14,  18,  21,  24 }, {  14,  17,  20,  23 }, {  13,  16,  19,  22 }, {  12,  15,  18,  21 },
+  {  12,  14,  17,  20 }, {  11,  14,  16,  19 }, {  11,  13,  15,  18 }, {  10,  12,  15,  17 },
+  {  10,  12,  14,  16 }, {   9,  11,  13,  15 }, {   9,  11,  12,  14 }, {   8,  10,  12,  14 },
+  {   8,   9,  11,  13 }, {   7,   9,  11,  12 }, {   7,   9,  10,  12 }, {   7,   8,  10,  11 },
+  {   6,   8,   9,  11 }, {   6,   7,   9,  10 }, {   6,   7,   8,   9 }, {   2,   2,   2,   2 },
+};
+
+static const uint8_t cabac_next_lps[64] = {
+   0,  0,  1,  2,  2,  4,  4,  5,  6,  7,  8,  9,  9, 11, 11, 12,
+  13, 13, 15, 15, 16, 16, 18, 18, 19, 19, 21, 21, 22, 22, 23, 24,
+  24, 25, 26, 26, 27, 27, 28, 29, 29, 30, 30, 30, 31, 32, 32, 33,
+  33, 33, 34, 34, 35, 35, 35, 36, 36, 36, 37, 37, 37, 38, 38, 63,
+};
+
+typedef struct {
+  uint8_t state;
+  uint8_t mps;
+} cabac_ctx;
+
+typedef struct {
+  bit_writer *w;
+  uint32_t low;
+  uint32_t range;
+  int outstanding;
+  int first;
+} cabac_writer;
+
+static void cabac_ctx_init(cabac_ctx *ctx, int init_value, int qp)
+{
+  int m = (init_value >> 4) * 5 - 45;
+  int n = ((init_value & 15) << 3) - 16;
+  int state = ((m * qp) >> 4) + n;
+
+  state = state < 1 ? 1 : state > 126 ? 126 : state;
+  ctx->mps = state > 63;
+  ctx->state = ctx->mps ? state - 64 : 63 - state;
+}
+
+static void cabac_put_bit(cabac_writer *c, int bit)
+{
+  if (c->first) {
+    c->first = 0;
+  } else {
+    put_bits(c->w, 1, bit);
+  }
+  for (; c->outstanding > 0; c->outstanding--) {
+    put_bits(c->w, 1, !bit);
+  }
+}
+
+static void cabac_renorm(cabac_writer *c)
+{
+  while (c->range < 256) {
+    if (c->low < 256) {
+      cabac_put_bit(c, 0);
+    } else if (c->low >= 512) {
+      c->low -= 512;
+      cabac_put_bit(c, 1);
+    } else {
+      c->low -= 256;
+      c->outstanding++;
+    }
+    c->range <<= 1;
+    c->low <<= 1;
+  }
+}
+
+static void cabac_encode(cabac_writer *c, cabac_ctx *ctx, int bin)
+{
+  uint32_t lps = cabac_range_lps[ctx->state][(c->range >> 6) & 3];
+
+  c->range -= lps;
+  if (bin != ctx->mps) {
+    c->low += c->range;
+    c->range = lps;
+    if (ctx->state == 0) {
+      ctx->mps = !ctx->mps;
+    }
+    ctx->state = cabac_next_lps[ctx->state];
+  } else if (ctx->state < 62) {
+    ctx->state++;
+  }
+  cabac_renorm(c);
+}
+
+static void cabac_bypass(cabac_writer *c, int bin)
+{
+  c->low <<= 1;
+  if (bin) {
+    c->low += c->range;
+  }
+  if (c->low >= 1024) {
+    cabac_put_bit(c, 1);
+    c->low -= 1024;
+  } else if (c->low < 512) {
+    cabac_put_bit(c, 0);
+  } else {
+    c->low -= 512;
+    c->outstanding++;
+  }
+}
+
+/* end_of_slice_segment_flag; the flush writes rbsp_stop_one_bit */
+static void cabac_terminate(cabac_writer *c, int bin)
+{
+  c->range -= 2;
+  if (!bin) {
+    cabac_renorm(c);
+    return;
+  }
+  c->low += c->range;
+  c->range = 2;
+  cabac_renorm(c);
+  cabac_put_bit(c, (c->low >> 9) & 1);
+  put_bits(c->w, 2, ((c->low >> 7) & 3) | 1);
+}
+
+typedef struct {
+  cabac_writer cabac;
+  int intra;
+  unsigned int width;           /* coded, multiples of the minimum CB */
+  unsigned int height;
+  unsigned int depth_stride;
+  uint8_t *depth;               /* CtDepth per minimum CB */
+
+  cabac_ctx split_cu_flag[3];
+  cabac_ctx cu_skip_flag[3];
+  cabac_ctx part_mode;
+  cabac_ctx prev_intra_luma_pred_flag;
+  cabac_ctx intra_chroma_pred_mode;
+  cabac_ctx cbf_luma;           /* trafoDepth 0 */
+  cabac_ctx cbf_chroma;         /* trafoDepth 0 */
+} hevc_slice;
+
+static int hevc_depth(const hevc_slice *h, unsigned int x, unsigned int y)
+{
+  return h->depth[(y >> HEVC_MIN_CB_LOG2) * h->depth_stride + (x >> HEVC_MIN_CB_LOG2)];
+}
+
+static void hevc_coding_unit(hevc_slice *h, unsigned int x0, unsigned int y0, int log2_size)
+{
+  cabac_writer *c = &h->cabac;
+
+  if (!h->intra) {
+    /* Every CU is skipped, so the context is just which neighbours exist */
+    cabac_encode(c, &h->cu_skip_flag[(x0 > 0) + (y0 > 0)], 1);
+    return;                             /* merge_idx: MaxNumMergeCand is 1 */
+  }
+
+  if (log2_size == HEVC_MIN_CB_LOG2) {
+    cabac_encode(c, &h->part_mode, 1);  /* PART_2Nx2N */
+  }
+  cabac_encode(c, &h->prev_intra_luma_pred_flag, 1);
+  cabac_bypass(c, 0);                   /* mpm_idx */
+  cabac_encode(c, &h->intra_chroma_pred_mode, 0);  /* as luma */
+  cabac_encode(c, &h->cbf_chroma, 0);   /* cbf_cb */
+  cabac_encode(c, &h->cbf_chroma, 0);   /* cbf_cr */
+  cabac_encode(c, &h->cbf_luma, 0);
+}
+
+/* The largest CUs that fit: a split is only coded where the picture edge forces one */
+static void hevc_coding_quadtree(hevc_slice *h, unsigned int x0, unsigned int y0, int log2_size,
+                                 int depth)
+{
+  unsigned int size = 1u << log2_size;
+  int split;
+
+  if (x0 + size <= h->width && y0 + size <= h->height && log2_size > HEVC_MIN_CB_LOG2) {
+    int ctx = (x0 > 0 && hevc_depth(h, x0 - 1, y0) > depth) +
+              (y0 > 0 && hevc_depth(h, x0, y0 - 1) > depth);
+    cabac_encode(&h->cabac, &h->split_cu_flag[ctx], 0);
+    split = 0;
+  } else {
+    split = log2_size > HEVC_MIN_CB_LOG2;
+  }
+
+  if (split) {
+    unsigned int half = size / 2;
+    for (int i = 0; i < 4; i++) {
+      unsigned int x = x0 + (i & 1) * half, y = y0 + (i >> 1) * half;
+      if (x < h->width && y < h->height) {
+        hevc_coding_quadtree(h, x, y, log2_size - 1, depth + 1);
+      }
+    }
+    return;
+  }
+
+  hevc_coding_unit(h, x0, y0, log2_size);
+  for (unsigned int y = y0; y < y0 + size && y < h->height; y += 1u << HEVC_MIN_CB_LOG2) {
+    for (unsigned int x = x0; x < x0 + size && x < h->width; x += 1u << HEVC_MIN_CB_LOG2) {
+      h->depth[(y >> HEVC_MIN_CB_LOG2) * h->depth_stride + (x >> HEVC_MIN_CB_LOG2)] = depth;
+    }
+  }
+}
+
+static void hevc_slice_data(bit_writer *w, int intra, unsigned int width, unsigned int height)
+{
+  unsigned int ctb = 1u << HEVC_CTB_LOG2;
+  hevc_slice h = {
+    .cabac = { .w = w, .range = 510, .first = 1 },
+    .intra = intra,
+    .width = width,
+    .height = height,
+    .depth_stride = width >> HEVC_MIN_CB_LOG2,
+  };
+  const int qp = 26;
+
+  h.depth = calloc((size_t)h.depth_stride * (height >> HEVC_MIN_CB_LOG2), 1);
+  if (!h.depth) {
+    w->ret = -1;
+    return;
+  }
+
+  /* Initialisation values of H.265 Tables 9-5 to 9-37: initType 0 for I, 1 for P */
+  static const int split_init[2][3] = { { 139, 141, 157 }, { 107, 139, 126 } };
+  for (int i = 0; i < 3; i++) {
+    cabac_ctx_init(&h.split_cu_flag[i], split_init[!intra][i], qp);
+    cabac_ctx_init(&h.cu_skip_flag[i], (const int[]){ 197, 185, 201 }[i], qp);
+  }
+  cabac_ctx_init(&h.part_mode, 184, qp);
+  cabac_ctx_init(&h.prev_intra_luma_pred_flag, 184, qp);
+  cabac_ctx_init(&h.intra_chroma_pred_mode, 63, qp);
+  cabac_ctx_init(&h.cbf_luma, 141, qp);
+  cabac_ctx_init(&h.cbf_chroma, 94, qp);
+
+  for (unsigned int y = 0; y < height; y += ctb) {
+    for (unsigned int x = 0; x < width; x += ctb) {
+      hevc_coding_quadtree(&h, x, y, HEVC_CTB_LOG2, 0);
+      cabac_terminate(&h.cabac, x + ctb >= width && y + ctb >= height);
+    }
+  }
+  put_align(w);
+  free(h.depth);
+}
+
+static void hevc_profile_tier_level(bit_writer *w, int bit_depth, unsigned int width,
+                                    unsigned int height)
+{
+  uint64_t samples = (uint64_t)width * height;
+  int profile = bit_depth > 8 ? 2 : 1;  /* Main 10 or Main */
+
+  put_bits(w, 2, 0);                    /* general_profile_space */
+  put_bits(w, 1, 0);                    /* general_tier_flag */
+  put_bits(w, 5, profile);
+  /* general_profile_compatibility_flag: a Main stream is also Main 10 */
+  put_bits(w, 32, (profile == 1 ? 1u << 30 : 0) | 1u << 29);
+  put_bits(w, 1, 1);                    /* general_progressive_source_flag */
+  put_bits(w, 1, 0);                    /* general_interlaced_source_flag */
+  put_bits(w, 1, 0);                    /* general_non_packed_constraint_flag */
+  put_bits(w, 1, 1);                    /* general_frame_only_constraint_flag */
+  put_bits(w, 32, 0);                   /* general_reserved_zero_43bits */
+  put_bits(w, 11, 0);
+  put_bits(w, 1, 0);                    /* general_inbld_flag */
+  /* general_level_idc: 4.1, 5.1 or 6.1 by MaxLumaPs */
+  put_bits(w, 8, samples <= 2228224 ? 123 : samples <= 8912896 ? 153 : 183);
+}
+
+static void hevc_vps(bit_writer *w, int bit_depth, unsigned int width, unsigned int height)
+{
+  put_bits(w, 4, 0);                    /* vps_video_parameter_set_id */
+  put_bits(w, 1, 1);                    /* vps_base_layer_internal_flag */
+  put_bits(w, 1, 1);                    /* vps_base_layer_available_flag */
+  put_bits(w, 6, 0);                    /* vps_max_layers_minus1 */
+  put_bits(w, 3, 0);                    /* vps_max_sub_layers_minus1 */
+  put_bits(w, 1, 1);                    /* vps_temporal_id_nesting_flag */
+  put_bits(w, 16, 0xffff);              /* vps_reserved_0xffff_16bits */
+  hevc_profile_tier_level(w, bit_depth, width, height);
+  put_bits(w, 1, 0);                    /* vps_sub_layer_ordering_info_present_flag */
+  put_ue(w, 1);                         /* vps_max_dec_pic_buffering_minus1 */
+  put_ue(w, 0);                         /* vps_max_num_reorder_pics */
+  put_ue(w, 0);                         /* vps_max_latency_increase_plus1 */
+  put_bits(w, 6, 0);                    /* vps_max_layer_id */
+  put_ue(w, 0);                         /* vps_num_layer_sets_minus1 */
+  put_bits(w, 1, 0);                    /* vps_timing_info_present_flag */
+  put_bits(w, 1, 0);                    /* vps_extension_flag */
+  put_trailing_bits(w);
+}
+
+static void hevc_sps(bit_writer *w, int bit_depth, unsigned int width, unsigned int height,
+                     unsigned int coded_width, unsigned int coded_height)
+{
+  put_bits(w, 4, 0);                    /* sps_video_parameter_set_id */
+  put_bits(w, 3, 0);                    /* sps_max_sub_layers_minus1 */
+  put_bits(w, 1, 1);                    /* sps_temporal_id_nesting_flag */
+  hevc_profile_tier_level(w, bit_depth, width, height);
+  put_ue(w, 0);                         /* sps_seq_parameter_set_id */
+  put_ue(w, 1);                         /* chroma_format_idc: 4:2:0 */
+  put_ue(w, coded_width);
+  put_ue(w, coded_height);
+
+  int crop = coded_width != width || coded_height != height;
+  put_bits(w, 1, crop);                 /* conformance_window_flag */
+  if (crop) {
+    put_ue(w, 0);
+    put_ue(w, (coded_width - width) / 2);
+    put_ue(w, 0);
+    put_ue(w, (coded_height - height) / 2);
+  }
+
+  put_ue(w, bit_depth - 8);             /* bit_depth_luma_minus8 */
+  put_ue(w, bit_depth - 8);             /* bit_depth_chroma_minus8 */
+  put_ue(w, 4);                         /* log2_max_pic_order_cnt_lsb_minus4 */
+  put_bits(w, 1, 0);                    /* sps_sub_layer_ordering_info_present_flag */
+  put_ue(w, 1);                         /* sps_max_dec_pic_buffering_minus1 */
+  put_ue(w, 0);                         /* sps_max_num_reorder_pics */
+  put_ue(w, 0);                         /* sps_max_latency_increase_plus1 */
+  put_ue(w, HEVC_MIN_CB_LOG2 - 3);      /* log2_min_luma_coding_block_size_minus3 */
+  put_ue(w, HEVC_CTB_LOG2 - HEVC_MIN_CB_LOG2);
+  put_ue(w, 0);                         /* log2_min_luma_transform_block_size_minus2 */
+  put_ue(w, HEVC_CTB_LOG2 - 2);         /* log2_diff_max_min_luma_transform_block_size */
+  put_ue(w, 0);                         /* max_transform_hierarchy_depth_inter */
+  put_ue(w, 0);                         /* max_transform_hierarchy_depth_intra */
+  put_bits(w, 1, 0);                    /* scaling_list_enabled_flag */
+  put_bits(w, 1, 0);                    /* amp_enabled_flag */
+  put_bits(w, 1, 0);                    /* sample_adaptive_offset_enabled_flag */
+  put_bits(w, 1, 0);                    /* pcm_enabled_flag */
+
+  /* One short-term RPS for every P frame: the previous picture */
+  put_ue(w, 1);                         /* num_short_term_ref_pic_sets */
+  put_ue(w, 1);                         /* num_negative_pics */
+  put_ue(w, 0);                         /* num_positive_pics */
+  put_ue(w, 0);                         /* delta_poc_s0_minus1 */
+  put_bits(w, 1, 1);                    /* used_by_curr_pic_s0_flag */
+
+  put_bits(w, 1, 0);                    /* long_term_ref_pics_present_flag */
+  put_bits(w, 1, 0);                    /* sps_temporal_mvp_enabled_flag */
+  put_bits(w, 1, 0);                    /* strong_intra_smoothing_enabled_flag */
+  put_bits(w, 1, 0);                    /* vui_parameters_present_flag */
+  put_bits(w, 1, 0);                    /* sps_extension_present_flag */
+  put_trailing_bits(w);
+}
+
+static void hevc_pps(bit_writer *w)
+{
+  put_ue(w, 0);                         /* pps_pic_parameter_set_id */
+  put_ue(w, 0);                         /* pps_seq_parameter_set_id */
+  put_bits(w, 1, 0);                    /* dependent_slice_segments_enabled_flag */
+  put_bits(w, 1, 0);                    /* output_flag_present_flag */
+  put_bits(w, 3, 0);                    /* num_extra_slice_header_bits */
+  put_bits(w, 1, 0);                    /* sign_data_hiding_enabled_flag */
+  put_bits(w, 1, 0);                    /* cabac_init_present_flag */
+  put_ue(w, 0);                         /* num_ref_idx_l0_default_active_minus1 */
+  put_ue(w, 0);                         /* num_ref_idx_l1_default_active_minus1 */
+  put_se(w, 0);                         /* init_qp_minus26 */
+  put_bits(w, 1, 0);                    /* constrained_intra_pred_flag */
+  put_bits(w, 1, 0);                    /* transform_skip_enabled_flag */
+  put_bits(w, 1, 0);                    /* cu_qp_delta_enabled_flag */
+  put_se(w, 0);                         /* pps_cb_qp_offset */
+  put_se(w, 0);                         /* pps_cr_qp_offset */
+  put_bits(w, 1, 0);                    /* pps_slice_chroma_qp_offsets_present_flag */
+  put_bits(w, 1, 0);                    /* weighted_pred_flag */
+  put_bits(w, 1, 0);                    /* weighted_bipred_flag */
+  put_bits(w, 1, 0);                    /* transquant_bypass_enabled_flag */
+  put_bits(w, 1, 0);                    /* tiles_enabled_flag */
+  put_bits(w, 1, 0);                    /* entropy_coding_sync_enabled_flag */
+  put_bits(w, 1, 0);                    /* pps_loop_filter_across_slices_enabled_flag */
+  put_bits(w, 1, 0);                    /* deblocking_filter_control_present_flag */
+  put_bits(w, 1, 0);                    /* pps_scaling_list_data_present_flag */
+  put_bits(w, 1, 0);                    /* lists_modification_present_flag */
+  put_ue(w, 0);                         /* log2_parallel_merge_level_minus2 */
+  put_bits(w, 1, 0);                    /* slice_segment_header_extension_present_flag */
+  put_bits(w, 1, 0);                    /* pps_extension_present_flag */
+  put_trailing_bits(w);
+}
+
+static void hevc_slice_segment(bit_writer *w, int poc, unsigned int width, unsigned int height)
+{
+  put_bits(w, 1, 1);                    /* first_slice_segment_in_pic_flag */
+  if (poc == 0) {
+    put_bits(w, 1, 0);                  /* no_output_of_prior_pics_flag */
+  }
+  put_ue(w, 0);                         /* slice_pic_parameter_set_id */
+  put_ue(w, poc == 0 ? 2 : 1);          /* slice_type: I or P */
+  if (poc != 0) {
+    put_bits(w, 8, poc);                /* slice_pic_order_cnt_lsb */
+    put_bits(w, 1, 1);                  /* short_term_ref_pic_set_sps_flag */
+    put_bits(w, 1, 0);                  /* num_ref_idx_active_override_flag */
+    put_ue(w, 4);                       /* five_minus_max_num_merge_cand */
+  }
+  put_se(w, 0);                         /* slice_qp_delta */
+  put_trailing_bits(w);                 /* byte_alignment() */
+  hevc_slice_data(w, poc == 0, width, height);
+}
+
+static void hevc_unit(bit_writer *unit, int index, int bit_depth, unsigned int width,
+                      unsigned int height)
+{
+  unsigned int coded_width = (width + 7) & ~7u;
+  unsigned int coded_height = (height + 7) & ~7u;
+  bit_writer rbsp = { 0 };
+
+  /* nal_unit_type << 9 | nuh_layer_id << 3 | nuh_temporal_id_plus1 */
+  if (index < 2) {
+    hevc_vps(&rbsp, bit_depth, width, height);
+    put_nal(unit, 2, 32 << 9 | 1, &rbsp);
+    rbsp.size = 0;
+    hevc_sps(&rbsp, bit_depth, width, height, coded_width, coded_height);
+    put_nal(unit, 2, 33 << 9 | 1, &rbsp);
+    rbsp.size = 0;
+    hevc_pps(&rbsp);
+    put_nal(unit, 2, 34 << 9 | 1, &rbsp);
+    rbsp.size = 0;
+    hevc_slice_segment(&rbsp, 0, coded_width, coded_height);
+    put_nal(unit, 2, 19 << 9 | 1, &rbsp);  /* IDR_W_RADL */
+  } else {
+    hevc_slice_segment(&rbsp, index - 1, coded_width, coded_height);
+    put_nal(unit, 2, 1 << 9 | 1, &rbsp);   /* TRAIL_R */
+  }
+  free(rbsp.data);
+}
+
+
+/* AV1: the symbol encoder of libaom's entenc.c and a fixed partitioning */
+
+#define AV1_SB_LOG2      6
+#define AV1_OBU_SEQUENCE 1
+#define AV1_OBU_TD       2
+#define AV1_OBU_FRAME    6
+
+typedef struct {
+  uint16_t *buf;                /* output bytes before carry propagation */
+  size_t size;
+  size_t alloc;
+  uint32_t low;
+  unsigned int rng;
+  int cnt;
+  int ret;
+} symbol_writer;
+
+static void symbol_put(symbol_writer *e, uint16_t value)
+{
+  if (e->size == e->alloc) {
+    size_t alloc = e->alloc ? e->alloc * 2 : 256;
+    uint16_t *buf = realloc(e->buf, alloc * sizeof(*buf));
+    if (!buf) {
+      e->ret = -1;
+      return;
+    }
+    e->buf = buf;
+    e->alloc = alloc;
+  }
+  e->buf[e->size++] = value;
+}
+
+static void symbol_normalize(symbol_writer *e, uint32_t low, unsigned int rng)
+{
+  int d = 0;
+  while ((rng << d) < 0x8000) {
+    d++;
+  }
+
+  int c = e->cnt;
+  int s = c + d;
+  if (s >= 0) {
+    uint32_t m;
+    c += 16;
+    m = (1u << c) - 1;
+    if (s >= 8) {
+      symbol_put(e, low >> c);
+      low &= m;
+      c -= 8;
+      m >>= 8;
+    }
+    symbol_put(e, low >> c);
+    s = c + d - 24;
+    low &= m;
+  }
+  e->low = low << d;
+  e->rng = rng << d;
+  e->cnt = s;
+}
+
+/* cdf as the specification prints it: cumulative, without the final 32768 */
+static void symbol_encode(symbol_writer *e, int s, const uint16_t *cdf, int nsyms)
+{
+  unsigned int fl = s > 0 ? 32768 - cdf[s - 1] : 32768;
+  unsigned int fh = s < nsyms - 1 ? 32768 - cdf[s] : 0;
+  unsigned int r = e->rng;
+  uint32_t l = e->low;
+  int n = nsyms - 1;
+
+  if (fl < 32768) {
+    unsigned int u = ((r >> 8) * (fl >> 6) >> 1) + 4 * (n - (s - 1));
+    unsigned int v = ((r >> 8) * (fh >> 6) >> 1) + 4 * (n - s);
+    l += r - u;
+    r = u - v;
+  } else {
+    r -= ((r >> 8) * (fh >> 6) >> 1) + 4 * (n - s);
+  }
+  symbol_normalize(e, l, r);
+}
+
+/* Flush with the padding exit_symbol() expects, then copy the bytes out */
+static void symbol_finish(symbol_writer *e, bit_writer *w)
+{
+  uint32_t m = 0x3fff;
+  uint32_t end = ((e->low + m) & ~m) | (m + 1);
+  int c = e->cnt;
+  int s = c + 10;
+
+  if (s > 0) {
+    uint32_t n = (1u << (c + 16)) - 1;
+    do {
+      symbol_put(e, end >> (c + 16));
+      end &= n;
+      s -= 8;
+      c -= 8;
+      n >>= 8;
+    } while (s > 0);
+  }
+
+  unsigned int carry = 0;
+  for (size_t i = e->size; i-- > 0;) {
+    carry += e->buf[i];
+    e->buf[i] = carry & 0xff;
+    carry >>= 8;
+  }
+  for (size_t i = 0; i < e->size; i++) {
+    put_byte(w, e->buf[i]);
+  }
+  if (e->ret) {
+    w->ret = -1;
+  }
+}
+
+/*
+ * Default CDFs, AV1 section 10.3, for the symbols used: partition for 8x8
+ * to 64x64 blocks by context, skip by context, and the DC_PRED entries of
+ * the key frame Y mode (above and left DC) and UV mode CDFs.
+ */
+static const uint16_t av1_partition_cdf[4][4][9] = {
+  {
+    { 19132, 25510, 30392 },
+    { 13928, 19855, 28540 },
+    { 12522, 23679, 28629 },
+    { 9896, 18783, 25853 },
+  }, {
+    { 15597, 20929, 24571, 26706, 27664, 28821, 29601, 30571, 31902 },
+    { 7925, 11043, 16785, 22470, 23971, 25043, 26651, 28701, 29834 },
+    { 5414, 13269, 15111, 20488, 22360, 24500, 25537, 26336, 32117 },
+    { 2662, 6362, 8614, 20860, 23053, 24778, 26436, 27829, 31171 },
+  }, {
+    { 18462, 20920, 23124, 27647, 28227, 29049, 29519, 30178, 31544 },
+    { 7689, 9060, 12056, 24992, 25660, 26182, 26951, 28041, 29052 },
+    { 6015, 9009, 10062, 24544, 25409, 26545, 27071, 27526, 32047 },
+    { 1394, 2208, 2796, 28614, 29061, 29466, 29840, 30185, 31899 },
+  }, {
+    { 20137, 21547, 23078, 29566, 29837, 30261, 30524, 30892, 31724 },
+    { 6732, 7490, 9497, 27944, 28250, 28515, 28969, 29630, 30104 },
+    { 5945, 7663, 8348, 28683, 29117, 29749, 30064, 30298, 32238 },
+    { 870, 1212, 1487, 31198, 31394, 31574, 31743, 31881, 32332 },
+  },
+};
+static const uint16_t av1_skip_cdf[3][1] = { { 31671 }, { 16515 }, { 4576 } };
+static const uint16_t av1_y_mode_dc_cdf[1] = { 15588 };
+static const uint16_t av1_uv_mode_dc_cdf[2][1] = {
+  { 22631 },                            /* CfL not allowed */
+  { 10407 },                            /* CfL allowed */
+};
+
+enum {
+  AV1_PARTITION_NONE,
+  AV1_PARTITION_HORZ,
+  AV1_PARTITION_VERT,
+  AV1_PARTITION_SPLIT,
+  AV1_PARTITION_HORZ_A,
+  AV1_PARTITION_HORZ_B,
+  AV1_PARTITION_VERT_A,
+  AV1_PARTITION_VERT_B,
+  AV1_PARTITION_HORZ_4,
+  AV1_PARTITION_VERT_4,
+};
+
+typedef struct {
+  symbol_writer ec;
+  unsigned int mi_rows;         /* 4x4 units */
+  unsigned int mi_cols;
+  unsigned int row_start;       /* the tile */
+  unsigned int row_end;
+  unsigned int col_start;
+  unsigned int col_end;
+  unsigned int size_stride;
+  uint8_t *size_log2;           /* block width in 4x4 units, log2, per 8x8 */
+} av1_tile;
+
+static int av1_size(const av1_tile *t, unsigned int r, unsigned int c)
+{
+  return t->size_log2[(r / 2) * t->size_stride + c / 2];
+}
+
+/* The probability the partition CDF gives the listed partitions */
+static int av1_partition_sum(const uint16_t *cdf, int nsyms, const int *parts, int count)
+{
+  int sum = 0;
+
+  for (int i = 0; i < count; i++) {
+    int p = parts[i];
+    if (p < nsyms) {
+      sum += (p < nsyms - 1 ? cdf[p] : 32768) - (p > 0 ? cdf[p - 1] : 0);
+    }
+  }
+  return sum;
+}
+
+/* A square block, skipped and DC predicted */
+static void av1_block(av1_tile *t, unsigned int r, unsigned int c, int bsl)
+{
+  int avail_up = r > t->row_start, avail_left = c > t->col_start;
+
+  symbol_encode(&t->ec, 1, av1_skip_cdf[avail_up + avail_left], 2);
+  symbol_encode(&t->ec, 0, av1_y_mode_dc_cdf, 13);
+  symbol_encode(&t->ec, 0, av1_uv_mode_dc_cdf[bsl < 4], bsl < 4 ? 14 : 13);
+
+  for (unsigned int y = r; y < r + (1u << bsl) && y < t->mi_rows; y += 2) {
+    for (unsigned int x = c; x < c + (1u << bsl) && x < t->mi_cols; x += 2) {
+      t->size_log2[(y / 2) * t->size_stride + x / 2] = bsl;
+    }
+  }
+}
+
+/*
+ * The largest blocks that fit: PARTITION_NONE where the picture covers
+ * the middle of the block both ways, otherwise a split. bsl is the block
+ * width in 4x4 units, log2: 1 for 8x8 to 4 for 64x64.
+ */
+static void av1_partition(av1_tile *t, unsigned int r, unsigned int c, int bsl)
+{
+  /* split_or_horz and split_or_vert code a split with the summed probability of these */
+  static const int split_or_horz[] = {
+    AV1_PARTITION_VERT, AV1_PARTITION_SPLIT, AV1_PARTITION_HORZ_A,
+    AV1_PARTITION_VERT_A, AV1_PARTITION_VERT_B, AV1_PARTITION_VERT_4,
+  };
+  static const int split_or_vert[] = {
+    AV1_PARTITION_HORZ, AV1_PARTITION_SPLIT, AV1_PARTITION_HORZ_A,
+    AV1_PARTITION_HORZ_B, AV1_PARTITION_VERT_A, AV1_PARTITION_HORZ_4,
+  };
+  unsigned int half = 1u << (bsl - 1);
+
+  if (r >= t->mi_rows || c >= t->mi_cols) {
+    return;
+  }
+
+  int has_rows = r + half < t->mi_rows;
+  int has_cols = c + half < t->mi_cols;
+  int above = r > t->row_start && av1_size(t, r - 1, c) < bsl;
+  int left = c > t->col_start && av1_size(t, r, c - 1) < bsl;
+  const uint16_t *cdf = av1_partition_cdf[bsl - 1][left * 2 + above];
+  int nsyms = bsl == 1 ? 4 : 10;
+
+  if (has_rows && has_cols) {
+    symbol_encode(&t->ec, AV1_PARTITION_NONE, cdf, nsyms);
+    av1_block(t, r, c, bsl);
+    return;
+  }
+  if (has_cols || has_rows) {
+    /* split_or_horz or split_or_vert, 1 for PARTITION_SPLIT */
+    uint16_t split_cdf[1] = {
+      32768 - (has_cols ? av1_partition_sum(cdf, nsyms, split_or_horz, 6) :
+                          av1_partition_sum(cdf, nsyms, split_or_vert, 6))
+    };
+    symbol_encode(&t->ec, 1, split_cdf, 2);
+  }
+  for (int i = 0; i < 4; i++) {
+    av1_partition(t, r + (i >> 1) * half, c + (i & 1) * half, bsl - 1);
+  }
+}
+
+static int av1_tile_log2(unsigned int block, unsigned int target)
+{
+  int k = 0;
+  while ((block << k) < target) {
+    k++;
+  }
+  return k;
+}
+
+typedef struct {
+  unsigned int mi_rows;
+  unsigned int mi_cols;
+  int cols_log2;
+  int rows_log2;
+  unsigned int tile_width_sb;
+  unsigned int tile_height_sb;
+} av1_tiles;
+
+/* tile_info() with uniform spacing and the fewest tiles allowed */
+static void av1_tile_info(bit_writer *w, av1_tiles *tiles)
+{
+  unsigned int sb_cols = (tiles->mi_cols + 15) >> 4;
+  unsigned int sb_rows = (tiles->mi_rows + 15) >> 4;
+  int min_cols_log2 = av1_tile_log2(4096 >> AV1_SB_LOG2, sb_cols);
+  int max_cols_log2 = av1_tile_log2(1, sb_cols < 64 ? sb_cols : 64);
+  int max_rows_log2 = av1_tile_log2(1, sb_rows < 64 ? sb_rows : 64);
+  int min_log2 = av1_tile_log2((4096 * 2304) >> (2 * AV1_SB_LOG2), sb_rows * sb_cols);
+
+  if (min_log2 < min_cols_log2) {
+    min_log2 = min_cols_log2;
+  }
+
+  put_bits(w, 1, 1);                    /* uniform_tile_spacing_flag */
+  tiles->cols_log2 = min_cols_log2;
+  if (tiles->cols_log2 < max_cols_log2) {
+    put_bits(w, 1, 0);                  /* increment_tile_cols_log2 */
+  }
+  tiles->rows_log2 = min_log2 > tiles->cols_log2 ? min_log2 - tiles->cols_log2 : 0;
+  if (tiles->rows_log2 < max_rows_log2) {
+    put_bits(w, 1, 0);                  /* increment_tile_rows_log2 */
+  }
+  tiles->tile_width_sb = (sb_cols + (1u << tiles->cols_log2) - 1) >> tiles->cols_log2;
+  tiles->tile_height_sb = (sb_rows + (1u << tiles->rows_log2) - 1) >> tiles->rows_log2;
+  if (tiles->cols_log2 || tiles->rows_log2) {
+    put_bits(w, tiles->cols_log2 + tiles->rows_log2, 0);  /* context_update_tile_id */
+    put_bits(w, 2, 3);                  /* tile_size_bytes_minus_1 */
+  }
+}
+
+static void av1_frame_header(bit_writer *w, av1_tiles *tiles)
+{
+  put_bits(w, 1, 0);                    /* show_existing_frame */
+  put_bits(w, 2, 0);                    /* frame_type: KEY_FRAME */
+  put_bits(w, 1, 1);                    /* show_frame */
+  put_bits(w, 1, 1);                    /* disable_cdf_update */
+  put_bits(w, 1, 0);                    /* frame_size_override_flag */
+  put_bits(w, 1, 0);                    /* render_and_frame_size_different */
+  av1_tile_info(w, tiles);
+  put_bits(w, 8, 100);                  /* base_q_idx */
+  put_bits(w, 1, 0);                    /* DeltaQYDc delta_coded */
+  put_bits(w, 1, 0);                    /* DeltaQUDc delta_coded */
+  put_bits(w, 1, 0);                    /* DeltaQUAc delta_coded */
+  put_bits(w, 1, 0);                    /* using_qmatrix */
+  put_bits(w, 1, 0);                    /* segmentation_enabled */
+  put_bits(w, 1, 0);                    /* delta_q_present */
+  put_bits(w, 6, 0);                    /* loop_filter_level[0] */
+  put_bits(w, 6, 0);                    /* loop_filter_level[1] */
+  put_bits(w, 3, 0);                    /* loop_filter_sharpness */
+  put_bits(w, 1, 0);                    /* loop_filter_delta_enabled */
+  put_bits(w, 1, 0);                    /* tx_mode_select: TX_MODE_LARGEST */
+  put_bits(w, 1, 0);                    /* reduced_tx_set */
+}
+
+static void av1_tile_group(bit_writer *w, const av1_tiles *tiles)
+{
+  unsigned int sb = 1u << (AV1_SB_LOG2 - 2);
+  unsigned int tile_cols = ((tiles->mi_cols + sb - 1) / sb + tiles->tile_width_sb - 1) /
+                           tiles->tile_width_sb;
+  unsigned int tile_rows = ((tiles->mi_rows + sb - 1) / sb + tiles->tile_height_sb - 1) /
+                           tiles->tile_height_sb;
+  av1_tile t = {
+    .mi_rows = tiles->mi_rows,
+    .mi_cols = tiles->mi_cols,
+    .size_stride = tiles->mi_cols / 2,
+  };
+
+  if (tile_cols * tile_rows > 1) {
+    put_bits(w, 1, 0);                  /* tile_start_and_end_present_flag */
+  }
+  put_align(w);
+
+  t.size_log2 = calloc((size_t)t.size_stride * (tiles->mi_rows / 2), 1);
+  if (!t.size_log2) {
+    w->ret = -1;
+    return;
+  }
+
+  for (unsigned int row = 0; row < tile_rows; row++) {
+    for (unsigned int col = 0; col < tile_cols; col++) {
+      bit_writer data = { 0 };
+
+      memset(&t.ec, 0, sizeof(t.ec));
+      t.ec.rng = 0x8000;
+      t.ec.cnt = -9;
+      t.row_start = row * tiles->tile_height_sb * sb;
+      t.row_end = t.row_start + tiles->tile_height_sb * sb;
+      t.col_start = col * tiles->tile_width_sb * sb;
+      t.col_end = t.col_start + tiles->tile_width_sb * sb;
+      for (unsigned int r = t.row_start; r < t.row_end && r < t.mi_rows; r += sb) {
+        for (unsigned int c = t.col_start; c < t.col_end && c < t.mi_cols; c += sb) {
+          av1_partition(&t, r, c, AV1_SB_LOG2 - 2);
+        }
+      }
+      symbol_finish(&t.ec, &data);
+      free(t.ec.buf);
+
+      if (row < tile_rows - 1 || col < tile_cols - 1) {
+        for (int i = 0; i < 4; i++) {
+          put_bits(w, 8, ((data.size - 1) >> (8 * i)) & 0xff);  /* tile_size_minus_1 */
+        }
+      }
+      for (size_t i = 0; i < data.size; i++) {
+        put_byte(w, data.data[i]);
+      }
+      if (data.ret) {
+        w->ret = -1;
+      }
+      free(data.data);
+    }
+  }
+  free(t.size_log2);
+}
+
+static void av1_sequence_header(bit_writer *w, int bit_depth, unsigned int width,
+                                unsigned int height)
+{
+  uint64_t samples = (uint64_t)width * height;
+  int level;
+
+  /* seq_level_idx 9, 13 or 17 (4.1, 5.1, 6.1) by MaxPicSize and dimensions, else 31 */
+  if (samples <= 2359296 && width <= 4096 && height <= 2304) {
+    level = 9;
+  } else if (samples <= 8912896 && width <= 8192 && height <= 4352) {
+    level = 13;
+  } else if (samples <= 35651584 && width <= 16384 && height <= 8704) {
+    level = 17;
+  } else {
+    level = 31;
+  }
+
+  put_bits(w, 3, 0);                    /* seq_profile: Main */
+  put_bits(w, 1, 0);                    /* still_picture */
+  put_bits(w, 1, 0);                    /* reduced_still_picture_header */
+  put_bits(w, 1, 0);                    /* timing_info_present_flag */
+  put_bits(w, 1, 0);                    /* initial_display_delay_present_flag */
+  put_bits(w, 5, 0);                    /* operating_points_cnt_minus_1 */
+  put_bits(w, 12, 0);                   /* operating_point_idc[0] */
+  put_bits(w, 5, level);
+  if (level > 7) {
+    put_bits(w, 1, 0);                  /* seq_tier[0] */
+  }
+  put_bits(w, 4, 15);                   /* frame_width_bits_minus_1 */
+  put_bits(w, 4, 15);                   /* frame_height_bits_minus_1 */
+  put_bits(w, 16, width - 1);           /* max_frame_width_minus_1 */
+  put_bits(w, 16, height - 1);          /* max_frame_height_minus_1 */
+  put_bits(w, 1, 0);                    /* frame_id_numbers_present_flag */
+  put_bits(w, 1, 0);                    /* use_128x128_superblock */
+  put_bits(w, 1, 0);                    /* enable_filter_intra */
+  put_bits(w, 1, 0);                    /* enable_intra_edge_filter */
+  put_bits(w, 1, 0);                    /* enable_interintra_compound */
+  put_bits(w, 1, 0);                    /* enable_masked_compound */
+  put_bits(w, 1, 0);                    /* enable_warped_motion */
+  put_bits(w, 1, 0);                    /* enable_dual_filter */
+  put_bits(w, 1, 0);                    /* enable_order_hint */
+  put_bits(w, 1, 0);                    /* seq_choose_screen_content_tools */
+  put_bits(w, 1, 0);                    /* seq_force_screen_content_tools */
+  put_bits(w, 1, 0);                    /* enable_superres */
+  put_bits(w, 1, 0);                    /* enable_cdef */
+  put_bits(w, 1, 0);                    /* enable_restoration */
+  put_bits(w, 1, bit_depth > 8);        /* high_bitdepth */
+  put_bits(w, 1, 0);                    /* mono_chrome */
+  put_bits(w, 1, 0);                    /* color_description_present_flag */
+  put_bits(w, 1, 0);                    /* color_range */
+  put_bits(w, 2, 0);                    /* chroma_sample_position */
+  put_bits(w, 1, 0);                    /* separate_uv_delta_q */
+  put_bits(w, 1, 0);                    /* film_grain_params_present */
+  put_trailing_bits(w);
+}
+
+static void put_obu(bit_writer *unit, int type, const bit_writer *payload)
+{
+  size_t size = payload->size;
+
+  put_bits(unit, 8, type << 3 | 1 << 1);  /* obu_has_size_field */
+  while (size >= 0x80) {
+    put_byte(unit, (size & 0x7f) | 0x80);
+    size >>= 7;
+  }
+  put_byte(unit, size);
+  for (size_t i = 0; i < payload->size; i++) {
+    put_byte(unit, payload->data[i]);
+  }
+  if (payload->ret) {
+    unit->ret = -1;
+  }
+}
+
+/* Temporal units; as every picture is the same key frame only the first differs */
+static void av1_unit(bit_writer *unit, int index, int bit_depth, unsigned int width,
+                     unsigned int height)
+{
+  bit_writer payload = { 0 };
+  av1_tiles tiles = {
+    .mi_rows = 2 * ((height + 7) >> 3),
+    .mi_cols = 2 * ((width + 7) >> 3),
+  };
+
+  put_obu(unit, AV1_OBU_TD, &payload);
+  if (index == 0) {
+    av1_sequence_header(&payload, bit_depth, width, height);
+    put_obu(unit, AV1_OBU_SEQUENCE, &payload);
+    payload.size = 0;
+  }
+  av1_frame_header(&payload, &tiles);
+  put_align(&payload);
+  av1_tile_group(&payload, &tiles);
+  put_obu(unit, AV1_OBU_FRAME, &payload);
+  free(payload.data);
+}
+
+
+int nvvi_synth_supported(int codec, int chroma_format, int bit_depth)
+{
+  if (chroma_format != cudaVideoChromaFormat_420) {
+    return 0;
+  }
+  switch (codec) {
+  case cudaVideoCodec_H264:
+    return bit_depth == 8;
+  case cudaVideoCodec_HEVC:
+#if NVDECAPI_MAJOR_VERSION > 10
+  case cudaVideoCodec_AV1:
+#endif
+    return bit_depth == 8 || bit_depth == 10;
+  default:
+    return 0;
+  }
+}
+
+int nvvi_synth_stream_init(nvvi_synth_stream *s, int codec, int bit_depth,
+                           unsigned int width, unsigned int height)
+{
+  int ret = 0;
+
+  memset(s, 0, sizeof(*s));
+  if (!nvvi_synth_supported(codec, cudaVideoChromaFormat_420, bit_depth) ||
+      !width || !height || (width | height) & 1 || width > 65536 || height > 65536) {
+    return -1;
+  }
+
+  s->codec = codec;
+  switch (codec) {
+  case cudaVideoCodec_H264:
+    s->coded_width = (width + 15) & ~15u;
+    s->coded_height = (height + 15) & ~15u;
+    break;
+  case cudaVideoCodec_HEVC:
+    s->coded_width = (width + 7) & ~7u;
+    s->coded_height = (height + 7) & ~7u;
+    break;
+  default:
+    s->coded_width = width;
+    s->coded_height = height;
+    break;
+  }
+
+  for (int i = 0; i < NVVI_SYNTH_GOP + 1; i++) {
+    bit_writer unit = { 0 };
+
+    if (codec == cudaVideoCodec_H264) {
+      h264_unit(&unit, i, width, height);
+    } else if (codec == cudaVideoCodec_HEVC) {
+      hevc_unit(&unit, i, bit_depth, width, height);
+    } else if (i < 2) {
+      av1_unit(&unit, i, bit_depth, width, height);
+    } else {
+      /* Every later temporal unit is the same as the second */
+      unit.data = malloc(s->units[1].size);
+      unit.size = s->units[1].size;
+      if (unit.data) {
+        memcpy(unit.data, s->units[1].data, unit.size);
+      } else {
+        unit.ret = -1;
+      }
+    }
+
+    s->units[i].data = unit.data;
+    s->units[i].size = unit.size;
+    ret |= unit.ret;
+  }
+
+  if (ret != 0) {
+    nvvi_synth_stream_free(s);
+  }
+  return ret;
+}
+
+const nvvi_synth_unit *nvvi_synth_frame(const nvvi_synth_stream *s, int index)
+{
+  int pos = index % NVVI_SYNTH_GOP;
+
+  /* Consecutive H.264 IDRs must differ in idr_pic_id */
+  if (pos == 0) {
+    return &s->units[(index / NVVI_SYNTH_GOP) & 1];
+  }
+  return &s->units[pos + 1];
+}
+
+void nvvi_synth_stream_free(nvvi_synth_stream *s)
+{
+  for (int i = 0; i < NVVI_SYNTH_GOP + 1; i++) {
+    free(s->units[i].data);
+  }
+  memset(s, 0, sizeof(*s));
+}
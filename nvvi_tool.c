@@ -0,0 +1,543 @@
+/*
+ * nv-video-info - helpers shared by the command line tools
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "nvvi_tool.h"
+
+static int print_divider(int count) {
+  printf("-------------------------------------");
+  for (int i = 0; i < count; i++) {
+    printf("------------");
+  }
+  printf("\n");
+}
+
+static int print_thick_divider(int count) {
+  printf("=====================================");
+  for (int i = 0; i < count; i++) {
+    printf("============");
+  }
+  printf("\n");
+}
+
+static int print_header(const char *text, int count) {
+  printf("%s", text);
+  for (int i = 0; i < count; i++) {
+    printf("           |");
+  }
+  printf("\n");
+}
+
+static int print_formats(const nvvi_encode_codec *codecs, int count)
+{
+  print_header("        Input Buffer Formats        |", count);
+  print_divider(count);
+  for (int i = 0; i < nvvi_num_encode_formats; i++) {
+    printf("%35s |", nvvi_encode_formats[i].desc);
+    for (int j = 0; j < count; j++) {
+      printf("%10s |", (codecs[j].input_formats & nvvi_encode_formats[i].fmt) ? "x" : ".");
+    }
+    printf("\n");
+  }
+  print_divider(count);
+
+  return 0;
+}
+
+
+static int print_profiles(const nvvi_encode_codec *codecs, int count)
+{
+  print_divider(count);
+  print_header("              Profiles              |", count);
+  print_divider(count);
+
+  int max = 0;
+  for (int i = 0; i < count; i++) {
+    max = MAX(max, codecs[i].num_profiles);
+  }
+
+  for (int i = 0; i < max; i++) {
+    printf("%35s |", "");
+    for (int j = 0; j < count; j++) {
+      if (i < codecs[j].num_profiles) {
+        printf("%10s |", codecs[j].profiles[i].name);
+      } else {
+        printf("%10s |", "");
+      }
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
+
+
+static int print_presets(const nvvi_encode_codec *codecs, int count)
+{
+  print_divider(count);
+  print_header("               Presets              |", count);
+  print_divider(count);
+
+  int max = 0;
+  for (int i = 0; i < count; i++) {
+    max = MAX(max, codecs[i].num_presets);
+  }
+
+  for (int i = 0; i < max; i++) {
+    printf("%35s |", "");
+    for (int j = 0; j < count; j++) {
+      if (i < codecs[j].num_presets) {
+        printf("%10s |", codecs[j].presets[i].name);
+      } else {
+        printf("%10s |", "");
+      }
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
+
+
+static int print_caps(const nvvi_encode_codec *codecs, int count)
+{
+  print_header("              Limits                |", count);
+  print_divider(count);
+  for (int i = 0; i < nvvi_num_encode_limits; i++) {
+    printf("%35s |", nvvi_encode_limits[i].desc);
+    for (int j = 0; j < count; j++) {
+      printf("%10d |", codecs[j].caps[nvvi_encode_limits[i].cap]);
+    }
+    printf("\n");
+  }
+
+  print_divider(count);
+  print_header("            Capabilities            |", count);
+  print_divider(count);
+  for (int i = 0; i < nvvi_num_encode_caps; i++) {
+    printf("%35s |", nvvi_encode_caps[i].desc);
+    for (int j = 0; j < count; j++) {
+      printf("%10d |", codecs[j].caps[nvvi_encode_caps[i].cap]);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
+
+
+/* "ok 12.3ms", "fail N" or "." if nvvi_verify() didn't try it */
+static void format_verify(char *buf, size_t len, const nvvi_verify_result *verify)
+{
+  if (verify->result == NVVI_VERIFY_PASS) {
+    snprintf(buf, len, "ok %.1fms", verify->create_ms);
+  } else if (verify->result == NVVI_VERIFY_FAIL) {
+    snprintf(buf, len, "fail %d", verify->status);
+  } else {
+    snprintf(buf, len, ".");
+  }
+}
+
+
+static int print_verify(const nvvi_encode_codec *codecs, int count)
+{
+  static const char *const kinds[NVVI_VERIFY_KINDS] = {
+    [NVVI_VERIFY_MAX_SIZE] = "Max size",
+    [NVVI_VERIFY_YUV444]   = "4:4:4",
+    [NVVI_VERIFY_10BIT]    = "10-bit",
+    [NVVI_VERIFY_LOSSLESS] = "Lossless",
+  };
+  int verified = 0;
+
+  for (int j = 0; j < count; j++) {
+    verified |= codecs[j].verify[NVVI_VERIFY_MAX_SIZE].result != NVVI_VERIFY_UNTESTED;
+  }
+  if (!verified) {
+    return 0;
+  }
+
+  print_divider(count);
+  print_header("            Verification            |", count);
+  print_divider(count);
+  for (int i = 0; i < NVVI_VERIFY_KINDS; i++) {
+    printf("%35s |", kinds[i]);
+    for (int j = 0; j < count; j++) {
+      char buf[16];
+      format_verify(buf, sizeof(buf), &codecs[j].verify[i]);
+      printf("%10s |", buf);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
+
+
+void tool_print_encode(const nvvi_device *device)
+{
+  const nvvi_encode_codec *codecs = device->encode_codecs;
+  int count = device->num_encode_codecs;
+
+  print_thick_divider(count);
+  printf("                              Codec |");
+  for (int i = 0; i < count; i++) {
+    int pad = (11 - (int)strlen(codecs[i].name) + 1) / 2;
+    printf("%*s%-*s|", pad, "", 11 - pad, codecs[i].name);
+  }
+  printf("\n");
+  print_thick_divider(count);
+  print_formats(codecs, count);
+  print_caps(codecs, count);
+  print_verify(codecs, count);
+  print_profiles(codecs, count);
+  print_presets(codecs, count);
+  print_thick_divider(count);
+}
+
+
+static void print_decode_caps(const nvvi_decode_caps *caps, int verified)
+{
+  printf("%5s | %6s | %5d | %9d | %10d | %9d | %10d | %8d | %15s",
+         nvvi_decode_codec_name(caps->codec),
+         nvvi_chroma_format_name(caps->chroma_format),
+         caps->bit_depth, caps->min_width, caps->min_height,
+         caps->max_width, caps->max_height, caps->max_mb_count,
+         nvvi_surface_formats_name(caps->output_format_mask));
+  if (verified) {
+    char buf[16];
+    format_verify(buf, sizeof(buf), &caps->verify);
+    printf(" | %s", buf);
+  }
+  printf("\n");
+}
+
+
+static void print_decode_divider(int verified)
+{
+  printf("-----------------------------------------------------------------------------------------------------%s\n",
+         verified ? "-------------" : "");
+}
+
+
+int tool_print_decode(const nvvi_device *device)
+{
+  int verified = 0;
+
+  for (int j = 0; j < device->num_decode_caps; j++) {
+    verified |= device->decode_caps[j].verify.result != NVVI_VERIFY_UNTESTED;
+  }
+
+  print_decode_divider(verified);
+
+  if (device->decode_status != 0) {
+    return -1;
+  }
+
+  printf("Codec | Chroma | Depth | Min Width | Min Height | Max Width | Max Height |  Max MBs | Surface Formats%s\n",
+         verified ? " | Verified" : "");
+  print_decode_divider(verified);
+  for (int j = 0; j < device->num_decode_caps; j++) {
+    print_decode_caps(&device->decode_caps[j], verified);
+  }
+  print_decode_divider(verified);
+  printf("\n");
+
+  return 0;
+}
+
+
+void tool_print_device(const nvvi_device *device)
+{
+  const nvvi_topology *topo = &device->topology;
+
+  printf("Device %d: %s\n", device->index, device->name);
+  if (!device->uuid[0] && !device->pci_bus_id[0]) {
+    return;
+  }
+
+  printf("%s %s", device->uuid, device->pci_bus_id);
+  if (topo->numa_node >= 0) {
+    printf(", NUMA node %d", topo->numa_node);
+  }
+  if (topo->local_cpus[0]) {
+    printf(", CPUs %s", topo->local_cpus);
+  }
+  if (topo->link_gen && topo->link_width) {
+    printf(", PCIe Gen%d x%d", topo->link_gen, topo->link_width);
+    if (topo->max_link_gen != topo->link_gen || topo->max_link_width != topo->link_width) {
+      printf(" (max Gen%d x%d)", topo->max_link_gen, topo->max_link_width);
+    }
+  }
+  printf("\n");
+}
+
+
+#define TOOL_MAX_CPUS 8192
+
+/* "0-15,32-47" as the comma separated 32-bit hex words taskset takes; -1 if malformed */
+static int cpulist_mask(const char *list, char *buf, size_t len)
+{
+  uint32_t words[TOOL_MAX_CPUS / 32] = { 0 };
+  int top = 0;
+
+  for (const char *p = list; *p; ) {
+    char *end;
+    unsigned long first = strtoul(p, &end, 10), last = first;
+
+    if (end == p) {
+      return -1;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = strtoul(p, &end, 10);
+      if (end == p) {
+        return -1;
+      }
+    }
+    if ((*end && *end != ',') || last < first || last >= TOOL_MAX_CPUS) {
+      return -1;
+    }
+    for (unsigned long cpu = first; cpu <= last; cpu++) {
+      words[cpu / 32] |= 1u << (cpu % 32);
+    }
+    top = MAX(top, (int)(last / 32));
+    p = end + (*end == ',');
+  }
+
+  size_t used = 0;
+  buf[0] = '\0';
+  for (int i = top; i >= 0 && used < len; i--) {
+    used += snprintf(buf + used, len - used, i == top ? "%x" : ",%08x", words[i]);
+  }
+  return 0;
+}
+
+
+void tool_print_affinity(const nvvi_snapshot *snap)
+{
+  printf("# device bus-id numa-node cpu-list cpu-mask\n");
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    const nvvi_topology *topo = &device->topology;
+    char mask[TOOL_MAX_CPUS / 4 + TOOL_MAX_CPUS / 32];
+
+    if (!topo->local_cpus[0] || cpulist_mask(topo->local_cpus, mask, sizeof(mask)) != 0) {
+      snprintf(mask, sizeof(mask), "-");
+    }
+    printf("%d %s ", device->index, device->pci_bus_id[0] ? device->pci_bus_id : "-");
+    if (topo->numa_node >= 0) {
+      printf("%d", topo->numa_node);
+    } else {
+      printf("-");
+    }
+    printf(" %s %s\n", topo->local_cpus[0] ? topo->local_cpus : "-", mask);
+  }
+}
+
+
+int tool_print_probe_status(const nvvi_device *device)
+{
+  switch (device->probe_status) {
+  case NVVI_DEVICE_TIMED_OUT:
+    printf("Probe timed out after %.0f ms\n", device->probe_ms);
+    return -1;
+  case NVVI_DEVICE_ABORTED:
+    printf("Probe process failed after %.0f ms\n", device->probe_ms);
+    return -1;
+  }
+  return 0;
+}
+
+
+int tool_record_snapshot(const nvvi_snapshot *snap, const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "Cannot open %s for writing\n", path);
+    return -1;
+  }
+
+  int ret = nvvi_snapshot_save(snap, f);
+  if (fclose(f) != 0 || ret != 0) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+
+int tool_load_snapshot(nvvi_snapshot *snap, const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return -1;
+  }
+
+  int ret = nvvi_snapshot_load(snap, f);
+  fclose(f);
+  if (ret != 0) {
+    fprintf(stderr, "%s is not a snapshot\n", path);
+  }
+  return ret;
+}
+
+
+static void print_difference(const nvvi_diff_entry *e, void *opaque)
+{
+  static const char *kinds[] = { "added", "removed", "changed" };
+  int *count = opaque;
+
+  printf("%-10s ", e->regression ? "REGRESSION" : kinds[e->kind]);
+  if (e->device >= 0) {
+    printf("device %d %s%s%s: ", e->device, e->name, e->codec[0] ? " " : "", e->codec);
+  }
+  printf("%s", e->item);
+  if (e->kind == NVVI_DIFF_CHANGED) {
+    printf(" %s -> %s", e->from[0] ? e->from : "-", e->to[0] ? e->to : "-");
+  } else if (e->regression) {
+    printf(" removed");
+  }
+  printf("\n");
+  (*count)++;
+}
+
+
+int tool_diff(const char *old_path, const nvvi_snapshot *snap)
+{
+  nvvi_snapshot old;
+  int count = 0;
+
+  if (tool_load_snapshot(&old, old_path) != 0) {
+    return 2;
+  }
+  int regressions = nvvi_snapshot_diff(&old, snap, print_difference, &count);
+  nvvi_snapshot_free(&old);
+  if (regressions < 0) {
+    return 2;
+  }
+  printf("%d differences, %d regressions\n", count, regressions);
+  return regressions ? 1 : 0;
+}
+
+
+int tool_diff_files(const char *old_path, const char *new_path)
+{
+  nvvi_snapshot snap;
+
+  if (tool_load_snapshot(&snap, new_path) != 0) {
+    return 2;
+  }
+  int ret = tool_diff(old_path, &snap);
+  nvvi_snapshot_free(&snap);
+  return ret;
+}
+
+
+int tool_trace_start(tool_trace *trace)
+{
+  if (trace->trace_path) {
+    trace->trace = fopen(trace->trace_path, "w");
+    if (!trace->trace) {
+      fprintf(stderr, "Cannot open %s for writing\n", trace->trace_path);
+      return -1;
+    }
+  }
+  if (trace->timings || trace->trace) {
+    nvvi_trace_start(trace->trace);
+  }
+  return 0;
+}
+
+
+void tool_trace_finish(tool_trace *trace)
+{
+  if (!trace->timings && !trace->trace) {
+    return;
+  }
+
+  nvvi_trace_stop();
+  if (trace->timings) {
+    nvvi_trace_print(stderr);
+  }
+  if (trace->trace) {
+    fclose(trace->trace);
+    trace->trace = NULL;
+  }
+}
+
+
+int tool_parse_ints(const char *arg, int *values, int max)
+{
+  int count = 0;
+
+  for (const char *p = arg; *p; p += strcspn(p, ",")) {
+    char *end;
+
+    p += *p == ',';
+    if (count == max) {
+      return -1;
+    }
+    values[count] = strtol(p, &end, 10);
+    if (end == p || (*end && *end != ',') || values[count] < 0) {
+      return -1;
+    }
+    count++;
+  }
+  return count;
+}
+
+
+int tool_parse_sizes(const char *arg, unsigned int *widths, unsigned int *heights, int max)
+{
+  int count = 0;
+
+  for (const char *p = arg; *p; p += strcspn(p, ",")) {
+    p += *p == ',';
+    if (count == max || sscanf(p, "%ux%u", &widths[count], &heights[count]) != 2 ||
+        !widths[count] || !heights[count]) {
+      return -1;
+    }
+    count++;
+  }
+  return count;
+}
+
+
+void tool_print_memory(const nvvi_footprint *fp)
+{
+  printf("Memory: %llu of %llu MiB free\n", (unsigned long long)(fp->free_bytes >> 20),
+         (unsigned long long)(fp->total_bytes >> 20));
+}
+
+
+void tool_print_footprint(const nvvi_footprint *fp)
+{
+  if (fp->status != 0) {
+    printf("%s\n", fp->error);
+    return;
+  }
+  printf("%8.1f %8.1f %8.1f\n", fp->bytes / 1048576.0, fp->min_bytes / 1048576.0,
+         fp->max_bytes / 1048576.0);
+}
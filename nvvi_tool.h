@@ -0,0 +1,113 @@
+/*
+ * nv-video-info - helpers shared by the command line tools
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Rendering and option helpers shared by the command line tools. Not part
+ * of libnvvideoinfo.
+ */
+
+#ifndef NVVI_TOOL_H
+#define NVVI_TOOL_H
+
+#include <stdio.h>
+
+#include "nvvideoinfo.h"
+
+/* Long-only options common to the tools */
+enum {
+  TOOL_OPT_TIMINGS = 256,
+  TOOL_OPT_TRACE,
+  TOOL_OPT_VERIFY,
+  TOOL_OPT_TIMEOUT,
+  TOOL_OPT_SYSFS_ROOT,
+  TOOL_OPT_DIFF,
+  TOOL_OPT_FIRST_LOCAL,         /* tools number their own long options from here */
+};
+
+#define TOOL_COMMON_USAGE \
+  "  -j, --jobs N    probe with N worker threads (0: one per CPU)\n" \
+  "  -c, --cache F   answer from (and update) the capability cache F\n" \
+  "  -r, --record F  save a full decode+encode snapshot to F and exit\n" \
+  "      --timings   print per-phase and per-call driver timings to stderr\n" \
+  "      --trace F   write a Chrome trace of every driver call to F\n" \
+  "      --verify    create a session at every advertised limit\n" \
+  "      --timeout MS  probe each device in a child process, killed after MS\n" \
+  "      --sysfs-root DIR  read the PCIe/NUMA topology from DIR instead of /sys\n" \
+  "      --diff OLD [NEW]  compare the snapshot OLD with NEW or the probe and\n" \
+  "                  exit 1 on regressions\n"
+
+typedef struct {
+  int timings;
+  const char *trace_path;
+  FILE *trace;
+} tool_trace;
+
+/* Start library tracing if --timings or --trace was given */
+int tool_trace_start(tool_trace *trace);
+void tool_trace_finish(tool_trace *trace);
+
+int tool_record_snapshot(const nvvi_snapshot *snap, const char *path);
+int tool_load_snapshot(nvvi_snapshot *snap, const char *path);
+
+/*
+ * --diff: print every difference from the snapshot in old_path to snap
+ * and return the exit status, 0 if nothing regressed, 1 if something did
+ * and 2 on errors. tool_diff_files() compares two saved snapshots.
+ */
+int tool_diff(const char *old_path, const nvvi_snapshot *snap);
+int tool_diff_files(const char *old_path, const char *new_path);
+
+/* "Device N: name", then its ids and where it sits on the host */
+void tool_print_device(const nvvi_device *device);
+
+/*
+ * One line per device with its NUMA node, local CPU list and the same as a
+ * hex mask, ready for numactl and taskset.
+ */
+void tool_print_affinity(const nvvi_snapshot *snap);
+
+/* Say why a device probed with --timeout has no results; -1 if it doesn't */
+int tool_print_probe_status(const nvvi_device *device);
+
+/*
+ * The nvdecinfo table for one device; returns -1 if it has no decode caps.
+ * Rows nvvi_verify() tried get a Verified column, as does the encode table.
+ */
+int tool_print_decode(const nvvi_device *device);
+
+/* The nvencinfo table for one device */
+void tool_print_encode(const nvvi_device *device);
+
+/*
+ * Footprint sweeps. The parsers take comma separated lists, e.g. "0,3" or
+ * "1280x720,1920x1080", and return the number of entries, or -1 if one is
+ * invalid or there are more than max.
+ */
+#define TOOL_MAX_LIST 16
+
+int tool_parse_ints(const char *arg, int *values, int max);
+int tool_parse_sizes(const char *arg, unsigned int *widths, unsigned int *heights, int max);
+
+/* "Memory: X of Y MiB free" for the device a footprint was measured on */
+void tool_print_memory(const nvvi_footprint *fp);
+
+/* The MiB columns of a footprint row, or the reason there are none */
+void tool_print_footprint(const nvvi_footprint *fp);
+
+#endif /* NVVI_TOOL_H */
@@ -0,0 +1,490 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Per entry point call statistics and Chrome trace output.
+ *
+ * Every wrapped call bumps a set of counters and a log2 latency histogram
+ * for its entry point; counters are atomics so worker threads never
+ * contend on a lock. Trace events, when requested, are appended to the
+ * trace file under a mutex as they complete, in the Trace Event Format
+ * understood by chrome://tracing and Perfetto.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvvideoinfo.h"
+#include "nvvi_trace.h"
+
+#define TRACE_BUCKETS 24        /* [2^i, 2^(i+1)) us; bucket 0 is [0, 2) us */
+#define TRACE_PHASES  32
+
+/* table, return type, entry point, parameters, arguments */
+#define CUDA_CALLS(X) \
+  X(cuda, CUresult, cuInit, (unsigned int flags), (flags)) \
+  X(cuda, CUresult, cuDeviceGetCount, (int *count), (count)) \
+  X(cuda, CUresult, cuDeviceGet, (CUdevice *device, int ordinal), (device, ordinal)) \
+  X(cuda, CUresult, cuDeviceGetName, (char *name, int len, CUdevice dev), (name, len, dev)) \
+  X(cuda, CUresult, cuCtxCreate, (CUcontext *pctx, unsigned int flags, CUdevice dev), (pctx, flags, dev)) \
+  X(cuda, CUresult, cuCtxPushCurrent, (CUcontext ctx), (ctx)) \
+  X(cuda, CUresult, cuCtxPopCurrent, (CUcontext *pctx), (pctx)) \
+  X(cuda, CUresult, cuCtxDestroy, (CUcontext ctx), (ctx)) \
+  X(cuda, CUresult, cuDevicePrimaryCtxRetain, (CUcontext *pctx, CUdevice dev), (pctx, dev)) \
+  X(cuda, CUresult, cuDevicePrimaryCtxRelease, (CUdevice dev), (dev)) \
+  X(cuda, CUresult, cuMemcpy2D, (const CUDA_MEMCPY2D *copy), (copy))
+
+#define CUDA_EXT_CALLS(X) \
+  X(cuda_ext, CUresult, cuDriverGetVersion, (int *version), (version)) \
+  X(cuda_ext, CUresult, cuDeviceGetUuid, (CUuuid *uuid, CUdevice dev), (uuid, dev)) \
+  X(cuda_ext, CUresult, cuDeviceGetPCIBusId, (char *pciBusId, int len, CUdevice dev), \
+    (pciBusId, len, dev)) \
+  X(cuda_ext, CUresult, cuMemGetInfo, (size_t *free, size_t *total), (free, total))
+
+#define CUVID_CALLS(X) \
+  X(cuvid, CUresult, cuvidGetDecoderCaps, (CUVIDDECODECAPS *caps), (caps)) \
+  X(cuvid, CUresult, cuvidCreateDecoder, \
+    (CUvideodecoder *decoder, CUVIDDECODECREATEINFO *info), (decoder, info)) \
+  X(cuvid, CUresult, cuvidDestroyDecoder, (CUvideodecoder decoder), (decoder)) \
+  X(cuvid, CUresult, cuvidDecodePicture, \
+    (CUvideodecoder decoder, CUVIDPICPARAMS *pic), (decoder, pic)) \
+  X(cuvid, CUresult, cuvidMapVideoFrame, \
+    (CUvideodecoder decoder, int index, CUdeviceptr *frame, unsigned int *pitch, \
+     CUVIDPROCPARAMS *params), (decoder, index, frame, pitch, params)) \
+  X(cuvid, CUresult, cuvidUnmapVideoFrame, \
+    (CUvideodecoder decoder, CUdeviceptr frame), (decoder, frame)) \
+  X(cuvid, CUresult, cuvidCreateVideoParser, \
+    (CUvideoparser *parser, CUVIDPARSERPARAMS *params), (parser, params)) \
+  X(cuvid, CUresult, cuvidParseVideoData, \
+    (CUvideoparser parser, CUVIDSOURCEDATAPACKET *packet), (parser, packet)) \
+  X(cuvid, CUresult, cuvidDestroyVideoParser, (CUvideoparser parser), (parser))
+
+#define NVENC_CALLS(X) \
+  X(nvenc, NVENCSTATUS, NvEncodeAPIGetMaxSupportedVersion, (uint32_t *version), (version)) \
+  X(nvenc, NVENCSTATUS, NvEncodeAPICreateInstance, (NV_ENCODE_API_FUNCTION_LIST *list), (list))
+
+#define NVENC_API_CALLS(X) \
+  X(nvenc_api, NVENCSTATUS, nvEncOpenEncodeSessionEx, \
+    (NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS *params, void **encoder), (params, encoder)) \
+  X(nvenc_api, NVENCSTATUS, nvEncDestroyEncoder, (void *encoder), (encoder)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodeGUIDCount, (void *encoder, uint32_t *count), (encoder, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodeGUIDs, \
+    (void *encoder, GUID *guids, uint32_t size, uint32_t *count), (encoder, guids, size, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetInputFormatCount, \
+    (void *encoder, GUID guid, uint32_t *count), (encoder, guid, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetInputFormats, \
+    (void *encoder, GUID guid, NV_ENC_BUFFER_FORMAT *fmts, uint32_t size, uint32_t *count), \
+    (encoder, guid, fmts, size, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodeCaps, \
+    (void *encoder, GUID guid, NV_ENC_CAPS_PARAM *params, int *val), (encoder, guid, params, val)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodeProfileGUIDCount, \
+    (void *encoder, GUID guid, uint32_t *count), (encoder, guid, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodeProfileGUIDs, \
+    (void *encoder, GUID guid, GUID *guids, uint32_t size, uint32_t *count), \
+    (encoder, guid, guids, size, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodePresetCount, \
+    (void *encoder, GUID guid, uint32_t *count), (encoder, guid, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodePresetGUIDs, \
+    (void *encoder, GUID guid, GUID *guids, uint32_t size, uint32_t *count), \
+    (encoder, guid, guids, size, count)) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodePresetConfig, \
+    (void *encoder, GUID guid, GUID preset, NV_ENC_PRESET_CONFIG *config), \
+    (encoder, guid, preset, config)) \
+  NVENC_API_CALLS_EX(X) \
+  X(nvenc_api, NVENCSTATUS, nvEncInitializeEncoder, \
+    (void *encoder, NV_ENC_INITIALIZE_PARAMS *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncCreateInputBuffer, \
+    (void *encoder, NV_ENC_CREATE_INPUT_BUFFER *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncDestroyInputBuffer, \
+    (void *encoder, NV_ENC_INPUT_PTR buffer), (encoder, buffer)) \
+  X(nvenc_api, NVENCSTATUS, nvEncCreateBitstreamBuffer, \
+    (void *encoder, NV_ENC_CREATE_BITSTREAM_BUFFER *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncDestroyBitstreamBuffer, \
+    (void *encoder, NV_ENC_OUTPUT_PTR buffer), (encoder, buffer)) \
+  X(nvenc_api, NVENCSTATUS, nvEncLockInputBuffer, \
+    (void *encoder, NV_ENC_LOCK_INPUT_BUFFER *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncUnlockInputBuffer, \
+    (void *encoder, NV_ENC_INPUT_PTR buffer), (encoder, buffer)) \
+  X(nvenc_api, NVENCSTATUS, nvEncEncodePicture, \
+    (void *encoder, NV_ENC_PIC_PARAMS *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncLockBitstream, \
+    (void *encoder, NV_ENC_LOCK_BITSTREAM *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncUnlockBitstream, \
+    (void *encoder, NV_ENC_OUTPUT_PTR buffer), (encoder, buffer)) \
+  X(nvenc_api, NVENCSTATUS, nvEncRegisterResource, \
+    (void *encoder, NV_ENC_REGISTER_RESOURCE *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncUnregisterResource, \
+    (void *encoder, NV_ENC_REGISTERED_PTR resource), (encoder, resource)) \
+  X(nvenc_api, NVENCSTATUS, nvEncMapInputResource, \
+    (void *encoder, NV_ENC_MAP_INPUT_RESOURCE *params), (encoder, params)) \
+  X(nvenc_api, NVENCSTATUS, nvEncUnmapInputResource, \
+    (void *encoder, NV_ENC_INPUT_PTR buffer), (encoder, buffer))
+
+/* Entry points newer than the oldest nvEncodeAPI.h we build against */
+#if NVENCAPI_MAJOR_VERSION > 10
+#define NVENC_API_CALLS_EX(X) \
+  X(nvenc_api, NVENCSTATUS, nvEncGetEncodePresetConfigEx, \
+    (void *encoder, GUID guid, GUID preset, NV_ENC_TUNING_INFO tuning, NV_ENC_PRESET_CONFIG *config), \
+    (encoder, guid, preset, tuning, config))
+#else
+#define NVENC_API_CALLS_EX(X)
+#endif
+
+#define ALL_CALLS(X) \
+  CUDA_CALLS(X) CUDA_EXT_CALLS(X) CUVID_CALLS(X) NVENC_CALLS(X) NVENC_API_CALLS(X)
+
+#define CALL_ID(table, ret, name, params, args) CALL_##name,
+enum {
+  ALL_CALLS(CALL_ID)
+  NUM_CALLS
+};
+
+#define CALL_NAME(table, ret, name, params, args) #name,
+static const char *const call_names[NUM_CALLS] = {
+  ALL_CALLS(CALL_NAME)
+};
+
+typedef struct {
+  atomic_uint_fast64_t calls;
+  atomic_uint_fast64_t errors;
+  atomic_uint_fast64_t total_ns;
+  atomic_uint_fast64_t max_ns;
+  atomic_uint_fast64_t histogram[TRACE_BUCKETS];
+} call_stats;
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+  uint64_t total_ns;
+} phase_stats;
+
+static atomic_int enabled;
+static uint64_t epoch;
+static call_stats calls[NUM_CALLS];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static phase_stats phases[TRACE_PHASES];
+static int num_phases;
+static FILE *trace_file;
+static int trace_events;
+
+static atomic_int next_tid;
+static _Thread_local int tid;
+
+/* The real entry points, saved when the tables are wrapped */
+static CudaFunctions real_cuda;
+static nvvi_cuda_ext real_cuda_ext;
+static CuvidFunctions real_cuvid;
+static NvencFunctions real_nvenc;
+static NV_ENCODE_API_FUNCTION_LIST real_nvenc_api;
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int thread_id(void)
+{
+  if (!tid) {
+    tid = atomic_fetch_add(&next_tid, 1) + 1;
+  }
+  return tid;
+}
+
+
+/* Caller holds lock */
+static void write_event(const char *name, const char *cat, int device,
+                        uint64_t start, uint64_t end)
+{
+  if (!trace_file) {
+    return;
+  }
+
+  fprintf(trace_file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+          "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+          trace_events++ ? ",\n" : "", name, cat,
+          (start - epoch) / 1000.0, (end - start) / 1000.0,
+          (int)getpid(), thread_id());
+  if (device >= 0) {
+    fprintf(trace_file, ",\"args\":{\"device\":%d}", device);
+  }
+  fprintf(trace_file, "}");
+}
+
+
+static void record_call(int id, const char *cat, uint64_t start, int failed)
+{
+  if (!nvvi_trace_enabled()) {
+    return;
+  }
+
+  uint64_t end = now_ns();
+  uint64_t ns = end - start;
+  call_stats *stats = &calls[id];
+
+  atomic_fetch_add(&stats->calls, 1);
+  atomic_fetch_add(&stats->total_ns, ns);
+  if (failed) {
+    atomic_fetch_add(&stats->errors, 1);
+  }
+
+  uint_fast64_t max = atomic_load(&stats->max_ns);
+  while (ns > max && !atomic_compare_exchange_weak(&stats->max_ns, &max, ns)) {
+  }
+
+  int bucket = 0;
+  for (uint64_t us = ns / 1000; us > 1 && bucket < TRACE_BUCKETS - 1; us >>= 1) {
+    bucket++;
+  }
+  atomic_fetch_add(&stats->histogram[bucket], 1);
+
+  if (trace_file) {
+    pthread_mutex_lock(&lock);
+    write_event(call_names[id], cat, -1, start, end);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+
+#define CALL_WRAPPER(table, ret, name, params, args)       \
+  static ret trace_##name params                            \
+  {                                                         \
+    uint64_t start = now_ns();                              \
+    ret r = real_##table.name args;                         \
+    record_call(CALL_##name, #table, start, r != 0);        \
+    return r;                                               \
+  }
+ALL_CALLS(CALL_WRAPPER)
+
+#define CALL_INSTALL(table, ret, name, params, args)       \
+  if (funcs->name) {                                        \
+    funcs->name = trace_##name;                             \
+  }
+
+
+int nvvi_trace_enabled(void)
+{
+  return atomic_load(&enabled);
+}
+
+
+void nvvi_trace_detach(void)
+{
+  atomic_store(&enabled, 0);
+  trace_file = NULL;
+}
+
+
+void nvvi_trace_wrap_cuda(CudaFunctions *funcs)
+{
+  if (!nvvi_trace_enabled()) {
+    return;
+  }
+  real_cuda = *funcs;
+  CUDA_CALLS(CALL_INSTALL)
+}
+
+
+void nvvi_trace_wrap_cuda_ext(nvvi_cuda_ext *funcs)
+{
+  if (!nvvi_trace_enabled()) {
+    return;
+  }
+  real_cuda_ext = *funcs;
+  CUDA_EXT_CALLS(CALL_INSTALL)
+}
+
+
+void nvvi_trace_wrap_cuvid(CuvidFunctions *funcs)
+{
+  if (!nvvi_trace_enabled()) {
+    return;
+  }
+  real_cuvid = *funcs;
+  CUVID_CALLS(CALL_INSTALL)
+}
+
+
+void nvvi_trace_wrap_nvenc(NvencFunctions *funcs)
+{
+  if (!nvvi_trace_enabled()) {
+    return;
+  }
+  real_nvenc = *funcs;
+  NVENC_CALLS(CALL_INSTALL)
+}
+
+
+void nvvi_trace_wrap_nvenc_api(NV_ENCODE_API_FUNCTION_LIST *funcs)
+{
+  if (!nvvi_trace_enabled()) {
+    return;
+  }
+  real_nvenc_api = *funcs;
+  NVENC_API_CALLS(CALL_INSTALL)
+}
+
+
+uint64_t nvvi_trace_begin(void)
+{
+  return nvvi_trace_enabled() ? now_ns() : 0;
+}
+
+
+void nvvi_trace_end(const char *phase, int device, uint64_t start)
+{
+  if (!start) {
+    return;
+  }
+
+  uint64_t end = now_ns();
+
+  pthread_mutex_lock(&lock);
+  int i;
+  for (i = 0; i < num_phases; i++) {
+    if (strcmp(phases[i].name, phase) == 0) {
+      break;
+    }
+  }
+  if (i == num_phases && num_phases < TRACE_PHASES) {
+    phases[num_phases++].name = phase;
+  }
+  if (i < num_phases) {
+    phases[i].count++;
+    phases[i].total_ns += end - start;
+  }
+  write_event(phase, "phase", device, start, end);
+  pthread_mutex_unlock(&lock);
+}
+
+
+int nvvi_trace_start(FILE *trace)
+{
+  if (nvvi_trace_enabled()) {
+    return -1;
+  }
+
+  memset(calls, 0, sizeof(calls));
+  memset(phases, 0, sizeof(phases));
+  num_phases = 0;
+  epoch = now_ns();
+
+  trace_file = trace;
+  trace_events = 0;
+  if (trace_file) {
+    fprintf(trace_file, "[\n");
+  }
+
+  atomic_store(&enabled, 1);
+  return 0;
+}
+
+
+void nvvi_trace_stop(void)
+{
+  if (!nvvi_trace_enabled()) {
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  atomic_store(&enabled, 0);
+  if (trace_file) {
+    fprintf(trace_file, "\n]\n");
+    fflush(trace_file);
+    trace_file = NULL;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+
+static double ms(uint64_t ns)
+{
+  return ns / 1e6;
+}
+
+
+/* Upper bound of the bucket holding the given percentile, in us */
+static uint64_t percentile(const call_stats *stats, uint64_t count, int pct)
+{
+  uint64_t seen = 0;
+  uint64_t rank = (count * pct + 99) / 100;
+
+  for (int b = 0; b < TRACE_BUCKETS; b++) {
+    seen += atomic_load(&stats->histogram[b]);
+    if (seen >= rank) {
+      return (uint64_t)2 << b;
+    }
+  }
+  return (uint64_t)2 << (TRACE_BUCKETS - 1);
+}
+
+
+void nvvi_trace_print(FILE *f)
+{
+  pthread_mutex_lock(&lock);
+
+  fprintf(f, "%-36s %8s %12s\n", "Phase", "Count", "Total ms");
+  for (int i = 0; i < num_phases; i++) {
+    fprintf(f, "%-36s %8llu %12.3f\n", phases[i].name,
+            (unsigned long long)phases[i].count, ms(phases[i].total_ns));
+  }
+  fprintf(f, "\n");
+
+  fprintf(f, "%-36s %8s %6s %12s %10s %8s %8s %10s\n",
+          "Call", "Calls", "Errors", "Total ms", "Mean us", "p50 us", "p99 us", "Max us");
+  for (int i = 0; i < NUM_CALLS; i++) {
+    const call_stats *stats = &calls[i];
+    uint64_t count = atomic_load(&stats->calls);
+    if (!count) {
+      continue;
+    }
+
+    uint64_t total = atomic_load(&stats->total_ns);
+    char p50[24], p99[24];
+    snprintf(p50, sizeof(p50), "<%llu", (unsigned long long)percentile(stats, count, 50));
+    snprintf(p99, sizeof(p99), "<%llu", (unsigned long long)percentile(stats, count, 99));
+    fprintf(f, "%-36s %8llu %6llu %12.3f %10.1f %8s %8s %10.1f\n",
+            call_names[i], (unsigned long long)count,
+            (unsigned long long)atomic_load(&stats->errors), ms(total),
+            total / 1000.0 / count, p50, p99,
+            atomic_load(&stats->max_ns) / 1000.0);
+
+    /* Histogram: "<lower bound in us>:<count>" for every non-empty bucket */
+    fprintf(f, "  ");
+    for (int b = 0; b < TRACE_BUCKETS; b++) {
+      uint64_t n = atomic_load(&stats->histogram[b]);
+      if (n) {
+        fprintf(f, " %llu:%llu", b ? 1ULL << b : 0ULL, (unsigned long long)n);
+      }
+    }
+    fprintf(f, "\n");
+  }
+
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,74 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Call tracing internals. The driver function tables are wrapped in place
+ * when they are loaded, so the probe code itself is unchanged whether or
+ * not tracing is on.
+ */
+
+#ifndef NVVI_TRACE_H
+#define NVVI_TRACE_H
+
+#include <stdint.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+/*
+ * Entry points that are not part of CudaFunctions in every supported
+ * ffnvcodec version. They are looked up separately so that a missing
+ * symbol only disables the feature that needs it.
+ */
+typedef CUresult CUDAAPI nvvi_cuDriverGetVersion_t(int *version);
+typedef CUresult CUDAAPI nvvi_cuDeviceGetUuid_t(CUuuid *uuid, CUdevice dev);
+typedef CUresult CUDAAPI nvvi_cuDeviceGetPCIBusId_t(char *pciBusId, int len, CUdevice dev);
+typedef CUresult CUDAAPI nvvi_cuMemGetInfo_t(size_t *free, size_t *total);
+
+typedef struct {
+  nvvi_cuDriverGetVersion_t *cuDriverGetVersion;
+  nvvi_cuDeviceGetUuid_t *cuDeviceGetUuid;
+  nvvi_cuDeviceGetPCIBusId_t *cuDeviceGetPCIBusId;
+  nvvi_cuMemGetInfo_t *cuMemGetInfo;
+} nvvi_cuda_ext;
+
+/* Non-zero between nvvi_trace_start() and nvvi_trace_stop() */
+int nvvi_trace_enabled(void);
+
+/* In a forked child: stop recording without touching the parent's trace file */
+void nvvi_trace_detach(void);
+
+/*
+ * Replace the entry points of a freshly loaded table with timing wrappers.
+ * No-ops unless tracing is enabled.
+ */
+void nvvi_trace_wrap_cuda(CudaFunctions *cu);
+void nvvi_trace_wrap_cuda_ext(nvvi_cuda_ext *ext);
+void nvvi_trace_wrap_cuvid(CuvidFunctions *cv);
+void nvvi_trace_wrap_nvenc(NvencFunctions *nv);
+void nvvi_trace_wrap_nvenc_api(NV_ENCODE_API_FUNCTION_LIST *funcs);
+
+/*
+ * Phases: time a span of work under a name, e.g. "load nvenc" or "decode".
+ * begin returns 0 when tracing is off, in which case end does nothing.
+ * device is -1 when the phase is not specific to a device.
+ */
+uint64_t nvvi_trace_begin(void);
+void nvvi_trace_end(const char *phase, int device, uint64_t start);
+
+#endif /* NVVI_TRACE_H */
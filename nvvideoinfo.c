@@ -0,0 +1,3531 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ffnvcodec/dynlink_loader.h>
+
+#include "nvvideoinfo.h"
+#include "nvvi_internal.h"
+#include "nvvi_trace.h"
+
+_Static_assert(sizeof(nvvi_guid) == sizeof(GUID), "nvvi_guid must match GUID");
+_Static_assert(NV_ENC_CAPS_EXPOSED_COUNT <= NVVI_MAX_ENCODE_CAPS,
+               "NVVI_MAX_ENCODE_CAPS is too small for this nvEncodeAPI.h");
+
+static CudaFunctions *cu;
+static CuvidFunctions *cv;
+static NvencFunctions *nv;
+static NV_ENCODE_API_FUNCTION_LIST nv_funcs;
+static uint32_t nvenc_max_ver;
+
+static nvvi_cuda_ext cu_ext;
+
+static int check_cu(CUresult err, const char *func)
+{
+  const char *err_name;
+  const char *err_string;
+
+  if (err == CUDA_SUCCESS) {
+    return 0;
+  }
+
+  cu->cuGetErrorName(err, &err_name);
+  cu->cuGetErrorString(err, &err_string);
+
+  fprintf(stderr, "%s failed", func);
+  if (err_name && err_string) {
+    fprintf(stderr, " -> %s: %s", err_name, err_string);
+  }
+  fprintf(stderr, "\n");
+
+  return -1;
+}
+
+#define CHECK_CU(x) { int ret = check_cu((x), #x); if (ret != 0) { return ret; } }
+
+static const struct {
+    NVENCSTATUS nverr;
+    int         averr;
+    const char *desc;
+} nvenc_errors[] = {
+    { NV_ENC_SUCCESS,                       0, "success"                  },
+    { NV_ENC_ERR_NO_ENCODE_DEVICE,         -1, "no encode device"         },
+    { NV_ENC_ERR_UNSUPPORTED_DEVICE,       -1, "unsupported device"       },
+    { NV_ENC_ERR_INVALID_ENCODERDEVICE,    -1, "invalid encoder device"   },
+    { NV_ENC_ERR_INVALID_DEVICE,           -1, "invalid device"           },
+    { NV_ENC_ERR_DEVICE_NOT_EXIST,         -1, "device does not exist"    },
+    { NV_ENC_ERR_INVALID_PTR,              -1, "invalid ptr"              },
+    { NV_ENC_ERR_INVALID_EVENT,            -1, "invalid event"            },
+    { NV_ENC_ERR_INVALID_PARAM,            -1, "invalid param"            },
+    { NV_ENC_ERR_INVALID_CALL,             -1, "invalid call"             },
+    { NV_ENC_ERR_OUT_OF_MEMORY,            -1, "out of memory"            },
+    { NV_ENC_ERR_ENCODER_NOT_INITIALIZED,  -1, "encoder not initialized"  },
+    { NV_ENC_ERR_UNSUPPORTED_PARAM,        -1, "unsupported param"        },
+    { NV_ENC_ERR_LOCK_BUSY,                -1, "lock busy"                },
+    { NV_ENC_ERR_NOT_ENOUGH_BUFFER,        -1, "not enough buffer"        },
+    { NV_ENC_ERR_INVALID_VERSION,          -1, "invalid version"          },
+    { NV_ENC_ERR_MAP_FAILED,               -1, "map failed"               },
+    { NV_ENC_ERR_NEED_MORE_INPUT,          -1, "need more input"          },
+    { NV_ENC_ERR_ENCODER_BUSY,             -1, "encoder busy"             },
+    { NV_ENC_ERR_EVENT_NOT_REGISTERD,      -1, "event not registered"     },
+    { NV_ENC_ERR_GENERIC,                  -1, "generic error"            },
+    { NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY,  -1, "incompatible client key"  },
+    { NV_ENC_ERR_UNIMPLEMENTED,            -1, "unimplemented"            },
+    { NV_ENC_ERR_RESOURCE_REGISTER_FAILED, -1, "resource register failed" },
+    { NV_ENC_ERR_RESOURCE_NOT_REGISTERED,  -1, "resource not registered"  },
+    { NV_ENC_ERR_RESOURCE_NOT_MAPPED,      -1, "resource not mapped"      },
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 0)
+    { NV_ENC_ERR_NEED_MORE_OUTPUT,         -1, "need more output"         },
+#endif
+};
+
+#define FF_ARRAY_ELEMS(a) (sizeof(a) / sizeof((a)[0]))
+static int nvenc_map_error(NVENCSTATUS err, const char **desc)
+{
+    int i;
+    for (i = 0; i < FF_ARRAY_ELEMS(nvenc_errors); i++) {
+        if (nvenc_errors[i].nverr == err) {
+            if (desc)
+                *desc = nvenc_errors[i].desc;
+            return nvenc_errors[i].averr;
+        }
+    }
+    if (desc)
+        *desc = "unknown error";
+    return -1;
+}
+
+static int check_nv(NVENCSTATUS err, const char *func)
+{
+  const char *err_string;
+
+  if (err == NV_ENC_SUCCESS) {
+    return 0;
+  }
+
+  nvenc_map_error(err, &err_string);
+
+  fprintf(stderr, "%s failed", func);
+  if (err_string) {
+    fprintf(stderr, " -> %s", err_string);
+  }
+  fprintf(stderr, "\n");
+
+  return -1;
+}
+
+#define CHECK_NV(x) { int ret = check_nv((x), #x); if (ret != 0) { return ret; } }
+
+const nvvi_cap_desc nvvi_encode_limits[] = {
+  { NV_ENC_CAPS_WIDTH_MAX,                      "Maximum Width", "width_max" },
+  { NV_ENC_CAPS_HEIGHT_MAX,                     "Maximum Hight", "height_max" },
+  { NV_ENC_CAPS_MB_NUM_MAX,                     "Maximum Macroblocks/frame", "mb_num_max" },
+  { NV_ENC_CAPS_MB_PER_SEC_MAX,                 "Maximum Macroblocks/second", "mb_per_sec_max" },
+  { NV_ENC_CAPS_LEVEL_MAX,                      "Max Encoding Level", "level_max" },
+  { NV_ENC_CAPS_LEVEL_MIN,                      "Min Encoding Level", "level_min" },
+  { NV_ENC_CAPS_NUM_MAX_BFRAMES,                "Max No. of B-Frames", "num_max_bframes" },
+  { NV_ENC_CAPS_NUM_MAX_LTR_FRAMES,             "Maxmimum LT Reference Frames", "num_max_ltr_frames" },
+  { NV_ENC_CAPS_WIDTH_MIN,                      "Minimum Width", "width_min" },
+  { NV_ENC_CAPS_HEIGHT_MIN,                     "Minimum Hight", "height_min" },
+#if NVENCAPI_MAJOR_VERSION > 10
+  { NV_ENC_CAPS_NUM_ENCODER_ENGINES,            "Number of Encoder Engines", "num_encoder_engines" },
+#endif
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
+  { NV_ENC_CAPS_SUPPORT_LOOKAHEAD_LEVEL,        "Maximum Lookahead Level", "support_lookahead_level" }
+#endif
+};
+const int nvvi_num_encode_limits = FF_ARRAY_ELEMS(nvvi_encode_limits);
+
+const nvvi_cap_desc nvvi_encode_caps[] = {
+  { NV_ENC_CAPS_SUPPORTED_RATECONTROL_MODES,    "Supported Rate-Control Modes", "supported_ratecontrol_modes" },
+  { NV_ENC_CAPS_SUPPORT_FIELD_ENCODING,         "Supports Field-Encoding", "support_field_encoding" },
+  { NV_ENC_CAPS_SUPPORT_MONOCHROME,             "Supports Monochrome", "support_monochrome" },
+  { NV_ENC_CAPS_SUPPORT_FMO,                    "Supports FMO", "support_fmo" },
+  { NV_ENC_CAPS_SUPPORT_QPELMV,                 "Supports QPEL Motion Estimation", "support_qpelmv" },
+  { NV_ENC_CAPS_SUPPORT_BDIRECT_MODE,           "Supports BDirect Mode", "support_bdirect_mode" },
+  { NV_ENC_CAPS_SUPPORT_CABAC,                  "Supports CABAC", "support_cabac" },
+  { NV_ENC_CAPS_SUPPORT_ADAPTIVE_TRANSFORM,     "Supports Adaptive Transform", "support_adaptive_transform" },
+  { NV_ENC_CAPS_SUPPORT_STEREO_MVC,             "Supports Stereo Multi-View Coding", "support_stereo_mvc" },
+  { NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS,        "Supports Temporal Layers", "num_max_temporal_layers" },
+  { NV_ENC_CAPS_SUPPORT_HIERARCHICAL_PFRAMES,   "Supports Hierarchical P-Frames", "support_hierarchical_pframes" },
+  { NV_ENC_CAPS_SUPPORT_HIERARCHICAL_BFRAMES,   "Supports Hierarchical B-Frames", "support_hierarchical_bframes" },
+  { NV_ENC_CAPS_SEPARATE_COLOUR_PLANE,          "Supports Separate Colour Planes", "separate_colour_plane" },
+  { NV_ENC_CAPS_SUPPORT_TEMPORAL_SVC,           "Supports Temporal SVC", "support_temporal_svc" },
+  { NV_ENC_CAPS_SUPPORT_DYN_RES_CHANGE,         "Supports Dynamic Resolution Change", "support_dyn_res_change" },
+  { NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE,     "Supports Dynamic Bitrate Change", "support_dyn_bitrate_change" },
+  { NV_ENC_CAPS_SUPPORT_DYN_FORCE_CONSTQP,      "Supports Dynamic Force Const-QP", "support_dyn_force_constqp" },
+  { NV_ENC_CAPS_SUPPORT_DYN_RCMODE_CHANGE,      "Supports Dynamic RC-Mode Change", "support_dyn_rcmode_change" },
+  { NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK,      "Supports Sub-Frame Read-back", "support_subframe_readback" },
+  { NV_ENC_CAPS_SUPPORT_CONSTRAINED_ENCODING,   "Supports Constrained Encoding", "support_constrained_encoding" },
+  { NV_ENC_CAPS_SUPPORT_INTRA_REFRESH,          "Supports Intra Refresh", "support_intra_refresh" },
+  { NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE,    "Supports Custom VBV Buffer Size", "support_custom_vbv_buf_size" },
+  { NV_ENC_CAPS_SUPPORT_DYNAMIC_SLICE_MODE,     "Supports Dynamic Slice Mode", "support_dynamic_slice_mode" },
+  { NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION,   "Supports Ref Pic Invalidation", "support_ref_pic_invalidation" },
+  { NV_ENC_CAPS_PREPROC_SUPPORT,                "Supports PreProcessing", "preproc_support" },
+  { NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT,           "Supports Async Encoding", "async_encode_support" },
+  { NV_ENC_CAPS_SUPPORT_YUV444_ENCODE,          "Supports YUV444 Encoding", "support_yuv444_encode" },
+  { NV_ENC_CAPS_SUPPORT_LOSSLESS_ENCODE,        "Supports Lossless Encoding", "support_lossless_encode" },
+  { NV_ENC_CAPS_SUPPORT_SAO,                    "Supports SAO", "support_sao" },
+  { NV_ENC_CAPS_SUPPORT_MEONLY_MODE,            "Supports ME-Only Mode", "support_meonly_mode" },
+  { NV_ENC_CAPS_SUPPORT_LOOKAHEAD,              "Supports Lookahead Encoding", "support_lookahead" },
+  { NV_ENC_CAPS_SUPPORT_TEMPORAL_AQ,            "Supports Temporal AQ", "support_temporal_aq" },
+  { NV_ENC_CAPS_SUPPORT_10BIT_ENCODE,           "Supports 10-bit Encoding", "support_10bit_encode" },
+  { NV_ENC_CAPS_SUPPORT_WEIGHTED_PREDICTION,    "Supports Weighted Prediction", "support_weighted_prediction" },
+#if 0
+  /* This isn't really a capability. It's a runtime measurement; see nvvi_sampler. */
+  { NV_ENC_CAPS_DYNAMIC_QUERY_ENCODER_CAPACITY, "Remaining Encoder Capacity", "dynamic_query_encoder_capacity" },
+#endif
+  { NV_ENC_CAPS_SUPPORT_BFRAME_REF_MODE,        "Supports B-Frames as References", "support_bframe_ref_mode" },
+  { NV_ENC_CAPS_SUPPORT_EMPHASIS_LEVEL_MAP,     "Supports Emphasis Level Map", "support_emphasis_level_map" },
+  { NV_ENC_CAPS_SUPPORT_MULTIPLE_REF_FRAMES,    "Supports Multiple Reference Frames", "support_multiple_ref_frames" },
+#if NVENCAPI_MAJOR_VERSION > 11 || (NVENCAPI_MAJOR_VERSION == 11 && NVENCAPI_MINOR_VERSION > 0)
+  { NV_ENC_CAPS_SUPPORT_ALPHA_LAYER_ENCODING,   "Supports Alpha Layer Encoding", "support_alpha_layer_encoding" },
+  { NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH,     "Supports Single Slice Intra Refresh", "single_slice_intra_refresh" },
+#endif
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 0)
+  { NV_ENC_CAPS_DISABLE_ENC_STATE_ADVANCE,      "Supports encoding without advancing", "disable_enc_state_advance" },
+  { NV_ENC_CAPS_OUTPUT_RECON_SURFACE,           "Supports reconstructed output", "output_recon_surface" },
+  { NV_ENC_CAPS_OUTPUT_BLOCK_STATS,             "Supports per-block output stats", "output_block_stats" },
+  { NV_ENC_CAPS_OUTPUT_ROW_STATS,               "Supports per-row output stats", "output_row_stats" },
+#endif
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
+  { NV_ENC_CAPS_SUPPORT_TEMPORAL_FILTER,        "Supports Temporal Filtering", "support_temporal_filter" },
+  { NV_ENC_CAPS_SUPPORT_UNIDIRECTIONAL_B,       "Supports Unidirectional B Frames ", "support_unidirectional_b" },
+#endif
+#if NVENCAPI_MAJOR_VERSION > 12
+  { NV_ENC_CAPS_SUPPORT_MVHEVC_ENCODE,          "Supports Multi-View HEVC Encoding", "support_mvhevc_encode" },
+  { NV_ENC_CAPS_SUPPORT_YUV422_ENCODE,          "Supports YUV422 Encoding", "support_yuv422_encode" },
+#endif
+};
+const int nvvi_num_encode_caps = FF_ARRAY_ELEMS(nvvi_encode_caps);
+
+const nvvi_format_desc nvvi_encode_formats[] = {
+  { NV_ENC_BUFFER_FORMAT_NV12,         "NV12" },
+  { NV_ENC_BUFFER_FORMAT_YV12,         "YV12" },
+  { NV_ENC_BUFFER_FORMAT_IYUV,         "IYUV" },
+  { NV_ENC_BUFFER_FORMAT_YUV444,       "YUV444" },
+  { NV_ENC_BUFFER_FORMAT_YUV420_10BIT, "P010" },
+  { NV_ENC_BUFFER_FORMAT_YUV444_10BIT, "YUV444P10" },
+  { NV_ENC_BUFFER_FORMAT_ARGB,         "ARGB" },
+  { NV_ENC_BUFFER_FORMAT_ARGB10,       "ARGB10" },
+  { NV_ENC_BUFFER_FORMAT_AYUV,         "AYUV" },
+  { NV_ENC_BUFFER_FORMAT_ABGR,         "ABGR" },
+  { NV_ENC_BUFFER_FORMAT_ABGR10,       "ABGR10" },
+  { NV_ENC_BUFFER_FORMAT_U8,           "U8" },
+#if NVENCAPI_MAJOR_VERSION > 12
+  { NV_ENC_BUFFER_FORMAT_NV16,         "NV16" },
+  { NV_ENC_BUFFER_FORMAT_P210,         "P210" },
+#endif
+};
+const int nvvi_num_encode_formats = FF_ARRAY_ELEMS(nvvi_encode_formats);
+
+static const struct {
+  const GUID *guid;
+  const char *desc;
+} nvenc_profiles[] = {
+  { &NV_ENC_CODEC_PROFILE_AUTOSELECT_GUID,        "Auto" },
+  { &NV_ENC_H264_PROFILE_BASELINE_GUID,           "Baseline" },
+  { &NV_ENC_H264_PROFILE_MAIN_GUID,               "Main" },
+  { &NV_ENC_H264_PROFILE_HIGH_GUID,               "High" },
+#if NVENCAPI_MAJOR_VERSION > 12
+  { &NV_ENC_H264_PROFILE_HIGH_10_GUID,            "High10" },
+  { &NV_ENC_H264_PROFILE_HIGH_422_GUID,           "High422" },
+#endif
+  { &NV_ENC_H264_PROFILE_HIGH_444_GUID,           "High444" },
+  { &NV_ENC_H264_PROFILE_STEREO_GUID,             "MVC" },
+  { &NV_ENC_H264_PROFILE_PROGRESSIVE_HIGH_GUID,   "Progressive High" },
+  { &NV_ENC_H264_PROFILE_CONSTRAINED_HIGH_GUID,   "Constrained High" },
+  { &NV_ENC_HEVC_PROFILE_MAIN_GUID,               "Main" },
+  { &NV_ENC_HEVC_PROFILE_MAIN10_GUID,             "Main10" },
+  { &NV_ENC_HEVC_PROFILE_FREXT_GUID,              "Main444" },
+#if NVENCAPI_MAJOR_VERSION > 11
+  { &NV_ENC_AV1_PROFILE_MAIN_GUID,                "Main" },
+#endif
+};
+
+
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION >= 1)
+// =========================================================================================
+// *   Preset GUIDS supported by the NvEncodeAPI interface.
+// =========================================================================================
+// {B2DFB705-4EBD-4C49-9B5F-24A777D3E587}
+static const GUID NV_ENC_PRESET_DEFAULT_GUID =
+{ 0xb2dfb705, 0x4ebd, 0x4c49, { 0x9b, 0x5f, 0x24, 0xa7, 0x77, 0xd3, 0xe5, 0x87 } };
+
+// {60E4C59F-E846-4484-A56D-CD45BE9FDDF6}
+static const GUID NV_ENC_PRESET_HP_GUID =
+{ 0x60e4c59f, 0xe846, 0x4484, { 0xa5, 0x6d, 0xcd, 0x45, 0xbe, 0x9f, 0xdd, 0xf6 } };
+
+// {34DBA71D-A77B-4B8F-9C3E-B6D5DA24C012}
+static const GUID NV_ENC_PRESET_HQ_GUID =
+{ 0x34dba71d, 0xa77b, 0x4b8f, { 0x9c, 0x3e, 0xb6, 0xd5, 0xda, 0x24, 0xc0, 0x12 } };
+
+// {82E3E450-BDBB-4e40-989C-82A90DF9EF32}
+static const GUID NV_ENC_PRESET_BD_GUID  =
+{ 0x82e3e450, 0xbdbb, 0x4e40, { 0x98, 0x9c, 0x82, 0xa9, 0xd, 0xf9, 0xef, 0x32 } };
+
+// {49DF21C5-6DFA-4feb-9787-6ACC9EFFB726}
+static const GUID NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID  =
+{ 0x49df21c5, 0x6dfa, 0x4feb, { 0x97, 0x87, 0x6a, 0xcc, 0x9e, 0xff, 0xb7, 0x26 } };
+
+// {C5F733B9-EA97-4cf9-BEC2-BF78A74FD105}
+static const GUID NV_ENC_PRESET_LOW_LATENCY_HQ_GUID  =
+{ 0xc5f733b9, 0xea97, 0x4cf9, { 0xbe, 0xc2, 0xbf, 0x78, 0xa7, 0x4f, 0xd1, 0x5 } };
+
+// {67082A44-4BAD-48FA-98EA-93056D150A58}
+static const GUID NV_ENC_PRESET_LOW_LATENCY_HP_GUID =
+{ 0x67082a44, 0x4bad, 0x48fa, { 0x98, 0xea, 0x93, 0x5, 0x6d, 0x15, 0xa, 0x58 } };
+
+// {D5BFB716-C604-44e7-9BB8-DEA5510FC3AC}
+static const GUID NV_ENC_PRESET_LOSSLESS_DEFAULT_GUID =
+{ 0xd5bfb716, 0xc604, 0x44e7, { 0x9b, 0xb8, 0xde, 0xa5, 0x51, 0xf, 0xc3, 0xac } };
+
+// {149998E7-2364-411d-82EF-179888093409}
+static const GUID NV_ENC_PRESET_LOSSLESS_HP_GUID =
+{ 0x149998e7, 0x2364, 0x411d, { 0x82, 0xef, 0x17, 0x98, 0x88, 0x9, 0x34, 0x9 } };
+#endif
+
+static const struct {
+  const GUID *guid;
+  const char *desc;
+} nvenc_presets[] = {
+  { &NV_ENC_PRESET_DEFAULT_GUID,             "default" },
+  { &NV_ENC_PRESET_HP_GUID,                  "hp"},
+  { &NV_ENC_PRESET_HQ_GUID,                  "hq"},
+  { &NV_ENC_PRESET_BD_GUID,                  "bluray"},
+  { &NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID, "ll" },
+  { &NV_ENC_PRESET_LOW_LATENCY_HQ_GUID,      "llhq" },
+  { &NV_ENC_PRESET_LOW_LATENCY_HP_GUID,      "llhp" },
+  { &NV_ENC_PRESET_LOSSLESS_DEFAULT_GUID,    "lossless" },
+  { &NV_ENC_PRESET_LOSSLESS_HP_GUID,         "losslesshp" },
+#if NVENCAPI_MAJOR_VERSION > 10
+  { &NV_ENC_PRESET_P1_GUID,                  "p1" },
+  { &NV_ENC_PRESET_P2_GUID,                  "p2" },
+  { &NV_ENC_PRESET_P3_GUID,                  "p3" },
+  { &NV_ENC_PRESET_P4_GUID,                  "p4" },
+  { &NV_ENC_PRESET_P5_GUID,                  "p5" },
+  { &NV_ENC_PRESET_P6_GUID,                  "p6" },
+  { &NV_ENC_PRESET_P7_GUID,                  "p7" },
+#endif
+};
+
+
+#define NVENCAPI_CHECK_VERSION(major, minor) \
+    ((major) < NVENCAPI_MAJOR_VERSION || ((major) == NVENCAPI_MAJOR_VERSION && (minor) <= NVENCAPI_MINOR_VERSION))
+
+static void nvenc_print_driver_requirement()
+{
+#if NVENCAPI_CHECK_VERSION(9, 1)
+# if defined(_WIN32) || defined(__CYGWIN__)
+    const char *minver = "436.15";
+# else
+    const char *minver = "435.21";
+# endif
+#elif NVENCAPI_CHECK_VERSION(8, 1)
+# if defined(_WIN32) || defined(__CYGWIN__)
+    const char *minver = "390.77";
+# else
+    const char *minver = "390.25";
+# endif
+#else
+# if defined(_WIN32) || defined(__CYGWIN__)
+    const char *minver = "378.66";
+# else
+    const char *minver = "378.13";
+# endif
+#endif
+    fprintf(stderr, "The minimum required Nvidia driver for nvenc is %s or newer\n", minver);
+}
+
+static int cuvid_load_libraries()
+{
+  int ret;
+
+  uint64_t start = nvvi_trace_begin();
+  ret = cuvid_load_functions(&cv, NULL);
+  nvvi_trace_end("load nvdec", -1, start);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to load NVDEC functions.\n");
+    return -1;
+  }
+
+  if (!cv->cuvidGetDecoderCaps) {
+    fprintf(stderr,
+            "The current nvidia driver is too old to perform a capability check.\n"
+            "The minimum required driver version is %s\n",
+#if defined(_WIN32) || defined(__CYGWIN__)
+            "378.66");
+#else
+            "378.13");
+#endif
+    cuvid_free_functions(&cv);
+    return -1;
+  }
+  nvvi_trace_wrap_cuvid(cv);
+
+  return 0;
+}
+
+static int nvenc_load_libraries()
+{
+  int ret;
+
+  uint64_t start = nvvi_trace_begin();
+  ret = nvenc_load_functions(&nv, NULL);
+  nvvi_trace_end("load nvenc", -1, start);
+  if (ret < 0) {
+    nvenc_print_driver_requirement();
+    return ret;
+  }
+  nvvi_trace_wrap_nvenc(nv);
+
+  CHECK_NV(nv->NvEncodeAPIGetMaxSupportedVersion(&nvenc_max_ver));
+
+  if ((NVENCAPI_MAJOR_VERSION << 4 | NVENCAPI_MINOR_VERSION) > nvenc_max_ver) {
+    fprintf(stderr, "Driver does not support the required nvenc API version. "
+            "Required: %d.%d Found: %d.%d\n",
+            NVENCAPI_MAJOR_VERSION, NVENCAPI_MINOR_VERSION,
+            nvenc_max_ver >> 4, nvenc_max_ver & 0xf);
+    nvenc_print_driver_requirement();
+    nvenc_free_functions(&nv);
+    return -1;
+  }
+
+  nv_funcs.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+
+  CHECK_NV(nv->NvEncodeAPICreateInstance(&nv_funcs));
+  nvvi_trace_wrap_nvenc_api(&nv_funcs);
+
+  return 0;
+}
+
+static int load_libraries(unsigned int flags)
+{
+  int ret;
+
+  if (!cu) {
+    uint64_t start = nvvi_trace_begin();
+    ret = cuda_load_functions(&cu, NULL);
+    nvvi_trace_end("load cuda", -1, start);
+    if (ret != 0) {
+      fprintf(stderr, "Failed to load CUDA functions.\n");
+      return -1;
+    }
+    nvvi_trace_wrap_cuda(cu);
+
+    cu_ext.cuDriverGetVersion = (nvvi_cuDriverGetVersion_t *)FFNV_SYM_FUNC(cu->lib, "cuDriverGetVersion");
+    cu_ext.cuDeviceGetUuid = (nvvi_cuDeviceGetUuid_t *)FFNV_SYM_FUNC(cu->lib, "cuDeviceGetUuid");
+    cu_ext.cuDeviceGetPCIBusId = (nvvi_cuDeviceGetPCIBusId_t *)FFNV_SYM_FUNC(cu->lib, "cuDeviceGetPCIBusId");
+    cu_ext.cuMemGetInfo = (nvvi_cuMemGetInfo_t *)FFNV_SYM_FUNC(cu->lib, "cuMemGetInfo_v2");
+    nvvi_trace_wrap_cuda_ext(&cu_ext);
+  }
+
+  if ((flags & NVVI_PROBE_DECODE) && !cv) {
+    ret = cuvid_load_libraries();
+    if (ret != 0) {
+      return ret;
+    }
+  }
+
+  if ((flags & NVVI_PROBE_ENCODE) && !nv) {
+    ret = nvenc_load_libraries();
+    if (ret != 0) {
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
+void nvvi_unload(void)
+{
+  if (nv) {
+    nvenc_free_functions(&nv);
+  }
+  if (cv) {
+    cuvid_free_functions(&cv);
+  }
+  if (cu) {
+    cuda_free_functions(&cu);
+    memset(&cu_ext, 0, sizeof(cu_ext));
+  }
+}
+
+
+static void copy_name(char *dst, const char *src)
+{
+  snprintf(dst, NVVI_NAME_LEN, "%s", src);
+}
+
+
+/*
+ * A unit of work for the probe workers. The decoder sweep is split per
+ * codec so that a device with many supported codecs does not become the
+ * long pole, and each device additionally gets a single encoder task.
+ * Results are merged back in task order once all workers have finished.
+ */
+typedef struct {
+  int device;
+  int codec;                    /* -1 for the encoder task */
+  int status;
+  int num_rows;
+  nvvi_decode_caps rows[4 * 3];
+} probe_task;
+
+typedef struct {
+  nvvi_snapshot *snap;
+  CUcontext *ctxs;              /* retained primary context per device */
+  probe_task *tasks;
+  int num_tasks;
+  atomic_int next_task;
+} probe_queue;
+
+
+static int probe_decode_caps(probe_task *task,
+                             cudaVideoCodec codec_type,
+                             cudaVideoChromaFormat chroma_format,
+                             unsigned int bit_depth)
+{
+  CUVIDDECODECAPS caps = { 0 };
+  caps.eCodecType = codec_type;
+  caps.eChromaFormat = chroma_format;
+  caps.nBitDepthMinus8 = bit_depth - 8;
+
+  CHECK_CU(cv->cuvidGetDecoderCaps(&caps));
+
+  if (!caps.bIsSupported) {
+    return 0;
+  }
+
+  nvvi_decode_caps *out = &task->rows[task->num_rows++];
+  out->codec = codec_type;
+  out->chroma_format = chroma_format;
+  out->bit_depth = bit_depth;
+  out->min_width = caps.nMinWidth;
+  out->min_height = caps.nMinHeight;
+  out->max_width = caps.nMaxWidth;
+  out->max_height = caps.nMaxHeight;
+  out->max_mb_count = caps.nMaxMBCount;
+  out->output_format_mask = caps.nOutputFormatMask;
+
+  return 0;
+}
+
+
+static int probe_decoder(probe_task *task)
+{
+  for (int f = 0; f < 4; f++) {
+    for (int b = 8; b < 14; b += 2) {
+      probe_decode_caps(task, task->codec, f, b);
+    }
+  }
+
+  return 0;
+}
+
+
+static int get_cap(void *encoder, GUID *guid, NV_ENC_CAPS cap)
+{
+  NV_ENC_CAPS_PARAM params = { 0 };
+
+  int val = 0;
+  params.version = NV_ENC_CAPS_PARAM_VER;
+  params.capsToQuery = cap;
+  CHECK_NV(nv_funcs.nvEncGetEncodeCaps(encoder, *guid, &params, &val));
+
+  return val;
+}
+
+
+static int get_formats(void *encoder, GUID *guid, uint32_t *mask)
+{
+  uint32_t count = 0;
+  CHECK_NV(nv_funcs.nvEncGetInputFormatCount(encoder, *guid, &count));
+
+  NV_ENC_BUFFER_FORMAT *formats = malloc(count * sizeof(NV_ENC_BUFFER_FORMAT));
+  if (!formats) {
+    return -1;
+  }
+
+  NVENCSTATUS err = nv_funcs.nvEncGetInputFormats(encoder, *guid, formats, count, &count);
+  if (check_nv(err, "nvEncGetInputFormats") != 0) {
+    free(formats);
+    return -1;
+  }
+
+  *mask = 0;
+  for (int i = 0; i < count; i++) {
+    *mask |= formats[i];
+  }
+
+  free(formats);
+
+  return 0;
+}
+
+
+static int get_profiles(void *encoder, GUID *encodeGUID, nvvi_encode_codec *codec)
+{
+  GUID guids[NVVI_MAX_PROFILES];
+  uint32_t count = 0;
+  CHECK_NV(nv_funcs.nvEncGetEncodeProfileGUIDs(encoder, *encodeGUID, guids,
+                                               NVVI_MAX_PROFILES, &count));
+
+  for (int i = 0; i < count; i++) {
+    const char *desc = "Unknown";
+    for (int j = 0; j < FF_ARRAY_ELEMS(nvenc_profiles); j++) {
+      if (memcmp(&guids[i], nvenc_profiles[j].guid, sizeof (GUID)) == 0) {
+        desc = nvenc_profiles[j].desc;
+      }
+    }
+    memcpy(&codec->profiles[i].guid, &guids[i], sizeof (GUID));
+    copy_name(codec->profiles[i].name, desc);
+  }
+  codec->num_profiles = count;
+
+  return 0;
+}
+
+
+static int get_presets(void *encoder, GUID *encodeGUID, nvvi_encode_codec *codec)
+{
+  GUID guids[NVVI_MAX_PRESETS];
+  uint32_t count = 0;
+  CHECK_NV(nv_funcs.nvEncGetEncodePresetGUIDs(encoder, *encodeGUID, guids,
+                                              NVVI_MAX_PRESETS, &count));
+
+  for (int i = 0; i < count; i++) {
+    const char *desc = "Unknown";
+    for (int j = 0; j < FF_ARRAY_ELEMS(nvenc_presets); j++) {
+      if (memcmp(&guids[i], nvenc_presets[j].guid, sizeof (GUID)) == 0) {
+        desc = nvenc_presets[j].desc;
+      }
+    }
+    memcpy(&codec->presets[i].guid, &guids[i], sizeof (GUID));
+    copy_name(codec->presets[i].name, desc);
+  }
+  codec->num_presets = count;
+
+  return 0;
+}
+
+
+static const char *encode_codec_name(GUID *guid)
+{
+  if (memcmp(guid, &NV_ENC_CODEC_H264_GUID, 16) == 0) {
+    return "H264";
+  } else if (memcmp(guid, &NV_ENC_CODEC_HEVC_GUID, 16) == 0) {
+    return "HEVC";
+#if NVENCAPI_MAJOR_VERSION > 11
+  } else if (memcmp(guid, &NV_ENC_CODEC_AV1_GUID, 16) == 0) {
+    return "AV1";
+#endif
+  }
+  return "Unknown";
+}
+
+
+static int probe_codecs(void *encoder, nvvi_device *device)
+{
+  uint32_t count = 0;
+  CHECK_NV(nv_funcs.nvEncGetEncodeGUIDCount(encoder, &count));
+
+  GUID *guids = malloc(count * sizeof(GUID));
+  if (!guids) {
+    return -1;
+  }
+
+  NVENCSTATUS err = nv_funcs.nvEncGetEncodeGUIDs(encoder, guids, count, &count);
+  if (check_nv(err, "nvEncGetEncodeGUIDs") != 0) {
+    free(guids);
+    return -1;
+  }
+
+  if (count > NVVI_MAX_ENCODE_CODECS) {
+    count = NVVI_MAX_ENCODE_CODECS;
+  }
+
+  for (int i = 0; i < count; i++) {
+    nvvi_encode_codec *codec = &device->encode_codecs[i];
+
+    memcpy(&codec->guid, &guids[i], sizeof (GUID));
+    copy_name(codec->name, encode_codec_name(&guids[i]));
+
+    get_formats(encoder, &guids[i], &codec->input_formats);
+
+    for (int j = 0; j < nvvi_num_encode_limits; j++) {
+      int cap = nvvi_encode_limits[j].cap;
+      codec->caps[cap] = get_cap(encoder, &guids[i], cap);
+    }
+    for (int j = 0; j < nvvi_num_encode_caps; j++) {
+      int cap = nvvi_encode_caps[j].cap;
+      codec->caps[cap] = get_cap(encoder, &guids[i], cap);
+    }
+
+    get_profiles(encoder, &guids[i], codec);
+    get_presets(encoder, &guids[i], codec);
+  }
+  device->num_encode_codecs = count;
+
+  free(guids);
+
+  return 0;
+}
+
+
+static int probe_encoder(nvvi_device *device, CUcontext cuda_ctx)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  void *nvencoder;
+  int ret;
+
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = cuda_ctx;
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+
+  CHECK_NV(nv_funcs.nvEncOpenEncodeSessionEx(&params, &nvencoder));
+
+  ret = probe_codecs(nvencoder, device);
+
+  CHECK_NV(nv_funcs.nvEncDestroyEncoder(nvencoder));
+
+  return ret;
+}
+
+
+static void *probe_worker(void *opaque)
+{
+  probe_queue *queue = opaque;
+  CUcontext dummy;
+
+  /*
+   * All workers share the device's primary context; a context may be
+   * current on several threads at once.
+   */
+  for (;;) {
+    int t = atomic_fetch_add(&queue->next_task, 1);
+    if (t >= queue->num_tasks) {
+      break;
+    }
+
+    probe_task *task = &queue->tasks[t];
+    nvvi_device *device = &queue->snap->devices[task->device];
+    CUcontext ctx = queue->ctxs[task->device];
+
+    uint64_t start = nvvi_trace_begin();
+    if (check_cu(cu->cuCtxPushCurrent(ctx), "cuCtxPushCurrent") != 0) {
+      task->status = -1;
+      continue;
+    }
+    if (task->codec < 0) {
+      task->status = probe_encoder(device, ctx);
+    } else {
+      task->status = probe_decoder(task);
+    }
+    cu->cuCtxPopCurrent(&dummy);
+    nvvi_trace_end(task->codec < 0 ? "encode" : "decode", task->device, start);
+  }
+
+  return NULL;
+}
+
+
+static int run_workers(probe_queue *queue, int threads)
+{
+  if (threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  threads = MIN(threads, queue->num_tasks);
+  threads = MAX(threads, 1);
+
+  /* The calling thread is always one of the workers. */
+  pthread_t *workers = calloc(threads - 1, sizeof(pthread_t));
+  int started = 0;
+  if (workers) {
+    for (; started < threads - 1; started++) {
+      if (pthread_create(&workers[started], NULL, probe_worker, queue) != 0) {
+        break;
+      }
+    }
+  }
+
+  probe_worker(queue);
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+
+  return 0;
+}
+
+
+static void merge_results(nvvi_snapshot *snap, probe_task *tasks, int num_tasks)
+{
+  for (int i = 0; i < num_tasks; i++) {
+    probe_task *task = &tasks[i];
+    nvvi_device *device = &snap->devices[task->device];
+
+    if (task->codec < 0) {
+      device->encode_status = task->status;
+      continue;
+    }
+
+    if (task->status != 0) {
+      device->decode_status = -1;
+    }
+    for (int j = 0; j < task->num_rows; j++) {
+      if (device->num_decode_caps >= NVVI_MAX_DECODE_CAPS) {
+        break;
+      }
+      device->decode_caps[device->num_decode_caps++] = task->rows[j];
+    }
+  }
+}
+
+
+static void get_device_ids(nvvi_device *device, CUdevice dev)
+{
+  CUuuid uuid;
+  char bus_id[32];
+
+  if (cu_ext.cuDeviceGetUuid &&
+      cu_ext.cuDeviceGetUuid(&uuid, dev) == CUDA_SUCCESS) {
+    const unsigned char *b = (const unsigned char *)uuid.bytes;
+    snprintf(device->uuid, sizeof(device->uuid),
+             "GPU-%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+             b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+  }
+
+  if (cu_ext.cuDeviceGetPCIBusId &&
+      cu_ext.cuDeviceGetPCIBusId(bus_id, sizeof(bus_id), dev) == CUDA_SUCCESS) {
+    nvvi_normalize_bus_id(device->pci_bus_id, bus_id);
+  }
+}
+
+
+static void get_driver_version(nvvi_snapshot *snap)
+{
+  int version;
+
+  if (nvvi_read_driver_version(snap->driver_version, sizeof(snap->driver_version)) == 0) {
+    return;
+  }
+
+  /* No kernel module information; fall back to the CUDA driver API version. */
+  if (cu_ext.cuDriverGetVersion &&
+      cu_ext.cuDriverGetVersion(&version) == CUDA_SUCCESS) {
+    snprintf(snap->driver_version, sizeof(snap->driver_version), "cuda-%d", version);
+  }
+}
+
+
+int nvvi_probe_devices(nvvi_snapshot *snap, const nvvi_probe_options *opts,
+                       nvvi_reuse_fn reuse, void *opaque)
+{
+  unsigned int flags = opts->flags;
+  int ret;
+
+  memset(snap, 0, sizeof(*snap));
+  snap->flags = flags;
+
+  ret = load_libraries(flags);
+  if (ret != 0) {
+    return ret;
+  }
+  snap->nvenc_max_version = nvenc_max_ver;
+
+  uint64_t start = nvvi_trace_begin();
+  CHECK_CU(cu->cuInit(0));
+  nvvi_trace_end("init", -1, start);
+
+  start = nvvi_trace_begin();
+  int count;
+  CHECK_CU(cu->cuDeviceGetCount(&count));
+
+  get_driver_version(snap);
+
+  snap->devices = calloc(count, sizeof(nvvi_device));
+  if (count && !snap->devices) {
+    return -1;
+  }
+  snap->num_devices = count;
+
+  int tasks_per_device = ((flags & NVVI_PROBE_ENCODE) ? 1 : 0) +
+                         ((flags & NVVI_PROBE_DECODE) ? cudaVideoCodec_NumCodecs : 0);
+  probe_task *tasks = calloc(count * tasks_per_device + 1, sizeof(probe_task));
+  char *probe_decode = calloc(count + 1, 1);
+  CUcontext *ctxs = calloc(count + 1, sizeof(CUcontext));
+  CUdevice *devs = calloc(count + 1, sizeof(CUdevice));
+  if (!tasks || !probe_decode || !ctxs || !devs) {
+    free(tasks);
+    free(probe_decode);
+    free(ctxs);
+    free(devs);
+    nvvi_snapshot_free(snap);
+    return -1;
+  }
+
+  /*
+   * Queue the encoder tasks first as opening an encode session is by far
+   * the slowest step. Decoder tasks are queued in sweep order, so merging
+   * in task order reproduces the serial output exactly.
+   */
+  int num_tasks = 0;
+  for (int i = 0; i < count; i++) {
+    nvvi_device *device = &snap->devices[i];
+    CUdevice dev;
+
+    device->index = i;
+    device->decode_status = -1;
+    device->encode_status = -1;
+
+    if (check_cu(cu->cuDeviceGet(&dev, i), "cuDeviceGet") != 0 ||
+        check_cu(cu->cuDeviceGetName(device->name, sizeof(device->name), dev),
+                 "cuDeviceGetName") != 0) {
+      continue;
+    }
+    get_device_ids(device, dev);
+
+    if (reuse && reuse(device, snap, opaque)) {
+      continue;
+    }
+
+    /*
+     * Decode and encode both run on the device's primary context, which is
+     * shared with anything else in the process using the runtime API
+     * rather than costing a context of our own.
+     */
+    uint64_t retain_start = nvvi_trace_begin();
+    if (check_cu(cu->cuDevicePrimaryCtxRetain(&ctxs[i], dev), "cuDevicePrimaryCtxRetain") != 0) {
+      ctxs[i] = NULL;
+      continue;
+    }
+    devs[i] = dev;
+    nvvi_trace_end("retain context", i, retain_start);
+
+    if (flags & NVVI_PROBE_DECODE) {
+      device->decode_status = 0;
+      probe_decode[i] = 1;
+    }
+    if (flags & NVVI_PROBE_ENCODE) {
+      tasks[num_tasks].device = i;
+      tasks[num_tasks].codec = -1;
+      num_tasks++;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (!probe_decode[i]) {
+      continue;
+    }
+    for (int c = 0; c < cudaVideoCodec_NumCodecs; c++) {
+      tasks[num_tasks].device = i;
+      tasks[num_tasks].codec = c;
+      num_tasks++;
+    }
+  }
+
+  nvvi_trace_end("enumerate", -1, start);
+
+  probe_queue queue = {
+    .snap = snap,
+    .ctxs = ctxs,
+    .tasks = tasks,
+    .num_tasks = num_tasks,
+  };
+  atomic_init(&queue.next_task, 0);
+
+  start = nvvi_trace_begin();
+  run_workers(&queue, opts->threads);
+  merge_results(snap, tasks, num_tasks);
+  nvvi_trace_end("probe", -1, start);
+
+  for (int i = 0; i < count; i++) {
+    if (ctxs[i]) {
+      cu->cuDevicePrimaryCtxRelease(devs[i]);
+    }
+  }
+
+  free(devs);
+  free(ctxs);
+  free(probe_decode);
+  free(tasks);
+
+  return 0;
+}
+
+
+struct nvvi_sampler {
+  const nvvi_snapshot *snap;
+  CUdevice *devs;
+  CUcontext *ctxs;              /* retained primary contexts */
+  void **encoders;
+};
+
+
+static int open_sampler_session(nvvi_sampler *sampler, int i)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  CUdevice dev;
+  CUcontext dummy;
+  int ret;
+
+  CHECK_CU(cu->cuDeviceGet(&dev, sampler->snap->devices[i].index));
+  if (check_cu(cu->cuDevicePrimaryCtxRetain(&sampler->ctxs[i], dev), "cuDevicePrimaryCtxRetain") != 0) {
+    sampler->ctxs[i] = NULL;
+    return -1;
+  }
+  sampler->devs[i] = dev;
+  CHECK_CU(cu->cuCtxPushCurrent(sampler->ctxs[i]));
+
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = sampler->ctxs[i];
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+
+  ret = check_nv(nv_funcs.nvEncOpenEncodeSessionEx(&params, &sampler->encoders[i]),
+                 "nvEncOpenEncodeSessionEx");
+  if (ret != 0) {
+    sampler->encoders[i] = NULL;
+  }
+  cu->cuCtxPopCurrent(&dummy);
+
+  return ret;
+}
+
+
+nvvi_sampler *nvvi_sampler_open(const nvvi_snapshot *snap)
+{
+  if (load_libraries(NVVI_PROBE_ENCODE) != 0 || check_cu(cu->cuInit(0), "cuInit") != 0) {
+    return NULL;
+  }
+
+  nvvi_sampler *sampler = calloc(1, sizeof(*sampler));
+  if (!sampler) {
+    return NULL;
+  }
+  sampler->snap = snap;
+  sampler->devs = calloc(snap->num_devices + 1, sizeof(CUdevice));
+  sampler->ctxs = calloc(snap->num_devices + 1, sizeof(CUcontext));
+  sampler->encoders = calloc(snap->num_devices + 1, sizeof(void *));
+  if (!sampler->devs || !sampler->ctxs || !sampler->encoders) {
+    nvvi_sampler_close(sampler);
+    return NULL;
+  }
+
+  /* A device that can't be sampled just reports -1; it isn't fatal. */
+  for (int i = 0; i < snap->num_devices; i++) {
+    if (snap->devices[i].encode_status == 0 && snap->devices[i].num_encode_codecs > 0) {
+      open_sampler_session(sampler, i);
+    }
+  }
+
+  return sampler;
+}
+
+
+int nvvi_sampler_poll(nvvi_sampler *sampler, int *capacity)
+{
+  const nvvi_snapshot *snap = sampler->snap;
+  CUcontext dummy;
+  int ret = 0;
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    const nvvi_device *device = &snap->devices[i];
+    int *row = &capacity[i * NVVI_MAX_ENCODE_CODECS];
+
+    for (int j = 0; j < NVVI_MAX_ENCODE_CODECS; j++) {
+      row[j] = -1;
+    }
+    if (!sampler->encoders[i]) {
+      continue;
+    }
+
+    cu->cuCtxPushCurrent(sampler->ctxs[i]);
+    for (int j = 0; j < device->num_encode_codecs; j++) {
+      NV_ENC_CAPS_PARAM params = { 0 };
+      GUID guid;
+      int val;
+
+      params.version = NV_ENC_CAPS_PARAM_VER;
+      params.capsToQuery = NV_ENC_CAPS_DYNAMIC_QUERY_ENCODER_CAPACITY;
+      memcpy(&guid, &device->encode_codecs[j].guid, sizeof(guid));
+      if (check_nv(nv_funcs.nvEncGetEncodeCaps(sampler->encoders[i], guid, &params, &val),
+                   "nvEncGetEncodeCaps") == 0) {
+        row[j] = val;
+      } else {
+        ret = -1;
+      }
+    }
+    cu->cuCtxPopCurrent(&dummy);
+  }
+
+  return ret;
+}
+
+
+void nvvi_sampler_close(nvvi_sampler *sampler)
+{
+  if (!sampler) {
+    return;
+  }
+
+  for (int i = 0; sampler->devs && sampler->ctxs && i < sampler->snap->num_devices; i++) {
+    if (sampler->encoders && sampler->encoders[i]) {
+      nv_funcs.nvEncDestroyEncoder(sampler->encoders[i]);
+    }
+    if (sampler->ctxs[i]) {
+      cu->cuDevicePrimaryCtxRelease(sampler->devs[i]);
+    }
+  }
+  free(sampler->encoders);
+  free(sampler->devs);
+  free(sampler->ctxs);
+  free(sampler);
+}
+
+
+/*
+ * Targeted queries. Unlike a probe these load only the library the
+ * question needs and make only the calls that can change the answer: one
+ * cuvidGetDecoderCaps for a decode query, and a session plus a handful of
+ * caps (and the input format list if a format is given) for an encode
+ * query.
+ */
+
+static int query_enter(int index, CUdevice *dev, CUcontext *ctx)
+{
+  CHECK_CU(cu->cuInit(0));
+  CHECK_CU(cu->cuDeviceGet(dev, index));
+  CHECK_CU(cu->cuDevicePrimaryCtxRetain(ctx, *dev));
+  if (check_cu(cu->cuCtxPushCurrent(*ctx), "cuCtxPushCurrent") != 0) {
+    cu->cuDevicePrimaryCtxRelease(*dev);
+    return -1;
+  }
+  return 0;
+}
+
+
+static void query_leave(CUdevice dev)
+{
+  CUcontext dummy;
+
+  cu->cuCtxPopCurrent(&dummy);
+  cu->cuDevicePrimaryCtxRelease(dev);
+}
+
+
+static int query_size(const nvvi_query *query, unsigned int min_w, unsigned int min_h,
+                      unsigned int max_w, unsigned int max_h, unsigned int max_mbs,
+                      char *detail, size_t len)
+{
+  unsigned int mbs = ((query->width + 15) / 16) * ((query->height + 15) / 16);
+
+  if (!query->width && !query->height) {
+    return NVVI_QUERY_YES;
+  }
+  if (query->width > max_w || query->height > max_h) {
+    snprintf(detail, len, "%ux%u exceeds maximum %ux%u",
+             query->width, query->height, max_w, max_h);
+    return NVVI_QUERY_NO;
+  }
+  if (query->width < min_w || query->height < min_h) {
+    snprintf(detail, len, "%ux%u is below minimum %ux%u",
+             query->width, query->height, min_w, min_h);
+    return NVVI_QUERY_NO;
+  }
+  if (max_mbs && mbs > max_mbs) {
+    snprintf(detail, len, "%u macroblocks exceeds maximum %u", mbs, max_mbs);
+    return NVVI_QUERY_NO;
+  }
+  return NVVI_QUERY_YES;
+}
+
+
+static int query_decode(const nvvi_query *query, char *detail, size_t len)
+{
+  CUVIDDECODECAPS caps = { 0 };
+
+  caps.eCodecType = query->codec;
+  caps.eChromaFormat = query->chroma_format;
+  caps.nBitDepthMinus8 = query->bit_depth - 8;
+  if (check_cu(cv->cuvidGetDecoderCaps(&caps), "cuvidGetDecoderCaps") != 0) {
+    snprintf(detail, len, "cuvidGetDecoderCaps failed");
+    return NVVI_QUERY_ERROR;
+  }
+
+  if (!caps.bIsSupported) {
+    snprintf(detail, len, "%s %s %d-bit decode not supported",
+             nvvi_decode_codec_name(query->codec),
+             nvvi_chroma_format_name(query->chroma_format), query->bit_depth);
+    return NVVI_QUERY_NO;
+  }
+
+  int ret = query_size(query, caps.nMinWidth, caps.nMinHeight, caps.nMaxWidth,
+                       caps.nMaxHeight, caps.nMaxMBCount, detail, len);
+  if (ret == NVVI_QUERY_YES) {
+    snprintf(detail, len, "max %ux%u, %u macroblocks, %s",
+             caps.nMaxWidth, caps.nMaxHeight, caps.nMaxMBCount,
+             nvvi_surface_formats_name(caps.nOutputFormatMask));
+  }
+  return ret;
+}
+
+
+static const GUID *encode_codec_guid(int codec)
+{
+  switch (codec) {
+  case cudaVideoCodec_H264:
+    return &NV_ENC_CODEC_H264_GUID;
+  case cudaVideoCodec_HEVC:
+    return &NV_ENC_CODEC_HEVC_GUID;
+#if NVENCAPI_MAJOR_VERSION > 11 && NVDECAPI_MAJOR_VERSION > 10
+  case cudaVideoCodec_AV1:
+    return &NV_ENC_CODEC_AV1_GUID;
+#endif
+  default:
+    return NULL;
+  }
+}
+
+
+static int query_encode_session(void *encoder, const nvvi_query *query, GUID guid,
+                                char *detail, size_t len)
+{
+  const char *name = nvvi_decode_codec_name(query->codec);
+  GUID guids[NVVI_MAX_ENCODE_CODECS];
+  uint32_t count = 0;
+
+  if (check_nv(nv_funcs.nvEncGetEncodeGUIDs(encoder, guids, NVVI_MAX_ENCODE_CODECS, &count),
+               "nvEncGetEncodeGUIDs") != 0) {
+    snprintf(detail, len, "nvEncGetEncodeGUIDs failed");
+    return NVVI_QUERY_ERROR;
+  }
+
+  int found = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    found |= memcmp(&guids[i], &guid, sizeof(guid)) == 0;
+  }
+  if (!found) {
+    snprintf(detail, len, "%s encode not supported", name);
+    return NVVI_QUERY_NO;
+  }
+
+  NV_ENC_CAPS chroma_cap = 0;
+  switch (query->chroma_format) {
+  case cudaVideoChromaFormat_420:
+    break;
+  case cudaVideoChromaFormat_444:
+    chroma_cap = NV_ENC_CAPS_SUPPORT_YUV444_ENCODE;
+    break;
+  case cudaVideoChromaFormat_Monochrome:
+    chroma_cap = NV_ENC_CAPS_SUPPORT_MONOCHROME;
+    break;
+#if NVENCAPI_MAJOR_VERSION > 12
+  case cudaVideoChromaFormat_422:
+    chroma_cap = NV_ENC_CAPS_SUPPORT_YUV422_ENCODE;
+    break;
+#endif
+  default:
+    snprintf(detail, len, "%s %s encode not supported", name,
+             nvvi_chroma_format_name(query->chroma_format));
+    return NVVI_QUERY_NO;
+  }
+  if (chroma_cap && get_cap(encoder, &guid, chroma_cap) <= 0) {
+    snprintf(detail, len, "%s %s encode not supported", name,
+             nvvi_chroma_format_name(query->chroma_format));
+    return NVVI_QUERY_NO;
+  }
+
+  if (query->bit_depth > 10 ||
+      (query->bit_depth > 8 && get_cap(encoder, &guid, NV_ENC_CAPS_SUPPORT_10BIT_ENCODE) <= 0)) {
+    snprintf(detail, len, "%s %d-bit encode not supported", name, query->bit_depth);
+    return NVVI_QUERY_NO;
+  }
+
+  if (query->input_format) {
+    uint32_t formats = 0;
+    if (get_formats(encoder, &guid, &formats) != 0) {
+      snprintf(detail, len, "nvEncGetInputFormats failed");
+      return NVVI_QUERY_ERROR;
+    }
+    if (!(formats & query->input_format)) {
+      snprintf(detail, len, "%s encode from %s not supported", name,
+               nvvi_encode_format_name(query->input_format));
+      return NVVI_QUERY_NO;
+    }
+  }
+
+  /* get_cap() returns -1 on failure, which must not turn into a limit */
+  int max_w = get_cap(encoder, &guid, NV_ENC_CAPS_WIDTH_MAX);
+  int max_h = get_cap(encoder, &guid, NV_ENC_CAPS_HEIGHT_MAX);
+  int max_mbs = get_cap(encoder, &guid, NV_ENC_CAPS_MB_NUM_MAX);
+  if (max_w < 0 || max_h < 0 || max_mbs < 0) {
+    snprintf(detail, len, "nvEncGetEncodeCaps failed");
+    return NVVI_QUERY_ERROR;
+  }
+
+  int ret = NVVI_QUERY_YES;
+  if (query->width || query->height) {
+    int min_w = get_cap(encoder, &guid, NV_ENC_CAPS_WIDTH_MIN);
+    int min_h = get_cap(encoder, &guid, NV_ENC_CAPS_HEIGHT_MIN);
+    if (min_w < 0 || min_h < 0) {
+      snprintf(detail, len, "nvEncGetEncodeCaps failed");
+      return NVVI_QUERY_ERROR;
+    }
+    ret = query_size(query, min_w, min_h, max_w, max_h, max_mbs, detail, len);
+  }
+  if (ret == NVVI_QUERY_YES) {
+    snprintf(detail, len, "max %dx%d, %d macroblocks", max_w, max_h, max_mbs);
+  }
+  return ret;
+}
+
+
+static int query_encode(const nvvi_query *query, CUcontext ctx, char *detail, size_t len)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  const GUID *guid = encode_codec_guid(query->codec);
+  void *encoder;
+
+  if (!guid) {
+    snprintf(detail, len, "%s encode not supported", nvvi_decode_codec_name(query->codec));
+    return NVVI_QUERY_NO;
+  }
+
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = ctx;
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  if (check_nv(nv_funcs.nvEncOpenEncodeSessionEx(&params, &encoder),
+               "nvEncOpenEncodeSessionEx") != 0) {
+    snprintf(detail, len, "nvEncOpenEncodeSessionEx failed");
+    return NVVI_QUERY_ERROR;
+  }
+
+  int ret = query_encode_session(encoder, query, *guid, detail, len);
+  nv_funcs.nvEncDestroyEncoder(encoder);
+
+  return ret;
+}
+
+
+int nvvi_query_run(const nvvi_query *query, char *detail, size_t len)
+{
+  char dummy[1];
+  CUdevice dev;
+  CUcontext ctx;
+  int ret;
+
+  if (!detail) {
+    detail = dummy;
+    len = sizeof(dummy);
+  }
+  snprintf(detail, len, "driver unavailable");
+
+  if (load_libraries(query->encode ? NVVI_PROBE_ENCODE : NVVI_PROBE_DECODE) != 0) {
+    return NVVI_QUERY_ERROR;
+  }
+  if (query_enter(query->device, &dev, &ctx) != 0) {
+    snprintf(detail, len, "device %d unavailable", query->device);
+    return NVVI_QUERY_ERROR;
+  }
+
+  if (query->encode) {
+    ret = query_encode(query, ctx, detail, len);
+  } else {
+    ret = query_decode(query, detail, len);
+  }
+
+  query_leave(dev);
+  return ret;
+}
+
+
+/*
+ * Session scaling benchmark. All sessions of a step are set up on the
+ * calling thread, in order, so the first one the driver refuses is known
+ * exactly; only then does every session get a worker thread to encode on.
+ * Each worker encodes IPPP with one input and one bitstream buffer, so a
+ * frame's latency is the full round trip of upload, encode and readback.
+ */
+
+#define BENCH_DEFAULT_WIDTH  1920
+#define BENCH_DEFAULT_HEIGHT 1080
+#define BENCH_DEFAULT_FRAMES 300
+
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  int frames;
+  CUcontext ctx;
+  int external_input;           /* no input buffer, pictures come from elsewhere */
+
+  void *encoder;
+  NV_ENC_INPUT_PTR input;
+  NV_ENC_OUTPUT_PTR output;
+
+  uint8_t *ramp;                /* width + 256 bytes of 0, 1, ... 255, 0, ... */
+  double *latency;              /* ms, one per encoded frame */
+  int encoded;
+  uint64_t start;
+  uint64_t end;
+  int ret;
+} bench_session;
+
+
+static uint64_t bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static NVENCSTATUS bench_setup(bench_session *s, GUID codec, GUID preset, const char **func)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  NV_ENC_PRESET_CONFIG config = { 0 };
+  NV_ENC_INITIALIZE_PARAMS init = { 0 };
+  NV_ENC_CREATE_INPUT_BUFFER input = { 0 };
+  NV_ENC_CREATE_BITSTREAM_BUFFER output = { 0 };
+  NVENCSTATUS err;
+
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = s->ctx;
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  *func = "nvEncOpenEncodeSessionEx";
+  err = nv_funcs.nvEncOpenEncodeSessionEx(&params, &s->encoder);
+  if (err != NV_ENC_SUCCESS) {
+    s->encoder = NULL;
+    return err;
+  }
+
+  config.version = NV_ENC_PRESET_CONFIG_VER;
+  config.presetCfg.version = NV_ENC_CONFIG_VER;
+#if NVENCAPI_MAJOR_VERSION > 10
+  *func = "nvEncGetEncodePresetConfigEx";
+  err = nv_funcs.nvEncGetEncodePresetConfigEx(s->encoder, codec, preset,
+                                              NV_ENC_TUNING_INFO_LOW_LATENCY, &config);
+#else
+  *func = "nvEncGetEncodePresetConfig";
+  err = nv_funcs.nvEncGetEncodePresetConfig(s->encoder, codec, preset, &config);
+#endif
+  if (err != NV_ENC_SUCCESS) {
+    return err;
+  }
+
+  /* No B-frames, so every picture comes back before the next goes in */
+  config.presetCfg.frameIntervalP = 1;
+
+  init.version      = NV_ENC_INITIALIZE_PARAMS_VER;
+  init.encodeGUID   = codec;
+  init.presetGUID   = preset;
+  init.encodeWidth  = s->width;
+  init.encodeHeight = s->height;
+  init.darWidth     = s->width;
+  init.darHeight    = s->height;
+  init.frameRateNum = 30;
+  init.frameRateDen = 1;
+  init.enablePTD    = 1;
+  init.encodeConfig = &config.presetCfg;
+#if NVENCAPI_MAJOR_VERSION > 10
+  init.tuningInfo   = NV_ENC_TUNING_INFO_LOW_LATENCY;
+#endif
+  *func = "nvEncInitializeEncoder";
+  err = nv_funcs.nvEncInitializeEncoder(s->encoder, &init);
+  if (err != NV_ENC_SUCCESS) {
+    return err;
+  }
+
+  if (!s->external_input) {
+    input.version   = NV_ENC_CREATE_INPUT_BUFFER_VER;
+    input.width     = s->width;
+    input.height    = s->height;
+    input.bufferFmt = NV_ENC_BUFFER_FORMAT_NV12;
+    *func = "nvEncCreateInputBuffer";
+    err = nv_funcs.nvEncCreateInputBuffer(s->encoder, &input);
+    if (err != NV_ENC_SUCCESS) {
+      return err;
+    }
+    s->input = input.inputBuffer;
+  }
+
+  output.version = NV_ENC_CREATE_BITSTREAM_BUFFER_VER;
+  *func = "nvEncCreateBitstreamBuffer";
+  err = nv_funcs.nvEncCreateBitstreamBuffer(s->encoder, &output);
+  if (err != NV_ENC_SUCCESS) {
+    return err;
+  }
+  s->output = output.bitstreamBuffer;
+
+  return NV_ENC_SUCCESS;
+}
+
+
+static void bench_teardown(bench_session *s)
+{
+  if (s->encoder) {
+    if (s->output) {
+      nv_funcs.nvEncDestroyBitstreamBuffer(s->encoder, s->output);
+    }
+    if (s->input) {
+      nv_funcs.nvEncDestroyInputBuffer(s->encoder, s->input);
+    }
+    nv_funcs.nvEncDestroyEncoder(s->encoder);
+  }
+  free(s->ramp);
+  free(s->latency);
+}
+
+
+/* A diagonal ramp that moves two pixels a frame, on flat chroma */
+static void bench_fill(bench_session *s, uint8_t *data, uint32_t pitch, int index)
+{
+  for (unsigned int y = 0; y < s->height; y++) {
+    memcpy(data + (size_t)y * pitch, s->ramp + ((y + 2 * index) & 0xff), s->width);
+  }
+  data += (size_t)s->height * pitch;
+  for (unsigned int y = 0; y < s->height / 2; y++) {
+    memset(data + (size_t)y * pitch, 0x80, s->width);
+  }
+}
+
+
+/* Encode one NV12 picture and wait for its bitstream */
+static int bench_picture(bench_session *s, NV_ENC_INPUT_PTR input, uint32_t pitch, int index)
+{
+  NV_ENC_PIC_PARAMS pic = { 0 };
+  NV_ENC_LOCK_BITSTREAM bitstream = { 0 };
+
+  pic.version         = NV_ENC_PIC_PARAMS_VER;
+  pic.inputWidth      = s->width;
+  pic.inputHeight     = s->height;
+  pic.inputPitch      = pitch;
+  pic.frameIdx        = index;
+  pic.inputTimeStamp  = index;
+  pic.inputBuffer     = input;
+  pic.outputBitstream = s->output;
+  pic.bufferFmt       = NV_ENC_BUFFER_FORMAT_NV12;
+  pic.pictureStruct   = NV_ENC_PIC_STRUCT_FRAME;
+  CHECK_NV(nv_funcs.nvEncEncodePicture(s->encoder, &pic));
+
+  bitstream.version = NV_ENC_LOCK_BITSTREAM_VER;
+  bitstream.outputBitstream = s->output;
+  CHECK_NV(nv_funcs.nvEncLockBitstream(s->encoder, &bitstream));
+  CHECK_NV(nv_funcs.nvEncUnlockBitstream(s->encoder, s->output));
+
+  return 0;
+}
+
+
+static int bench_frame(bench_session *s, int index)
+{
+  NV_ENC_LOCK_INPUT_BUFFER lock = { 0 };
+
+  lock.version = NV_ENC_LOCK_INPUT_BUFFER_VER;
+  lock.inputBuffer = s->input;
+  CHECK_NV(nv_funcs.nvEncLockInputBuffer(s->encoder, &lock));
+  bench_fill(s, lock.bufferDataPtr, lock.pitch, index);
+  CHECK_NV(nv_funcs.nvEncUnlockInputBuffer(s->encoder, s->input));
+
+  return bench_picture(s, s->input, lock.pitch, index);
+}
+
+
+static void *bench_worker(void *opaque)
+{
+  bench_session *s = opaque;
+  CUcontext dummy;
+
+  s->ret = check_cu(cu->cuCtxPushCurrent(s->ctx), "cuCtxPushCurrent");
+  if (s->ret != 0) {
+    return NULL;
+  }
+
+  s->start = bench_now();
+  for (int i = 0; i < s->frames; i++) {
+    uint64_t t = bench_now();
+    s->ret = bench_frame(s, i);
+    if (s->ret != 0) {
+      break;
+    }
+    s->latency[s->encoded++] = (bench_now() - t) / 1e6;
+  }
+  s->end = bench_now();
+
+  cu->cuCtxPopCurrent(&dummy);
+  return NULL;
+}
+
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+/* Sorts latency and fills p50, p95, p99 and max, in that order */
+static void bench_percentiles(double *latency, int n, double *p)
+{
+  qsort(latency, n, sizeof(double), compare_double);
+  p[0] = latency[(n - 1) * 50 / 100];
+  p[1] = latency[(n - 1) * 95 / 100];
+  p[2] = latency[(n - 1) * 99 / 100];
+  p[3] = latency[n - 1];
+}
+
+
+static int bench_encode(bench_session *sessions, int count, nvvi_bench_step *step)
+{
+  pthread_t *threads = calloc(count, sizeof(pthread_t));
+  double *latency = calloc((size_t)count * sessions[0].frames, sizeof(double));
+  int started = 0;
+  int ret = 0;
+
+  if (!threads || !latency) {
+    free(threads);
+    free(latency);
+    return -1;
+  }
+
+  for (; started < count; started++) {
+    if (pthread_create(&threads[started], NULL, bench_worker, &sessions[started]) != 0) {
+      ret = -1;
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  uint64_t start = UINT64_MAX, end = 0;
+  int n = 0;
+  step->session_fps_min = 0;
+  step->session_fps_max = 0;
+  for (int i = 0; i < started; i++) {
+    bench_session *s = &sessions[i];
+    double fps = s->end > s->start ? s->encoded * 1e9 / (s->end - s->start) : 0;
+
+    ret |= s->ret;
+    start = MIN(start, s->start);
+    end = MAX(end, s->end);
+    memcpy(&latency[n], s->latency, s->encoded * sizeof(double));
+    n += s->encoded;
+    if (i == 0 || fps < step->session_fps_min) {
+      step->session_fps_min = fps;
+    }
+    if (fps > step->session_fps_max) {
+      step->session_fps_max = fps;
+    }
+  }
+
+  step->frames = n;
+  if (n > 0) {
+    double p[4];
+    bench_percentiles(latency, n, p);
+    step->fps = end > start ? n * 1e9 / (end - start) : 0;
+    step->latency_p50_ms = p[0];
+    step->latency_p95_ms = p[1];
+    step->latency_p99_ms = p[2];
+    step->latency_max_ms = p[3];
+  }
+
+  free(threads);
+  free(latency);
+  return ret;
+}
+
+
+/* The preset asked for, or the default one if it is all zero */
+static GUID bench_preset(const nvvi_guid *asked)
+{
+  GUID preset;
+
+  memcpy(&preset, asked, sizeof(preset));
+  if (memcmp(&preset, &(GUID){ 0 }, sizeof(preset)) == 0) {
+#if NVENCAPI_MAJOR_VERSION > 10
+    preset = NV_ENC_PRESET_P4_GUID;
+#else
+    preset = NV_ENC_PRESET_DEFAULT_GUID;
+#endif
+  }
+  return preset;
+}
+
+
+int nvvi_bench_run(const nvvi_bench_options *opts, int sessions, nvvi_bench_step *step)
+{
+  const GUID *codec = encode_codec_guid(opts->codec);
+  GUID preset = bench_preset(&opts->preset);
+  CUdevice dev;
+  CUcontext ctx;
+  int ret = 0;
+
+  memset(step, 0, sizeof(*step));
+  step->sessions = sessions;
+  if (!codec || sessions <= 0) {
+    return -1;
+  }
+
+  if (load_libraries(NVVI_PROBE_ENCODE) != 0 || query_enter(opts->device, &dev, &ctx) != 0) {
+    return -1;
+  }
+
+  bench_session *s = calloc(sessions, sizeof(*s));
+  if (!s) {
+    query_leave(dev);
+    return -1;
+  }
+
+  uint64_t start = nvvi_trace_begin();
+  for (int i = 0; i < sessions; i++) {
+    const char *func;
+    NVENCSTATUS err;
+
+    s[i].width = opts->width ? opts->width : BENCH_DEFAULT_WIDTH;
+    s[i].height = opts->height ? opts->height : BENCH_DEFAULT_HEIGHT;
+    s[i].frames = opts->frames > 0 ? opts->frames : BENCH_DEFAULT_FRAMES;
+    s[i].ctx = ctx;
+    s[i].ramp = malloc(s[i].width + 256);
+    s[i].latency = calloc(s[i].frames, sizeof(double));
+    if (!s[i].ramp || !s[i].latency) {
+      ret = -1;
+      break;
+    }
+    for (unsigned int x = 0; x < s[i].width + 256; x++) {
+      s[i].ramp[x] = x & 0xff;
+    }
+
+    err = bench_setup(&s[i], *codec, preset, &func);
+    if (err != NV_ENC_SUCCESS) {
+      const char *desc;
+      nvenc_map_error(err, &desc);
+      step->status = err;
+      snprintf(step->error, sizeof(step->error), "%s: %s", func, desc);
+      break;
+    }
+    step->opened++;
+  }
+  nvvi_trace_end("bench setup", opts->device, start);
+
+  if (ret == 0 && step->opened == sessions) {
+    start = nvvi_trace_begin();
+    ret = bench_encode(s, sessions, step);
+    nvvi_trace_end("bench encode", opts->device, start);
+  }
+
+  for (int i = 0; i < sessions; i++) {
+    bench_teardown(&s[i]);
+  }
+  free(s);
+  query_leave(dev);
+
+  return ret;
+}
+
+
+/*
+ * Decode benchmark. Every decoder gets its own parser, fed one access unit
+ * of the synthetic stream per cuvidParseVideoData call. The parser calls
+ * back to decode each picture and, as the stream never reorders, to
+ * display it right away, where mapping the frame waits for its decode to
+ * finish. Decoders are created up front from the known stream format, so
+ * a decoder the driver refuses shows up before anything is decoded.
+ */
+
+#define DECODE_BENCH_SURFACES 8
+
+typedef struct {
+  CUcontext ctx;
+  const nvvi_synth_stream *stream;
+  int bit_depth;
+  unsigned int width;
+  unsigned int height;
+  int frames;
+
+  CUvideodecoder decoder;
+  CUvideoparser parser;
+
+  uint64_t *submitted;          /* ns, per frame */
+  double *latency;              /* ms, per displayed frame */
+  int displayed;
+  uint64_t start;
+  uint64_t end;
+  int ret;
+} decode_session;
+
+
+static int CUDAAPI decode_bench_sequence(void *opaque, CUVIDEOFORMAT *format)
+{
+  decode_session *s = opaque;
+
+  /* The decoder already exists; just make sure the parser agrees on what it is */
+  if (format->codec != s->stream->codec ||
+      format->bit_depth_luma_minus8 != s->bit_depth - 8 ||
+      format->coded_width > s->stream->coded_width ||
+      format->coded_height > s->stream->coded_height) {
+    fprintf(stderr, "Unexpected stream format %ux%u\n", format->coded_width, format->coded_height);
+    s->ret = -1;
+    return 0;
+  }
+  return 1;
+}
+
+
+static int CUDAAPI decode_bench_decode(void *opaque, CUVIDPICPARAMS *pic)
+{
+  decode_session *s = opaque;
+
+  if (check_cu(cv->cuvidDecodePicture(s->decoder, pic), "cuvidDecodePicture") != 0) {
+    s->ret = -1;
+    return 0;
+  }
+  return 1;
+}
+
+
+static int CUDAAPI decode_bench_display(void *opaque, CUVIDPARSERDISPINFO *disp)
+{
+  decode_session *s = opaque;
+  CUVIDPROCPARAMS proc = { 0 };
+  CUdeviceptr frame;
+  unsigned int pitch;
+
+  if (!disp) {
+    return 1;
+  }
+
+  proc.progressive_frame = disp->progressive_frame;
+  proc.top_field_first = disp->top_field_first;
+  if (check_cu(cv->cuvidMapVideoFrame(s->decoder, disp->picture_index, &frame, &pitch, &proc),
+               "cuvidMapVideoFrame") != 0) {
+    s->ret = -1;
+    return 0;
+  }
+  cv->cuvidUnmapVideoFrame(s->decoder, frame);
+
+  if (disp->timestamp >= 0 && disp->timestamp < s->frames && s->displayed < s->frames) {
+    s->latency[s->displayed++] = (bench_now() - s->submitted[disp->timestamp]) / 1e6;
+  }
+  return 1;
+}
+
+
+static CUresult decode_bench_setup(decode_session *s, PFNVIDDISPLAYCALLBACK display,
+                                   const char **func)
+{
+  CUVIDDECODECREATEINFO info = { 0 };
+  CUVIDPARSERPARAMS params = { 0 };
+  CUresult err;
+
+  info.ulWidth             = s->stream->coded_width;
+  info.ulHeight            = s->stream->coded_height;
+  info.ulNumDecodeSurfaces = DECODE_BENCH_SURFACES;
+  info.CodecType           = s->stream->codec;
+  info.ChromaFormat        = cudaVideoChromaFormat_420;
+  info.bitDepthMinus8      = s->bit_depth - 8;
+  info.ulCreationFlags     = cudaVideoCreate_PreferCUVID;
+  info.ulMaxWidth          = info.ulWidth;
+  info.ulMaxHeight         = info.ulHeight;
+  info.display_area.right  = s->width;
+  info.display_area.bottom = s->height;
+  info.OutputFormat        = s->bit_depth > 8 ? cudaVideoSurfaceFormat_P016
+                                                : cudaVideoSurfaceFormat_NV12;
+  info.DeinterlaceMode     = cudaVideoDeinterlaceMode_Weave;
+  info.ulTargetWidth       = s->width;
+  info.ulTargetHeight      = s->height;
+  info.ulNumOutputSurfaces = 1;
+  *func = "cuvidCreateDecoder";
+  err = cv->cuvidCreateDecoder(&s->decoder, &info);
+  if (err != CUDA_SUCCESS) {
+    s->decoder = NULL;
+    return err;
+  }
+
+  params.CodecType              = s->stream->codec;
+  params.ulMaxNumDecodeSurfaces = DECODE_BENCH_SURFACES;
+  params.ulMaxDisplayDelay      = 0;
+  params.pUserData              = s;
+  params.pfnSequenceCallback    = decode_bench_sequence;
+  params.pfnDecodePicture       = decode_bench_decode;
+  params.pfnDisplayPicture      = display;
+  *func = "cuvidCreateVideoParser";
+  err = cv->cuvidCreateVideoParser(&s->parser, &params);
+  if (err != CUDA_SUCCESS) {
+    s->parser = NULL;
+  }
+  return err;
+}
+
+
+static void decode_bench_teardown(decode_session *s)
+{
+  if (s->parser) {
+    cv->cuvidDestroyVideoParser(s->parser);
+  }
+  if (s->decoder) {
+    cv->cuvidDestroyDecoder(s->decoder);
+  }
+  free(s->submitted);
+  free(s->latency);
+}
+
+
+static void *decode_bench_worker(void *opaque)
+{
+  decode_session *s = opaque;
+  CUVIDSOURCEDATAPACKET eos = { 0 };
+  CUcontext dummy;
+
+  s->ret = check_cu(cu->cuCtxPushCurrent(s->ctx), "cuCtxPushCurrent");
+  if (s->ret != 0) {
+    return NULL;
+  }
+
+  s->start = bench_now();
+  for (int i = 0; i < s->frames && s->ret == 0; i++) {
+    const nvvi_synth_unit *unit = nvvi_synth_frame(s->stream, i);
+    CUVIDSOURCEDATAPACKET packet = { 0 };
+
+    packet.flags = CUVID_PKT_TIMESTAMP;
+#if NVDECAPI_MAJOR_VERSION > 9
+    /* Decode each picture now rather than when the next one starts */
+    packet.flags |= CUVID_PKT_ENDOFPICTURE;
+#endif
+    packet.payload = unit->data;
+    packet.payload_size = unit->size;
+    packet.timestamp = i;
+    s->submitted[i] = bench_now();
+    if (check_cu(cv->cuvidParseVideoData(s->parser, &packet), "cuvidParseVideoData") != 0) {
+      s->ret = -1;
+    }
+  }
+  eos.flags = CUVID_PKT_ENDOFSTREAM;
+  if (s->ret == 0) {
+    s->ret = check_cu(cv->cuvidParseVideoData(s->parser, &eos), "cuvidParseVideoData");
+  }
+  s->end = bench_now();
+
+  cu->cuCtxPopCurrent(&dummy);
+  return NULL;
+}
+
+
+static int decode_bench_decode_all(decode_session *sessions, int count,
+                                   nvvi_decode_bench_step *step)
+{
+  pthread_t *threads = calloc(count, sizeof(pthread_t));
+  double *latency = calloc((size_t)count * sessions[0].frames, sizeof(double));
+  int started = 0;
+  int ret = 0;
+
+  if (!threads || !latency) {
+    free(threads);
+    free(latency);
+    return -1;
+  }
+
+  for (; started < count; started++) {
+    if (pthread_create(&threads[started], NULL, decode_bench_worker, &sessions[started]) != 0) {
+      ret = -1;
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  uint64_t start = UINT64_MAX, end = 0;
+  int n = 0;
+  for (int i = 0; i < started; i++) {
+    decode_session *s = &sessions[i];
+    double fps = s->end > s->start ? s->displayed * 1e9 / (s->end - s->start) : 0;
+
+    ret |= s->ret;
+    start = MIN(start, s->start);
+    end = MAX(end, s->end);
+    memcpy(&latency[n], s->latency, s->displayed * sizeof(double));
+    n += s->displayed;
+    if (i == 0 || fps < step->session_fps_min) {
+      step->session_fps_min = fps;
+    }
+    if (fps > step->session_fps_max) {
+      step->session_fps_max = fps;
+    }
+  }
+
+  step->frames = n;
+  if (n > 0) {
+    double p[4];
+    bench_percentiles(latency, n, p);
+    step->fps = end > start ? n * 1e9 / (end - start) : 0;
+    step->mb_per_sec = step->fps * ((sessions[0].width + 15) / 16) * ((sessions[0].height + 15) / 16);
+    step->latency_p50_ms = p[0];
+    step->latency_p95_ms = p[1];
+    step->latency_p99_ms = p[2];
+    step->latency_max_ms = p[3];
+  }
+
+  free(threads);
+  free(latency);
+  return ret;
+}
+
+
+int nvvi_decode_bench_supported(int codec, int chroma_format, int bit_depth)
+{
+  return nvvi_synth_supported(codec, chroma_format, bit_depth);
+}
+
+
+int nvvi_decode_bench_run(const nvvi_decode_bench_options *opts, int sessions,
+                          nvvi_decode_bench_step *step)
+{
+  CUVIDDECODECAPS caps = { 0 };
+  nvvi_synth_stream stream;
+  unsigned int width = opts->width ? opts->width : BENCH_DEFAULT_WIDTH;
+  unsigned int height = opts->height ? opts->height : BENCH_DEFAULT_HEIGHT;
+  int bit_depth = opts->bit_depth ? opts->bit_depth : 8;
+  CUdevice dev;
+  CUcontext ctx;
+  int ret = 0;
+
+  memset(step, 0, sizeof(*step));
+  step->sessions = sessions;
+  if (!nvvi_synth_supported(opts->codec, cudaVideoChromaFormat_420, bit_depth) || sessions <= 0) {
+    return -1;
+  }
+
+  if (load_libraries(NVVI_PROBE_DECODE) != 0 || query_enter(opts->device, &dev, &ctx) != 0) {
+    return -1;
+  }
+
+  caps.eCodecType = opts->codec;
+  caps.eChromaFormat = cudaVideoChromaFormat_420;
+  caps.nBitDepthMinus8 = bit_depth - 8;
+  if (check_cu(cv->cuvidGetDecoderCaps(&caps), "cuvidGetDecoderCaps") != 0) {
+    query_leave(dev);
+    return -1;
+  }
+  step->nvdecs = caps.nNumNVDECs;
+  step->max_mb_count = caps.nMaxMBCount;
+  if (!caps.bIsSupported) {
+    snprintf(step->error, sizeof(step->error), "%s 420 %d-bit decode not supported",
+             nvvi_decode_codec_name(opts->codec), bit_depth);
+    query_leave(dev);
+    return 0;
+  }
+
+  if (nvvi_synth_stream_init(&stream, opts->codec, bit_depth, width, height) != 0) {
+    query_leave(dev);
+    return -1;
+  }
+
+  decode_session *s = calloc(sessions, sizeof(*s));
+  if (!s) {
+    nvvi_synth_stream_free(&stream);
+    query_leave(dev);
+    return -1;
+  }
+
+  uint64_t start = nvvi_trace_begin();
+  for (int i = 0; i < sessions; i++) {
+    const char *func;
+    CUresult err;
+
+    s[i].ctx = ctx;
+    s[i].stream = &stream;
+    s[i].bit_depth = bit_depth;
+    s[i].width = width;
+    s[i].height = height;
+    s[i].frames = opts->frames > 0 ? opts->frames : BENCH_DEFAULT_FRAMES;
+    s[i].submitted = calloc(s[i].frames, sizeof(uint64_t));
+    s[i].latency = calloc(s[i].frames, sizeof(double));
+    if (!s[i].submitted || !s[i].latency) {
+      ret = -1;
+      break;
+    }
+
+    err = decode_bench_setup(&s[i], decode_bench_display, &func);
+    if (err != CUDA_SUCCESS) {
+      const char *desc = NULL;
+      cu->cuGetErrorName(err, &desc);
+      step->status = err;
+      snprintf(step->error, sizeof(step->error), "%s: %s", func, desc ? desc : "unknown error");
+      break;
+    }
+    step->opened++;
+  }
+  nvvi_trace_end("decode bench setup", opts->device, start);
+
+  if (ret == 0 && step->opened == sessions) {
+    start = nvvi_trace_begin();
+    ret = decode_bench_decode_all(s, sessions, step);
+    nvvi_trace_end("decode bench decode", opts->device, start);
+  }
+
+  for (int i = 0; i < sessions; i++) {
+    decode_bench_teardown(&s[i]);
+  }
+  free(s);
+  nvvi_synth_stream_free(&stream);
+  query_leave(dev);
+
+  return ret;
+}
+
+
+/*
+ * Transcode latency probe. The decoder is set up like a decode bench
+ * session, but its display callback hands every frame straight to an
+ * encoder on the same context and waits for the bitstream, so each
+ * cuvidParseVideoData call transcodes one frame. Registered resources are
+ * kept for as long as the session, as a pipeline would, and only the
+ * first frame on each decoder output surface pays for registering it.
+ */
+
+#define TRANSCODE_MAX_REGISTERED DECODE_BENCH_SURFACES
+
+enum {
+  TRANSCODE_DECODE,
+  TRANSCODE_MAP,
+  TRANSCODE_ENCODE,
+  TRANSCODE_TOTAL,
+  TRANSCODE_STAGES,
+};
+
+typedef struct {
+  decode_session dec;           /* first, the parser callbacks get the session as their opaque */
+  bench_session enc;
+  int zero_copy;
+
+  struct {
+    CUdeviceptr frame;
+    NV_ENC_REGISTERED_PTR resource;
+  } registered[TRANSCODE_MAX_REGISTERED];
+  int num_registered;
+
+  double *latency[TRANSCODE_STAGES];  /* ms, per transcoded frame */
+  int transcoded;
+
+  /* The driver refused to take the frame as encoder input */
+  int status;
+  const char *func;
+} transcode_session;
+
+
+static NVENCSTATUS transcode_register(transcode_session *t, CUdeviceptr frame, unsigned int pitch,
+                                      NV_ENC_REGISTERED_PTR *resource)
+{
+  NV_ENC_REGISTER_RESOURCE reg = { 0 };
+  NVENCSTATUS err;
+
+  for (int i = 0; i < t->num_registered; i++) {
+    if (t->registered[i].frame == frame) {
+      *resource = t->registered[i].resource;
+      return NV_ENC_SUCCESS;
+    }
+  }
+  if (t->num_registered == TRANSCODE_MAX_REGISTERED) {
+    return NV_ENC_ERR_RESOURCE_REGISTER_FAILED;
+  }
+
+  reg.version            = NV_ENC_REGISTER_RESOURCE_VER;
+  reg.resourceType       = NV_ENC_INPUT_RESOURCE_TYPE_CUDADEVICEPTR;
+  reg.width              = t->enc.width;
+  reg.height             = t->enc.height;
+  reg.pitch              = pitch;
+  reg.resourceToRegister = (void *)(uintptr_t)frame;
+  reg.bufferFormat       = NV_ENC_BUFFER_FORMAT_NV12;
+#if NVENCAPI_MAJOR_VERSION > 8
+  reg.bufferUsage        = NV_ENC_INPUT_IMAGE;
+#endif
+  err = nv_funcs.nvEncRegisterResource(t->enc.encoder, &reg);
+  if (err != NV_ENC_SUCCESS) {
+    return err;
+  }
+
+  t->registered[t->num_registered].frame = frame;
+  t->registered[t->num_registered].resource = reg.registeredResource;
+  t->num_registered++;
+  *resource = reg.registeredResource;
+  return NV_ENC_SUCCESS;
+}
+
+
+/*
+ * Make the mapped frame the encoder's input: map its registered resource,
+ * or copy it into the input buffer. A refusal to register or map is noted
+ * in the session and returns 1, any other failure -1.
+ */
+static int transcode_input(transcode_session *t, CUdeviceptr frame, unsigned int pitch,
+                           NV_ENC_INPUT_PTR *input, uint32_t *input_pitch)
+{
+  if (t->zero_copy) {
+    NV_ENC_MAP_INPUT_RESOURCE map = { 0 };
+    NVENCSTATUS err;
+
+    t->func = "nvEncRegisterResource";
+    err = transcode_register(t, frame, pitch, &map.registeredResource);
+    if (err == NV_ENC_SUCCESS) {
+      map.version = NV_ENC_MAP_INPUT_RESOURCE_VER;
+      t->func = "nvEncMapInputResource";
+      err = nv_funcs.nvEncMapInputResource(t->enc.encoder, &map);
+    }
+    if (err != NV_ENC_SUCCESS) {
+      t->status = err;
+      return 1;
+    }
+    t->func = NULL;
+    *input = map.mappedResource;
+    *input_pitch = pitch;
+    return 0;
+  }
+
+  NV_ENC_LOCK_INPUT_BUFFER lock = { 0 };
+  CUDA_MEMCPY2D copy = { 0 };
+  int ret;
+
+  lock.version = NV_ENC_LOCK_INPUT_BUFFER_VER;
+  lock.inputBuffer = t->enc.input;
+  CHECK_NV(nv_funcs.nvEncLockInputBuffer(t->enc.encoder, &lock));
+
+  /* NV12 with the chroma plane right below the luma, on both sides */
+  copy.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+  copy.srcDevice     = frame;
+  copy.srcPitch      = pitch;
+  copy.dstMemoryType = CU_MEMORYTYPE_HOST;
+  copy.dstHost       = lock.bufferDataPtr;
+  copy.dstPitch      = lock.pitch;
+  copy.WidthInBytes  = t->enc.width;
+  copy.Height        = t->enc.height * 3 / 2;
+  ret = check_cu(cu->cuMemcpy2D(&copy), "cuMemcpy2D");
+  ret |= check_nv(nv_funcs.nvEncUnlockInputBuffer(t->enc.encoder, t->enc.input),
+                  "nvEncUnlockInputBuffer");
+
+  *input = t->enc.input;
+  *input_pitch = lock.pitch;
+  return ret;
+}
+
+
+static int CUDAAPI transcode_display(void *opaque, CUVIDPARSERDISPINFO *disp)
+{
+  transcode_session *t = opaque;
+  CUVIDPROCPARAMS proc = { 0 };
+  NV_ENC_INPUT_PTR input = NULL;
+  uint32_t input_pitch;
+  CUdeviceptr frame;
+  unsigned int pitch;
+  int ret;
+
+  if (!disp || disp->timestamp < 0 || disp->timestamp >= t->dec.frames ||
+      t->transcoded == t->dec.frames) {
+    return 1;
+  }
+
+  proc.progressive_frame = disp->progressive_frame;
+  proc.top_field_first = disp->top_field_first;
+  if (check_cu(cv->cuvidMapVideoFrame(t->dec.decoder, disp->picture_index, &frame, &pitch, &proc),
+               "cuvidMapVideoFrame") != 0) {
+    t->dec.ret = -1;
+    return 0;
+  }
+
+  uint64_t mapped = bench_now();
+  ret = transcode_input(t, frame, pitch, &input, &input_pitch);
+  uint64_t ready = bench_now();
+  if (ret == 0) {
+    ret = bench_picture(&t->enc, input, input_pitch, disp->timestamp);
+  }
+  uint64_t encoded = bench_now();
+
+  if (t->zero_copy && input) {
+    nv_funcs.nvEncUnmapInputResource(t->enc.encoder, input);
+  }
+  cv->cuvidUnmapVideoFrame(t->dec.decoder, frame);
+  if (ret != 0) {
+    t->dec.ret = -1;
+    return 0;
+  }
+
+  uint64_t submitted = t->dec.submitted[disp->timestamp];
+  t->latency[TRANSCODE_DECODE][t->transcoded] = (mapped - submitted) / 1e6;
+  t->latency[TRANSCODE_MAP][t->transcoded] = (ready - mapped) / 1e6;
+  t->latency[TRANSCODE_ENCODE][t->transcoded] = (encoded - ready) / 1e6;
+  t->latency[TRANSCODE_TOTAL][t->transcoded] = (encoded - submitted) / 1e6;
+  t->transcoded++;
+  return 1;
+}
+
+
+/* Feed the stream one access unit at a time; 0 also if the input was refused */
+static int transcode_all(transcode_session *t)
+{
+  CUVIDSOURCEDATAPACKET eos = { 0 };
+
+  t->dec.start = bench_now();
+  for (int i = 0; i < t->dec.frames && t->dec.ret == 0; i++) {
+    const nvvi_synth_unit *unit = nvvi_synth_frame(t->dec.stream, i);
+    CUVIDSOURCEDATAPACKET packet = { 0 };
+    CUresult err;
+
+    packet.flags = CUVID_PKT_TIMESTAMP;
+#if NVDECAPI_MAJOR_VERSION > 9
+    packet.flags |= CUVID_PKT_ENDOFPICTURE;
+#endif
+    packet.payload = unit->data;
+    packet.payload_size = unit->size;
+    packet.timestamp = i;
+    t->dec.submitted[i] = bench_now();
+    err = cv->cuvidParseVideoData(t->dec.parser, &packet);
+    /* After a refusal the parser fails because the callback did, not worth saying */
+    if (!t->func && check_cu(err, "cuvidParseVideoData") != 0) {
+      t->dec.ret = -1;
+    }
+  }
+  t->dec.end = bench_now();
+  if (t->func) {
+    return 0;
+  }
+
+  eos.flags = CUVID_PKT_ENDOFSTREAM;
+  if (t->dec.ret == 0) {
+    t->dec.ret = check_cu(cv->cuvidParseVideoData(t->dec.parser, &eos), "cuvidParseVideoData");
+  }
+  return t->dec.ret;
+}
+
+
+static void transcode_teardown(transcode_session *t)
+{
+  /* Registrations point into the decoder's surfaces, so they go first */
+  for (int i = 0; i < t->num_registered; i++) {
+    nv_funcs.nvEncUnregisterResource(t->enc.encoder, t->registered[i].resource);
+  }
+  bench_teardown(&t->enc);
+  decode_bench_teardown(&t->dec);
+  free(t->latency[0]);
+}
+
+
+static void transcode_percentiles(double *latency, int n, nvvi_percentiles *out)
+{
+  double p[4];
+
+  bench_percentiles(latency, n, p);
+  out->p50_ms = p[0];
+  out->p95_ms = p[1];
+  out->p99_ms = p[2];
+  out->max_ms = p[3];
+}
+
+
+int nvvi_transcode_run(const nvvi_transcode_options *opts, nvvi_transcode_step *step)
+{
+  const GUID *codec = encode_codec_guid(opts->encode_codec);
+  GUID preset = bench_preset(&opts->preset);
+  CUVIDDECODECAPS caps = { 0 };
+  nvvi_synth_stream stream;
+  transcode_session t = { 0 };
+  CUdevice dev;
+  CUcontext ctx;
+  int ret = 0;
+
+  memset(step, 0, sizeof(*step));
+  if (!nvvi_synth_supported(opts->decode_codec, cudaVideoChromaFormat_420, 8) || !codec) {
+    return -1;
+  }
+
+  if (load_libraries(NVVI_PROBE_DECODE | NVVI_PROBE_ENCODE) != 0 ||
+      query_enter(opts->device, &dev, &ctx) != 0) {
+    return -1;
+  }
+
+  caps.eCodecType = opts->decode_codec;
+  caps.eChromaFormat = cudaVideoChromaFormat_420;
+  if (check_cu(cv->cuvidGetDecoderCaps(&caps), "cuvidGetDecoderCaps") != 0) {
+    query_leave(dev);
+    return -1;
+  }
+  if (!caps.bIsSupported) {
+    snprintf(step->error, sizeof(step->error), "%s 420 8-bit decode not supported",
+             nvvi_decode_codec_name(opts->decode_codec));
+    query_leave(dev);
+    return 0;
+  }
+
+  t.dec.width = t.enc.width = opts->width ? opts->width : BENCH_DEFAULT_WIDTH;
+  t.dec.height = t.enc.height = opts->height ? opts->height : BENCH_DEFAULT_HEIGHT;
+  t.dec.frames = t.enc.frames = opts->frames > 0 ? opts->frames : BENCH_DEFAULT_FRAMES;
+  t.dec.ctx = t.enc.ctx = ctx;
+  t.dec.stream = &stream;
+  t.dec.bit_depth = 8;
+  t.enc.external_input = t.zero_copy = opts->zero_copy;
+
+  if (nvvi_synth_stream_init(&stream, opts->decode_codec, 8, t.dec.width, t.dec.height) != 0) {
+    query_leave(dev);
+    return -1;
+  }
+
+  t.dec.submitted = calloc(t.dec.frames, sizeof(uint64_t));
+  t.latency[0] = calloc((size_t)t.dec.frames * TRANSCODE_STAGES, sizeof(double));
+  if (!t.dec.submitted || !t.latency[0]) {
+    ret = -1;
+  } else {
+    for (int i = 1; i < TRANSCODE_STAGES; i++) {
+      t.latency[i] = t.latency[0] + (size_t)i * t.dec.frames;
+    }
+  }
+
+  uint64_t start = nvvi_trace_begin();
+  if (ret == 0) {
+    const char *func;
+    CUresult cu_err = decode_bench_setup(&t.dec, transcode_display, &func);
+    NVENCSTATUS nv_err = NV_ENC_SUCCESS;
+
+    if (cu_err == CUDA_SUCCESS) {
+      nv_err = bench_setup(&t.enc, *codec, preset, &func);
+    }
+    if (cu_err != CUDA_SUCCESS) {
+      const char *desc = NULL;
+      cu->cuGetErrorName(cu_err, &desc);
+      step->status = cu_err;
+      snprintf(step->error, sizeof(step->error), "%s: %s", func, desc ? desc : "unknown error");
+    } else if (nv_err != NV_ENC_SUCCESS) {
+      const char *desc;
+      nvenc_map_error(nv_err, &desc);
+      step->status = nv_err;
+      snprintf(step->error, sizeof(step->error), "%s: %s", func, desc);
+    }
+  }
+  nvvi_trace_end("transcode setup", opts->device, start);
+
+  if (ret == 0 && !step->error[0]) {
+    start = nvvi_trace_begin();
+    ret = transcode_all(&t);
+    nvvi_trace_end("transcode", opts->device, start);
+
+    if (t.func) {
+      const char *desc;
+      nvenc_map_error(t.status, &desc);
+      step->status = t.status;
+      snprintf(step->error, sizeof(step->error), "%s: %s", t.func, desc);
+    }
+    step->frames = t.transcoded;
+    step->registered = t.num_registered;
+    if (t.transcoded > 0) {
+      step->fps = t.dec.end > t.dec.start ? t.transcoded * 1e9 / (t.dec.end - t.dec.start) : 0;
+      transcode_percentiles(t.latency[TRANSCODE_DECODE], t.transcoded, &step->decode);
+      transcode_percentiles(t.latency[TRANSCODE_MAP], t.transcoded, &step->map);
+      transcode_percentiles(t.latency[TRANSCODE_ENCODE], t.transcoded, &step->encode);
+      transcode_percentiles(t.latency[TRANSCODE_TOTAL], t.transcoded, &step->total);
+    }
+  }
+
+  transcode_teardown(&t);
+  nvvi_synth_stream_free(&stream);
+  query_leave(dev);
+
+  return ret;
+}
+
+
+/*
+ * Session memory footprint. Each repeat reads free memory, creates the
+ * session and everything it allocates, reads free memory again and tears
+ * it all down before the next one, so repeats don't see each other.
+ */
+
+#define FOOTPRINT_DEFAULT_REPEAT   3
+#define FOOTPRINT_DEFAULT_SURFACES 8
+#define FOOTPRINT_MAX_BUFFERS      64
+
+typedef struct {
+  void *encoder;
+  int buffers;
+  NV_ENC_INPUT_PTR inputs[FOOTPRINT_MAX_BUFFERS];
+  NV_ENC_OUTPUT_PTR outputs[FOOTPRINT_MAX_BUFFERS];
+} footprint_encoder;
+
+
+static int compare_int64(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+static void footprint_summarise(nvvi_footprint *fp, int64_t *bytes, int n)
+{
+  qsort(bytes, n, sizeof(*bytes), compare_int64);
+  fp->bytes = bytes[n / 2];
+  fp->min_bytes = bytes[0];
+  fp->max_bytes = bytes[n - 1];
+}
+
+
+static int footprint_enter(const nvvi_footprint_options *opts, unsigned int flags,
+                           nvvi_footprint *fp, CUdevice *dev, CUcontext *ctx)
+{
+  size_t free_mem, total;
+
+  memset(fp, 0, sizeof(*fp));
+  if (load_libraries(flags) != 0) {
+    return -1;
+  }
+  if (!cu_ext.cuMemGetInfo) {
+    fprintf(stderr, "cuMemGetInfo is not available\n");
+    return -1;
+  }
+  if (query_enter(opts->device, dev, ctx) != 0) {
+    return -1;
+  }
+  if (check_cu(cu_ext.cuMemGetInfo(&free_mem, &total), "cuMemGetInfo") != 0) {
+    query_leave(*dev);
+    return -1;
+  }
+  fp->free_bytes = free_mem;
+  fp->total_bytes = total;
+  return 0;
+}
+
+
+/* Free memory taken since *before; -1 if it can't be read */
+static int footprint_taken(size_t before, int64_t *bytes)
+{
+  size_t free_mem, total;
+
+  if (check_cu(cu_ext.cuMemGetInfo(&free_mem, &total), "cuMemGetInfo") != 0) {
+    return -1;
+  }
+  *bytes = (int64_t)before - (int64_t)free_mem;
+  return 0;
+}
+
+
+/* The surface a decoder outputs for a depth, out of the formats it offers */
+static cudaVideoSurfaceFormat decode_output_surface(unsigned int mask, int bit_depth)
+{
+  static const cudaVideoSurfaceFormat deep[] = {
+    cudaVideoSurfaceFormat_P016, cudaVideoSurfaceFormat_YUV444_16Bit, cudaVideoSurfaceFormat_P216,
+  };
+  static const cudaVideoSurfaceFormat shallow[] = {
+    cudaVideoSurfaceFormat_NV12, cudaVideoSurfaceFormat_YUV444, cudaVideoSurfaceFormat_NV16,
+  };
+  const cudaVideoSurfaceFormat *order = bit_depth > 8 ? deep : shallow;
+
+  for (int i = 0; i < 3; i++) {
+    if (mask & (1u << order[i])) {
+      return order[i];
+    }
+  }
+  return cudaVideoSurfaceFormat_NV12;
+}
+
+
+/* A decoder of the given coded size that outputs at that size */
+static void decode_create_info(CUVIDDECODECREATEINFO *info, int codec, int chroma_format,
+                               int bit_depth, unsigned int width, unsigned int height,
+                               unsigned int output_format_mask)
+{
+  memset(info, 0, sizeof(*info));
+  info->ulWidth             = (width + 15) & ~15;
+  info->ulHeight            = (height + 15) & ~15;
+  info->ulNumDecodeSurfaces = FOOTPRINT_DEFAULT_SURFACES;
+  info->CodecType           = codec;
+  info->ChromaFormat        = chroma_format;
+  info->bitDepthMinus8      = bit_depth - 8;
+  info->ulCreationFlags     = cudaVideoCreate_PreferCUVID;
+  info->ulMaxWidth          = info->ulWidth;
+  info->ulMaxHeight         = info->ulHeight;
+  info->display_area.right  = width;
+  info->display_area.bottom = height;
+  info->OutputFormat        = decode_output_surface(output_format_mask, bit_depth);
+  info->DeinterlaceMode     = cudaVideoDeinterlaceMode_Weave;
+  info->ulTargetWidth       = width;
+  info->ulTargetHeight      = height;
+  info->ulNumOutputSurfaces = 1;
+}
+
+
+int nvvi_decode_footprint(const nvvi_footprint_options *opts, nvvi_footprint *fp)
+{
+  CUVIDDECODECAPS caps = { 0 };
+  CUVIDDECODECREATEINFO info;
+  int repeat = opts->repeat > 0 ? opts->repeat : FOOTPRINT_DEFAULT_REPEAT;
+  int64_t *bytes;
+  CUdevice dev;
+  CUcontext ctx;
+  int ret = 0;
+
+  if (footprint_enter(opts, NVVI_PROBE_DECODE, fp, &dev, &ctx) != 0) {
+    return -1;
+  }
+
+  caps.eCodecType = opts->codec;
+  caps.eChromaFormat = opts->chroma_format;
+  caps.nBitDepthMinus8 = opts->bit_depth - 8;
+  if (check_cu(cv->cuvidGetDecoderCaps(&caps), "cuvidGetDecoderCaps") != 0) {
+    query_leave(dev);
+    return -1;
+  }
+  if (!caps.bIsSupported ||
+      opts->width > caps.nMaxWidth || opts->height > caps.nMaxHeight ||
+      opts->width < caps.nMinWidth || opts->height < caps.nMinHeight) {
+    fp->status = -1;
+    snprintf(fp->error, sizeof(fp->error), "%s", caps.bIsSupported ? "size not supported" :
+             "not supported");
+    query_leave(dev);
+    return 0;
+  }
+
+  decode_create_info(&info, opts->codec, opts->chroma_format, opts->bit_depth,
+                     opts->width, opts->height, caps.nOutputFormatMask);
+  if (opts->decode_surfaces > 0) {
+    info.ulNumDecodeSurfaces = opts->decode_surfaces;
+  }
+  if (opts->output_surfaces > 0) {
+    info.ulNumOutputSurfaces = opts->output_surfaces;
+  }
+
+  bytes = calloc(repeat, sizeof(*bytes));
+  if (!bytes) {
+    query_leave(dev);
+    return -1;
+  }
+
+  uint64_t start = nvvi_trace_begin();
+  for (int i = 0; i < repeat && ret == 0; i++) {
+    CUvideodecoder decoder;
+    size_t before, total;
+    CUresult err;
+
+    if (check_cu(cu_ext.cuMemGetInfo(&before, &total), "cuMemGetInfo") != 0) {
+      ret = -1;
+      break;
+    }
+    err = cv->cuvidCreateDecoder(&decoder, &info);
+    if (err != CUDA_SUCCESS) {
+      const char *desc = NULL;
+      cu->cuGetErrorName(err, &desc);
+      fp->status = err;
+      snprintf(fp->error, sizeof(fp->error), "cuvidCreateDecoder: %s",
+               desc ? desc : "unknown error");
+      break;
+    }
+    ret = footprint_taken(before, &bytes[i]);
+    cv->cuvidDestroyDecoder(decoder);
+  }
+  nvvi_trace_end("decode footprint", opts->device, start);
+
+  if (ret == 0 && fp->status == 0) {
+    footprint_summarise(fp, bytes, repeat);
+  }
+  free(bytes);
+  query_leave(dev);
+
+  return ret;
+}
+
+
+static void footprint_encoder_close(footprint_encoder *e)
+{
+  if (!e->encoder) {
+    return;
+  }
+  for (int i = 0; i < e->buffers; i++) {
+    if (e->outputs[i]) {
+      nv_funcs.nvEncDestroyBitstreamBuffer(e->encoder, e->outputs[i]);
+    }
+    if (e->inputs[i]) {
+      nv_funcs.nvEncDestroyInputBuffer(e->encoder, e->inputs[i]);
+    }
+  }
+  nv_funcs.nvEncDestroyEncoder(e->encoder);
+}
+
+
+static NVENCSTATUS footprint_encoder_open(footprint_encoder *e, CUcontext ctx,
+                                          const nvvi_footprint_options *opts,
+                                          GUID codec, GUID preset, const char **func)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  NV_ENC_PRESET_CONFIG config = { 0 };
+  NV_ENC_INITIALIZE_PARAMS init = { 0 };
+  NVENCSTATUS err;
+
+  memset(e, 0, sizeof(*e));
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = ctx;
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  *func = "nvEncOpenEncodeSessionEx";
+  err = nv_funcs.nvEncOpenEncodeSessionEx(&params, &e->encoder);
+  if (err != NV_ENC_SUCCESS) {
+    e->encoder = NULL;
+    return err;
+  }
+
+  config.version = NV_ENC_PRESET_CONFIG_VER;
+  config.presetCfg.version = NV_ENC_CONFIG_VER;
+#if NVENCAPI_MAJOR_VERSION > 10
+  NV_ENC_TUNING_INFO tuning = opts->tuning ? opts->tuning : NV_ENC_TUNING_INFO_HIGH_QUALITY;
+  *func = "nvEncGetEncodePresetConfigEx";
+  err = nv_funcs.nvEncGetEncodePresetConfigEx(e->encoder, codec, preset, tuning, &config);
+#else
+  *func = "nvEncGetEncodePresetConfig";
+  err = nv_funcs.nvEncGetEncodePresetConfig(e->encoder, codec, preset, &config);
+#endif
+  if (err != NV_ENC_SUCCESS) {
+    return err;
+  }
+
+  config.presetCfg.frameIntervalP = opts->b_frames + 1;
+  if (opts->lookahead > 0) {
+    config.presetCfg.rcParams.enableLookahead = 1;
+    config.presetCfg.rcParams.lookaheadDepth = opts->lookahead;
+  } else {
+    config.presetCfg.rcParams.enableLookahead = 0;
+    config.presetCfg.rcParams.lookaheadDepth = 0;
+  }
+
+  init.version      = NV_ENC_INITIALIZE_PARAMS_VER;
+  init.encodeGUID   = codec;
+  init.presetGUID   = preset;
+  init.encodeWidth  = opts->width;
+  init.encodeHeight = opts->height;
+  init.darWidth     = opts->width;
+  init.darHeight    = opts->height;
+  init.frameRateNum = 30;
+  init.frameRateDen = 1;
+  init.enablePTD    = 1;
+  init.encodeConfig = &config.presetCfg;
+#if NVENCAPI_MAJOR_VERSION > 10
+  init.tuningInfo   = tuning;
+#endif
+  *func = "nvEncInitializeEncoder";
+  err = nv_funcs.nvEncInitializeEncoder(e->encoder, &init);
+  if (err != NV_ENC_SUCCESS) {
+    return err;
+  }
+
+  e->buffers = opts->buffers > 0 ? opts->buffers : opts->b_frames + opts->lookahead + 1;
+  if (e->buffers > FOOTPRINT_MAX_BUFFERS) {
+    e->buffers = FOOTPRINT_MAX_BUFFERS;
+  }
+  for (int i = 0; i < e->buffers; i++) {
+    NV_ENC_CREATE_INPUT_BUFFER input = { 0 };
+    NV_ENC_CREATE_BITSTREAM_BUFFER output = { 0 };
+
+    input.version   = NV_ENC_CREATE_INPUT_BUFFER_VER;
+    input.width     = opts->width;
+    input.height    = opts->height;
+    input.bufferFmt = NV_ENC_BUFFER_FORMAT_NV12;
+    *func = "nvEncCreateInputBuffer";
+    err = nv_funcs.nvEncCreateInputBuffer(e->encoder, &input);
+    if (err != NV_ENC_SUCCESS) {
+      return err;
+    }
+    e->inputs[i] = input.inputBuffer;
+
+    output.version = NV_ENC_CREATE_BITSTREAM_BUFFER_VER;
+    *func = "nvEncCreateBitstreamBuffer";
+    err = nv_funcs.nvEncCreateBitstreamBuffer(e->encoder, &output);
+    if (err != NV_ENC_SUCCESS) {
+      return err;
+    }
+    e->outputs[i] = output.bitstreamBuffer;
+  }
+
+  return NV_ENC_SUCCESS;
+}
+
+
+/* Settings the encoder doesn't take set status -1 instead of costing a driver error */
+static void footprint_encode_check(CUcontext ctx, const nvvi_footprint_options *opts,
+                                   GUID codec, nvvi_footprint *fp)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  const char *reason = NULL;
+  void *encoder;
+
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = ctx;
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  if (nv_funcs.nvEncOpenEncodeSessionEx(&params, &encoder) != NV_ENC_SUCCESS) {
+    /* The measurement will say why */
+    return;
+  }
+
+  if ((int)opts->width > get_cap(encoder, &codec, NV_ENC_CAPS_WIDTH_MAX) ||
+      (int)opts->height > get_cap(encoder, &codec, NV_ENC_CAPS_HEIGHT_MAX)) {
+    reason = "size not supported";
+  } else if (opts->b_frames > get_cap(encoder, &codec, NV_ENC_CAPS_NUM_MAX_BFRAMES)) {
+    reason = "B-frames not supported";
+  } else if (opts->lookahead > 0 && get_cap(encoder, &codec, NV_ENC_CAPS_SUPPORT_LOOKAHEAD) <= 0) {
+    reason = "lookahead not supported";
+  }
+  nv_funcs.nvEncDestroyEncoder(encoder);
+
+  if (reason) {
+    fp->status = -1;
+    snprintf(fp->error, sizeof(fp->error), "%s", reason);
+  }
+}
+
+
+int nvvi_encode_footprint(const nvvi_footprint_options *opts, nvvi_footprint *fp)
+{
+  const GUID *codec = encode_codec_guid(opts->codec);
+  int repeat = opts->repeat > 0 ? opts->repeat : FOOTPRINT_DEFAULT_REPEAT;
+  footprint_encoder *e;
+  int64_t *bytes;
+  GUID preset = bench_preset(&opts->preset);
+  CUdevice dev;
+  CUcontext ctx;
+  int ret = 0;
+
+  if (!codec) {
+    memset(fp, 0, sizeof(*fp));
+    return -1;
+  }
+
+  if (footprint_enter(opts, NVVI_PROBE_ENCODE, fp, &dev, &ctx) != 0) {
+    return -1;
+  }
+  footprint_encode_check(ctx, opts, *codec, fp);
+  if (fp->status != 0) {
+    query_leave(dev);
+    return 0;
+  }
+
+  bytes = calloc(repeat, sizeof(*bytes));
+  e = calloc(1, sizeof(*e));
+  if (!bytes || !e) {
+    free(bytes);
+    free(e);
+    query_leave(dev);
+    return -1;
+  }
+
+  uint64_t start = nvvi_trace_begin();
+  for (int i = 0; i < repeat && ret == 0; i++) {
+    size_t before, total;
+    const char *func;
+    NVENCSTATUS err;
+
+    if (check_cu(cu_ext.cuMemGetInfo(&before, &total), "cuMemGetInfo") != 0) {
+      ret = -1;
+      break;
+    }
+    err = footprint_encoder_open(e, ctx, opts, *codec, preset, &func);
+    if (err != NV_ENC_SUCCESS) {
+      const char *desc;
+      nvenc_map_error(err, &desc);
+      fp->status = err;
+      snprintf(fp->error, sizeof(fp->error), "%s: %s", func, desc);
+      footprint_encoder_close(e);
+      break;
+    }
+    ret = footprint_taken(before, &bytes[i]);
+    footprint_encoder_close(e);
+  }
+  nvvi_trace_end("encode footprint", opts->device, start);
+
+  if (ret == 0 && fp->status == 0) {
+    footprint_summarise(fp, bytes, repeat);
+  }
+  free(bytes);
+  free(e);
+  query_leave(dev);
+
+  return ret;
+}
+
+
+/*
+ * Capability verification. The caps say what the driver would accept;
+ * creating a session at each advertised limit on an idle context is the
+ * only way to know it really does. Sessions are created one at a time,
+ * so this proves the limit, not how it behaves next to other sessions.
+ */
+
+#define VERIFY_FEATURE_WIDTH  1920
+#define VERIFY_FEATURE_HEIGHT 1080
+
+/* Height fitting max_mb_count at width, or height itself if it already does */
+static unsigned int verify_fit_height(unsigned int width, unsigned int height,
+                                      unsigned int max_mb_count)
+{
+  unsigned int mbs_wide = (width + 15) / 16;
+
+  if (max_mb_count == 0 || mbs_wide == 0) {
+    return height;
+  }
+  if ((height + 15) / 16 * mbs_wide <= max_mb_count) {
+    return height;
+  }
+  return max_mb_count / mbs_wide * 16;
+}
+
+
+static void verify_record(nvvi_verify_result *result, int status, double ms)
+{
+  if (status != 0) {
+    if (result->result != NVVI_VERIFY_FAIL) {
+      result->status = status;
+    }
+    result->result = NVVI_VERIFY_FAIL;
+  } else if (result->result == NVVI_VERIFY_UNTESTED) {
+    result->result = NVVI_VERIFY_PASS;
+  }
+  if (ms > result->create_ms) {
+    result->create_ms = ms;
+  }
+}
+
+
+static CUresult verify_decoder(const nvvi_decode_caps *caps, unsigned int width,
+                               unsigned int height, double *ms)
+{
+  CUVIDDECODECREATEINFO info;
+  CUvideodecoder decoder;
+  CUresult err;
+
+  decode_create_info(&info, caps->codec, caps->chroma_format, caps->bit_depth,
+                     width, height, caps->output_format_mask);
+  uint64_t start = bench_now();
+  err = cv->cuvidCreateDecoder(&decoder, &info);
+  *ms = (bench_now() - start) / 1e6;
+  if (err == CUDA_SUCCESS) {
+    cv->cuvidDestroyDecoder(decoder);
+  }
+  return err;
+}
+
+
+static void verify_decode(nvvi_decode_caps *caps)
+{
+  unsigned int sizes[3][2] = {
+    { caps->min_width, caps->min_height },
+    { caps->max_width, verify_fit_height(caps->max_width, caps->max_height, caps->max_mb_count) },
+    { verify_fit_height(caps->max_height, caps->max_width, caps->max_mb_count), caps->max_height },
+  };
+
+  memset(&caps->verify, 0, sizeof(caps->verify));
+  for (int i = 0; i < 3; i++) {
+    double ms;
+
+    if (sizes[i][0] == 0 || sizes[i][1] == 0 ||
+        (i == 2 && sizes[2][0] == sizes[1][0] && sizes[2][1] == sizes[1][1])) {
+      continue;
+    }
+    CUresult err = verify_decoder(caps, sizes[i][0], sizes[i][1], &ms);
+    verify_record(&caps->verify, err, ms);
+  }
+}
+
+
+/* Apply one verification kind to a preset configuration, false if the API can't express it */
+static int verify_encode_config(NV_ENC_CONFIG *config, GUID codec, int kind)
+{
+  int h264 = memcmp(&codec, &NV_ENC_CODEC_H264_GUID, sizeof(codec)) == 0;
+  int hevc = memcmp(&codec, &NV_ENC_CODEC_HEVC_GUID, sizeof(codec)) == 0;
+
+  switch (kind) {
+  case NVVI_VERIFY_YUV444:
+    if (h264) {
+      config->profileGUID = NV_ENC_H264_PROFILE_HIGH_444_GUID;
+      config->encodeCodecConfig.h264Config.chromaFormatIDC = 3;
+    } else if (hevc) {
+      config->profileGUID = NV_ENC_HEVC_PROFILE_FREXT_GUID;
+      config->encodeCodecConfig.hevcConfig.chromaFormatIDC = 3;
+    } else {
+      return 0;
+    }
+    return 1;
+  case NVVI_VERIFY_10BIT:
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
+    if (h264) {
+      config->encodeCodecConfig.h264Config.inputBitDepth = NV_ENC_BIT_DEPTH_10;
+      config->encodeCodecConfig.h264Config.outputBitDepth = NV_ENC_BIT_DEPTH_10;
+    } else if (hevc) {
+      config->profileGUID = NV_ENC_HEVC_PROFILE_MAIN10_GUID;
+      config->encodeCodecConfig.hevcConfig.inputBitDepth = NV_ENC_BIT_DEPTH_10;
+      config->encodeCodecConfig.hevcConfig.outputBitDepth = NV_ENC_BIT_DEPTH_10;
+    } else {
+      config->encodeCodecConfig.av1Config.inputBitDepth = NV_ENC_BIT_DEPTH_10;
+      config->encodeCodecConfig.av1Config.outputBitDepth = NV_ENC_BIT_DEPTH_10;
+    }
+    return 1;
+#else
+    if (hevc) {
+      config->profileGUID = NV_ENC_HEVC_PROFILE_MAIN10_GUID;
+      config->encodeCodecConfig.hevcConfig.pixelBitDepthMinus8 = 2;
+      return 1;
+    }
+#if NVENCAPI_MAJOR_VERSION > 11 && NVDECAPI_MAJOR_VERSION > 10
+    if (memcmp(&codec, &NV_ENC_CODEC_AV1_GUID, sizeof(codec)) == 0) {
+      config->encodeCodecConfig.av1Config.pixelBitDepthMinus8 = 2;
+      return 1;
+    }
+#endif
+    /* 10-bit H.264 needs SDK 12.2 */
+    return 0;
+#endif
+  default:
+    return 1;
+  }
+}
+
+
+/*
+ * Create and initialise one encoder with the kind applied and record the
+ * outcome. A kind the API can't express for the codec is left untested.
+ */
+static void verify_encoder(CUcontext ctx, GUID codec, int kind, unsigned int width,
+                           unsigned int height, nvvi_verify_result *result)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  NV_ENC_PRESET_CONFIG config = { 0 };
+  NV_ENC_INITIALIZE_PARAMS init = { 0 };
+  void *encoder;
+  NVENCSTATUS err;
+  uint64_t start;
+#if NVENCAPI_MAJOR_VERSION > 10
+  GUID preset = NV_ENC_PRESET_P4_GUID;
+  NV_ENC_TUNING_INFO tuning = kind == NVVI_VERIFY_LOSSLESS ? NV_ENC_TUNING_INFO_LOSSLESS :
+                              NV_ENC_TUNING_INFO_HIGH_QUALITY;
+#else
+  GUID preset = kind == NVVI_VERIFY_LOSSLESS ? NV_ENC_PRESET_LOSSLESS_DEFAULT_GUID :
+                NV_ENC_PRESET_DEFAULT_GUID;
+#endif
+
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = ctx;
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  start = bench_now();
+  err = nv_funcs.nvEncOpenEncodeSessionEx(&params, &encoder);
+  if (err != NV_ENC_SUCCESS) {
+    verify_record(result, err, 0);
+    return;
+  }
+
+  config.version = NV_ENC_PRESET_CONFIG_VER;
+  config.presetCfg.version = NV_ENC_CONFIG_VER;
+#if NVENCAPI_MAJOR_VERSION > 10
+  err = nv_funcs.nvEncGetEncodePresetConfigEx(encoder, codec, preset, tuning, &config);
+#else
+  err = nv_funcs.nvEncGetEncodePresetConfig(encoder, codec, preset, &config);
+#endif
+  if (err == NV_ENC_SUCCESS) {
+    if (!verify_encode_config(&config.presetCfg, codec, kind)) {
+      nv_funcs.nvEncDestroyEncoder(encoder);
+      return;
+    }
+
+    init.version      = NV_ENC_INITIALIZE_PARAMS_VER;
+    init.encodeGUID   = codec;
+    init.presetGUID   = preset;
+    init.encodeWidth  = width;
+    init.encodeHeight = height;
+    init.darWidth     = width;
+    init.darHeight    = height;
+    init.frameRateNum = 30;
+    init.frameRateDen = 1;
+    init.enablePTD    = 1;
+    init.encodeConfig = &config.presetCfg;
+#if NVENCAPI_MAJOR_VERSION > 10
+    init.tuningInfo   = tuning;
+#endif
+    err = nv_funcs.nvEncInitializeEncoder(encoder, &init);
+  }
+  double ms = (bench_now() - start) / 1e6;
+  nv_funcs.nvEncDestroyEncoder(encoder);
+
+  verify_record(result, err, ms);
+}
+
+
+static void verify_encode(CUcontext ctx, nvvi_encode_codec *codec)
+{
+  static const int feature_caps[NVVI_VERIFY_KINDS] = {
+    [NVVI_VERIFY_YUV444]   = NV_ENC_CAPS_SUPPORT_YUV444_ENCODE,
+    [NVVI_VERIFY_10BIT]    = NV_ENC_CAPS_SUPPORT_10BIT_ENCODE,
+    [NVVI_VERIFY_LOSSLESS] = NV_ENC_CAPS_SUPPORT_LOSSLESS_ENCODE,
+  };
+  unsigned int max_w = codec->caps[NV_ENC_CAPS_WIDTH_MAX] > 0 ? codec->caps[NV_ENC_CAPS_WIDTH_MAX] : 0;
+  unsigned int max_h = codec->caps[NV_ENC_CAPS_HEIGHT_MAX] > 0 ? codec->caps[NV_ENC_CAPS_HEIGHT_MAX] : 0;
+  unsigned int max_mbs = codec->caps[NV_ENC_CAPS_MB_NUM_MAX] > 0 ? codec->caps[NV_ENC_CAPS_MB_NUM_MAX] : 0;
+  GUID guid;
+
+  memcpy(&guid, &codec->guid, sizeof(guid));
+  memset(codec->verify, 0, sizeof(codec->verify));
+  if (max_w == 0 || max_h == 0) {
+    return;
+  }
+  max_h = verify_fit_height(max_w, max_h, max_mbs);
+
+  for (int kind = 0; kind < NVVI_VERIFY_KINDS; kind++) {
+    unsigned int w = max_w, h = max_h;
+
+    if (kind != NVVI_VERIFY_MAX_SIZE) {
+      if (codec->caps[feature_caps[kind]] <= 0) {
+        continue;
+      }
+      if (w > VERIFY_FEATURE_WIDTH || h > VERIFY_FEATURE_HEIGHT) {
+        w = VERIFY_FEATURE_WIDTH;
+        h = VERIFY_FEATURE_HEIGHT;
+      }
+    }
+    verify_encoder(ctx, guid, kind, w, h, &codec->verify[kind]);
+  }
+}
+
+
+/*
+ * Verify one device of a snapshot whose libraries are loaded. A device
+ * neither of whose probes succeeded is skipped before its context is
+ * touched, so a wedged GPU the probe gave up on can't block verification.
+ */
+static void verify_device(nvvi_snapshot *snap, nvvi_device *device)
+{
+  int decode = (snap->flags & NVVI_PROBE_DECODE) && device->decode_status == 0;
+  int encode = (snap->flags & NVVI_PROBE_ENCODE) && device->encode_status == 0;
+  CUdevice dev;
+  CUcontext ctx;
+
+  if (!decode && !encode) {
+    return;
+  }
+  if (query_enter(device->index, &dev, &ctx) != 0) {
+    return;
+  }
+
+  if (decode) {
+    uint64_t start = nvvi_trace_begin();
+    for (int j = 0; j < device->num_decode_caps; j++) {
+      verify_decode(&device->decode_caps[j]);
+    }
+    nvvi_trace_end("verify decode", device->index, start);
+  }
+
+  if (encode) {
+    uint64_t start = nvvi_trace_begin();
+    for (int j = 0; j < device->num_encode_codecs; j++) {
+      verify_encode(ctx, &device->encode_codecs[j]);
+    }
+    nvvi_trace_end("verify encode", device->index, start);
+  }
+
+  query_leave(dev);
+}
+
+
+int nvvi_verify_device(nvvi_snapshot *snap, int index)
+{
+  if (index < 0 || index >= snap->num_devices) {
+    return -1;
+  }
+  if (load_libraries(snap->flags) != 0) {
+    return -1;
+  }
+
+  verify_device(snap, &snap->devices[index]);
+  return 0;
+}
+
+
+int nvvi_verify(nvvi_snapshot *snap)
+{
+  if (load_libraries(snap->flags) != 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    verify_device(snap, &snap->devices[i]);
+  }
+
+  snap->flags |= NVVI_PROBE_VERIFY;
+  return 0;
+}
+
+
+/*
+ * Preset configurations. Presets only name a configuration, so expand
+ * each one, per tuning info where the API has them, on a bare session:
+ * nvEncGetEncodePresetConfig(Ex) needs no initialised encoder.
+ */
+
+static void preset_config_fill(nvvi_preset_config *c, int codec, const NV_ENC_CONFIG *config)
+{
+  const NV_ENC_RC_PARAMS *rc = &config->rcParams;
+
+  c->rc_mode = rc->rateControlMode;
+  c->average_bitrate = rc->averageBitRate;
+  c->max_bitrate = rc->maxBitRate;
+  c->vbv_buffer_size = rc->vbvBufferSize;
+  c->qp_intra = rc->constQP.qpIntra;
+  c->qp_inter_p = rc->constQP.qpInterP;
+  c->qp_inter_b = rc->constQP.qpInterB;
+
+  c->gop_length = config->gopLength;
+  c->b_frames = config->frameIntervalP > 0 ? config->frameIntervalP - 1 : 0;
+  c->lookahead = rc->enableLookahead ? rc->lookaheadDepth : 0;
+#if NVENCAPI_MAJOR_VERSION > 10
+  c->multipass = rc->multiPass;
+#endif
+  c->spatial_aq = rc->enableAQ;
+  c->aq_strength = rc->aqStrength;
+  c->temporal_aq = rc->enableTemporalAQ;
+  c->zero_reorder_delay = rc->zeroReorderDelay;
+
+  switch (codec) {
+  case cudaVideoCodec_H264:
+    c->ref_frames = config->encodeCodecConfig.h264Config.maxNumRefFrames;
+    c->b_ref_mode = config->encodeCodecConfig.h264Config.useBFramesAsRef;
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
+    c->temporal_filter = config->encodeCodecConfig.h264Config.tfLevel;
+#endif
+    break;
+  case cudaVideoCodec_HEVC:
+    c->ref_frames = config->encodeCodecConfig.hevcConfig.maxNumRefFramesInDPB;
+    c->b_ref_mode = config->encodeCodecConfig.hevcConfig.useBFramesAsRef;
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION > 1)
+    c->temporal_filter = config->encodeCodecConfig.hevcConfig.tfLevel;
+#endif
+    break;
+#if NVENCAPI_MAJOR_VERSION > 11 && NVDECAPI_MAJOR_VERSION > 10
+  case cudaVideoCodec_AV1:
+    c->ref_frames = config->encodeCodecConfig.av1Config.maxNumRefFramesInDPB;
+    c->b_ref_mode = config->encodeCodecConfig.av1Config.useBFramesAsRef;
+    break;
+#endif
+  }
+}
+
+
+static int preset_config_query(void *encoder, int codec, GUID codec_guid,
+                               nvvi_preset_config *configs, int max)
+{
+  GUID presets[NVVI_MAX_PRESETS];
+  uint32_t num_presets = 0;
+  int count = 0;
+
+  CHECK_NV(nv_funcs.nvEncGetEncodePresetGUIDs(encoder, codec_guid, presets,
+                                              NVVI_MAX_PRESETS, &num_presets));
+
+#if NVENCAPI_MAJOR_VERSION > 10
+  int num_tunings = MIN(NV_ENC_TUNING_INFO_COUNT - 1, NVVI_MAX_TUNINGS);
+#else
+  int num_tunings = 1;
+#endif
+
+  for (uint32_t i = 0; i < num_presets; i++) {
+    const char *desc = "Unknown";
+    for (int j = 0; j < FF_ARRAY_ELEMS(nvenc_presets); j++) {
+      if (memcmp(&presets[i], nvenc_presets[j].guid, sizeof (GUID)) == 0) {
+        desc = nvenc_presets[j].desc;
+      }
+    }
+
+    for (int t = 0; t < num_tunings && count < max; t++) {
+      nvvi_preset_config *c = &configs[count++];
+      NV_ENC_PRESET_CONFIG config = { 0 };
+
+      memset(c, 0, sizeof(*c));
+      memcpy(&c->preset, &presets[i], sizeof (GUID));
+      copy_name(c->preset_name, desc);
+
+      config.version = NV_ENC_PRESET_CONFIG_VER;
+      config.presetCfg.version = NV_ENC_CONFIG_VER;
+#if NVENCAPI_MAJOR_VERSION > 10
+      c->tuning = NV_ENC_TUNING_INFO_HIGH_QUALITY + t;
+      c->status = nv_funcs.nvEncGetEncodePresetConfigEx(encoder, codec_guid, presets[i],
+                                                        c->tuning, &config);
+#else
+      c->status = nv_funcs.nvEncGetEncodePresetConfig(encoder, codec_guid, presets[i], &config);
+#endif
+      if (c->status == NV_ENC_SUCCESS) {
+        preset_config_fill(c, codec, &config.presetCfg);
+      }
+    }
+  }
+
+  return count;
+}
+
+
+int nvvi_preset_configs(int device, int codec, nvvi_preset_config *configs, int max)
+{
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = { 0 };
+  const GUID *guid = encode_codec_guid(codec);
+  void *encoder;
+  CUdevice dev;
+  CUcontext ctx;
+
+  if (!guid) {
+    return -1;
+  }
+  if (load_libraries(NVVI_PROBE_ENCODE) != 0 || query_enter(device, &dev, &ctx) != 0) {
+    return -1;
+  }
+
+  uint64_t start = nvvi_trace_begin();
+  params.version    = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  params.apiVersion = NVENCAPI_VERSION;
+  params.device     = ctx;
+  params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  if (check_nv(nv_funcs.nvEncOpenEncodeSessionEx(&params, &encoder),
+               "nvEncOpenEncodeSessionEx") != 0) {
+    query_leave(dev);
+    return -1;
+  }
+
+  int ret = preset_config_query(encoder, codec, *guid, configs, max);
+  nv_funcs.nvEncDestroyEncoder(encoder);
+  nvvi_trace_end("preset configs", device, start);
+  query_leave(dev);
+
+  return ret;
+}
+
+
+int nvvi_probe_ex(nvvi_snapshot *snap, const nvvi_probe_options *opts)
+{
+  nvvi_probe_options probe = *opts;
+  int ret;
+
+  /* Verification results are never cached, so look up what the probe itself has */
+  probe.flags &= ~NVVI_PROBE_VERIFY;
+  if (opts->timeout_ms > 0) {
+    /* Verifies in the children too */
+    ret = nvvi_isolated_probe(snap, opts);
+  } else {
+    if (probe.cache_path) {
+      ret = nvvi_cache_probe(snap, &probe);
+    } else {
+      ret = nvvi_probe_devices(snap, &probe, NULL, NULL);
+    }
+    if (ret == 0 && (opts->flags & NVVI_PROBE_VERIFY)) {
+      ret = nvvi_verify(snap);
+    }
+  }
+
+  if (ret == 0) {
+    for (int i = 0; i < snap->num_devices; i++) {
+      nvvi_read_topology(opts->sysfs_root, &snap->devices[i]);
+    }
+  }
+  return ret;
+}
+
+
+int nvvi_probe(nvvi_snapshot *snap, unsigned int flags)
+{
+  nvvi_probe_options opts = {
+    .flags = flags,
+    .threads = 1,
+  };
+
+  return nvvi_probe_ex(snap, &opts);
+}
+
+
+void nvvi_snapshot_free(nvvi_snapshot *snap)
+{
+  free(snap->devices);
+  snap->devices = NULL;
+  snap->num_devices = 0;
+}
+
+
+const char *nvvi_decode_codec_name(int codec)
+{
+  switch (codec) {
+  case cudaVideoCodec_MPEG1:
+    return "MPEG1";
+  case cudaVideoCodec_MPEG2:
+    return "MPEG2";
+  case cudaVideoCodec_MPEG4:
+    return "MPEG4";
+  case cudaVideoCodec_VC1:
+    return "VC1";
+  case cudaVideoCodec_H264:
+    return "H264";
+  case cudaVideoCodec_JPEG:
+    return "MJPEG";
+  case cudaVideoCodec_H264_SVC:
+    return "H264 SVC";
+  case cudaVideoCodec_H264_MVC:
+    return "H264 MVC";
+  case cudaVideoCodec_HEVC:
+    return "HEVC";
+  case cudaVideoCodec_VP8:
+    return "VP8";
+  case cudaVideoCodec_VP9:
+    return "VP9";
+#if NVDECAPI_MAJOR_VERSION > 10
+  case cudaVideoCodec_AV1:
+    return "AV1";
+#endif
+  default:
+    return "Unknown";
+  }
+}
+
+
+const char *nvvi_chroma_format_name(int chroma_format)
+{
+  switch (chroma_format) {
+  case cudaVideoChromaFormat_Monochrome:
+    return "400";
+  case cudaVideoChromaFormat_420:
+    return "420";
+  case cudaVideoChromaFormat_422:
+    return "422";
+  case cudaVideoChromaFormat_444:
+    return "444";
+  default:
+    return "Unknown";
+  }
+}
+
+
+const char *nvvi_surface_format_name(int format)
+{
+  switch (format) {
+  case cudaVideoSurfaceFormat_NV12:
+    return "NV12";
+  case cudaVideoSurfaceFormat_P016:
+    return "P016";
+  case cudaVideoSurfaceFormat_YUV444:
+    return "YUV444P";
+  case cudaVideoSurfaceFormat_YUV444_16Bit:
+    return "YUV444P16";
+#if NVDECAPI_MAJOR_VERSION > 12
+  case cudaVideoSurfaceFormat_NV16:
+    return "NV16";
+  case cudaVideoSurfaceFormat_P216:
+    return "P216";
+#endif
+  default:
+    return "Unknown";
+  }
+}
+
+
+const char *nvvi_surface_formats_name(unsigned int mask)
+{
+  /* Every bit set, deepest first; bits this build has no name for by number */
+  static _Thread_local char buf[128];
+  size_t len = 0;
+
+  if (!mask) {
+    return "Unknown";
+  }
+  buf[0] = '\0';
+  for (int i = 31; i >= 0; i--) {
+    const char *name = nvvi_surface_format_name(i);
+
+    if (!(mask & (1u << i)) || len >= sizeof(buf)) {
+      continue;
+    }
+    if (strcmp(name, "Unknown") == 0) {
+      len += snprintf(buf + len, sizeof(buf) - len, "%sformat %d", len ? ", " : "", i);
+    } else {
+      len += snprintf(buf + len, sizeof(buf) - len, "%s%s", len ? ", " : "", name);
+    }
+  }
+  return buf;
+}
+
+
+static int name_lookup(const char *name, int max, const char *(*to_name)(int))
+{
+  for (int i = 0; i < max; i++) {
+    if (strcasecmp(name, to_name(i)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+int nvvi_decode_codec_from_name(const char *name)
+{
+  /* Accept the usual aliases as well as the names used in the tables */
+  if (strcasecmp(name, "h265") == 0) {
+    return cudaVideoCodec_HEVC;
+  } else if (strcasecmp(name, "jpeg") == 0) {
+    return cudaVideoCodec_JPEG;
+  }
+  return name_lookup(name, cudaVideoCodec_NumCodecs, nvvi_decode_codec_name);
+}
+
+
+int nvvi_chroma_format_from_name(const char *name)
+{
+  if (strcasecmp(name, "mono") == 0) {
+    return cudaVideoChromaFormat_Monochrome;
+  }
+  return name_lookup(name, cudaVideoChromaFormat_444 + 1, nvvi_chroma_format_name);
+}
+
+
+const char *nvvi_encode_format_name(uint32_t fmt)
+{
+  for (int i = 0; i < nvvi_num_encode_formats; i++) {
+    if (nvvi_encode_formats[i].fmt == fmt) {
+      return nvvi_encode_formats[i].desc;
+    }
+  }
+  return "Unknown";
+}
+
+
+uint32_t nvvi_encode_format_from_name(const char *name)
+{
+  for (int i = 0; i < nvvi_num_encode_formats; i++) {
+    if (strcasecmp(name, nvvi_encode_formats[i].desc) == 0) {
+      return nvvi_encode_formats[i].fmt;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,1029 @@
+/*
+ * libnvvideoinfo - query nvdec/nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NVVIDEOINFO_H
+#define NVVIDEOINFO_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * All structures below are plain data with fixed-size arrays, so a
+ * snapshot can be copied around with memcpy and needs no cleanup beyond
+ * nvvi_snapshot_free().
+ *
+ * Enumerated values (codec, chroma format, surface format bits, encoder
+ * capabilities and input buffer formats) use the numeric values from the
+ * nvidia headers, so callers that include ffnvcodec can compare them
+ * directly against cudaVideoCodec, NV_ENC_CAPS and friends.
+ */
+
+#define NVVI_MAX_DECODE_CAPS   256
+#define NVVI_MAX_ENCODE_CODECS 8
+#define NVVI_MAX_ENCODE_CAPS   96
+#define NVVI_MAX_PROFILES      32
+#define NVVI_MAX_PRESETS       32
+#define NVVI_NAME_LEN          32
+#define NVVI_UUID_LEN          48
+#define NVVI_BUS_ID_LEN        16
+#define NVVI_CPULIST_LEN       256
+#define NVVI_GUID_STRING_LEN   37
+
+enum {
+  NVVI_PROBE_DECODE = 1 << 0,
+  NVVI_PROBE_ENCODE = 1 << 1,
+  NVVI_PROBE_ALL    = NVVI_PROBE_DECODE | NVVI_PROBE_ENCODE,
+
+  /* Also run nvvi_verify(); set in snapshot flags once it has */
+  NVVI_PROBE_VERIFY = 1 << 2,
+};
+
+/* Layout compatible with the GUID type used by nvEncodeAPI.h */
+typedef struct {
+  uint32_t data1;
+  uint16_t data2;
+  uint16_t data3;
+  uint8_t  data4[8];
+} nvvi_guid;
+
+/* Outcome of creating a real session at an advertised limit, see nvvi_verify() */
+enum {
+  NVVI_VERIFY_UNTESTED,
+  NVVI_VERIFY_PASS,
+  NVVI_VERIFY_FAIL,
+};
+
+typedef struct {
+  int result;                   /* NVVI_VERIFY_* */
+  int status;                   /* CUresult or NVENCSTATUS that failed it */
+  double create_ms;             /* slowest creation, 0 if untested */
+} nvvi_verify_result;
+
+/* The encoder limits nvvi_verify() tries, indexing nvvi_encode_codec.verify */
+enum {
+  NVVI_VERIFY_MAX_SIZE,         /* NV_ENC_CAPS_WIDTH_MAX x NV_ENC_CAPS_HEIGHT_MAX */
+  NVVI_VERIFY_YUV444,
+  NVVI_VERIFY_10BIT,
+  NVVI_VERIFY_LOSSLESS,
+  NVVI_VERIFY_KINDS,
+};
+
+typedef struct {
+  int codec;                    /* cudaVideoCodec */
+  int chroma_format;            /* cudaVideoChromaFormat */
+  int bit_depth;
+  unsigned int min_width;
+  unsigned int min_height;
+  unsigned int max_width;
+  unsigned int max_height;
+  unsigned int max_mb_count;
+  unsigned int output_format_mask; /* 1 << cudaVideoSurfaceFormat */
+
+  nvvi_verify_result verify;    /* at the minimum and maximum size */
+} nvvi_decode_caps;
+
+typedef struct {
+  nvvi_guid guid;
+  char name[NVVI_NAME_LEN];
+} nvvi_named_guid;
+
+typedef struct {
+  nvvi_guid guid;
+  char name[NVVI_NAME_LEN];
+
+  /* Indexed by NV_ENC_CAPS. Only entries in the tables below are filled. */
+  int caps[NVVI_MAX_ENCODE_CAPS];
+
+  /* Bitwise OR of every NV_ENC_BUFFER_FORMAT accepted for this codec */
+  uint32_t input_formats;
+
+  int num_profiles;
+  nvvi_named_guid profiles[NVVI_MAX_PROFILES];
+
+  int num_presets;
+  nvvi_named_guid presets[NVVI_MAX_PRESETS];
+
+  nvvi_verify_result verify[NVVI_VERIFY_KINDS];
+} nvvi_encode_codec;
+
+/*
+ * Where a device sits, from sysfs. Workers that pin their threads and
+ * memory to the device's NUMA node keep frame copies and bitstream I/O off
+ * the interconnect. The current link may train down while the GPU idles.
+ */
+typedef struct {
+  int numa_node;                /* -1 if the platform doesn't say */
+  char local_cpus[NVVI_CPULIST_LEN]; /* CPU list, e.g. "0-15,32-47"; empty if unknown */
+  int link_gen;                 /* PCIe generation, 0 if unknown */
+  int link_width;               /* lanes, 0 if unknown */
+  int max_link_gen;
+  int max_link_width;
+} nvvi_topology;
+
+/* How the probe of a device ended, see nvvi_probe_options.timeout_ms */
+enum {
+  NVVI_DEVICE_PROBED,
+  NVVI_DEVICE_ABORTED,          /* its probe process died without an answer */
+  NVVI_DEVICE_TIMED_OUT,        /* and was killed at the deadline */
+};
+
+typedef struct {
+  int index;
+  char name[256];
+
+  /* "GPU-xxxxxxxx-..." and "dddd:bb:dd.f"; empty if the driver can't tell */
+  char uuid[NVVI_UUID_LEN];
+  char pci_bus_id[NVVI_BUS_ID_LEN];
+
+  /* Read afresh on every probe, also when the rest comes from the cache */
+  nvvi_topology topology;
+
+  /* 0 on success, negative if the decode/encode half could not be probed */
+  int decode_status;
+  int encode_status;
+
+  /* NVVI_DEVICE_*, and how long an isolated probe took; 0 if not isolated */
+  int probe_status;
+  double probe_ms;
+
+  int num_decode_caps;
+  nvvi_decode_caps decode_caps[NVVI_MAX_DECODE_CAPS];
+
+  int num_encode_codecs;
+  nvvi_encode_codec encode_codecs[NVVI_MAX_ENCODE_CODECS];
+} nvvi_device;
+
+typedef struct {
+  unsigned int flags;
+
+  /* NvEncodeAPIGetMaxSupportedVersion(), as (major << 4 | minor) */
+  uint32_t nvenc_max_version;
+
+  /* Kernel driver version, e.g. "550.54.14" */
+  char driver_version[32];
+
+  int num_devices;
+  nvvi_device *devices;
+} nvvi_snapshot;
+
+typedef struct {
+  int cap;                      /* NV_ENC_CAPS */
+  const char *desc;
+  const char *name;             /* the NV_ENC_CAPS_ suffix in lower case, e.g. "width_max" */
+} nvvi_cap_desc;
+
+typedef struct {
+  uint32_t fmt;                 /* NV_ENC_BUFFER_FORMAT */
+  const char *desc;
+} nvvi_format_desc;
+
+/*
+ * The encoder capabilities are split into numeric limits and feature
+ * flags. Both tables list exactly the entries that nvvi_probe() fills in
+ * nvvi_encode_codec.caps, in display order.
+ */
+extern const nvvi_cap_desc nvvi_encode_limits[];
+extern const int nvvi_num_encode_limits;
+extern const nvvi_cap_desc nvvi_encode_caps[];
+extern const int nvvi_num_encode_caps;
+extern const nvvi_format_desc nvvi_encode_formats[];
+extern const int nvvi_num_encode_formats;
+
+/*
+ * Load the driver libraries, initialise CUDA and probe every device in a
+ * single pass. The driver libraries stay loaded after the first call, so
+ * repeated probes only pay for the device queries themselves.
+ *
+ * Returns 0 on success. Per-device failures are reported through the
+ * decode_status/encode_status fields rather than the return value.
+ */
+int nvvi_probe(nvvi_snapshot *snap, unsigned int flags);
+
+typedef struct {
+  unsigned int flags;
+
+  /*
+   * Number of worker threads. Workers share the primary context of each
+   * device, retained once per probe, and the decoder sweep of each device
+   * is split across workers per codec. 1 probes serially on the calling
+   * thread, 0 uses one worker per online CPU. Results are always merged
+   * back in device order, so the snapshot does not depend on this value.
+   */
+  int threads;
+
+  /*
+   * Optional path of a persistent capability cache. Entries are keyed by
+   * GPU UUID, PCI bus id, driver version and the NVENC/NVDEC API versions
+   * this library was built against. When every GPU on the system hits,
+   * the snapshot is answered from the cache without loading CUDA at all;
+   * otherwise only the devices that missed are probed and the cache is
+   * rewritten.
+   */
+  const char *cache_path;
+
+  /*
+   * When positive, probe in child processes so a wedged GPU can't hang
+   * the caller: one lists the devices, then one per device probes it, and
+   * any that take longer than timeout_ms are killed. Devices that didn't
+   * answer are still listed, with probe_status saying why and both
+   * halves unprobed, so the whole probe takes at most about twice
+   * timeout_ms. The calling process never loads CUDA and cache_path is
+   * ignored.
+   */
+  int timeout_ms;
+
+  /* Where sysfs is mounted, for the topology; NULL for /sys */
+  const char *sysfs_root;
+} nvvi_probe_options;
+
+int nvvi_probe_ex(nvvi_snapshot *snap, const nvvi_probe_options *opts);
+
+/*
+ * Prove the limits of a snapshot by creating real sessions at them, so a
+ * scheduler can trust only what has actually worked (see
+ * nvvi_place_options.verified_only). The caps alone can promise sizes or
+ * formats that a session then refuses.
+ *
+ * - every decode row: cuvidCreateDecoder at its minimum size and at its
+ *   maximum width and height, each cut down to fit the maximum MB count
+ * - every encode codec: nvEncInitializeEncoder at the maximum size (cut
+ *   down to NV_ENC_CAPS_MB_NUM_MAX), and where the caps claim them, 4:4:4,
+ *   10-bit and lossless at 1920x1080 or the maximum size if smaller
+ *
+ * Each result records pass or fail, the error and the slowest creation.
+ * Sessions are created one at a time on an otherwise idle context, so a
+ * pass proves the limit holds, not that it holds next to other sessions.
+ * Returns -1 if the driver could not be used at all.
+ */
+int nvvi_verify(nvvi_snapshot *snap);
+
+void nvvi_snapshot_free(nvvi_snapshot *snap);
+
+/* Unload the driver libraries loaded by nvvi_probe() */
+void nvvi_unload(void);
+
+/*
+ * Save/load a snapshot as line oriented text. This is the format used to
+ * record a machine's answers for the fake driver, and to keep snapshots
+ * around for later comparison. Loading ignores lines it does not know.
+ */
+int nvvi_snapshot_save(const nvvi_snapshot *snap, FILE *f);
+int nvvi_snapshot_load(nvvi_snapshot *snap, FILE *f);
+
+/*
+ * Compare snapshot a (e.g. before a driver upgrade) with b, calling fn
+ * with every difference. Devices are paired by UUID, else by index. Only
+ * halves probed (and probed successfully) in a are compared, so a decode
+ * snapshot can be checked against a full one.
+ *
+ * Regressions are changes that take something away: a lower maximum
+ * (MB/s, sizes, engines, B-frames, lookahead level, nMaxMBCount) or a
+ * higher minimum, a feature cap that went down, bits gone from the rate
+ * control mask, a verification that now fails, and removed devices,
+ * decoder rows, encoders, presets, profiles and surface or input formats.
+ * Formats, like presets and profiles, get one entry each. Returns the
+ * number of regressions, or -1 on allocation failure.
+ */
+enum {
+  NVVI_DIFF_ADDED,
+  NVVI_DIFF_REMOVED,
+  NVVI_DIFF_CHANGED,
+};
+
+typedef struct {
+  int kind;                     /* NVVI_DIFF_* */
+  int regression;
+  int device;                   /* index in a (in b if added), -1 for the snapshot */
+  char name[256];               /* of the device */
+  char codec[NVVI_NAME_LEN];    /* encoder, empty for the device and decoders */
+  char item[96];                /* e.g. "mb_per_sec_max", "preset P4", "decode HEVC 4:2:0 8-bit max_mb_count" */
+  char from[64];                /* empty unless changed */
+  char to[64];
+} nvvi_diff_entry;
+
+typedef void (*nvvi_diff_fn)(const nvvi_diff_entry *entry, void *opaque);
+
+int nvvi_snapshot_diff(const nvvi_snapshot *a, const nvvi_snapshot *b,
+                       nvvi_diff_fn fn, void *opaque);
+
+/*
+ * Live encoder capacity sampling. NV_ENC_CAPS_DYNAMIC_QUERY_ENCODER_CAPACITY
+ * reports the percentage (0-100) of a device's encoder capacity that is
+ * still free for a codec, which depends on every other session on the GPU.
+ *
+ * nvvi_sampler_open() keeps one context and one encode session open per
+ * device of snap that has encode codecs, so each poll costs one caps query
+ * per codec and nothing else. snap must be an encode probe and must stay
+ * valid until the sampler is closed.
+ *
+ * nvvi_sampler_poll() fills capacity[i * NVVI_MAX_ENCODE_CODECS + j] for
+ * snap->devices[i].encode_codecs[j], with -1 for anything that couldn't be
+ * sampled. Returns -1 if any query failed.
+ */
+typedef struct nvvi_sampler nvvi_sampler;
+
+nvvi_sampler *nvvi_sampler_open(const nvvi_snapshot *snap);
+int nvvi_sampler_poll(nvvi_sampler *sampler, int *capacity);
+void nvvi_sampler_close(nvvi_sampler *sampler);
+
+/*
+ * Write snap as OpenMetrics text: device info, decoder size limits and
+ * encoder limits, caps and input formats, all as gauges labelled by device
+ * and codec. capacity, as filled by nvvi_sampler_poll(), adds the live
+ * encoder capacity; pass NULL to leave it out.
+ */
+int nvvi_metrics_write(const nvvi_snapshot *snap, const int *capacity, FILE *f);
+
+/*
+ * Shared-memory snapshot, so other processes can read the answers without
+ * probing or loading the driver. nvvi_shm_create() replaces any segment of
+ * the same name (shm_open(3), "/name"; the slash is optional) with one
+ * holding snap. nvvi_shm_update() republishes a snapshot with the same
+ * number of devices and/or the capacity from nvvi_sampler_poll(); either
+ * may be NULL. Capacity reads as -1 until first published.
+ *
+ * Readers never block the publisher: each read copies under a sequence
+ * counter and retries if a write overlapped it. The generation counts
+ * published snapshots, so a reader can tell when its copy went stale.
+ * Segments hold structs as laid out by this build and are only opened by
+ * the same build. nvvi_shm_read() allocates snap->devices; free it with
+ * nvvi_snapshot_free(). capacity, if given, holds
+ * NVVI_MAX_ENCODE_CODECS entries per device.
+ */
+typedef struct nvvi_shm nvvi_shm;
+
+nvvi_shm *nvvi_shm_create(const char *name, const nvvi_snapshot *snap);
+int nvvi_shm_update(nvvi_shm *shm, const nvvi_snapshot *snap, const int *capacity);
+nvvi_shm *nvvi_shm_open(const char *name);
+int nvvi_shm_num_devices(const nvvi_shm *shm);
+uint64_t nvvi_shm_generation(const nvvi_shm *shm);
+int nvvi_shm_read_device(const nvvi_shm *shm, int index, nvvi_device *device, int *capacity);
+int nvvi_shm_read(const nvvi_shm *shm, nvvi_snapshot *snap, int *capacity);
+/* Unmaps; the publisher also removes the segment if unlink is set */
+void nvvi_shm_close(nvvi_shm *shm, int unlink);
+
+/*
+ * Fleet capability index, for snapshots (e.g. --record files) collected
+ * from many hosts. Every device is reduced to its capability set: what the
+ * driver reports for it, under that driver version, without anything
+ * specific to the machine (ids, topology, timings). Each distinct set is
+ * stored once and a host is only a list of sets, so a fleet of identical
+ * machines costs one set and a few bytes per host.
+ *
+ * nvvi_fleet_add() adds a host or replaces what it had. An index is saved
+ * to and loaded from a directory: sets/<id> holds each set as a one device
+ * snapshot, hosts the list of sets of every host.
+ */
+typedef struct nvvi_fleet nvvi_fleet;
+
+nvvi_fleet *nvvi_fleet_new(void);
+void nvvi_fleet_free(nvvi_fleet *fleet);
+int nvvi_fleet_add(nvvi_fleet *fleet, const char *host, const nvvi_snapshot *snap);
+int nvvi_fleet_save(const nvvi_fleet *fleet, const char *dir);
+int nvvi_fleet_load(nvvi_fleet *fleet, const char *dir);
+
+void nvvi_fleet_stats(const nvvi_fleet *fleet, int *hosts, int *devices, int *sets);
+
+/*
+ * The sets of the index, including ones no host uses any more. Each is a
+ * snapshot of one device; id is what it is stored under.
+ */
+int nvvi_fleet_num_sets(const nvvi_fleet *fleet);
+const nvvi_snapshot *nvvi_fleet_set(const nvvi_fleet *fleet, int index, uint64_t *id,
+                                    int *hosts, int *devices);
+
+/*
+ * Queries are space separated terms that a device must all satisfy, and
+ * how many devices of a host have to:
+ *
+ *   decode=CODEC[:CHROMA[:DEPTH]]  decodes it, e.g. decode=hevc:444
+ *   encode=CODEC                   encodes it
+ *   CAP OP N                       encoder cap, named as in nvvi_cap_desc,
+ *                                  e.g. support_lookahead_level>=2
+ *   format=FORMAT                  encoder input format, e.g. format=P010
+ *   driver=VERSION, gpu=TEXT       driver version, text in the GPU name
+ *   devices OP N                   matching devices per host (default >=1)
+ *
+ * OP is one of = != < <= > >=. Cap and format terms qualify the encode=
+ * term before them, or any encoder if none came before, e.g.
+ * "encode=av1 support_10bit_encode=1 support_lookahead_level>=2" or
+ * "decode=hevc:444 devices>=2". Every set is tested once per query, and
+ * the matching hosts reported in index order with their device count.
+ */
+typedef struct nvvi_fleet_query nvvi_fleet_query;
+typedef void (*nvvi_fleet_match_fn)(const char *host, int devices, void *opaque);
+
+/* NULL on a syntax error, described in error */
+nvvi_fleet_query *nvvi_fleet_query_parse(const char *expr, char *error, size_t len);
+void nvvi_fleet_query_free(nvvi_fleet_query *q);
+
+/* Returns the number of matching hosts, or -1 on allocation failure */
+int nvvi_fleet_query_run(const nvvi_fleet *fleet, const nvvi_fleet_query *q,
+                         nvvi_fleet_match_fn fn, void *opaque);
+
+/*
+ * Targeted single-question queries, e.g. "does device 2 decode HEVC 4:2:0
+ * 10-bit at 7680x4320" or "does device 0 encode AV1 from P010". Only the
+ * library and the driver calls needed for the answer are used, so this is
+ * far cheaper than a probe.
+ */
+typedef struct {
+  int device;                   /* CUDA device ordinal */
+  int encode;                   /* 0 asks about decoding, 1 about encoding */
+  int codec;                    /* cudaVideoCodec; encode knows H264, HEVC and AV1 */
+  int chroma_format;            /* cudaVideoChromaFormat */
+  int bit_depth;
+
+  /* 0x0 skips the size check */
+  unsigned int width;
+  unsigned int height;
+
+  /* Encode only: NV_ENC_BUFFER_FORMAT the frames arrive in, 0 for any */
+  uint32_t input_format;
+} nvvi_query;
+
+enum {
+  NVVI_QUERY_YES   = 0,
+  NVVI_QUERY_NO    = 1,
+  NVVI_QUERY_ERROR = 2,
+};
+
+/*
+ * Returns one of NVVI_QUERY_*, chosen to be usable as a process exit
+ * status. If detail is not NULL it receives a one-line explanation: the
+ * relevant limits on YES, the failed requirement on NO.
+ */
+int nvvi_query_run(const nvvi_query *query, char *detail, size_t len);
+
+/*
+ * Encoder session scaling benchmark. One step sets up a number of encode
+ * sessions on a device, one after the other, and then has every session
+ * encode the same synthetic NV12 clip concurrently from its own thread.
+ * Sweeping the session count shows both the throughput curve and the
+ * point where the driver stops handing out sessions.
+ */
+typedef struct {
+  int device;                   /* CUDA device ordinal */
+  int codec;                    /* cudaVideoCodec: H264, HEVC or AV1 */
+
+  /* All zero for the default preset (P4 where the driver has it) */
+  nvvi_guid preset;
+
+  /* 0x0 means 1920x1080 */
+  unsigned int width;
+  unsigned int height;
+
+  int frames;                   /* per session, 0 means 300 */
+} nvvi_bench_options;
+
+typedef struct {
+  int sessions;                 /* sessions asked for */
+
+  /*
+   * Sessions that were set up. If this is short of sessions, status is
+   * the NVENCSTATUS that refused the next one, error says which call
+   * failed, and nothing was encoded.
+   */
+  int opened;
+  int status;
+  char error[64];
+
+  int frames;                   /* encoded over all sessions */
+  double fps;                   /* aggregate over the wall time of the step */
+  double session_fps_min;
+  double session_fps_max;
+
+  /* Per frame, from locking the input buffer to the bitstream being ready */
+  double latency_p50_ms;
+  double latency_p95_ms;
+  double latency_p99_ms;
+  double latency_max_ms;
+} nvvi_bench_step;
+
+/*
+ * Run one step with the given number of sessions. Returns 0 if the step
+ * ran, including when the driver refused a session, and -1 if the device
+ * could not be used at all or encoding failed.
+ */
+int nvvi_bench_run(const nvvi_bench_options *opts, int sessions, nvvi_bench_step *step);
+
+/*
+ * Decoder scaling benchmark, the decode side of nvvi_bench_run(). One step
+ * creates a number of decoders on a device, each with its own parser, and
+ * then has each decode the same synthetic stream from its own thread.
+ *
+ * The stream is generated at run time, see nvvi_decode_bench_supported()
+ * for what can be. Pictures are flat predicted blocks with no residual:
+ * H.264 and HEVC have an IDR every 30 frames and skipped P frames in
+ * between, AV1 is all key frames. It measures how fast the decoders
+ * reconstruct pictures of a size, not how fast they parse real content,
+ * so take it as an upper bound.
+ */
+typedef struct {
+  int device;                   /* CUDA device ordinal */
+  int codec;                    /* cudaVideoCodec, always 4:2:0 */
+  int bit_depth;                /* 0 means 8 */
+
+  /* 0x0 means 1920x1080; both must be even */
+  unsigned int width;
+  unsigned int height;
+
+  int frames;                   /* per decoder, 0 means 300 */
+} nvvi_decode_bench_options;
+
+typedef struct {
+  int sessions;                 /* decoders asked for */
+
+  /*
+   * Decoders that were set up. If this is short of sessions, status is
+   * the CUresult that refused the next one, error says which call failed,
+   * and nothing was decoded. error is also set if the device doesn't
+   * decode the stream at all.
+   */
+  int opened;
+  int status;
+  char error[64];
+
+  /* From cuvidGetDecoderCaps; nvdecs is 0 where the driver doesn't say */
+  int nvdecs;
+  unsigned int max_mb_count;
+
+  int frames;                   /* decoded over all decoders */
+  double fps;                   /* aggregate over the wall time of the step */
+  double mb_per_sec;            /* fps in macroblocks */
+  double session_fps_min;
+  double session_fps_max;
+
+  /* Per frame, from handing the access unit to the parser to the decoded frame being mapped */
+  double latency_p50_ms;
+  double latency_p95_ms;
+  double latency_p99_ms;
+  double latency_max_ms;
+} nvvi_decode_bench_step;
+
+/*
+ * Non-zero if a stream can be generated for codec, chroma format and bit
+ * depth: 4:2:0 H.264 at 8 bits, HEVC and AV1 at 8 or 10 bits.
+ */
+int nvvi_decode_bench_supported(int codec, int chroma_format, int bit_depth);
+
+/* Same return convention as nvvi_bench_run() */
+int nvvi_decode_bench_run(const nvvi_decode_bench_options *opts, int sessions,
+                          nvvi_decode_bench_step *step);
+
+/*
+ * Transcode latency probe. One decoder and one encode session share the
+ * device's primary context: each frame of the synthetic stream of
+ * nvvi_decode_bench_run() is decoded, handed to the encoder and encoded
+ * (IPPP, low latency tuning) before the next access unit is parsed, so a
+ * frame's latency is its own and never time spent queued behind another.
+ *
+ * With zero_copy the frame cuvidMapVideoFrame returns is registered with
+ * nvEncRegisterResource as a CUDA device pointer, once per distinct
+ * pointer, and mapped with nvEncMapInputResource as the encoder's input.
+ * Otherwise it is copied through host memory into an nvEncCreateInputBuffer
+ * buffer, the way a pipeline that doesn't share surfaces does it.
+ */
+typedef struct {
+  int device;                   /* CUDA device ordinal */
+  int decode_codec;             /* cudaVideoCodec, see nvvi_decode_bench_supported() */
+  int encode_codec;             /* cudaVideoCodec: H264, HEVC or AV1 */
+
+  /* All zero for the default preset (P4 where the driver has it) */
+  nvvi_guid preset;
+
+  /* 0x0 means 1920x1080; both must be even */
+  unsigned int width;
+  unsigned int height;
+
+  int frames;                   /* 0 means 300 */
+  int zero_copy;
+} nvvi_transcode_options;
+
+typedef struct {
+  double p50_ms;
+  double p95_ms;
+  double p99_ms;
+  double max_ms;
+} nvvi_percentiles;
+
+typedef struct {
+  /*
+   * CUresult or NVENCSTATUS of the call that failed while setting up or
+   * handing over a frame, with error saying which; nothing below is set
+   * but what was measured before. error is also set if the device doesn't
+   * decode the stream at all.
+   */
+  int status;
+  char error[64];
+
+  int frames;                   /* transcoded */
+  double fps;
+  int registered;               /* zero copy: resources registered */
+
+  /* Handing the access unit to the parser until the frame is mapped */
+  nvvi_percentiles decode;
+  /* From the mapped frame to encoder input: mapping or copying it */
+  nvvi_percentiles map;
+  /* nvEncEncodePicture until the bitstream is locked */
+  nvvi_percentiles encode;
+  nvvi_percentiles total;
+} nvvi_transcode_step;
+
+/* Same return convention as nvvi_bench_run() */
+int nvvi_transcode_run(const nvvi_transcode_options *opts, nvvi_transcode_step *step);
+
+/*
+ * Device memory footprint of one decoder or encode session, as the drop
+ * in free device memory (cuMemGetInfo) across creating it on the device's
+ * primary context. For a decoder that is cuvidCreateDecoder; for an
+ * encoder it is the session, nvEncInitializeEncoder and its input and
+ * bitstream buffers. The session is created and destroyed repeat times
+ * and the median kept.
+ *
+ * Free memory is device wide, so anything else allocating on the GPU at
+ * the same time shows up too: measure on an idle device. The CUDA context
+ * itself is not included, and the driver allocates in pages, so small
+ * differences between settings may not show.
+ */
+typedef struct {
+  int device;                   /* CUDA device ordinal */
+  int codec;                    /* cudaVideoCodec; H264, HEVC or AV1 to encode */
+  unsigned int width;
+  unsigned int height;
+
+  /* Decoders: the output surface follows the chroma format and depth */
+  int chroma_format;            /* cudaVideoChromaFormat */
+  int bit_depth;
+  int decode_surfaces;          /* ulNumDecodeSurfaces, 0 means 8 */
+  int output_surfaces;          /* ulNumOutputSurfaces, 0 means 1 */
+
+  /* Encoders, 8-bit NV12 input */
+  nvvi_guid preset;             /* all zero for the default preset */
+  int tuning;                   /* NV_ENC_TUNING_INFO, 0 means high quality */
+  int b_frames;
+  int lookahead;                /* lookahead depth, 0 for none */
+  int buffers;                  /* input/bitstream pairs, 0 means b_frames + lookahead + 1 */
+
+  int repeat;                   /* 0 means 3 */
+} nvvi_footprint_options;
+
+typedef struct {
+  /*
+   * CUresult or NVENCSTATUS of the call that failed, or -1 if the caps
+   * rule the settings out (format, size, B-frames, lookahead); nothing
+   * below but the device memory is set unless it is 0
+   */
+  int status;
+  char error[64];
+
+  int64_t bytes;                /* median over the repeats */
+  int64_t min_bytes;
+  int64_t max_bytes;
+
+  /* Device memory before the first session */
+  uint64_t free_bytes;
+  uint64_t total_bytes;
+} nvvi_footprint;
+
+/*
+ * Returns 0 if the measurement ran, including when the driver refused the
+ * session, and -1 if the device or cuMemGetInfo could not be used.
+ */
+int nvvi_decode_footprint(const nvvi_footprint_options *opts, nvvi_footprint *fp);
+int nvvi_encode_footprint(const nvvi_footprint_options *opts, nvvi_footprint *fp);
+
+/*
+ * What the presets of an encoder actually configure. For one device and
+ * codec, every preset the driver lists is expanded with every tuning info
+ * through nvEncGetEncodePresetConfigEx (nvEncGetEncodePresetConfig, with
+ * tuning 0, where the API has no tuning info), and the fields of the
+ * returned NV_ENC_CONFIG that decide throughput and latency are kept.
+ */
+#define NVVI_MAX_TUNINGS 8
+
+typedef struct {
+  nvvi_guid preset;
+  char preset_name[NVVI_NAME_LEN];
+  int tuning;                   /* NV_ENC_TUNING_INFO */
+
+  /* NVENCSTATUS of the query; nothing below is set unless it is 0 */
+  int status;
+
+  int rc_mode;                  /* NV_ENC_PARAMS_RC_MODE */
+  uint32_t average_bitrate;
+  uint32_t max_bitrate;
+  uint32_t vbv_buffer_size;
+  int qp_intra;                 /* constQP, for NV_ENC_PARAMS_RC_CONSTQP */
+  int qp_inter_p;
+  int qp_inter_b;
+
+  uint32_t gop_length;          /* NVENC_INFINITE_GOPLENGTH for none */
+  int b_frames;                 /* frameIntervalP - 1 */
+  int b_ref_mode;               /* NV_ENC_BFRAME_REF_MODE */
+  int ref_frames;               /* 0 lets the driver pick */
+  int lookahead;                /* frames, 0 if disabled */
+  int multipass;                /* NV_ENC_MULTI_PASS */
+  int spatial_aq;
+  int aq_strength;              /* 0 is automatic */
+  int temporal_aq;
+  int zero_reorder_delay;
+  int temporal_filter;          /* NV_ENC_TEMPORAL_FILTER_LEVEL, H264/HEVC on SDK 12.2+ */
+} nvvi_preset_config;
+
+/*
+ * Fills configs with up to max entries, preset major, and returns how
+ * many were filled, or -1 if no encode session could be opened. A
+ * combination the driver rejects is still listed, with its status.
+ */
+int nvvi_preset_configs(int device, int codec, nvvi_preset_config *configs, int max);
+
+/*
+ * Capacity planning from a snapshot alone, for H264, HEVC and AV1. For a
+ * rendition it works out the lowest level of the codec's specification
+ * that admits it and a theoretical ceiling on concurrent streams:
+ *
+ * - encode: NV_ENC_CAPS_MB_PER_SEC_MAX, taken as the rate of one engine,
+ *   times NV_ENC_CAPS_NUM_ENCODER_ENGINES, over the rendition's MB/s
+ * - decode: NVDEC reports no rate, so the sample rate of the level the
+ *   decoder's largest picture needs, over the rendition's sample rate
+ *
+ * These are upper bounds from the advertised limits; session limits,
+ * memory and the preset decide what is sustained (see nvvi_bench_run()).
+ */
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  double fps;
+  int bit_depth;                /* 0 means 8 */
+} nvvi_rendition;
+
+typedef struct {
+  int supported;                /* 0 if the device can't take the rendition at all */
+  int streams;                  /* -1 if no rate limit is known */
+  char detail[64];              /* what bounds streams, or why it's unsupported */
+
+  /* Lowest level that fits, e.g. "5.1"; empty if the rendition is beyond every level */
+  char level[8];
+
+  /* Highest level the device handles; empty if unknown */
+  char max_level[8];
+
+  /* level is empty or above max_level */
+  int level_exceeded;
+} nvvi_plan;
+
+/* Returns -1 if there is no level table for codec */
+int nvvi_plan_rendition(const nvvi_device *device, int encode, int codec,
+                        const nvvi_rendition *rendition, nvvi_plan *plan);
+
+/*
+ * Structural encoder latency of a preset configuration on an encoder: the
+ * frames the encoder holds before the first picture comes out, plus the
+ * time it takes to encode one.
+ *
+ * - reordering: one frame per B-frame, capped at NV_ENC_CAPS_NUM_MAX_BFRAMES
+ * - lookahead: its depth, if NV_ENC_CAPS_SUPPORT_LOOKAHEAD
+ * - temporal filtering: the future half of its window; it overlaps with
+ *   reordering, so only the larger of the two counts
+ * - encoding: the rendition's macroblocks at NV_ENC_CAPS_MB_PER_SEC_MAX of
+ *   one engine, 1.25x for a quarter resolution first pass, 2x for a full one
+ *
+ * The minimum is what is left with all of these disabled or single pass,
+ * which every configuration can do: zero frames and one single pass
+ * encode. Rate control buffering (VBV) and transport are not included.
+ */
+typedef struct {
+  int reorder;
+  int lookahead;
+  int temporal_filter;
+  int frames;                   /* lookahead + max(reorder, temporal_filter) */
+
+  double frame_ms;              /* one frame at the rendition's fps */
+  double encode_ms;             /* 0 if the encoder reports no MB/s */
+  double ms;                    /* frames * frame_ms + encode_ms */
+  double min_ms;
+} nvvi_latency;
+
+void nvvi_plan_latency(const nvvi_encode_codec *enc, const nvvi_preset_config *config,
+                       const nvvi_rendition *rendition, nvvi_latency *latency);
+
+/*
+ * Decode to encode paths that need no format conversion. A decoder surface
+ * can go straight to the encoder when an input format shares its layout:
+ * NV12 as NV12, P016 as P010 (16-bit surfaces keep samples in the high
+ * bits, so a 12-bit stream passes as its top 10 bits), planar 4:4:4 as
+ * YUV444 or YUV444P10, NV16 as NV16 and P216 as P210. Of the surfaces the
+ * decoder offers, the one keeping the most chroma wins, then the one
+ * keeping the most depth, then the smaller surface.
+ */
+typedef struct {
+  int codec;                    /* decoder row, cudaVideoCodec */
+  int chroma_format;
+  int bit_depth;
+  int encode_codec;             /* cudaVideoCodec */
+  int surface_format;           /* cudaVideoSurfaceFormat, -1 if no path */
+  uint32_t input_format;        /* NV_ENC_BUFFER_FORMAT, 0 if no path */
+  int out_chroma_format;        /* what reaches the encoder */
+  int out_bit_depth;
+  char detail[64];              /* why there is no path */
+} nvvi_format_path;
+
+/* Best path from one decoder row to one encoder; 0 if found, else -1 with detail set */
+int nvvi_format_path_find(const nvvi_decode_caps *dec, const nvvi_encode_codec *enc,
+                          nvvi_format_path *path);
+
+/* Every decoder row against every encoder of a device; returns the number written */
+int nvvi_format_paths(const nvvi_device *device, nvvi_format_path *paths, int max);
+
+/*
+ * Job placement across the devices of a snapshot. A job decodes one input
+ * and encodes a ladder of outputs from it, one encode session per rung.
+ * Using the rate model of nvvi_plan_rendition(), every job costs each
+ * device a fraction of its decode budget and of its encode budget (the
+ * engines of a device share one budget), and jobs are only placed where
+ * the decoder takes the input (codec, chroma, depth, size, an output
+ * surface the encoder can read) and the encoder takes every rung (size,
+ * NV12 input, preset).
+ *
+ * Placement is greedy, largest job first: NVVI_PLACE_PACK puts each job on
+ * the device it fills the most without overflowing it, NVVI_PLACE_SPREAD
+ * on the least loaded one.
+ */
+#define NVVI_MAX_LADDER 8
+
+typedef struct {
+  char name[NVVI_NAME_LEN];
+  int codec;                    /* cudaVideoCodec of the input */
+  int chroma_format;            /* cudaVideoChromaFormat of the input */
+  nvvi_rendition input;         /* bit_depth is the input's */
+
+  int out_codec;                /* cudaVideoCodec: H264, HEVC or AV1 */
+  char preset[NVVI_NAME_LEN];   /* as named in nvvi_encode_codec; empty for any */
+  int num_outputs;
+  nvvi_rendition outputs[NVVI_MAX_LADDER];
+} nvvi_job;
+
+enum {
+  NVVI_PLACE_PACK,
+  NVVI_PLACE_SPREAD,
+};
+
+typedef struct {
+  int policy;                   /* NVVI_PLACE_* */
+  double headroom;              /* fraction of every budget kept free, 0-1 */
+  int max_sessions;             /* encode sessions per device, 0 for no limit */
+
+  /* Only use decode rows and encoders nvvi_verify() passed */
+  int verified_only;
+} nvvi_place_options;
+
+typedef struct {
+  int device;                   /* index into snap->devices, -1 if not placed */
+  char reason[64];              /* why not, from the device that came closest */
+} nvvi_placement;
+
+typedef struct {
+  int jobs;
+  int sessions;
+  double decode_load;           /* fraction of the decode budget in use */
+  double encode_load;           /* fraction of the encode budget in use */
+  uint64_t memory_bytes;        /* device memory reserved; admission only */
+} nvvi_device_load;
+
+/*
+ * Fills placements[num_jobs] and loads[snap->num_devices]. Returns the
+ * number of jobs that could not be placed, or -1 on allocation failure.
+ */
+int nvvi_place(const nvvi_snapshot *snap, const nvvi_job *jobs, int num_jobs,
+               const nvvi_place_options *opts, nvvi_placement *placements,
+               nvvi_device_load *loads);
+
+/*
+ * Read a job manifest: one job per line,
+ *
+ *   job NAME CODEC CHROMA DEPTH WxH@FPS OUT_CODEC PRESET WxH@FPS[,WxH@FPS...]
+ *
+ * e.g. "job cam1 hevc 420 10 3840x2160@30 h264 p4 1920x1080@30,1280x720@30".
+ * PRESET may be "-" for any, and a rung may end in ":DEPTH" to encode at a
+ * different bit depth than the input. Blank lines and lines starting with '#' are
+ * skipped. *jobs is allocated and must be freed by the caller.
+ */
+int nvvi_jobs_load(FILE *f, nvvi_job **jobs, int *num_jobs);
+
+/* One manifest line, starting with "job" */
+int nvvi_job_parse(nvvi_job *job, const char *line);
+
+/*
+ * Admission control: placement one job at a time, as jobs start, with
+ * every reservation held until it is released. Each reservation takes its
+ * share of a device's decode and encode budgets and its encode sessions
+ * (up to max_sessions), and, with a memory model for the device, an
+ * estimate of the device memory its decoder and encode sessions take.
+ *
+ * The memory model scales a measured session footprint by frame size:
+ * e.g. nvvi_decode_footprint() and nvvi_encode_footprint() at one size,
+ * divided by its macroblocks, against what was free when measured.
+ */
+typedef struct {
+  uint64_t budget_bytes;        /* device memory to hand out, 0 to not account it */
+  double decode_bytes_per_mb;   /* per macroblock of the input */
+  double encode_bytes_per_mb;   /* per macroblock of every output */
+} nvvi_memory_model;
+
+typedef struct {
+  int device;                   /* index into snap->devices, -1 if not placed */
+  int sessions;
+  double decode;                /* fractions of the device's budgets */
+  double encode;
+  uint64_t memory_bytes;
+} nvvi_reservation;
+
+typedef struct nvvi_admission nvvi_admission;
+
+/*
+ * memory is NULL or holds one model per device of snap. snap must stay
+ * valid until the admission is closed. Not thread safe.
+ */
+nvvi_admission *nvvi_admission_open(const nvvi_snapshot *snap, const nvvi_place_options *opts,
+                                    const nvvi_memory_model *memory);
+
+/*
+ * Reserve room for job on a device chosen by opts->policy. Returns -1
+ * with the reason if no device can take it now: a capability the job
+ * needs or, if some device has one, which budget ran out.
+ */
+int nvvi_admission_reserve(nvvi_admission *adm, const nvvi_job *job, nvvi_reservation *res,
+                           char *reason, size_t len);
+void nvvi_admission_release(nvvi_admission *adm, const nvvi_reservation *res);
+
+/* The current load of every device of the snapshot */
+const nvvi_device_load *nvvi_admission_loads(const nvvi_admission *adm);
+void nvvi_admission_close(nvvi_admission *adm);
+
+/*
+ * Call tracing. Between start and stop, every driver entry point the
+ * library calls is counted and timed into a per entry point latency
+ * histogram, and the probe phases (library loading, initialisation,
+ * enumeration, per-device decode/encode work, cache access) are timed
+ * too. If trace is not NULL, each call and phase is also written to it as
+ * a Chrome trace event JSON array, loadable in chrome://tracing or
+ * Perfetto.
+ *
+ * Tracing must be started before the first probe, as the function tables
+ * are wrapped when the driver libraries are loaded. Returns -1 if tracing
+ * is already running.
+ */
+int nvvi_trace_start(FILE *trace);
+void nvvi_trace_stop(void);
+
+/* Print the phase and per call summary collected so far */
+void nvvi_trace_print(FILE *f);
+
+/* "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"; buf must hold NVVI_GUID_STRING_LEN */
+void nvvi_guid_to_string(const nvvi_guid *guid, char *buf);
+int nvvi_guid_from_string(nvvi_guid *guid, const char *str);
+
+const char *nvvi_decode_codec_name(int codec);
+const char *nvvi_chroma_format_name(int chroma_format);
+
+/* cudaVideoSurfaceFormat */
+const char *nvvi_surface_format_name(int format);
+
+/*
+ * Human readable list of every surface format in an output format mask,
+ * e.g. "P016, NV12". The string is per thread and valid until the next call.
+ */
+const char *nvvi_surface_formats_name(unsigned int mask);
+
+/* Inverse of the name functions; -1 (or 0 for formats) if unknown */
+int nvvi_decode_codec_from_name(const char *name);
+int nvvi_chroma_format_from_name(const char *name);
+const char *nvvi_encode_format_name(uint32_t fmt);
+uint32_t nvvi_encode_format_from_name(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NVVIDEOINFO_H */
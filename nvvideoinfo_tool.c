@@ -0,0 +1,1279 @@
+/*
+ * nvvideoinfo - enumerate nvdec and nvenc capabilities of nvidia video devices
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Both halves of the inventory from a single probe: the driver libraries
+ * are loaded and initialised once, and each device's decoder sweep and
+ * encode session run on its retained primary context.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvvideoinfo.h"
+#include "nvvi_tool.h"
+
+enum {
+  OPT_DECODE = TOOL_OPT_FIRST_LOCAL,
+  OPT_ENCODE,
+  OPT_CHROMA,
+  OPT_DEPTH,
+  OPT_SIZE,
+  OPT_FORMAT,
+  OPT_PLAN,
+  OPT_PLACE,
+  OPT_SPREAD,
+  OPT_HEADROOM,
+  OPT_MAX_SESSIONS,
+  OPT_VERIFIED,
+  OPT_AFFINITY,
+  OPT_PATHS,
+  OPT_METRICS,
+  OPT_LISTEN,
+  OPT_CAPACITY,
+  OPT_PUBLISH,
+  OPT_INTERVAL,
+  OPT_SHM,
+  OPT_ADMIT,
+  OPT_NO_MEMORY,
+};
+
+#define MAX_RENDITIONS 16
+
+static const int plan_codecs[] = { 4 /* H264 */, 8 /* HEVC */, 11 /* AV1 */ };
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          TOOL_COMMON_USAGE
+          "  -h, --help      show this help\n"
+          "\n"
+          "Query mode: answer one question through the exit status\n"
+          "(0: yes, 1: no, 2: error) instead of printing the inventory.\n"
+          "      --decode CODEC  can the device decode CODEC (h264, hevc, av1, ...)\n"
+          "      --encode CODEC  can the device encode CODEC (h264, hevc, av1)\n"
+          "  -d, --device N      device to ask about (default 0)\n"
+          "      --chroma C      400, 420, 422 or 444 (default 420)\n"
+          "      --depth N       bit depth (default 8)\n"
+          "      --size WxH      frame size to check against the limits\n"
+          "      --format F      encoder input format, e.g. NV12 or P010\n"
+          "  -v, --verbose       also print a one-line answer\n"
+          "\n"
+          "Planning mode: theoretical concurrent streams and required level\n"
+          "for H264, HEVC and AV1, from the probed limits.\n"
+          "      --plan LIST     comma separated WxH@FPS renditions, e.g.\n"
+          "                      1920x1080@60,3840x2160@30 (--depth applies)\n"
+          "\n"
+          "Placement mode: assign the jobs of a manifest to devices.\n"
+          "      --place FILE        job manifest, see nvvi_jobs_load()\n"
+          "      --spread            balance load instead of packing devices\n"
+          "      --headroom PCT      keep PCT%% of every budget free\n"
+          "      --max-sessions N    at most N encode sessions per device\n"
+          "      --verified          only use what --verify could create\n"
+          "\n"
+          "Affinity mode: where each device sits on the host.\n"
+          "      --affinity      NUMA node and local CPUs of every device, as a\n"
+          "                      list for numactl and a mask for taskset\n"
+          "\n"
+          "Paths mode: how each decoder row can feed each encoder.\n"
+          "      --paths         the decoder surface and encoder input format\n"
+          "                      that need no conversion, keeping the most\n"
+          "                      chroma and depth\n"
+          "\n"
+          "Exporter mode: probe once, then publish OpenMetrics gauges.\n"
+          "      --metrics FILE  write them to FILE (- for stdout) and exit\n"
+          "      --listen [HOST:]PORT  serve them over HTTP at /metrics\n"
+          "      --capacity      add the live encoder capacity, sampled per scrape\n"
+          "\n"
+          "Shared-memory mode: publish the snapshot for other processes.\n"
+          "      --publish NAME  probe once and publish to the segment NAME; with\n"
+          "                      --capacity, keep sampling it until interrupted\n"
+          "      --interval MS   capacity sampling interval (default 1000)\n"
+          "      --shm NAME      read the snapshot from NAME instead of probing,\n"
+          "                      for any of the modes above\n"
+          "\n"
+          "Admission mode: a daemon that reserves room for jobs as they start.\n"
+          "      --admit SOCKET  serve reservations on the Unix socket SOCKET;\n"
+          "                      --spread, --headroom, --max-sessions and\n"
+          "                      --verified apply as for --place\n"
+          "      --no-memory     don't measure and account device memory\n",
+          prog);
+}
+
+static int parse_query_arg(nvvi_query *query, int opt, const char *arg)
+{
+  switch (opt) {
+  case OPT_DECODE:
+  case OPT_ENCODE:
+    query->encode = opt == OPT_ENCODE;
+    query->codec = nvvi_decode_codec_from_name(arg);
+    return query->codec < 0 ? -1 : 0;
+  case OPT_CHROMA:
+    query->chroma_format = nvvi_chroma_format_from_name(arg);
+    return query->chroma_format < 0 ? -1 : 0;
+  case OPT_DEPTH:
+    query->bit_depth = atoi(arg);
+    return query->bit_depth < 8 ? -1 : 0;
+  case OPT_SIZE:
+    return sscanf(arg, "%ux%u", &query->width, &query->height) == 2 ? 0 : -1;
+  case OPT_FORMAT:
+    query->input_format = nvvi_encode_format_from_name(arg);
+    return query->input_format ? 0 : -1;
+  }
+  return -1;
+}
+
+static int run_query(const nvvi_query *query, int verbose)
+{
+  static const char *const answers[] = { "yes", "no", "error" };
+  char detail[256];
+
+  int ret = nvvi_query_run(query, detail, sizeof(detail));
+  if (verbose) {
+    printf("%s: %s\n", answers[ret], detail);
+  }
+  nvvi_unload();
+
+  return ret;
+}
+
+static int parse_renditions(nvvi_rendition *renditions, const char *arg)
+{
+  int count = 0;
+
+  for (const char *p = arg; *p; p += strcspn(p, ",")) {
+    p += *p == ',';
+    if (count == MAX_RENDITIONS ||
+        sscanf(p, "%ux%u@%lf", &renditions[count].width, &renditions[count].height,
+               &renditions[count].fps) != 3 || renditions[count].fps <= 0) {
+      return -1;
+    }
+    count++;
+  }
+  return count;
+}
+
+static void format_streams(char *buf, size_t len, const nvvi_plan *plan)
+{
+  if (!plan->supported) {
+    snprintf(buf, len, "-");
+  } else if (plan->streams < 0) {
+    snprintf(buf, len, "?");
+  } else {
+    snprintf(buf, len, "%d%s", plan->streams, plan->level_exceeded ? "!" : "");
+  }
+}
+
+static void print_plan_note(const char *what, const nvvi_rendition *r, int codec,
+                            const nvvi_plan *plan)
+{
+  if (!plan->supported) {
+    printf("  %ux%u@%g %s %s: %s\n", r->width, r->height, r->fps,
+           nvvi_decode_codec_name(codec), what, plan->detail);
+  } else if (plan->streams == 0) {
+    printf("  %ux%u@%g %s %s: not even one stream within %s\n", r->width, r->height, r->fps,
+           nvvi_decode_codec_name(codec), what, plan->detail);
+  }
+  if (plan->supported && plan->level_exceeded) {
+    printf("  %ux%u@%g %s %s: needs level %s, above %s\n", r->width, r->height, r->fps,
+           nvvi_decode_codec_name(codec), what, plan->level[0] ? plan->level : "beyond the last",
+           plan->max_level[0] ? plan->max_level : "every level");
+  }
+}
+
+static void print_plan(const nvvi_device *device, const nvvi_rendition *renditions, int count)
+{
+  nvvi_plan plans[MAX_RENDITIONS][3][2];
+
+  printf("Rendition        | Codec | Level | Encode streams | Decode streams\n");
+  printf("-------------------------------------------------------------------\n");
+  for (int i = 0; i < count; i++) {
+    const nvvi_rendition *r = &renditions[i];
+    for (int j = 0; j < 3; j++) {
+      nvvi_plan *enc = &plans[i][j][0];
+      nvvi_plan *dec = &plans[i][j][1];
+      char name[32], enc_streams[16], dec_streams[16];
+
+      nvvi_plan_rendition(device, 1, plan_codecs[j], r, enc);
+      nvvi_plan_rendition(device, 0, plan_codecs[j], r, dec);
+      snprintf(name, sizeof(name), "%ux%u@%g", r->width, r->height, r->fps);
+      format_streams(enc_streams, sizeof(enc_streams), enc);
+      format_streams(dec_streams, sizeof(dec_streams), dec);
+      printf("%-16s | %5s | %5s | %14s | %14s\n", name, nvvi_decode_codec_name(plan_codecs[j]),
+             enc->level[0] ? enc->level : "-", enc_streams, dec_streams);
+    }
+  }
+
+  printf("\nLimits used:\n");
+  for (int j = 0; j < 3; j++) {
+    const char *limit[2] = { "-", "-" };
+    for (int i = 0; i < count; i++) {
+      for (int k = 0; k < 2; k++) {
+        if (plans[i][j][k].supported && limit[k][0] == '-') {
+          limit[k] = plans[i][j][k].detail;
+        }
+      }
+    }
+    printf("  %s encode: %s, decode: %s\n", nvvi_decode_codec_name(plan_codecs[j]),
+           limit[0], limit[1]);
+  }
+  printf("\nFlagged (! marks a rendition above the device's level):\n");
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < 3; j++) {
+      print_plan_note("encode", &renditions[i], plan_codecs[j], &plans[i][j][0]);
+      print_plan_note("decode", &renditions[i], plan_codecs[j], &plans[i][j][1]);
+    }
+  }
+}
+
+static int print_paths(const nvvi_device *device)
+{
+  int max = device->num_decode_caps * device->num_encode_codecs;
+  nvvi_format_path *paths = calloc(max ? max : 1, sizeof(*paths));
+  if (!paths) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  int count = nvvi_format_paths(device, paths, max);
+  if (!count) {
+    printf("No paths: %s\n", device->decode_status != 0 || device->encode_status != 0 ?
+           "decode or encode probe failed" : "no decoder or encoder");
+  }
+  for (int i = 0; i < count; i++) {
+    const nvvi_format_path *path = &paths[i];
+    char from[32];
+
+    snprintf(from, sizeof(from), "%s %s %d-bit", nvvi_decode_codec_name(path->codec),
+             nvvi_chroma_format_name(path->chroma_format), path->bit_depth);
+    printf("%-18s -> %-5s ", from, nvvi_decode_codec_name(path->encode_codec));
+    if (path->surface_format < 0) {
+      printf("none: %s\n", path->detail);
+      continue;
+    }
+    printf("%s -> %s (%s %d-bit)\n", nvvi_surface_format_name(path->surface_format),
+           nvvi_encode_format_name(path->input_format),
+           nvvi_chroma_format_name(path->out_chroma_format), path->out_bit_depth);
+  }
+  free(paths);
+  return 0;
+}
+
+typedef struct {
+  const char *path;
+  const char *listen;
+  const char *publish;
+  int capacity;
+  int interval_ms;
+} exporter_config;
+
+typedef struct {
+  const nvvi_snapshot *snap;
+  const nvvi_shm *shm;          /* with --shm, read per scrape instead of snap */
+  nvvi_sampler *sampler;        /* NULL without --capacity */
+  int *capacity;
+} exporter;
+
+/* The whole exposition in memory; the snapshot is reused, only capacity is sampled */
+static int render_metrics(exporter *e, char **buf, size_t *len)
+{
+  FILE *f = open_memstream(buf, len);
+  if (!f) {
+    return -1;
+  }
+  int ret;
+  if (e->shm) {
+    /* Whatever the publisher last wrote, capacity included */
+    nvvi_snapshot snap;
+    ret = nvvi_shm_read(e->shm, &snap, e->capacity);
+    if (ret == 0) {
+      ret = nvvi_metrics_write(&snap, e->capacity, f);
+      nvvi_snapshot_free(&snap);
+    }
+  } else {
+    if (e->sampler) {
+      nvvi_sampler_poll(e->sampler, e->capacity);
+    }
+    ret = nvvi_metrics_write(e->snap, e->sampler ? e->capacity : NULL, f);
+  }
+  if (fclose(f) != 0) {
+    ret = -1;
+  }
+  return ret;
+}
+
+/* Write to a temporary file first, so a textfile collector never sees half of it */
+static int write_metrics(exporter *e, const char *path)
+{
+  char tmp[4096];
+  char *buf = NULL;
+  size_t len = 0;
+  int ret = render_metrics(e, &buf, &len);
+
+  if (ret == 0 && strcmp(path, "-") == 0) {
+    ret = fwrite(buf, 1, len, stdout) == len ? 0 : -1;
+  } else if (ret == 0) {
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+      fprintf(stderr, "Cannot open %s for writing\n", tmp);
+      ret = -1;
+    } else {
+      ret = fwrite(buf, 1, len, f) == len ? 0 : -1;
+      if (fclose(f) != 0 || ret != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        remove(tmp);
+        ret = -1;
+      }
+    }
+  }
+  free(buf);
+  return ret;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return -1;
+    }
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static void answer_scrape(exporter *e, int fd)
+{
+  char request[4096];
+  size_t used = 0;
+  char header[256];
+
+  /* Only the request line matters; headers are read up to the blank line and dropped */
+  while (used < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + used, sizeof(request) - 1 - used, 0);
+    if (n <= 0) {
+      return;
+    }
+    used += n;
+    request[used] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+      break;
+    }
+  }
+
+  char method[8], path[256];
+  if (sscanf(request, "%7s %255s", method, path) != 2 || strcmp(method, "GET") != 0 ||
+      (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0)) {
+    static const char not_found[] =
+      "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\n\r\n"
+      "Not Found\n";
+    send_all(fd, not_found, sizeof(not_found) - 1);
+    return;
+  }
+
+  char *body = NULL;
+  size_t len = 0;
+  if (render_metrics(e, &body, &len) != 0) {
+    static const char error[] = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+    send_all(fd, error, sizeof(error) - 1);
+  } else {
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\n"
+             "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+             "Content-Length: %zu\r\n\r\n", len);
+    if (send_all(fd, header, strlen(header)) == 0) {
+      send_all(fd, body, len);
+    }
+  }
+  free(body);
+}
+
+/* One scrape at a time is plenty for a handful of scrapers */
+static int serve_metrics(exporter *e, const char *listen_addr)
+{
+  struct addrinfo hints = { .ai_flags = AI_PASSIVE, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *addrs;
+  char host[256];
+  const char *port = strrchr(listen_addr, ':');
+  int fd = -1;
+
+  if (port) {
+    snprintf(host, sizeof(host), "%.*s", (int)(port - listen_addr), listen_addr);
+    port++;
+  } else {
+    host[0] = '\0';
+    port = listen_addr;
+  }
+
+  int err = getaddrinfo(host[0] ? host : NULL, port, &hints, &addrs);
+  if (err != 0) {
+    fprintf(stderr, "Cannot resolve %s: %s\n", listen_addr, gai_strerror(err));
+    return -1;
+  }
+  for (struct addrinfo *a = addrs; a && fd < 0; a = a->ai_next) {
+    int one = 1;
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot listen on %s\n", listen_addr);
+    return -1;
+  }
+  fprintf(stderr, "Serving metrics on %s\n", listen_addr);
+
+  for (;;) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      continue;
+    }
+    struct timeval timeout = { .tv_sec = 5 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    answer_scrape(e, client);
+    close(client);
+  }
+
+  return 0;
+}
+
+static int export_metrics(const nvvi_snapshot *snap, const nvvi_shm *shm,
+                          const exporter_config *config)
+{
+  exporter e = { .snap = snap, .shm = shm };
+  int ret;
+
+  if (shm) {
+    e.capacity = calloc(snap->num_devices * NVVI_MAX_ENCODE_CODECS + 1, sizeof(int));
+    if (!e.capacity) {
+      return -1;
+    }
+  } else if (config->capacity) {
+    e.capacity = calloc(snap->num_devices * NVVI_MAX_ENCODE_CODECS + 1, sizeof(int));
+    e.sampler = e.capacity ? nvvi_sampler_open(snap) : NULL;
+    if (!e.sampler) {
+      free(e.capacity);
+      return -1;
+    }
+  }
+
+  if (config->listen) {
+    ret = serve_metrics(&e, config->listen);
+  } else {
+    ret = write_metrics(&e, config->path);
+  }
+
+  if (e.sampler) {
+    nvvi_sampler_close(e.sampler);
+  }
+  free(e.capacity);
+  return ret;
+}
+
+static volatile sig_atomic_t stopping;
+
+static void request_stop(int sig)
+{
+  stopping = 1;
+}
+
+/* SIGINT and SIGTERM end the long-running modes cleanly */
+static void catch_stop_signals(void)
+{
+  struct sigaction sa = { .sa_handler = request_stop };
+
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+}
+
+/*
+ * Without --capacity the segment outlives us, holding the one snapshot.
+ * With it, capacity is sampled into the segment until SIGINT or SIGTERM,
+ * and the segment is removed so nobody reads a stale capacity.
+ */
+static int publish_snapshot(const nvvi_snapshot *snap, const exporter_config *config)
+{
+  nvvi_sampler *sampler = NULL;
+  int *capacity = NULL;
+
+  if (config->capacity) {
+    capacity = calloc(snap->num_devices * NVVI_MAX_ENCODE_CODECS + 1, sizeof(int));
+    sampler = capacity ? nvvi_sampler_open(snap) : NULL;
+    if (!sampler) {
+      free(capacity);
+      return -1;
+    }
+  }
+
+  nvvi_shm *shm = nvvi_shm_create(config->publish, snap);
+  if (!shm) {
+    if (sampler) {
+      nvvi_sampler_close(sampler);
+    }
+    free(capacity);
+    return -1;
+  }
+
+  if (sampler) {
+    struct timespec interval = {
+      .tv_sec = config->interval_ms / 1000,
+      .tv_nsec = config->interval_ms % 1000 * 1000000L,
+    };
+    catch_stop_signals();
+    fprintf(stderr, "Publishing %s every %d ms\n", config->publish, config->interval_ms);
+    while (!stopping) {
+      nvvi_sampler_poll(sampler, capacity);
+      nvvi_shm_update(shm, NULL, capacity);
+      nanosleep(&interval, NULL);
+    }
+    nvvi_sampler_close(sampler);
+  }
+
+  nvvi_shm_close(shm, sampler != NULL);
+  free(capacity);
+  return 0;
+}
+
+#define ADMIT_MAX_CLIENTS 256
+#define ADMIT_LINE_LEN    1024
+
+typedef struct {
+  const char *socket_path;
+  int measure_memory;
+} admit_config;
+
+typedef struct {
+  int fd;                       /* -1 for a free slot */
+  size_t len;
+  char buf[ADMIT_LINE_LEN];
+} admit_client;
+
+typedef struct {
+  unsigned long id;             /* 0 for a free slot */
+  int client;                   /* owner, released when it disconnects */
+  nvvi_reservation res;
+} admit_entry;
+
+typedef struct {
+  const nvvi_snapshot *snap;
+  nvvi_admission *adm;
+  admit_client clients[ADMIT_MAX_CLIENTS];
+  admit_entry *entries;
+  int num_entries;
+  unsigned long next_id;
+} admitter;
+
+/*
+ * What a 1080p H264 decoder and encode session take, per macroblock, with
+ * whatever was free at the time as the budget. Devices where either can't
+ * be measured don't have their memory accounted.
+ */
+static void measure_memory(const nvvi_snapshot *snap, nvvi_memory_model *memory)
+{
+  const double mbs = (1920 / 16) * ((1080 + 15) / 16);
+
+  for (int i = 0; i < snap->num_devices; i++) {
+    nvvi_footprint_options fp_opts = {
+      .device = snap->devices[i].index,
+      .codec = nvvi_decode_codec_from_name("h264"),
+      .width = 1920,
+      .height = 1080,
+      .chroma_format = nvvi_chroma_format_from_name("420"),
+      .bit_depth = 8,
+    };
+    nvvi_footprint dec, enc;
+
+    memset(&memory[i], 0, sizeof(memory[i]));
+    if (nvvi_decode_footprint(&fp_opts, &dec) != 0 || dec.status != 0 ||
+        nvvi_encode_footprint(&fp_opts, &enc) != 0 || enc.status != 0) {
+      fprintf(stderr, "Device %d: session memory unknown, not accounting it\n",
+              snap->devices[i].index);
+      continue;
+    }
+    memory[i].budget_bytes = dec.free_bytes;
+    memory[i].decode_bytes_per_mb = dec.bytes / mbs;
+    memory[i].encode_bytes_per_mb = enc.bytes / mbs;
+    fprintf(stderr, "Device %d: %.0f MiB free, 1080p decoder %.1f MiB, encoder %.1f MiB\n",
+            snap->devices[i].index, dec.free_bytes / 1048576.0, dec.bytes / 1048576.0,
+            enc.bytes / 1048576.0);
+  }
+}
+
+/* Replies are a line or two; a client that doesn't read them is dropped */
+static int admit_reply(admit_client *client, const char *fmt, ...)
+{
+  char line[512];
+  va_list ap;
+
+  va_start(ap, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (len >= (int)sizeof(line)) {
+    len = sizeof(line) - 1;
+  }
+  return send(client->fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT) == len ? 0 : -1;
+}
+
+static int admit_reserve(admitter *a, int c, const char *line)
+{
+  admit_client *client = &a->clients[c];
+  admit_entry *entry = NULL;
+  nvvi_reservation res;
+  nvvi_job job;
+  char reason[64];
+
+  if (nvvi_job_parse(&job, line) != 0) {
+    return admit_reply(client, "error invalid job\n");
+  }
+  if (nvvi_admission_reserve(a->adm, &job, &res, reason, sizeof(reason)) != 0) {
+    return admit_reply(client, "denied %s\n", reason);
+  }
+
+  for (int i = 0; i < a->num_entries && !entry; i++) {
+    if (!a->entries[i].id) {
+      entry = &a->entries[i];
+    }
+  }
+  if (!entry) {
+    int size = a->num_entries ? a->num_entries * 2 : 256;
+    admit_entry *grown = realloc(a->entries, size * sizeof(*grown));
+    if (!grown) {
+      nvvi_admission_release(a->adm, &res);
+      return admit_reply(client, "error out of memory\n");
+    }
+    memset(grown + a->num_entries, 0, (size - a->num_entries) * sizeof(*grown));
+    entry = &grown[a->num_entries];
+    a->entries = grown;
+    a->num_entries = size;
+  }
+  entry->id = a->next_id++;
+  entry->client = c;
+  entry->res = res;
+  return admit_reply(client, "ok %lu %d\n", entry->id, a->snap->devices[res.device].index);
+}
+
+static int admit_release(admitter *a, int c, const char *line)
+{
+  unsigned long id;
+
+  if (sscanf(line, "release %lu", &id) != 1) {
+    return admit_reply(&a->clients[c], "error invalid release\n");
+  }
+  for (int i = 0; i < a->num_entries; i++) {
+    admit_entry *entry = &a->entries[i];
+    if (entry->id == id && entry->client == c) {
+      nvvi_admission_release(a->adm, &entry->res);
+      entry->id = 0;
+      return admit_reply(&a->clients[c], "ok\n");
+    }
+  }
+  return admit_reply(&a->clients[c], "error unknown reservation\n");
+}
+
+static int admit_status(admitter *a, int c)
+{
+  const nvvi_device_load *loads = nvvi_admission_loads(a->adm);
+
+  for (int d = 0; d < a->snap->num_devices; d++) {
+    if (admit_reply(&a->clients[c], "device %d jobs %d sessions %d decode %.1f encode %.1f "
+                    "memory %.0f\n", a->snap->devices[d].index, loads[d].jobs,
+                    loads[d].sessions, 100 * loads[d].decode_load,
+                    100 * loads[d].encode_load, loads[d].memory_bytes / 1048576.0) != 0) {
+      return -1;
+    }
+  }
+  return admit_reply(&a->clients[c], ".\n");
+}
+
+static int admit_request(admitter *a, int c, char *line)
+{
+  line[strcspn(line, "\r")] = '\0';
+  if (strncmp(line, "job ", 4) == 0) {
+    return admit_reserve(a, c, line);
+  } else if (strncmp(line, "release ", 8) == 0) {
+    return admit_release(a, c, line);
+  } else if (strcmp(line, "status") == 0) {
+    return admit_status(a, c);
+  }
+  return admit_reply(&a->clients[c], "error unknown request\n");
+}
+
+static void admit_disconnect(admitter *a, int c)
+{
+  for (int i = 0; i < a->num_entries; i++) {
+    if (a->entries[i].id && a->entries[i].client == c) {
+      nvvi_admission_release(a->adm, &a->entries[i].res);
+      a->entries[i].id = 0;
+    }
+  }
+  close(a->clients[c].fd);
+  a->clients[c].fd = -1;
+}
+
+/* Every complete line in the client's buffer; -1 to drop the client */
+static int admit_read(admitter *a, int c)
+{
+  admit_client *client = &a->clients[c];
+  ssize_t n = recv(client->fd, client->buf + client->len,
+                   sizeof(client->buf) - 1 - client->len, 0);
+  if (n <= 0) {
+    return -1;
+  }
+  client->len += n;
+  client->buf[client->len] = '\0';
+
+  char *line = client->buf;
+  for (char *end; (end = strchr(line, '\n')); line = end + 1) {
+    *end = '\0';
+    if (admit_request(a, c, line) != 0) {
+      return -1;
+    }
+  }
+  client->len -= line - client->buf;
+  memmove(client->buf, line, client->len);
+  return client->len < sizeof(client->buf) - 1 ? 0 : -1;
+}
+
+static int admit_listen(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * One thread answers everyone from memory, so a request costs a job
+ * costing per device and a send; there is nothing to lock.
+ */
+static int admit_jobs(const nvvi_snapshot *snap, const nvvi_place_options *opts,
+                      const admit_config *config)
+{
+  nvvi_memory_model *memory = NULL;
+  struct pollfd fds[ADMIT_MAX_CLIENTS + 1];
+  admitter *a = calloc(1, sizeof(*a));
+  int ret = 0;
+
+  if (!a) {
+    return -1;
+  }
+  if (config->measure_memory) {
+    memory = calloc(snap->num_devices + 1, sizeof(*memory));
+    if (!memory) {
+      free(a);
+      return -1;
+    }
+    measure_memory(snap, memory);
+  }
+  a->snap = snap;
+  a->next_id = 1;
+  a->adm = nvvi_admission_open(snap, opts, memory);
+  free(memory);
+  int listen_fd = a->adm ? admit_listen(config->socket_path) : -1;
+  if (listen_fd < 0) {
+    nvvi_admission_close(a->adm);
+    free(a);
+    return -1;
+  }
+  for (int c = 0; c < ADMIT_MAX_CLIENTS; c++) {
+    a->clients[c].fd = -1;
+  }
+
+  catch_stop_signals();
+  fprintf(stderr, "Admitting jobs on %s\n", config->socket_path);
+  while (!stopping) {
+    int n = 0;
+    fds[n++] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+    for (int c = 0; c < ADMIT_MAX_CLIENTS; c++) {
+      fds[n++] = (struct pollfd){ .fd = a->clients[c].fd, .events = POLLIN };
+    }
+    if (poll(fds, n, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      ret = -1;
+      break;
+    }
+
+    for (int c = 0; c < ADMIT_MAX_CLIENTS; c++) {
+      if (fds[c + 1].revents && admit_read(a, c) != 0) {
+        admit_disconnect(a, c);
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listen_fd, NULL, NULL);
+      int c = 0;
+      while (fd >= 0 && c < ADMIT_MAX_CLIENTS && a->clients[c].fd >= 0) {
+        c++;
+      }
+      if (c == ADMIT_MAX_CLIENTS) {
+        close(fd);
+      } else if (fd >= 0) {
+        a->clients[c].fd = fd;
+        a->clients[c].len = 0;
+      }
+    }
+  }
+
+  for (int c = 0; c < ADMIT_MAX_CLIENTS; c++) {
+    if (a->clients[c].fd >= 0) {
+      admit_disconnect(a, c);
+    }
+  }
+  close(listen_fd);
+  unlink(config->socket_path);
+  nvvi_admission_close(a->adm);
+  free(a->entries);
+  free(a);
+  return ret;
+}
+
+static int place_jobs(const nvvi_snapshot *snap, const char *path,
+                      const nvvi_place_options *opts)
+{
+  FILE *f = fopen(path, "r");
+  nvvi_job *jobs;
+  int num_jobs;
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  int ret = nvvi_jobs_load(f, &jobs, &num_jobs);
+  fclose(f);
+  if (ret != 0) {
+    return -1;
+  }
+
+  nvvi_placement *placements = calloc(num_jobs + 1, sizeof(*placements));
+  nvvi_device_load *loads = calloc(snap->num_devices + 1, sizeof(*loads));
+  if (!placements || !loads) {
+    free(placements);
+    free(loads);
+    free(jobs);
+    return -1;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int unplaced = nvvi_place(snap, jobs, num_jobs, opts, placements, loads);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (unplaced >= 0) {
+    for (int i = 0; i < num_jobs; i++) {
+      if (placements[i].device >= 0) {
+        printf("%-31s %d\n", jobs[i].name, snap->devices[placements[i].device].index);
+      } else {
+        printf("%-31s - %s\n", jobs[i].name, placements[i].reason);
+      }
+    }
+
+    printf("\n");
+    for (int d = 0; d < snap->num_devices; d++) {
+      const nvvi_device_load *load = &loads[d];
+      printf("Device %d: %d jobs, %d sessions, decode %.1f%% (%.1f%% free), "
+             "encode %.1f%% (%.1f%% free)\n", snap->devices[d].index, load->jobs,
+             load->sessions, 100 * load->decode_load, 100 * (1 - load->decode_load),
+             100 * load->encode_load, 100 * (1 - load->encode_load));
+    }
+    printf("Placed %d of %d jobs in %.3f ms\n", num_jobs - unplaced, num_jobs,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+  }
+
+  free(placements);
+  free(loads);
+  free(jobs);
+  return unplaced == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+  nvvi_probe_options opts = {
+    .flags = NVVI_PROBE_ALL,
+    .threads = 1,
+  };
+  static const struct option long_opts[] = {
+    { "jobs", required_argument, NULL, 'j' },
+    { "cache", required_argument, NULL, 'c' },
+    { "record", required_argument, NULL, 'r' },
+    { "timings", no_argument,     NULL, TOOL_OPT_TIMINGS },
+    { "trace", required_argument, NULL, TOOL_OPT_TRACE },
+    { "verify", no_argument,      NULL, TOOL_OPT_VERIFY },
+    { "timeout", required_argument, NULL, TOOL_OPT_TIMEOUT },
+    { "sysfs-root", required_argument, NULL, TOOL_OPT_SYSFS_ROOT },
+    { "diff", required_argument, NULL, TOOL_OPT_DIFF },
+    { "help", no_argument,       NULL, 'h' },
+    { "decode", required_argument, NULL, OPT_DECODE },
+    { "encode", required_argument, NULL, OPT_ENCODE },
+    { "device", required_argument, NULL, 'd' },
+    { "chroma", required_argument, NULL, OPT_CHROMA },
+    { "depth", required_argument,  NULL, OPT_DEPTH },
+    { "size", required_argument,   NULL, OPT_SIZE },
+    { "format", required_argument, NULL, OPT_FORMAT },
+    { "verbose", no_argument,      NULL, 'v' },
+    { "plan", required_argument,   NULL, OPT_PLAN },
+    { "place", required_argument,  NULL, OPT_PLACE },
+    { "spread", no_argument,       NULL, OPT_SPREAD },
+    { "headroom", required_argument, NULL, OPT_HEADROOM },
+    { "max-sessions", required_argument, NULL, OPT_MAX_SESSIONS },
+    { "verified", no_argument,     NULL, OPT_VERIFIED },
+    { "affinity", no_argument,     NULL, OPT_AFFINITY },
+    { "paths", no_argument,        NULL, OPT_PATHS },
+    { "metrics", required_argument, NULL, OPT_METRICS },
+    { "listen", required_argument, NULL, OPT_LISTEN },
+    { "capacity", no_argument,     NULL, OPT_CAPACITY },
+    { "publish", required_argument, NULL, OPT_PUBLISH },
+    { "interval", required_argument, NULL, OPT_INTERVAL },
+    { "shm", required_argument,    NULL, OPT_SHM },
+    { "admit", required_argument,  NULL, OPT_ADMIT },
+    { "no-memory", no_argument,    NULL, OPT_NO_MEMORY },
+    { NULL },
+  };
+  nvvi_query query = {
+    .codec = -1,
+    .chroma_format = 1,         /* cudaVideoChromaFormat_420 */
+    .bit_depth = 8,
+  };
+  nvvi_rendition renditions[MAX_RENDITIONS];
+  int num_renditions = 0;
+  nvvi_place_options place_opts = { NVVI_PLACE_PACK };
+  const char *manifest = NULL;
+  int verbose = 0;
+  int affinity = 0;
+  int paths = 0;
+  exporter_config exporter = { .interval_ms = 1000 };
+  const char *shm_name = NULL;
+  admit_config admit = { .measure_memory = 1 };
+  nvvi_shm *shm = NULL;
+  const char *record_path = NULL;
+  const char *diff_path = NULL;
+  tool_trace trace = { 0 };
+  nvvi_snapshot snap;
+  int ret;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "j:c:r:d:vh", long_opts, NULL)) != -1) {
+    switch (c) {
+    case 'j':
+      opts.threads = atoi(optarg);
+      break;
+    case 'c':
+      opts.cache_path = optarg;
+      break;
+    case 'r':
+      record_path = optarg;
+      break;
+    case TOOL_OPT_TIMINGS:
+      trace.timings = 1;
+      break;
+    case TOOL_OPT_TRACE:
+      trace.trace_path = optarg;
+      break;
+    case TOOL_OPT_VERIFY:
+      opts.flags |= NVVI_PROBE_VERIFY;
+      break;
+    case TOOL_OPT_TIMEOUT:
+      opts.timeout_ms = atoi(optarg);
+      if (opts.timeout_ms <= 0) {
+        fprintf(stderr, "Invalid timeout '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case TOOL_OPT_SYSFS_ROOT:
+      opts.sysfs_root = optarg;
+      break;
+    case TOOL_OPT_DIFF:
+      diff_path = optarg;
+      break;
+    case 'd':
+      query.device = atoi(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case OPT_DECODE:
+    case OPT_ENCODE:
+    case OPT_CHROMA:
+    case OPT_DEPTH:
+    case OPT_SIZE:
+    case OPT_FORMAT:
+      if (parse_query_arg(&query, c, optarg) != 0) {
+        fprintf(stderr, "Invalid value '%s'\n", optarg);
+        return NVVI_QUERY_ERROR;
+      }
+      break;
+    case OPT_PLAN:
+      num_renditions = parse_renditions(renditions, optarg);
+      if (num_renditions <= 0) {
+        fprintf(stderr, "Invalid rendition list '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_PLACE:
+      manifest = optarg;
+      break;
+    case OPT_SPREAD:
+      place_opts.policy = NVVI_PLACE_SPREAD;
+      break;
+    case OPT_HEADROOM:
+      place_opts.headroom = atof(optarg) / 100;
+      if (place_opts.headroom < 0 || place_opts.headroom >= 1) {
+        fprintf(stderr, "Invalid headroom '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_MAX_SESSIONS:
+      place_opts.max_sessions = atoi(optarg);
+      break;
+    case OPT_AFFINITY:
+      affinity = 1;
+      break;
+    case OPT_PATHS:
+      paths = 1;
+      break;
+    case OPT_METRICS:
+      exporter.path = optarg;
+      break;
+    case OPT_LISTEN:
+      exporter.listen = optarg;
+      break;
+    case OPT_CAPACITY:
+      exporter.capacity = 1;
+      break;
+    case OPT_PUBLISH:
+      exporter.publish = optarg;
+      break;
+    case OPT_INTERVAL:
+      exporter.interval_ms = atoi(optarg);
+      if (exporter.interval_ms <= 0) {
+        fprintf(stderr, "Invalid interval '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_SHM:
+      shm_name = optarg;
+      break;
+    case OPT_ADMIT:
+      admit.socket_path = optarg;
+      break;
+    case OPT_NO_MEMORY:
+      admit.measure_memory = 0;
+      break;
+    case OPT_VERIFIED:
+      place_opts.verified_only = 1;
+      opts.flags |= NVVI_PROBE_VERIFY;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (diff_path && optind < argc) {
+    return tool_diff_files(diff_path, argv[optind]);
+  }
+
+  if (query.codec >= 0) {
+    int ret;
+    if (tool_trace_start(&trace) != 0) {
+      return NVVI_QUERY_ERROR;
+    }
+    ret = run_query(&query, verbose);
+    tool_trace_finish(&trace);
+    return ret;
+  }
+
+  if (tool_trace_start(&trace) != 0) {
+    return -1;
+  }
+
+  if (shm_name) {
+    shm = nvvi_shm_open(shm_name);
+    ret = shm ? nvvi_shm_read(shm, &snap, NULL) : -1;
+    if (ret != 0) {
+      fprintf(stderr, "Cannot read the snapshot published as %s\n", shm_name);
+    }
+  } else {
+    ret = nvvi_probe_ex(&snap, &opts);
+  }
+  tool_trace_finish(&trace);
+  if (ret != 0) {
+    nvvi_shm_close(shm, 0);
+    return -1;
+  }
+  if (!exporter.path && !exporter.listen) {
+    /* Only the exporter reads the segment again */
+    nvvi_shm_close(shm, 0);
+    shm = NULL;
+  }
+
+  if (exporter.publish) {
+    ret = publish_snapshot(&snap, &exporter);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (diff_path) {
+    ret = tool_diff(diff_path, &snap);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (record_path) {
+    ret = tool_record_snapshot(&snap, record_path);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (affinity) {
+    tool_print_affinity(&snap);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return 0;
+  }
+
+  if (paths) {
+    ret = 0;
+    for (int i = 0; i < snap.num_devices && ret == 0; i++) {
+      printf("Device %d: %s\n", snap.devices[i].index, snap.devices[i].name);
+      ret = print_paths(&snap.devices[i]);
+      printf("\n");
+    }
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (exporter.path || exporter.listen) {
+    ret = export_metrics(&snap, shm, &exporter);
+    nvvi_shm_close(shm, 0);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (admit.socket_path) {
+    ret = admit_jobs(&snap, &place_opts, &admit);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (manifest) {
+    ret = place_jobs(&snap, manifest, &place_opts);
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return ret;
+  }
+
+  if (num_renditions) {
+    for (int i = 0; i < num_renditions; i++) {
+      renditions[i].bit_depth = query.bit_depth;
+    }
+    for (int i = 0; i < snap.num_devices; i++) {
+      printf("Device %d: %s\n", snap.devices[i].index, snap.devices[i].name);
+      print_plan(&snap.devices[i], renditions, num_renditions);
+      printf("\n");
+    }
+    nvvi_snapshot_free(&snap);
+    nvvi_unload();
+    return 0;
+  }
+
+  printf("Driver version %s, Nvenc version %d.%d\n",
+         snap.driver_version[0] ? snap.driver_version : "unknown",
+         snap.nvenc_max_version >> 4, snap.nvenc_max_version & 0xf);
+
+  for (int i = 0; i < snap.num_devices; i++) {
+    const nvvi_device *device = &snap.devices[i];
+
+    printf("\n");
+    tool_print_device(device);
+    if (tool_print_probe_status(device) != 0) {
+      ret = -1;
+      continue;
+    }
+
+    printf("\nDecode\n");
+    if (tool_print_decode(device) != 0) {
+      printf("Decoder capabilities unavailable\n\n");
+      ret = -1;
+    }
+
+    printf("Encode\n");
+    if (device->encode_status == 0) {
+      tool_print_encode(device);
+    } else {
+      printf("Encoder capabilities unavailable\n");
+      ret = -1;
+    }
+  }
+
+  nvvi_snapshot_free(&snap);
+  nvvi_unload();
+
+  return ret;
+}
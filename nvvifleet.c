@@ -0,0 +1,262 @@
+/*
+ * nvvifleet - index nvdec/nvenc capabilities across many hosts
+ * Copyright (c) 2018 Philip Langdale <philipl@overt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Collects the snapshots recorded on every host into one deduplicated
+ * index and answers queries over it. Nothing here talks to a driver.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "nvvideoinfo.h"
+
+#define MAX_QUERIES 16
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options] [FILE|DIR...]\n"
+          "Add the snapshots (nvvideoinfo --record) in FILE, or every file in\n"
+          "DIR, to the index, one host per file named after it (without a\n"
+          ".snapshot or .txt suffix), then answer the queries.\n"
+          "  -i, --index DIR     load the index from DIR first and save it back\n"
+          "                      if anything was added\n"
+          "  -q, --query EXPR    print the hosts matching EXPR, e.g.\n"
+          "                      'encode=av1 support_10bit_encode=1 support_lookahead_level>=2'\n"
+          "                      or 'decode=hevc:444 devices>=2'; see nvvi_fleet_query_parse()\n"
+          "  -s, --stats         print host, device and capability set counts\n"
+          "      --sets          list the capability sets\n"
+          "  -h, --help          show this help\n",
+          prog);
+}
+
+/* The host a file describes: its name without the directory and suffix */
+static void host_name(char *dst, size_t len, const char *path)
+{
+  static const char *suffixes[] = { ".snapshot", ".txt" };
+  const char *base = strrchr(path, '/');
+
+  snprintf(dst, len, "%s", base ? base + 1 : path);
+  for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+    size_t n = strlen(dst);
+    size_t s = strlen(suffixes[i]);
+    if (n > s && strcmp(dst + n - s, suffixes[i]) == 0) {
+      dst[n - s] = '\0';
+    }
+  }
+}
+
+static int add_file(nvvi_fleet *fleet, const char *path)
+{
+  char host[256];
+  nvvi_snapshot snap;
+
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  int ret = nvvi_snapshot_load(&snap, f);
+  fclose(f);
+  if (ret != 0) {
+    fprintf(stderr, "%s is not a snapshot\n", path);
+    return -1;
+  }
+
+  host_name(host, sizeof(host), path);
+  ret = nvvi_fleet_add(fleet, host, &snap);
+  nvvi_snapshot_free(&snap);
+  return ret;
+}
+
+/* Returns the number of files added, or -1 */
+static int add_path(nvvi_fleet *fleet, const char *path)
+{
+  struct stat st;
+  char file[4096];
+  int added = 0;
+
+  if (stat(path, &st) != 0) {
+    perror(path);
+    return -1;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return add_file(fleet, path) == 0 ? 1 : -1;
+  }
+
+  DIR *d = opendir(path);
+  if (!d) {
+    perror(path);
+    return -1;
+  }
+  for (struct dirent *e; (e = readdir(d));) {
+    if (e->d_name[0] == '.') {
+      continue;
+    }
+    snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+    if (stat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (add_file(fleet, file) != 0) {
+      added = -1;
+      break;
+    }
+    added++;
+  }
+  closedir(d);
+  return added;
+}
+
+static void print_match(const char *host, int devices, void *opaque)
+{
+  printf("%s %d\n", host, devices);
+}
+
+static void print_sets(const nvvi_fleet *fleet)
+{
+  printf("# set hosts devices driver nvenc decode-rows encoders gpu\n");
+  for (int i = 0; i < nvvi_fleet_num_sets(fleet); i++) {
+    uint64_t id;
+    int hosts, devices;
+    const nvvi_snapshot *set = nvvi_fleet_set(fleet, i, &id, &hosts, &devices);
+    const nvvi_device *device = &set->devices[0];
+
+    if (devices == 0) {
+      continue;
+    }
+    printf("%016llx %d %d %s %d.%d %d %d %s\n", (unsigned long long)id, hosts, devices,
+           set->driver_version[0] ? set->driver_version : "-",
+           set->nvenc_max_version >> 4, set->nvenc_max_version & 0xf,
+           device->num_decode_caps, device->num_encode_codecs, device->name);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option long_opts[] = {
+    { "index", required_argument, NULL, 'i' },
+    { "query", required_argument, NULL, 'q' },
+    { "stats", no_argument,       NULL, 's' },
+    { "sets", no_argument,        NULL, 'S' },
+    { "help", no_argument,        NULL, 'h' },
+    { NULL },
+  };
+  const char *index_dir = NULL;
+  const char *queries[MAX_QUERIES];
+  int num_queries = 0;
+  int stats = 0;
+  int sets = 0;
+  int added = 0;
+  int ret = 0;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "i:q:sh", long_opts, NULL)) != -1) {
+    switch (c) {
+    case 'i':
+      index_dir = optarg;
+      break;
+    case 'q':
+      if (num_queries == MAX_QUERIES) {
+        fprintf(stderr, "At most %d queries\n", MAX_QUERIES);
+        return -1;
+      }
+      queries[num_queries++] = optarg;
+      break;
+    case 's':
+      stats = 1;
+      break;
+    case 'S':
+      sets = 1;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  nvvi_fleet *fleet = nvvi_fleet_new();
+  if (!fleet) {
+    return -1;
+  }
+
+  if (index_dir) {
+    char hosts[4096];
+    struct stat st;
+    snprintf(hosts, sizeof(hosts), "%s/hosts", index_dir);
+    if (stat(hosts, &st) == 0 && nvvi_fleet_load(fleet, index_dir) != 0) {
+      nvvi_fleet_free(fleet);
+      return -1;
+    }
+  }
+
+  for (int i = optind; i < argc; i++) {
+    int n = add_path(fleet, argv[i]);
+    if (n < 0) {
+      nvvi_fleet_free(fleet);
+      return -1;
+    }
+    added += n;
+  }
+  if (index_dir && added && nvvi_fleet_save(fleet, index_dir) != 0) {
+    nvvi_fleet_free(fleet);
+    return -1;
+  }
+
+  if (stats) {
+    int hosts, devices, distinct;
+    nvvi_fleet_stats(fleet, &hosts, &devices, &distinct);
+    printf("%d hosts, %d devices, %d capability sets\n", hosts, devices, distinct);
+  }
+  if (sets) {
+    print_sets(fleet);
+  }
+
+  for (int i = 0; i < num_queries; i++) {
+    char error[128];
+    nvvi_fleet_query *q = nvvi_fleet_query_parse(queries[i], error, sizeof(error));
+    if (!q) {
+      fprintf(stderr, "Invalid query: %s\n", error);
+      ret = -1;
+      continue;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printf("# %s\n", queries[i]);
+    int matched = nvvi_fleet_query_run(fleet, q, print_match, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("# %d hosts in %.3f ms\n", matched,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    nvvi_fleet_query_free(q);
+  }
+
+  nvvi_fleet_free(fleet);
+  return ret;
+}